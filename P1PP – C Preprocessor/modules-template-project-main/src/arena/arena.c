@@ -0,0 +1,129 @@
+/* -----------------------------------------------------------------------------
+ * Program: C Preprocessor (Practice 1)
+ * Description:
+ *     This module provides a bump allocator with mark/release for short-lived
+ *     scratch memory (line buffers and other per-line temporaries).
+ *
+ * - `arena_init` / `arena_free`: Set up and release all blocks.
+ * - `arena_alloc`: Bump-allocates n bytes from the current block.
+ * - `arena_realloc`: Grows the most recent allocation in place when possible.
+ * - `arena_mark` / `arena_release`: Save and restore the allocation point.
+ *
+ * Usage:
+ *     Called by pp_core (through arena-backed buffers) for line temporaries.
+ *
+ * Status:
+ *     Active - scratch memory for the preprocessing engine.
+ * -------------------------------------------------------------------------- */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+// Round n up to the arena alignment.
+static size_t align_up(size_t n)
+{
+    return (n + (ARENA_ALIGNMENT - 1)) & ~(size_t)(ARENA_ALIGNMENT - 1);
+}
+
+// Usable bytes start right after the (aligned) block header.
+static char *block_data(arena_block_t *b)
+{
+    return (char *)b + align_up(sizeof(arena_block_t));
+}
+
+// Initialize an empty arena.
+void arena_init(arena_t *a, size_t block_size)
+{
+    a->first = NULL;
+    a->current = NULL;
+    a->block_size = block_size ? block_size : ARENA_DEFAULT_BLOCK_SIZE;
+    a->heap_allocs = 0;
+}
+
+// Free all blocks and reset the arena to empty.
+void arena_free(arena_t *a)
+{
+    if (!a) return;
+    arena_block_t *b = a->first;
+    while (b) {
+        arena_block_t *next = b->next;
+        free(b);
+        b = next;
+    }
+    a->first = NULL;
+    a->current = NULL;
+}
+
+// Bump-allocate n bytes, reusing free blocks before asking the heap.
+void *arena_alloc(arena_t *a, size_t n)
+{
+    if (!a) return NULL;
+    size_t need = align_up(n ? n : 1);
+
+    // Try the current block, then the free blocks that follow it
+    arena_block_t *b = a->current ? a->current : a->first;
+    if (b && !a->current) b->used = 0;
+    arena_block_t *last = NULL;
+    while (b) {
+        if (b->size - b->used >= need) {
+            char *p = block_data(b) + b->used;
+            b->used += need;
+            a->current = b;
+            return p;
+        }
+        last = b;
+        b = b->next;
+        if (b) b->used = 0;
+    }
+
+    // No block has room: append a new one (large requests get their own size)
+    size_t size = need > a->block_size ? need : a->block_size;
+    arena_block_t *nb = (arena_block_t *)malloc(align_up(sizeof(arena_block_t)) + size);
+    if (!nb) return NULL;
+    a->heap_allocs++;
+    nb->next = NULL;
+    nb->size = size;
+    nb->used = need;
+    if (last) last->next = nb;
+    else a->first = nb;
+    a->current = nb;
+    return block_data(nb);
+}
+
+// Grow the last allocation in place if it has room, otherwise move it.
+void *arena_realloc(arena_t *a, void *ptr, size_t old_size, size_t new_size)
+{
+    if (!ptr) return arena_alloc(a, new_size);
+    if (new_size <= old_size) return ptr;
+
+    arena_block_t *b = a->current;
+    size_t old_al = align_up(old_size);
+    size_t new_al = align_up(new_size);
+    if (b && (char *)ptr + old_al == block_data(b) + b->used &&
+        b->size - (b->used - old_al) >= new_al) {
+        b->used = b->used - old_al + new_al;
+        return ptr;
+    }
+
+    void *p = arena_alloc(a, new_size);
+    if (p) memcpy(p, ptr, old_size);
+    return p;
+}
+
+// Save the current allocation point.
+arena_mark_t arena_mark(const arena_t *a)
+{
+    arena_mark_t m;
+    m.block = a->current;
+    m.used = a->current ? a->current->used : 0;
+    return m;
+}
+
+// Roll back to a saved allocation point.
+void arena_release(arena_t *a, arena_mark_t mark)
+{
+    a->current = mark.block;
+    if (mark.block) mark.block->used = mark.used;
+}
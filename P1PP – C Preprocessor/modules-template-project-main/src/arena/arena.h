@@ -0,0 +1,74 @@
+/* -----------------------------------------------------------------------------
+ * Program: C Preprocessor (Practice 1)
+ * Description:
+ *     This module provides a bump allocator with mark/release for short-lived
+ *     scratch memory (line buffers and other per-line temporaries).
+ *
+ * - `arena_init` / `arena_free`: Set up and release all blocks.
+ * - `arena_alloc`: Bump-allocates n bytes from the current block.
+ * - `arena_realloc`: Grows the most recent allocation in place when possible.
+ * - `arena_mark` / `arena_release`: Save and restore the allocation point.
+ *
+ * Usage:
+ *     Owned by pp_context_t. Each line takes a mark, allocates its temporaries
+ *     and releases back to the mark, so blocks are reused and steady-state
+ *     processing performs no heap allocations.
+ *
+ * Status:
+ *     Active - scratch memory for the preprocessing engine.
+ * -------------------------------------------------------------------------- */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/* Default usable size of one arena block. */
+#define ARENA_DEFAULT_BLOCK_SIZE 65536
+/* Alignment of every allocation returned by the arena. */
+#define ARENA_ALIGNMENT 16
+
+/* One heap block; usable bytes follow the header. */
+typedef struct arena_block {
+    /* Next block in the chain (blocks after the current one are free). */
+    struct arena_block *next;
+    /* Usable bytes in this block. */
+    size_t size;
+    /* Bytes handed out from this block. */
+    size_t used;
+} arena_block_t;
+
+/* Bump allocator made of a chain of reusable blocks. */
+typedef struct arena {
+    /* First block of the chain. */
+    arena_block_t *first;
+    /* Block currently allocated from. */
+    arena_block_t *current;
+    /* Minimum size of newly allocated blocks. */
+    size_t block_size;
+    /* Number of heap allocations made for blocks (kept across arena_free). */
+    long heap_allocs;
+} arena_t;
+
+/* Saved allocation point. */
+typedef struct {
+    arena_block_t *block;
+    size_t used;
+} arena_mark_t;
+
+/* Initialize an empty arena (no memory is allocated until first use). */
+void arena_init(arena_t *a, size_t block_size);
+/* Release every block (the heap_allocs counter is kept). */
+void arena_free(arena_t *a);
+
+/* Allocate n bytes; returns NULL when out of memory. */
+void *arena_alloc(arena_t *a, size_t n);
+/* Resize an allocation of old_size bytes to new_size bytes (contents kept). */
+void *arena_realloc(arena_t *a, void *ptr, size_t old_size, size_t new_size);
+
+/* Save the current allocation point. */
+arena_mark_t arena_mark(const arena_t *a);
+/* Free everything allocated since mark (blocks are kept for reuse). */
+void arena_release(arena_t *a, arena_mark_t mark);
+
+#endif
@@ -6,7 +6,8 @@
  *     This module provides functionality to build and grow a dynamic text buffer.
  *
  * - `buffer_init`: Initializes a buffer to an empty, NUL-terminated state.
- * - `buffer_free`: Releases buffer storage and resets its fields.
+ * - `buffer_init_arena`: Initializes a buffer backed by an arena.
+ * - `buffer_free`: Releases buffer storage (heap or mapping) and resets its fields.
  * - `buffer_append_char`: Appends a single character to the buffer.
  * - `buffer_append_n`: Appends n bytes from a source pointer.
  * - `buffer_append_str`: Appends a NUL-terminated string.
@@ -20,12 +21,17 @@
 
 #include <stdlib.h>
 #include <string.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
 
 #include "buffer.h"
 
 // Ensure the buffer can hold at least min_capacity bytes.
 static int buffer_grow(buffer_t *b, long min_capacity)
 {
+    // Mapped buffers are read-only views and can never grow
+    if (b->kind == BUFFER_KIND_MAPPED) return 1;
     // If the buffer already has enough space, we're done
     if (b->cap >= min_capacity) return 0;
 
@@ -36,8 +42,10 @@ static int buffer_grow(buffer_t *b, long min_capacity)
         new_cap *= BUFFER_GROWTH_FACTOR;
     }
 
-    // Try to reallocate the memory to the new size
-    char *new_data = (char *)realloc(b->data, (size_t)new_cap);
+    // Try to reallocate the memory to the new size (from the arena if arena-backed)
+    char *new_data = (b->kind == BUFFER_KIND_ARENA)
+        ? (char *)arena_realloc(b->arena, b->data, (size_t)b->cap, (size_t)new_cap)
+        : (char *)realloc(b->data, (size_t)new_cap);
     if (!new_data) return 1;  // Out of memory
 
     // Update the buffer with the new allocation
@@ -53,6 +61,8 @@ void buffer_init(buffer_t *b)
     b->data = NULL;
     b->len = 0;
     b->cap = 0;
+    b->kind = BUFFER_KIND_HEAP;
+    b->arena = NULL;
 
     // Allocate a small initial chunk of memory so the buffer is ready to use
     buffer_grow(b, BUFFER_MIN_CAPACITY);
@@ -60,17 +70,40 @@ void buffer_init(buffer_t *b)
     if (b->data) b->data[0] = BUFFER_CHAR_NUL;
 }
 
+// Initialize a buffer whose storage is carved from an arena.
+void buffer_init_arena(buffer_t *b, arena_t *arena)
+{
+    // Same empty state as buffer_init, but growth goes through the arena
+    b->data = NULL;
+    b->len = 0;
+    b->cap = 0;
+    b->kind = BUFFER_KIND_ARENA;
+    b->arena = arena;
+
+    buffer_grow(b, BUFFER_MIN_CAPACITY);
+    if (b->data) b->data[0] = BUFFER_CHAR_NUL;
+}
+
 // Free buffer storage and reset all fields to empty state.
 void buffer_free(buffer_t *b)
 {
     // Safety check - don't try to free a null pointer
     if (!b) return;
-    // Release the dynamically allocated memory
-    free(b->data);
+    // Release the storage the way it was acquired
+    if (b->kind == BUFFER_KIND_MAPPED) {
+#ifndef _WIN32
+        if (b->data) munmap(b->data, (size_t)b->cap);
+#endif
+    } else if (b->kind == BUFFER_KIND_HEAP) {
+        free(b->data);
+    }
+    // Arena storage is reclaimed by arena_release/arena_free
     // Reset all fields to a safe empty state to prevent use-after-free bugs
     b->data = NULL;
     b->len = 0;
     b->cap = 0;
+    b->kind = BUFFER_KIND_HEAP;
+    b->arena = NULL;
 }
 
 // Append a single character to the buffer.
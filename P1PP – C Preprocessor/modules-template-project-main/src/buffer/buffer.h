@@ -10,6 +10,9 @@
  * - `buffer_append_char`: Appends a single character to the buffer.
  * - `buffer_append_n`: Appends n bytes from a source pointer.
  * - `buffer_append_str`: Appends a NUL-terminated string.
+ * - `buffer_init_arena`: Initializes a buffer whose storage lives in an arena.
+ * - `buffer_kind_t`: Distinguishes growable heap buffers, arena-backed
+ *   scratch buffers and read-only file mappings (see `io_map_file`).
  *
  * Usage:
  *     Include this header in modules that need growable text buffers.
@@ -21,6 +24,8 @@
 #ifndef BUFFER_H
 #define BUFFER_H
 
+#include "arena/arena.h"
+
 /* Initial capacity allocated when a buffer is first grown. */
 #define BUFFER_INITIAL_CAPACITY 64
 /* Factor used to grow buffer capacity when more space is needed. */
@@ -34,19 +39,35 @@
 /* NUL terminator character used by the buffer. */
 #define BUFFER_CHAR_NUL '\0'
 
+/* Storage backing a buffer. */
+typedef enum {
+    /* Growable heap storage, always NUL-terminated. */
+    BUFFER_KIND_HEAP = 0,
+    /* Read-only file mapping: not NUL-terminated, appends fail. */
+    BUFFER_KIND_MAPPED = 1,
+    /* Growable storage carved from an arena, released with the arena. */
+    BUFFER_KIND_ARENA = 2
+} buffer_kind_t;
+
 /* Growable buffer used to accumulate preprocessing output. */
 typedef struct {
-    /* Pointer to heap storage for bytes. */
+    /* Pointer to heap storage (or mapped file bytes) for data. */
     char *data;
     /* Current number of valid bytes in data (excluding NUL). */
     long len;
-    /* Allocated capacity in bytes for data. */
+    /* Allocated capacity in bytes for data (mapping length if mapped). */
     long cap;
+    /* How data is owned and released by buffer_free. */
+    buffer_kind_t kind;
+    /* Arena providing storage (BUFFER_KIND_ARENA only). */
+    arena_t *arena;
 } buffer_t;
 
 /* Initialize a buffer to an empty, NUL-terminated state. */
 void buffer_init(buffer_t *b);
-/* Release heap memory held by the buffer and reset fields. */
+/* Initialize an empty buffer that allocates from arena (no heap traffic). */
+void buffer_init_arena(buffer_t *b, arena_t *arena);
+/* Release heap memory (or unmap the file) held by the buffer and reset fields. */
 void buffer_free(buffer_t *b);
 
 /* Append a single character to the buffer (keeps NUL terminator). */
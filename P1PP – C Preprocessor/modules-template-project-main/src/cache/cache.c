@@ -0,0 +1,683 @@
+/* -----------------------------------------------------------------------------
+ * Program: C Preprocessor (Practice 1)
+ * Description:
+ *     This module implements the persistent preprocessing cache declared in
+ *     cache.h.
+ *
+ * - Key helpers: input key, result key (input key + dependency hashes).
+ * - Lookup: read the manifest, re-hash every recorded dependency (checking
+ *   that missing ones are still absent), and serve the result stored under
+ *   the resulting key.
+ * - Store: the output is streamed into a temporary file while it is written
+ *   and renamed into place only when the run had no errors.
+ * - Close: merge counters into the stats file under flock and evict the
+ *   least recently used files when the size limit is exceeded.
+ *
+ * Usage:
+ *     Called by main when -cache is given.
+ *
+ * Status:
+ *     Active - POSIX only; cache_open fails on _WIN32 and the run proceeds
+ *     without caching.
+ * -------------------------------------------------------------------------- */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#include "cache.h"
+#include "spec/pp_spec.h"
+
+// Versions of the key derivation and of the manifest format.
+#define CACHE_KEY_VERSION "P1PP-CACHE 1"
+#define CACHE_MANIFEST_HEADER "P1PP-MANIFEST 1\n"
+// File names inside the cache directory.
+#define CACHE_MANIFEST_EXT ".manifest"
+#define CACHE_RESULT_EXT ".pp"
+#define CACHE_STATS_NAME "stats"
+#define CACHE_TMP_PREFIX "tmp."
+// Eviction shrinks the cache to this percentage of the limit.
+#define CACHE_EVICT_TARGET_PCT 90
+// Temporary files older than this (seconds) are left over from crashed runs.
+#define CACHE_TMP_MAX_AGE 3600
+// Permissions of cache directories.
+#define CACHE_DIR_MODE 0755
+
+/* ---- Dependencies --------------------------------------------------------- */
+
+void cache_deps_init(cache_deps_t *deps)
+{
+    deps->paths = NULL;
+    deps->hashes = NULL;
+    deps->count = 0;
+    deps->capacity = 0;
+    deps->missing_slots = NULL;
+    deps->missing_slot_capacity = 0;
+    deps->missing_count = 0;
+}
+
+int cache_deps_add_hash(cache_deps_t *deps, const char *path, hash128_t hash)
+{
+    if (deps->count == deps->capacity) {
+        int new_capacity = deps->capacity ? deps->capacity * 2 : 8;
+        char **paths = realloc(deps->paths, sizeof(char *) * (size_t)new_capacity);
+        if (!paths) return 1;
+        deps->paths = paths;
+        hash128_t *hashes = realloc(deps->hashes, sizeof(hash128_t) * (size_t)new_capacity);
+        if (!hashes) return 1;
+        deps->hashes = hashes;
+        deps->capacity = new_capacity;
+    }
+
+    // Store absolute paths: the manifest must not depend on the working directory
+    char abs_path[PP_MAX_PATH_LEN];
+    const char *stored = path;
+#ifndef _WIN32
+    if (realpath(path, abs_path)) stored = abs_path;
+#endif
+    char *copy = strdup(stored);
+    if (!copy) return 1;
+
+    deps->paths[deps->count] = copy;
+    deps->hashes[deps->count] = hash;
+    deps->count++;
+    return 0;
+}
+
+int cache_deps_add(cache_deps_t *deps, const char *path, const char *data, long len)
+{
+    return cache_deps_add_hash(deps, path, hash_bytes(data, (size_t)(len > 0 ? len : 0)));
+}
+
+int cache_deps_is_missing(const cache_deps_t *deps, int i)
+{
+    return hash_equal(deps->hashes[i], CACHE_DEP_MISSING);
+}
+
+// Slot of the missing entry for path, or the empty slot where it would go.
+static int find_missing_slot(const cache_deps_t *deps, const char *path)
+{
+    int mask = deps->missing_slot_capacity - 1;
+    int i = (int)(hash_bytes(path, strlen(path)).lo & (uint64_t)mask);
+    while (deps->missing_slots[i] >= 0 && strcmp(deps->paths[deps->missing_slots[i]], path) != 0) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+// Keep the missing index at most half full.
+static int grow_missing_slots(cache_deps_t *deps)
+{
+    if ((deps->missing_count + 1) * 2 <= deps->missing_slot_capacity) return 0;
+    int capacity = deps->missing_slot_capacity ? deps->missing_slot_capacity * 2 : 16;
+    int *slots = malloc(sizeof(int) * (size_t)capacity);
+    if (!slots) return 1;
+    free(deps->missing_slots);
+    deps->missing_slots = slots;
+    deps->missing_slot_capacity = capacity;
+    for (int i = 0; i < capacity; i++) slots[i] = -1;
+    for (int n = 0; n < deps->count; n++) {
+        if (cache_deps_is_missing(deps, n)) slots[find_missing_slot(deps, deps->paths[n])] = n;
+    }
+    return 0;
+}
+
+int cache_deps_add_missing(cache_deps_t *deps, const char *path)
+{
+    // The file does not exist, so only its directory can be made absolute
+    char abs_path[PP_MAX_PATH_LEN];
+    const char *stored = path;
+#ifndef _WIN32
+    char dir[PP_MAX_PATH_LEN], abs_dir[PP_MAX_PATH_LEN];
+    const char *slash = strrchr(path, '/');
+    const char *name = slash ? slash + 1 : path;
+    int n = slash ? snprintf(dir, sizeof(dir), "%.*s", (int)(slash - path), path)
+                  : snprintf(dir, sizeof(dir), ".");
+    if (slash == path) snprintf(dir, sizeof(dir), "/");
+    if (n >= 0 && n < (int)sizeof(dir) && realpath(dir, abs_dir)) {
+        n = snprintf(abs_path, sizeof(abs_path), "%s%s%s", abs_dir,
+                     strcmp(abs_dir, "/") == 0 ? "" : "/", name);
+        if (n >= 0 && n < (int)sizeof(abs_path)) stored = abs_path;
+    } else if (path[0] != '/' && getcwd(abs_dir, sizeof(abs_dir))) {
+        // Its directory is missing too: anchor it at the working directory
+        n = snprintf(abs_path, sizeof(abs_path), "%s/%s", abs_dir, path);
+        if (n >= 0 && n < (int)sizeof(abs_path)) stored = abs_path;
+    }
+#endif
+
+    if (grow_missing_slots(deps) != 0) return 1;
+    int slot = find_missing_slot(deps, stored);
+    if (deps->missing_slots[slot] >= 0) return 0;
+    if (cache_deps_add_hash(deps, stored, CACHE_DEP_MISSING) != 0) return 1;
+    deps->missing_slots[slot] = deps->count - 1;
+    deps->missing_count++;
+    return 0;
+}
+
+void cache_deps_free(cache_deps_t *deps)
+{
+    for (int i = 0; i < deps->count; i++) free(deps->paths[i]);
+    free(deps->paths);
+    free(deps->hashes);
+    free(deps->missing_slots);
+    cache_deps_init(deps);
+}
+
+/* ---- Keys ----------------------------------------------------------------- */
+
+hash128_t cache_input_key(const buffer_t *input, unsigned options, const char *base_dir,
+                          const char *prefix, const hash128_t *search)
+{
+    hash_state_t st;
+    hash_init(&st);
+    hash_update_str(&st, CACHE_KEY_VERSION);
+    hash_update(&st, &options, sizeof(options));
+
+    // The prefix header's contents are recorded as dependencies; its path
+    // tells inputs started from different headers apart
+    if (prefix) hash_update_str(&st, prefix);
+    // Another search path may resolve the same names to other files
+    if (search) hash_update(&st, search, sizeof(*search));
+
+    // Relative includes resolve against base_dir, so it is part of the key
+    const char *dir = (base_dir && base_dir[0]) ? base_dir : ".";
+    char abs_dir[PP_MAX_PATH_LEN];
+#ifndef _WIN32
+    if (realpath(dir, abs_dir)) dir = abs_dir;
+#endif
+    hash_update_str(&st, dir);
+    hash_update(&st, input->data, (size_t)input->len);
+    return hash_final(&st);
+}
+
+// Key of the stored output: the input key plus every dependency in order.
+static hash128_t result_key(hash128_t key, char *const *paths, const hash128_t *hashes, int count)
+{
+    hash_state_t st;
+    hash_init(&st);
+    hash_update(&st, &key, sizeof(key));
+    for (int i = 0; i < count; i++) {
+        hash_update_str(&st, paths[i]);
+        hash_update(&st, &hashes[i], sizeof(hashes[i]));
+    }
+    return hash_final(&st);
+}
+
+#ifndef _WIN32
+
+/* ---- File helpers --------------------------------------------------------- */
+
+// Create path and its missing parents.
+static int mkdir_p(const char *path)
+{
+    char tmp[PP_MAX_PATH_LEN];
+    int n = snprintf(tmp, sizeof(tmp), "%s", path);
+    if (n < 0 || n >= (int)sizeof(tmp)) return 1;
+    for (char *p = tmp + 1; *p; p++) {
+        if (*p != '/') continue;
+        *p = '\0';
+        if (mkdir(tmp, CACHE_DIR_MODE) != 0 && errno != EEXIST) return 1;
+        *p = '/';
+    }
+    if (mkdir(tmp, CACHE_DIR_MODE) != 0 && errno != EEXIST) return 1;
+    return 0;
+}
+
+// Path of a cache entry: <dir>/<first two hex digits>/<hex><ext>.
+static int entry_path(const cache_t *cache, hash128_t key, const char *ext, char *out, size_t size)
+{
+    char hex[HASH_HEX_LEN + 1];
+    hash_to_hex(key, hex);
+    int n = snprintf(out, size, "%s/%.2s/%s%s", cache->dir, hex, hex, ext);
+    return (n < 0 || n >= (int)size) ? 1 : 0;
+}
+
+// Make sure the subdirectory of an entry path exists.
+static int ensure_parent(const char *path)
+{
+    char dir[PP_MAX_PATH_LEN];
+    snprintf(dir, sizeof(dir), "%s", path);
+    char *slash = strrchr(dir, '/');
+    if (!slash) return 0;
+    *slash = '\0';
+    return mkdir_p(dir);
+}
+
+// Read a whole (small) file into a buffer without reporting errors.
+static int read_file_quiet(const char *path, buffer_t *out)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 1;
+    char chunk[PP_IO_READ_CHUNK];
+    for (;;) {
+        ssize_t n = read(fd, chunk, sizeof(chunk));
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            close(fd);
+            return 1;
+        }
+        if (n == 0) break;
+        if (buffer_append_n(out, chunk, (long)n) != 0) {
+            close(fd);
+            return 1;
+        }
+    }
+    close(fd);
+    return 0;
+}
+
+// Write all bytes to fd.
+static int write_fd(int fd, const char *p, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return 1;
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+// Create a temporary file in the cache root; returns its fd or -1.
+static int make_temp(const cache_t *cache, char *path, size_t size)
+{
+    int n = snprintf(path, size, "%s/" CACHE_TMP_PREFIX "XXXXXX", cache->dir);
+    if (n < 0 || n >= (int)size) return -1;
+    return mkstemp(path);
+}
+
+/* ---- Open / close --------------------------------------------------------- */
+
+// Parse a size such as 500M or 2G (bytes when there is no suffix).
+static long long parse_size(const char *s)
+{
+    char *end = NULL;
+    long long v = strtoll(s, &end, 10);
+    if (end == s || v <= 0) return 0;
+    switch (*end) {
+    case 'k': case 'K': v <<= 10; break;
+    case 'm': case 'M': v <<= 20; break;
+    case 'g': case 'G': v <<= 30; break;
+    default: break;
+    }
+    return v;
+}
+
+int cache_open(cache_t *cache, const char *dir)
+{
+    memset(cache, 0, sizeof(*cache));
+
+    char path[PP_MAX_PATH_LEN];
+    if (!dir) dir = getenv(PP_CACHE_ENV_DIR);
+    if (!dir || !dir[0]) {
+        const char *home = getenv("HOME");
+        if (!home || !home[0]) return 1;
+        int n = snprintf(path, sizeof(path), "%s/" PP_CACHE_DEFAULT_SUBDIR, home);
+        if (n < 0 || n >= (int)sizeof(path)) return 1;
+        dir = path;
+    }
+    if (mkdir_p(dir) != 0) return 1;
+    cache->dir = strdup(dir);
+    if (!cache->dir) return 1;
+
+    const char *max = getenv(PP_CACHE_ENV_MAX_SIZE);
+    cache->max_size = max ? parse_size(max) : 0;
+    if (cache->max_size <= 0) cache->max_size = PP_CACHE_DEFAULT_MAX_SIZE;
+    return 0;
+}
+
+/* One file considered for eviction. */
+typedef struct {
+    char *path;
+    time_t mtime;
+    long long size;
+} cache_file_t;
+
+static int compare_mtime(const void *a, const void *b)
+{
+    const cache_file_t *x = (const cache_file_t *)a;
+    const cache_file_t *y = (const cache_file_t *)b;
+    return (x->mtime > y->mtime) - (x->mtime < y->mtime);
+}
+
+// Remove least recently used files until the cache fits below the target
+// size; also drops stale temporary files. Returns the remaining size.
+static long long evict(cache_t *cache, long *evicted)
+{
+    cache_file_t *files = NULL;
+    int count = 0, capacity = 0;
+    long long total = 0;
+    time_t now = time(NULL);
+    char path[PP_MAX_PATH_LEN];
+
+    // Temporary files left by crashed runs
+    DIR *root = opendir(cache->dir);
+    if (root) {
+        struct dirent *de;
+        while ((de = readdir(root)) != NULL) {
+            if (strncmp(de->d_name, CACHE_TMP_PREFIX, strlen(CACHE_TMP_PREFIX)) != 0) continue;
+            int n = snprintf(path, sizeof(path), "%s/%s", cache->dir, de->d_name);
+            if (n < 0 || n >= (int)sizeof(path)) continue;
+            struct stat sb;
+            if (stat(path, &sb) == 0 && now - sb.st_mtime > CACHE_TMP_MAX_AGE) unlink(path);
+        }
+        closedir(root);
+    }
+
+    for (int sub = 0; sub < 256; sub++) {
+        char subdir[PP_MAX_PATH_LEN];
+        int n = snprintf(subdir, sizeof(subdir), "%s/%02x", cache->dir, sub);
+        if (n < 0 || n >= (int)sizeof(subdir)) continue;
+        DIR *d = opendir(subdir);
+        if (!d) continue;
+        struct dirent *de;
+        while ((de = readdir(d)) != NULL) {
+            if (de->d_name[0] == '.') continue;
+            // A truncated name would stat some other file
+            n = snprintf(path, sizeof(path), "%s/%s", subdir, de->d_name);
+            if (n < 0 || n >= (int)sizeof(path)) continue;
+            struct stat sb;
+            if (stat(path, &sb) != 0 || !S_ISREG(sb.st_mode)) continue;
+            if (count == capacity) {
+                int new_capacity = capacity ? capacity * 2 : 256;
+                cache_file_t *grown = realloc(files, sizeof(cache_file_t) * (size_t)new_capacity);
+                if (!grown) break;
+                files = grown;
+                capacity = new_capacity;
+            }
+            files[count].path = strdup(path);
+            if (!files[count].path) break;
+            files[count].mtime = sb.st_mtime;
+            files[count].size = (long long)sb.st_size;
+            total += files[count].size;
+            count++;
+        }
+        closedir(d);
+    }
+
+    long long target = cache->max_size / 100 * CACHE_EVICT_TARGET_PCT;
+    qsort(files, (size_t)count, sizeof(cache_file_t), compare_mtime);
+    for (int i = 0; i < count && total > target; i++) {
+        if (unlink(files[i].path) == 0) {
+            total -= files[i].size;
+            (*evicted)++;
+        }
+    }
+
+    for (int i = 0; i < count; i++) free(files[i].path);
+    free(files);
+    return total;
+}
+
+void cache_close(cache_t *cache)
+{
+    if (!cache->dir) return;
+
+    char path[PP_MAX_PATH_LEN];
+    snprintf(path, sizeof(path), "%s/" CACHE_STATS_NAME, cache->dir);
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd >= 0 && flock(fd, LOCK_EX) == 0) {
+        // Read the current totals
+        char text[512];
+        ssize_t n = pread(fd, text, sizeof(text) - 1, 0);
+        text[n > 0 ? n : 0] = '\0';
+        long hits = 0, misses = 0, stores = 0, evictions = 0;
+        long long size = 0;
+        sscanf(text, "hits %ld\nmisses %ld\nstores %ld\nevictions %ld\nsize %lld",
+               &hits, &misses, &stores, &evictions, &size);
+
+        hits += cache->hits;
+        misses += cache->misses;
+        stores += cache->stores;
+        size += cache->added_bytes;
+        if (size > cache->max_size) {
+            long evicted = 0;
+            size = evict(cache, &evicted);
+            evictions += evicted;
+            cache->evictions = evicted;
+        }
+
+        int len = snprintf(text, sizeof(text), "hits %ld\nmisses %ld\nstores %ld\nevictions %ld\nsize %lld\n",
+                           hits, misses, stores, evictions, size);
+        if (ftruncate(fd, 0) == 0) {
+            if (pwrite(fd, text, (size_t)len, 0) != len) { /* stats are best effort */ }
+        }
+        flock(fd, LOCK_UN);
+
+        cache->total_hits = hits;
+        cache->total_misses = misses;
+        cache->total_size = size;
+    }
+    if (fd >= 0) close(fd);
+
+    free(cache->dir);
+    cache->dir = NULL;
+}
+
+/* ---- Lookup / store ------------------------------------------------------- */
+
+int cache_lookup(cache_t *cache, hash128_t key, sink_t *out, cache_deps_t *deps)
+{
+    char manifest_path[PP_MAX_PATH_LEN];
+    if (entry_path(cache, key, CACHE_MANIFEST_EXT, manifest_path, sizeof(manifest_path)) != 0) {
+        __atomic_fetch_add(&cache->misses, 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+
+    buffer_t manifest;
+    buffer_init(&manifest);
+    int hit = 0;
+    hash128_t rkey;
+    size_t header_len = strlen(CACHE_MANIFEST_HEADER);
+
+    if (read_file_quiet(manifest_path, &manifest) == 0 && manifest.len >= (long)header_len &&
+        memcmp(manifest.data, CACHE_MANIFEST_HEADER, header_len) == 0) {
+        // Re-hash every recorded dependency; any change is a miss
+        hash_state_t st;
+        hash_init(&st);
+        hash_update(&st, &key, sizeof(key));
+        hit = 1;
+        char *line = manifest.data + header_len;
+        char *end = manifest.data + manifest.len;
+        while (line < end) {
+            char *nl = memchr(line, '\n', (size_t)(end - line));
+            if (!nl || nl - line < HASH_HEX_LEN + 2 || line[HASH_HEX_LEN] != '\t') {
+                hit = 0;
+                break;
+            }
+            *nl = '\0';
+            const char *dep_path = line + HASH_HEX_LEN + 1;
+            hash128_t recorded, current;
+            // A candidate recorded as missing must still not exist
+            if (hash_file(dep_path, &current) != 0) current = CACHE_DEP_MISSING;
+            if (hash_from_hex(line, &recorded) != 0 || !hash_equal(recorded, current)) {
+                hit = 0;
+                break;
+            }
+            hash_update_str(&st, dep_path);
+            hash_update(&st, &current, sizeof(current));
+            if (deps && cache_deps_add_hash(deps, dep_path, current) != 0) {
+                hit = 0;
+                break;
+            }
+            line = nl + 1;
+        }
+        rkey = hash_final(&st);
+    }
+    buffer_free(&manifest);
+
+    char result_path[PP_MAX_PATH_LEN];
+    int fd = -1;
+    if (hit && entry_path(cache, rkey, CACHE_RESULT_EXT, result_path, sizeof(result_path)) == 0) {
+        fd = open(result_path, O_RDONLY);
+    }
+    if (fd < 0) {
+        if (deps) cache_deps_free(deps);
+        __atomic_fetch_add(&cache->misses, 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+
+    // Serve the stored output
+    int rc = 1;
+    struct stat sb;
+    if (fstat(fd, &sb) != 0) {
+        rc = 0;
+    } else if (sb.st_size > 0) {
+        void *data = mmap(NULL, (size_t)sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            rc = 0;
+        } else {
+            if (sink_write(out, data, (long)sb.st_size) != 0) rc = -1;
+            munmap(data, (size_t)sb.st_size);
+        }
+    }
+    close(fd);
+    if (rc == 0) {
+        if (deps) cache_deps_free(deps);
+        __atomic_fetch_add(&cache->misses, 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+
+    // Refresh the LRU order
+    utimes(result_path, NULL);
+    utimes(manifest_path, NULL);
+    __atomic_fetch_add(&cache->hits, 1, __ATOMIC_RELAXED);
+    return rc;
+}
+
+int cache_store_begin(cache_t *cache, cache_store_t *store)
+{
+    char path[PP_MAX_PATH_LEN];
+    store->tmp_path = NULL;
+    store->fd = make_temp(cache, path, sizeof(path));
+    if (store->fd < 0) return 1;
+    store->tmp_path = strdup(path);
+    if (!store->tmp_path) {
+        close(store->fd);
+        unlink(path);
+        store->fd = -1;
+        return 1;
+    }
+    return 0;
+}
+
+void cache_store_abort(cache_t *cache, cache_store_t *store)
+{
+    (void)cache;
+    if (store->fd >= 0) close(store->fd);
+    if (store->tmp_path) unlink(store->tmp_path);
+    free(store->tmp_path);
+    store->fd = -1;
+    store->tmp_path = NULL;
+}
+
+int cache_store_commit(cache_t *cache, cache_store_t *store, hash128_t key,
+                       const cache_deps_t *deps)
+{
+    char result_path[PP_MAX_PATH_LEN];
+    char manifest_path[PP_MAX_PATH_LEN];
+    hash128_t rkey = result_key(key, deps->paths, deps->hashes, deps->count);
+
+    struct stat sb;
+    int ok = fstat(store->fd, &sb) == 0 && close(store->fd) == 0;
+    store->fd = -1;
+    ok = ok && entry_path(cache, rkey, CACHE_RESULT_EXT, result_path, sizeof(result_path)) == 0 &&
+         entry_path(cache, key, CACHE_MANIFEST_EXT, manifest_path, sizeof(manifest_path)) == 0 &&
+         ensure_parent(result_path) == 0 && ensure_parent(manifest_path) == 0 &&
+         rename(store->tmp_path, result_path) == 0;
+    if (!ok) {
+        cache_store_abort(cache, store);
+        return 1;
+    }
+    free(store->tmp_path);
+    store->tmp_path = NULL;
+
+    // Publish the manifest last: a reader that sees it finds the result too
+    buffer_t text;
+    buffer_init(&text);
+    buffer_append_str(&text, CACHE_MANIFEST_HEADER);
+    for (int i = 0; i < deps->count; i++) {
+        char hex[HASH_HEX_LEN + 1];
+        hash_to_hex(deps->hashes[i], hex);
+        buffer_append_str(&text, hex);
+        buffer_append_char(&text, '\t');
+        buffer_append_str(&text, deps->paths[i]);
+        buffer_append_char(&text, '\n');
+    }
+
+    char tmp[PP_MAX_PATH_LEN];
+    int fd = make_temp(cache, tmp, sizeof(tmp));
+    ok = fd >= 0 && text.data && write_fd(fd, text.data, (size_t)text.len) == 0;
+    if (fd >= 0 && close(fd) != 0) ok = 0;
+    if (ok && rename(tmp, manifest_path) != 0) ok = 0;
+    if (!ok && fd >= 0) unlink(tmp);
+
+    if (ok) {
+        __atomic_fetch_add(&cache->stores, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&cache->added_bytes, (long long)sb.st_size + text.len, __ATOMIC_RELAXED);
+    }
+    buffer_free(&text);
+    return ok ? 0 : 1;
+}
+
+#else /* _WIN32: no persistent cache */
+
+int cache_open(cache_t *cache, const char *dir)
+{
+    (void)dir;
+    memset(cache, 0, sizeof(*cache));
+    return 1;
+}
+
+void cache_close(cache_t *cache)
+{
+    (void)cache;
+}
+
+int cache_lookup(cache_t *cache, hash128_t key, sink_t *out, cache_deps_t *deps)
+{
+    (void)cache; (void)key; (void)out; (void)deps;
+    return 0;
+}
+
+int cache_store_begin(cache_t *cache, cache_store_t *store)
+{
+    (void)cache;
+    store->fd = -1;
+    store->tmp_path = NULL;
+    return 1;
+}
+
+int cache_store_commit(cache_t *cache, cache_store_t *store, hash128_t key,
+                       const cache_deps_t *deps)
+{
+    (void)cache; (void)store; (void)key; (void)deps;
+    return 1;
+}
+
+void cache_store_abort(cache_t *cache, cache_store_t *store)
+{
+    (void)cache; (void)store;
+}
+
+#endif
+
+void cache_print_stats(const cache_t *cache, FILE *out)
+{
+    fprintf(out, PP_FMT_STATS_CACHE_RUN, cache->hits, cache->misses, cache->stores);
+    fprintf(out, PP_FMT_STATS_CACHE_TOTAL, cache->total_hits, cache->total_misses,
+            cache->total_size, cache->max_size, cache->evictions);
+}
@@ -0,0 +1,119 @@
+/* -----------------------------------------------------------------------------
+ * Program: C Preprocessor (Practice 1)
+ * Description:
+ *     This module provides the persistent, content-addressed preprocessing
+ *     cache (-cache).
+ *
+ * - `cache_open` / `cache_close`: Locate the cache directory; merge run
+ *   statistics into it and evict least-recently-used entries when it grows
+ *   past its size limit.
+ * - `cache_input_key`: Key from the input bytes, options, base directory and
+ *   prefix header.
+ * - `cache_lookup`: On a hit, copies the stored output into a sink.
+ * - `cache_store_begin` / `_commit` / `_abort`: Record the output of a miss
+ *   together with the files it included.
+ * - `cache_deps_*`: Included files (absolute path + content hash), and include
+ *   candidates that must keep not existing (CACHE_DEP_MISSING).
+ *
+ * Layout (under PP_CACHE_DIR, default $HOME/.cache/p1pp):
+ *     xx/<input key>.manifest   included files and their hashes (all zero
+ *                               for a candidate that did not exist)
+ *     xx/<result key>.pp        output; result key = input key + every
+ *                               included file's path and content hash
+ *     stats                     totals, updated under flock
+ *     Files are written under a temporary name and renamed into place, so
+ *     concurrent runs never see partial entries. Hits refresh the mtime,
+ *     which is what eviction orders by.
+ *
+ * Status:
+ *     Active - disabled on _WIN32.
+ * -------------------------------------------------------------------------- */
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdio.h>
+
+#include "hash/hash.h"
+#include "buffer/buffer.h"
+#include "sink/sink.h"
+
+/* Hash recorded for an include candidate that did not exist: the run
+ * depends on it staying absent (a file appearing there would be used). */
+#define CACHE_DEP_MISSING ((hash128_t){0, 0})
+
+/* Files a preprocessing run depended on. */
+typedef struct {
+    char **paths;
+    hash128_t *hashes;
+    int count;
+    int capacity;
+    /* Index of the missing entries, so each is recorded once
+     * (open addressing into paths, -1 marks an empty slot). */
+    int *missing_slots;
+    int missing_slot_capacity;
+    int missing_count;
+} cache_deps_t;
+
+/* Open cache plus the statistics of this process. */
+typedef struct {
+    char *dir;
+    long long max_size;
+    /* This run (updated atomically; several files may run in parallel). */
+    long hits;
+    long misses;
+    long stores;
+    long long added_bytes;
+    /* Totals read back from the stats file by cache_close. */
+    long total_hits;
+    long total_misses;
+    long long total_size;
+    long evictions;
+} cache_t;
+
+/* A result being written during a miss. */
+typedef struct {
+    int fd;
+    char *tmp_path;
+} cache_store_t;
+
+void cache_deps_init(cache_deps_t *deps);
+/* Record path (made absolute) with the hash of its contents. Returns 0 or 1. */
+int cache_deps_add(cache_deps_t *deps, const char *path, const char *data, long len);
+/* Same with a precomputed content hash. */
+int cache_deps_add_hash(cache_deps_t *deps, const char *path, hash128_t hash);
+/* Record that path (made absolute) did not exist, once. Returns 0 or 1. */
+int cache_deps_add_missing(cache_deps_t *deps, const char *path);
+/* Non-zero if entry i is a missing candidate rather than a file. */
+int cache_deps_is_missing(const cache_deps_t *deps, int i);
+void cache_deps_free(cache_deps_t *deps);
+
+/* Open the cache in dir (NULL: $PP_CACHE_DIR, then $HOME/.cache/p1pp).
+ * Returns 0 on success, 1 if caching is unavailable. */
+int cache_open(cache_t *cache, const char *dir);
+/* Merge statistics into the cache directory, evict if needed, release. */
+void cache_close(cache_t *cache);
+
+/* Key of an input: bytes, option bits, the directory includes resolve from,
+ * the path of the -snapshot prefix header (NULL without one) and the key of
+ * the -I / -isystem search path (NULL without one). */
+hash128_t cache_input_key(const buffer_t *input, unsigned options, const char *base_dir,
+                          const char *prefix, const hash128_t *search);
+
+/* Look key up; on a hit the stored output is written to out and, if deps is
+ * not NULL, the recorded dependencies are appended to it (left empty on a miss).
+ * Returns 1 on a hit, 0 on a miss, -1 if writing to out failed. */
+int cache_lookup(cache_t *cache, hash128_t key, sink_t *out, cache_deps_t *deps);
+
+/* Start recording an output (the caller tees the sink into store->fd). */
+int cache_store_begin(cache_t *cache, cache_store_t *store);
+/* Publish the recorded output for key and deps. Returns 0 or 1. */
+int cache_store_commit(cache_t *cache, cache_store_t *store, hash128_t key,
+                       const cache_deps_t *deps);
+/* Drop the recorded output. */
+void cache_store_abort(cache_t *cache, cache_store_t *store);
+
+/* Print this run's counters and the directory totals. */
+void cache_print_stats(const cache_t *cache, FILE *out);
+
+#endif
@@ -7,15 +7,21 @@
  *
  * - `cli_parse`: Parses argv into structured preprocessing options.
  * - `cli_print_help`: Prints usage and available flags.
+ * - `cli_search_dir`: Reads the directory of a -I / -isystem argument.
  *
  * Usage:
  *     Called from main to interpret command-line flags before preprocessing.
  *
  * Status:
- *     Active - supports required flags (-c, -d, -all, -help).
+ *     Active - supports required flags (-c, -d, -all, -help), -stats, -stdout, -jN, -cache, -MD,
+ *     -incremental, -snapshot-out=<file>, -snapshot=<file>, -I<dir>,
+ *     -isystem<dir>, -no-prefetch, -max-include-depth=<n>, -serve=<socket>
+ *     and -connect=<socket>.
  * -------------------------------------------------------------------------- */
 
+#include <ctype.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "cli.h"
@@ -28,6 +34,57 @@ static int is_flag(const char *arg, const char *flag)
     return (arg != NULL) && (strcmp(arg, flag) == 0);
 }
 
+// Check for -jN (the prefix followed by at least one digit and digits only).
+static int is_jobs_flag(const char *arg)
+{
+    size_t n = strlen(PP_FLAG_JOBS);
+    if (arg == NULL || strncmp(arg, PP_FLAG_JOBS, n) != 0 || arg[n] == '\0') return 0;
+    for (const char *p = arg + n; *p; p++) {
+        if (!isdigit((unsigned char)*p)) return 0;
+    }
+    return 1;
+}
+
+// Value of a "-flag=<value>" argument, or NULL if arg is not that flag.
+static const char *flag_value(const char *arg, const char *prefix)
+{
+    size_t n = strlen(prefix);
+    if (arg == NULL || strncmp(arg, prefix, n) != 0) return NULL;
+    return arg + n;
+}
+
+// Value of a number flag: a positive decimal, or -1.
+static int positive_value(const char *s)
+{
+    long n = 0;
+    for (const char *p = s; *p; p++) {
+        if (!isdigit((unsigned char)*p) || n > 1000000) return -1;
+        n = n * 10 + (*p - '0');
+    }
+    return n > 0 && n <= 1000000 ? (int)n : -1;
+}
+
+// Directory of a -I<dir> / -isystem<dir> argument, or NULL.
+const char *cli_search_dir(const char *arg, int *system)
+{
+    const char *dir = flag_value(arg, PP_FLAG_SYSTEM_DIR);
+    *system = dir != NULL;
+    if (!dir) dir = flag_value(arg, PP_FLAG_INCLUDE_DIR);
+    return dir;
+}
+
+// Flags that tune a run without selecting a processing stage.
+static int is_option_flag(const char *arg)
+{
+    return is_flag(arg, PP_FLAG_STATS) || is_flag(arg, PP_FLAG_STDOUT) || is_jobs_flag(arg) ||
+           is_flag(arg, PP_FLAG_CACHE) || is_flag(arg, PP_FLAG_MD) ||
+           is_flag(arg, PP_FLAG_INCREMENTAL) || flag_value(arg, PP_FLAG_SNAPSHOT_OUT) ||
+           flag_value(arg, PP_FLAG_SNAPSHOT) || flag_value(arg, PP_FLAG_INCLUDE_DIR) ||
+           flag_value(arg, PP_FLAG_SYSTEM_DIR) || is_flag(arg, PP_FLAG_NO_PREFETCH) ||
+           flag_value(arg, PP_FLAG_MAX_INCLUDE_DEPTH) || flag_value(arg, PP_FLAG_SERVE) ||
+           flag_value(arg, PP_FLAG_CONNECT);
+}
+
 // Parse CLI arguments into an options structure.
 cli_options_t cli_parse(int argc, char **argv)
 {
@@ -36,12 +93,25 @@ cli_options_t cli_parse(int argc, char **argv)
     opt.do_comments = 0;
     opt.do_directives = 0;
     opt.do_help = 0;
+    opt.do_stats = 0;
+    opt.to_stdout = 0;
+    opt.jobs = 0;
+    opt.use_cache = 0;
+    opt.write_depfile = 0;
+    opt.incremental = 0;
+    opt.snapshot_out = NULL;
+    opt.snapshot = NULL;
+    opt.search_dirs = 0;
+    opt.no_prefetch = 0;
+    opt.max_include_depth = 0;
+    opt.serve = NULL;
+    opt.connect = NULL;
 
-    // First pass: detect if user provided any flags at all.
+    // First pass: detect if user provided any stage flags at all.
     int has_any_flag = 0;
     for (int i = 1; i < argc; i++) {
-        // Look for arguments starting with '-'
-        if (argv[i] != NULL && argv[i][0] == PP_CHAR_DASH) {
+        // Look for arguments starting with '-' (option-only flags do not count)
+        if (argv[i] != NULL && argv[i][0] == PP_CHAR_DASH && !is_option_flag(argv[i])) {
             has_any_flag = 1;
             break;
         }
@@ -70,6 +140,45 @@ cli_options_t cli_parse(int argc, char **argv)
         } else if (is_flag(a, PP_FLAG_D)) {
             // -d flag: enable directive processing (includes, defines, macros)
             opt.do_directives = 1;
+        } else if (is_flag(a, PP_FLAG_STATS)) {
+            // -stats flag: report cache statistics after the run
+            opt.do_stats = 1;
+        } else if (is_flag(a, PP_FLAG_STDOUT)) {
+            // -stdout flag: stream the result to stdout
+            opt.to_stdout = 1;
+        } else if (is_flag(a, PP_FLAG_CACHE)) {
+            // -cache flag: reuse outputs from the persistent cache
+            opt.use_cache = 1;
+        } else if (is_flag(a, PP_FLAG_MD)) {
+            // -MD flag: write a dependency file next to each output
+            opt.write_depfile = 1;
+        } else if (is_flag(a, PP_FLAG_INCREMENTAL)) {
+            // -incremental flag: skip inputs whose output is up to date
+            opt.incremental = 1;
+        } else if (flag_value(a, PP_FLAG_SNAPSHOT_OUT)) {
+            // -snapshot-out=<file>: save the state left by the input header
+            opt.snapshot_out = flag_value(a, PP_FLAG_SNAPSHOT_OUT);
+        } else if (flag_value(a, PP_FLAG_SNAPSHOT)) {
+            // -snapshot=<file>: start every input from a saved header
+            opt.snapshot = flag_value(a, PP_FLAG_SNAPSHOT);
+        } else if (flag_value(a, PP_FLAG_INCLUDE_DIR) || flag_value(a, PP_FLAG_SYSTEM_DIR)) {
+            // -I<dir> / -isystem<dir>: include search directories (main reads them)
+            opt.search_dirs++;
+        } else if (is_flag(a, PP_FLAG_NO_PREFETCH)) {
+            // -no-prefetch: only read headers when their #include is reached
+            opt.no_prefetch = 1;
+        } else if (flag_value(a, PP_FLAG_MAX_INCLUDE_DEPTH)) {
+            // -max-include-depth=<n>: limit of #include nesting (main rejects -1)
+            opt.max_include_depth = positive_value(flag_value(a, PP_FLAG_MAX_INCLUDE_DEPTH));
+        } else if (flag_value(a, PP_FLAG_SERVE)) {
+            // -serve=<socket>: run as a daemon (main rejects input files)
+            opt.serve = flag_value(a, PP_FLAG_SERVE);
+        } else if (flag_value(a, PP_FLAG_CONNECT)) {
+            // -connect=<socket>: let a daemon run the rest of the command line
+            opt.connect = flag_value(a, PP_FLAG_CONNECT);
+        } else if (is_jobs_flag(a)) {
+            // -jN flag: number of worker threads for several inputs
+            opt.jobs = atoi(a + strlen(PP_FLAG_JOBS));
         } else {
             // Not a recognized flag: likely the input filename.
             // We just skip it here - the main program will handle file arguments
@@ -98,6 +207,20 @@ void cli_print_help(const char *progname)
     printf(PP_FMT_OPTION_D, PP_FLAG_D);
     printf(PP_FMT_OPTION_ALL, PP_FLAG_ALL, PP_FLAG_C, PP_FLAG_D);
     printf(PP_FMT_OPTION_HELP, PP_FLAG_HELP);
+    printf(PP_FMT_OPTION_STATS, PP_FLAG_STATS);
+    printf(PP_FMT_OPTION_STDOUT, PP_FLAG_STDOUT);
+    printf(PP_FMT_OPTION_JOBS, PP_FLAG_JOBS);
+    printf(PP_FMT_OPTION_CACHE, PP_FLAG_CACHE);
+    printf(PP_FMT_OPTION_MD, PP_FLAG_MD);
+    printf(PP_FMT_OPTION_INCREMENTAL, PP_FLAG_INCREMENTAL);
+    printf(PP_FMT_OPTION_SNAPSHOT_OUT, PP_FLAG_SNAPSHOT_OUT);
+    printf(PP_FMT_OPTION_SNAPSHOT, PP_FLAG_SNAPSHOT);
+    printf(PP_FMT_OPTION_INCLUDE_DIR, PP_FLAG_INCLUDE_DIR);
+    printf(PP_FMT_OPTION_SYSTEM_DIR, PP_FLAG_SYSTEM_DIR);
+    printf(PP_FMT_OPTION_NO_PREFETCH, PP_FLAG_NO_PREFETCH);
+    printf(PP_FMT_OPTION_MAX_INCLUDE_DEPTH, PP_FLAG_MAX_INCLUDE_DEPTH, PP_MAX_INCLUDE_DEPTH);
+    printf(PP_FMT_OPTION_SERVE, PP_FLAG_SERVE);
+    printf(PP_FMT_OPTION_CONNECT, PP_FLAG_CONNECT);
 
     // Show practical usage examples
     printf(PP_STR_EXAMPLES_LABEL);
@@ -7,6 +7,7 @@
  *
  * - `cli_parse`: Parses argv into structured preprocessing options.
  * - `cli_print_help`: Prints usage and available flags.
+ * - `cli_search_dir`: Reads the directory of a -I / -isystem argument.
  *
  * Usage:
  *     Include this header in main or test modules that need CLI parsing.
@@ -26,11 +27,41 @@ typedef struct {
     int do_directives;
     // Print help and exit (-help).
     int do_help;
+    // Print run statistics to stderr (-stats).
+    int do_stats;
+    // Write the result to stdout instead of <name>_pp.<ext> (-stdout).
+    int to_stdout;
+    // Worker threads for several inputs (-jN); 0 means one per CPU.
+    int jobs;
+    // Serve unchanged inputs from the persistent cache (-cache).
+    int use_cache;
+    // Write a Make dependency file <output>.d (-MD).
+    int write_depfile;
+    // Skip inputs whose output is up to date (-incremental).
+    int incremental;
+    // Save the state left by the input header here (-snapshot-out=<file>), or NULL.
+    const char *snapshot_out;
+    // Start every input from this saved header (-snapshot=<file>), or NULL.
+    const char *snapshot;
+    // Number of -I<dir> / -isystem<dir> arguments (read with cli_search_dir).
+    int search_dirs;
+    // Do not read #include targets ahead on background threads (-no-prefetch).
+    int no_prefetch;
+    // Deepest #include nesting allowed (-max-include-depth=<n>); 0 means
+    // PP_MAX_INCLUDE_DEPTH, -1 an invalid value.
+    int max_include_depth;
+    // Serve requests on this Unix socket (-serve=<socket>), or NULL.
+    const char *serve;
+    // Have the daemon at this socket run the command (-connect=<socket>), or NULL.
+    const char *connect;
 } cli_options_t;
 
 // Parse argv into structured CLI options.
 cli_options_t cli_parse(int argc, char **argv);
 // Print the user-facing help text (man page).
 void cli_print_help(const char *progname);
+// Directory of a -I<dir> or -isystem<dir> argument (system set for -isystem),
+// or NULL if arg is neither. The directory may be empty.
+const char *cli_search_dir(const char *arg, int *system);
 
 #endif
@@ -7,6 +7,7 @@
  * -------------------------------------------------------------------------- */
 
 #include "comments.h"
+#include "scan/scan.h"
 #include <string.h>
 #include <stdlib.h>
 #include <sys/types.h>
@@ -24,66 +25,76 @@ void comments_state_init(comment_state_t *state) {
     state->prev_char = 0;
 }
 
-void comments_update_state(const char *input, long input_len, comment_state_t *state)
-{
-    if (!input || !state) return;
-
-    /* Reuse the main comment-processing logic and discard output. */
-    buffer_t sink;
-    buffer_init(&sink);
-    comments_process_line(input, input_len, &sink, state);
-    buffer_free(&sink);
-}
+/* Append to output unless running in state-only mode (output == NULL). */
+#define EMIT(c) do { if (output) buffer_append_char(output, (c)); } while (0)
 
-/* Process a single line removing comments while preserving state */
-int comments_process_line(const char *input, long input_len, buffer_t *output, comment_state_t *state) {
-    if (!input || !output || !state) return 1;
-    
+/* Shared state machine; output may be NULL to only advance the state.
+ * Runs of bytes that cannot change the state are found with the SIMD
+ * scanners and copied (or skipped) in one step. */
+static void process_line(const char *input, long input_len, buffer_t *output, comment_state_t *state)
+{
     CommentState st = state->in_block_comment ? ST_BLOCK_COMMENT : ST_NORMAL;
     int prev = state->prev_char;
     int escaped = 0;
     int wrote_space = 0;  /* Track if we already wrote space for current comment */
     
+    const char *end = input + input_len;
+
     for (long i = 0; i < input_len; i++) {
+        /* Fast path: copy ordinary code up to the next '/', quote or newline,
+         * and skip comment text up to the next byte that matters */
+        if (st == ST_NORMAL) {
+            long j = scan_find_special(input + i, end) - input;
+            if (j > i && output) buffer_append_n(output, input + i, j - i);
+            i = j;
+        } else if (st == ST_LINE_COMMENT) {
+            i = scan_find_newline(input + i, end) - input;
+        } else if (st == ST_BLOCK_COMMENT && prev != '*') {
+            long j = scan_find_block_special(input + i, end) - input;
+            if (j > i) prev = (unsigned char)input[j - 1];  /* never '*' */
+            i = j;
+        }
+        if (i >= input_len) break;
+
         int c = (unsigned char)input[i];
         
         switch (st) {
         case ST_NORMAL:
             if (c == '"') {
-                buffer_append_char(output, c);
+                EMIT(c);
                 st = ST_STRING;
                 escaped = 0;
             } else if (c == '\'') {
-                buffer_append_char(output, c);
+                EMIT(c);
                 st = ST_CHAR;
                 escaped = 0;
             } else if (c == '/' && i + 1 < input_len) {
                 int n = (unsigned char)input[i + 1];
                 if (n == '/') {
                     /* Start of line comment */
-                    buffer_append_char(output, ' ');
+                    EMIT(' ');
                     st = ST_LINE_COMMENT;
                     wrote_space = 1;
                     i++;  /* Skip the second '/' */
                 } else if (n == '*') {
                     /* Start of block comment */
-                    buffer_append_char(output, ' ');
+                    EMIT(' ');
                     st = ST_BLOCK_COMMENT;
                     wrote_space = 1;
                     prev = 0;
                     i++;  /* Skip the '*' */
                 } else {
-                    buffer_append_char(output, c);
+                    EMIT(c);
                 }
             } else {
-                buffer_append_char(output, c);
+                EMIT(c);
             }
             break;
 
         case ST_LINE_COMMENT:
             /* Skip until newline; preserve newline */
             if (c == '\n') {
-                buffer_append_char(output, '\n');
+                EMIT('\n');
                 st = ST_NORMAL;
                 wrote_space = 0;
             }
@@ -93,7 +104,7 @@ int comments_process_line(const char *input, long input_len, buffer_t *output, c
         case ST_BLOCK_COMMENT:
             /* Preserve newlines inside block comments */
             if (c == '\n') {
-                buffer_append_char(output, '\n');
+                EMIT('\n');
             }
             
             /* Detect closing star-slash */
@@ -107,9 +118,13 @@ int comments_process_line(const char *input, long input_len, buffer_t *output, c
             break;
 
         case ST_STRING:
-            /* Copy everything; handle escapes */
-            buffer_append_char(output, c);
-            if (escaped) {
+            /* Copy everything; handle escapes. A newline ends the literal
+             * (as a new call would), so multi-line spans match line-by-line */
+            EMIT(c);
+            if (c == '\n') {
+                st = ST_NORMAL;
+                escaped = 0;
+            } else if (escaped) {
                 escaped = 0;
             } else if (c == '\\') {
                 escaped = 1;
@@ -119,9 +134,12 @@ int comments_process_line(const char *input, long input_len, buffer_t *output, c
             break;
 
         case ST_CHAR:
-            /* Copy everything; handle escapes */
-            buffer_append_char(output, c);
-            if (escaped) {
+            /* Copy everything; handle escapes (a newline ends the literal) */
+            EMIT(c);
+            if (c == '\n') {
+                st = ST_NORMAL;
+                escaped = 0;
+            } else if (escaped) {
                 escaped = 0;
             } else if (c == '\\') {
                 escaped = 1;
@@ -135,6 +153,34 @@ int comments_process_line(const char *input, long input_len, buffer_t *output, c
     /* Save state for next line */
     state->in_block_comment = (st == ST_BLOCK_COMMENT);
     state->prev_char = prev;
-    
+}
+
+void comments_update_state(const char *input, long input_len, comment_state_t *state)
+{
+    if (!input || !state) return;
+
+    /* Reuse the main comment-processing logic without producing output. */
+    process_line(input, input_len, NULL, state);
+}
+
+/* Process a single line removing comments while preserving state */
+int comments_process_line(const char *input, long input_len, buffer_t *output, comment_state_t *state) {
+    if (!input || !output || !state) return 1;
+
+    process_line(input, input_len, output, state);
     return 0;
+}
+
+/* Same, then lex what was written into tokens (reset by the caller) while
+ * it is still in cache. Not done inside the loop above: a call there costs
+ * the fast paths more than the lexing itself. */
+int comments_process_line_tokens(const char *input, long input_len, buffer_t *output,
+                                 comment_state_t *state, token_list_t *tokens)
+{
+    if (!input || !output || !state || !tokens) return 1;
+
+    long base = output->len;
+    process_line(input, input_len, output, state);
+    tokens_list_feed(tokens, output->data + base, output->len - base);
+    return tokens->failed;
 }
\ No newline at end of file
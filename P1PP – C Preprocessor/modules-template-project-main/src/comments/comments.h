@@ -17,6 +17,7 @@
 
 #include <stdio.h>
 #include "buffer/buffer.h"
+#include "tokens/tokens.h"
 
 /* Comment processing state for multi-line handling */
 typedef struct {
@@ -33,6 +34,13 @@ void comments_state_init(comment_state_t *state);
  */
 int comments_process_line(const char *input, long input_len, buffer_t *output, comment_state_t *state);
 
+/* Process a line like comments_process_line, then lex the text written to
+ * output into tokens (see tokens_list_feed). Returns 0 on
+ * success, non-zero on error (including running out of memory for tokens).
+ */
+int comments_process_line_tokens(const char *input, long input_len, buffer_t *output,
+                                 comment_state_t *state, token_list_t *tokens);
+
 /* Update comment parsing state without producing output.
  * Use this when comments must be preserved (e.g., -d mode) but directives/macros
  * should still ignore text inside block comments.
@@ -0,0 +1,251 @@
+/* -----------------------------------------------------------------------------
+ * Program: C Preprocessor (Practice 1)
+ * Description:
+ *     This module implements the dependency and stamp files declared in
+ *     depfile.h.
+ *
+ * - Dependency paths are escaped for Make (spaces, '#', '$').
+ * - Stamp checks stat every recorded file and only read the ones whose
+ *   mtime or size changed, so an up-to-date input costs a few stat calls.
+ *   Missing include candidates only need their stat to keep failing.
+ *
+ * Usage:
+ *     Called by main after a successful run (write) and before reading an
+ *     input (check).
+ *
+ * Status:
+ *     Active - POSIX stat timestamps; on _WIN32 stamps always compare hashes.
+ * -------------------------------------------------------------------------- */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "depfile.h"
+#include "buffer/buffer.h"
+#include "io/io.h"
+#include "errors/errors.h"
+#include "spec/pp_spec.h"
+
+// First line of a stamp file (bumped when the format changes).
+#define STAMP_HEADER "P1PP-STAMP 3"
+// Prefix of the line recording the output.
+#define STAMP_OUTPUT "output "
+
+/* Modification time of a file, split like struct timespec. */
+typedef struct {
+    long long sec;
+    long nsec;
+} file_time_t;
+
+// Read the mtime and size of path; returns 0 on success.
+static int file_state(const char *path, file_time_t *mtime, long long *size)
+{
+    struct stat sb;
+    if (stat(path, &sb) != 0) return 1;
+#if defined(__APPLE__)
+    mtime->sec = (long long)sb.st_mtimespec.tv_sec;
+    mtime->nsec = (long)sb.st_mtimespec.tv_nsec;
+#elif defined(_WIN32)
+    mtime->sec = (long long)sb.st_mtime;
+    mtime->nsec = 0;
+#else
+    mtime->sec = (long long)sb.st_mtim.tv_sec;
+    mtime->nsec = (long)sb.st_mtim.tv_nsec;
+#endif
+    *size = (long long)sb.st_size;
+    return 0;
+}
+
+// Append path to b, escaped for a Make rule.
+static int append_make_path(buffer_t *b, const char *path)
+{
+    for (const char *p = path; *p; p++) {
+        int rc = 0;
+        if (*p == ' ' || *p == '#') rc = buffer_append_char(b, '\\');
+        else if (*p == '$') rc = buffer_append_char(b, '$');
+        if (rc != 0 || buffer_append_char(b, *p) != 0) return 1;
+    }
+    return 0;
+}
+
+int depfile_write(const char *path, const char *target, const char *input,
+                  const cache_deps_t *deps)
+{
+    buffer_t text;
+    buffer_init(&text);
+
+    // "<target>: <input> \<newline> <header> ..." then "<header>:" per header
+    int rc = append_make_path(&text, target) || buffer_append_str(&text, ":") ||
+             buffer_append_char(&text, ' ') || append_make_path(&text, input);
+    // Missing include candidates are not files Make could depend on
+    for (int i = 0; rc == 0 && i < deps->count; i++) {
+        if (cache_deps_is_missing(deps, i)) continue;
+        rc = buffer_append_str(&text, " \\\n  ") || append_make_path(&text, deps->paths[i]);
+    }
+    if (rc == 0) rc = buffer_append_char(&text, '\n');
+    for (int i = 0; rc == 0 && i < deps->count; i++) {
+        if (cache_deps_is_missing(deps, i)) continue;
+        rc = buffer_append_char(&text, '\n') || append_make_path(&text, deps->paths[i]) ||
+             buffer_append_str(&text, ":\n");
+    }
+
+    if (rc != 0) {
+        error(0, "%s: %s", path, PP_ERR_OUT_OF_MEMORY);
+    } else {
+        rc = io_write_file(path, &text);
+    }
+    buffer_free(&text);
+    return rc;
+}
+
+// Append one stamp line; files modified since run_start get a zero mtime
+// (a run_start of 0 keeps the mtime: the output was written by this run).
+static int append_stamp_line(buffer_t *b, const char *path, hash128_t hash, time_t run_start)
+{
+    file_time_t mtime = {0, 0};
+    long long size = -1;
+    if (file_state(path, &mtime, &size) != 0 ||
+        (run_start != 0 && mtime.sec >= (long long)run_start)) {
+        mtime.sec = 0;
+        mtime.nsec = 0;
+    }
+
+    char hex[HASH_HEX_LEN + 1];
+    hash_to_hex(hash, hex);
+    char head[128];
+    snprintf(head, sizeof(head), "%lld %ld %lld %s ", mtime.sec, mtime.nsec, size, hex);
+    return buffer_append_str(b, head) || buffer_append_str(b, path) || buffer_append_char(b, '\n');
+}
+
+int depfile_stamp_write(const char *path, unsigned options, hash128_t search, const char *output,
+                        const char *input, hash128_t input_hash, const cache_deps_t *deps,
+                        time_t run_start)
+{
+    // The output is read back once: it was streamed out, never held whole
+    hash128_t output_hash;
+    if (hash_file(output, &output_hash) != 0) {
+        error(0, "%s: %s", output, PP_ERR_OUTPUT_READ);
+        return 1;
+    }
+
+    buffer_t text;
+    buffer_init(&text);
+
+    char abs_input[PP_MAX_PATH_LEN], abs_output[PP_MAX_PATH_LEN];
+    const char *input_path = input;
+    const char *output_path = output;
+#ifndef _WIN32
+    if (realpath(input, abs_input)) input_path = abs_input;
+    if (realpath(output, abs_output)) output_path = abs_output;
+#endif
+
+    char head[64 + HASH_HEX_LEN];
+    char search_hex[HASH_HEX_LEN + 1];
+    hash_to_hex(search, search_hex);
+    snprintf(head, sizeof(head), STAMP_HEADER "\noptions %u %s\n", options, search_hex);
+    int rc = buffer_append_str(&text, head) || buffer_append_str(&text, STAMP_OUTPUT) ||
+             append_stamp_line(&text, output_path, output_hash, 0) ||
+             append_stamp_line(&text, input_path, input_hash, run_start);
+    for (int i = 0; rc == 0 && i < deps->count; i++) {
+        rc = append_stamp_line(&text, deps->paths[i], deps->hashes[i], run_start);
+    }
+
+    if (rc != 0) {
+        error(0, "%s: %s", path, PP_ERR_OUT_OF_MEMORY);
+    } else {
+        rc = io_write_file(path, &text);
+    }
+    buffer_free(&text);
+    return rc;
+}
+
+// Check one "<sec> <nsec> <size> <hash> <path>" line against the file system.
+static int stamp_line_fresh(char *line)
+{
+    long long sec, size;
+    long nsec;
+    char hex[HASH_HEX_LEN + 1];
+    int path_at = 0;
+    if (sscanf(line, "%lld %ld %lld %32s %n", &sec, &nsec, &size, hex, &path_at) != 4 ||
+        path_at == 0 || line[path_at] == '\0') {
+        return 0;
+    }
+    const char *path = line + path_at;
+    hash128_t recorded, current;
+    if (hash_from_hex(hex, &recorded) != 0) return 0;
+
+    file_time_t mtime;
+    long long cur_size;
+    int exists = file_state(path, &mtime, &cur_size) == 0;
+    // A candidate that did not exist must still be absent
+    if (hash_equal(recorded, CACHE_DEP_MISSING)) return !exists;
+    if (!exists) return 0;
+    if (cur_size != size) return 0;
+    if (sec != 0 && mtime.sec == sec && mtime.nsec == nsec) return 1;
+
+    // Touched (or recorded during its own modification): compare contents
+    return hash_file(path, &current) == 0 && hash_equal(recorded, current);
+}
+
+// Return 1 if the stamp line records path (its last field).
+static int stamp_line_names(const char *line, const char *path)
+{
+    size_t len = strlen(line), path_len = strlen(path);
+    return len > path_len && line[len - path_len - 1] == ' ' &&
+           strcmp(line + len - path_len, path) == 0;
+}
+
+// Read the next line of f into line without its newline; returns 0 at the end
+// of the file or on a line too long for line.
+static int read_stamp_line(FILE *f, char *line, int size)
+{
+    if (!fgets(line, size, f)) return 0;
+    size_t len = strlen(line);
+    if (len == 0 || line[len - 1] != '\n') return 0;
+    line[len - 1] = '\0';
+    return 1;
+}
+
+int depfile_stamp_check(const char *path, unsigned options, hash128_t search, const char *output)
+{
+    FILE *f = fopen(path, "r");
+    if (!f) return 0;
+
+    char line[PP_MAX_PATH_LEN + 128];
+    unsigned recorded_options = 0;
+    char search_hex[HASH_HEX_LEN + 1];
+    hash128_t recorded_search;
+    int fresh = read_stamp_line(f, line, sizeof(line)) && strcmp(line, STAMP_HEADER) == 0 &&
+                read_stamp_line(f, line, sizeof(line)) &&
+                sscanf(line, "options %u %32s", &recorded_options, search_hex) == 2 &&
+                recorded_options == options && hash_from_hex(search_hex, &recorded_search) == 0 &&
+                hash_equal(recorded_search, search);
+
+    // The output must be the one this stamp was written with: emptied,
+    // truncated by an interrupted run or edited, it is regenerated
+    char abs_output[PP_MAX_PATH_LEN];
+    const char *output_path = output;
+#ifndef _WIN32
+    if (realpath(output, abs_output)) output_path = abs_output;
+#endif
+    fresh = fresh && read_stamp_line(f, line, sizeof(line)) &&
+            strncmp(line, STAMP_OUTPUT, strlen(STAMP_OUTPUT)) == 0 &&
+            stamp_line_names(line, output_path) && stamp_line_fresh(line + strlen(STAMP_OUTPUT));
+    int files = 0;
+    while (fresh && fgets(line, sizeof(line), f)) {
+        size_t len = strlen(line);
+        if (len == 0 || line[len - 1] != '\n') {
+            fresh = 0;
+            break;
+        }
+        line[len - 1] = '\0';
+        fresh = stamp_line_fresh(line);
+        files++;
+    }
+    fclose(f);
+
+    // The input line is mandatory
+    return fresh && files > 0;
+}
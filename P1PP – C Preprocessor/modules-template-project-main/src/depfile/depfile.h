@@ -0,0 +1,55 @@
+/* -----------------------------------------------------------------------------
+ * Program: C Preprocessor (Practice 1)
+ * Description:
+ *     This module writes dependency files for build systems (-MD) and the
+ *     stamp files used to skip unchanged inputs (-incremental).
+ *
+ * - `depfile_write`: Make rule "<output>: <input> <headers...>" followed by an
+ *   empty rule per header, so deleting a header does not break the build.
+ * - `depfile_stamp_write`: Records the options, the search path key and, for
+ *   the output, the input and every included file, its mtime, size and
+ *   content hash.
+ * - `depfile_stamp_check`: Tells whether an output is still up to date. Files
+ *   whose mtime and size match are trusted; the others are re-hashed, so a
+ *   touched but unchanged header does not force a rebuild.
+ *
+ * Stamp format (<output>.stamp):
+ *     P1PP-STAMP 3
+ *     options <bits> <search path key hex>
+ *     output <mtime sec> <mtime nsec> <size> <hash hex> <absolute path>
+ *     <mtime sec> <mtime nsec> <size> <hash hex> <absolute path>   (input first)
+ *     An mtime of 0 0 means "always compare hashes": it is written for files
+ *     modified during the run, whose mtime cannot be trusted. An all-zero hash
+ *     marks an include candidate that must still not exist.
+ *
+ * Status:
+ *     Active - used by main for -MD and -incremental.
+ * -------------------------------------------------------------------------- */
+
+#ifndef DEPFILE_H
+#define DEPFILE_H
+
+#include <time.h>
+
+#include "hash/hash.h"
+#include "cache/cache.h"
+
+/* Write the dependency rule of target to path (missing candidates are left
+ * out). Returns 0 or 1 (error reported). */
+int depfile_write(const char *path, const char *target, const char *input,
+                  const cache_deps_t *deps);
+
+/* Record the state of output (read back to hash it), input (with the hash of
+ * its bytes) and deps in path. search is the key of the include search path
+ * (search_path_key). run_start is when the input was read. Returns 0 or 1
+ * (error reported). */
+int depfile_stamp_write(const char *path, unsigned options, hash128_t search, const char *output,
+                        const char *input, hash128_t input_hash, const cache_deps_t *deps,
+                        time_t run_start);
+
+/* Return 1 if nothing recorded in the stamp at path has changed (same options
+ * and search path, output as written, same file contents, missing candidates
+ * still absent); 0 otherwise. Never reports. */
+int depfile_stamp_check(const char *path, unsigned options, hash128_t search, const char *output);
+
+#endif
@@ -3,7 +3,8 @@
  * directives.h
  *
  * Module: directives - Directive detection and execution
- * Responsible for: #include, #define, #ifdef/#endif processing
+ * Responsible for: #include, #define, #if/#ifdef/#ifndef/#elif/#else/#endif,
+ *                  #pragma once
  *
  * Author: Carlos García
  * -----------------------------------------------------------------------------
@@ -16,11 +17,15 @@
 #include "macros/macros.h"
 #include "comments/comments.h"
 #include "spec/pp_spec.h"
+#include "expr/expr.h"
 
-/* Conditional stack for #ifdef/#endif */
+/* Conditional stack for #if/#ifdef/#ifndef ... #elif/#else ... #endif */
 typedef struct {
     int stack[PP_MAX_IF_DEPTH];  /* 1 = include code, 0 = skip code */
+    int taken[PP_MAX_IF_DEPTH];  /* 1 once a branch was included (or can never be) */
+    int seen_else[PP_MAX_IF_DEPTH]; /* 1 after #else */
     int top;
+    int first_inactive;          /* Lowest level set to 0, or -1 if all include */
 } ifdef_stack_t;
 
 /* Result codes for directive processing. */
@@ -28,16 +33,29 @@ typedef enum {
     DIR_OK = 0,
     DIR_ERROR = 1,
     DIR_SKIP = 2,
-    DIR_INCLUDE = 3
+    DIR_INCLUDE = 3,
+    DIR_INCLUDE_ANGLED = 4  /* #include <name>: the line is also in output,
+                               kept as written if no search directory has it */
 } directive_result_t;
 
 /* Initialize ifdef stack */
 void ifdef_stack_init(ifdef_stack_t *stack);
 
-/* Check if we should currently include code */
+/* Check if we should currently include code (O(1): every level includes
+ * code exactly when no level is inactive) */
 int ifdef_should_include(const ifdef_stack_t *stack);
 
+/* Push a level (returns 1 if PP_MAX_IF_DEPTH is exceeded) / pop the top level */
+int ifdef_push(ifdef_stack_t *stack, int include);
+void ifdef_pop(ifdef_stack_t *stack);
+/* Switch the top level to another branch (#elif / #else) */
+void ifdef_set_top(ifdef_stack_t *stack, int include);
+
 /* Process a directive line
+ * source identifies the line for the condition cache (its address in the
+ * input or include cache; NULL disables caching).
+ * tokens are the line's tokens if the caller lexed it already (its '#' at
+ * tokens->hash); NULL tokenizes the line here.
  * Returns: 
  *   0 if directive was processed successfully
  *   1 if there was an error
@@ -51,6 +69,9 @@ int directives_process_line(const char *line, long line_len,
                            int do_comments,
                            comment_state_t *comment_state,
                            buffer_t *output,
-                           buffer_t *include_name);
+                           buffer_t *include_name,
+                           expr_cache_t *conditions,
+                           const void *source,
+                           const token_list_t *tokens);
 
 #endif // DIRECTIVES_H
@@ -11,56 +11,73 @@
 #include "errors.h"
 #include <string.h>
 
-static int error_count = 0;
-static buffer_t *error_buffer = NULL;
+// Size of one formatted error message
+#define ERRORS_MSG_SIZE 1024
+
+// Used by threads that did not bind a context
+static errors_ctx_t default_ctx = {0, NULL, NULL};
+// Context bound to the calling thread (NULL means default_ctx)
+static _Thread_local errors_ctx_t *bound_ctx = NULL;
+
+static errors_ctx_t *current_ctx(void) {
+    return bound_ctx ? bound_ctx : &default_ctx;
+}
+
+void errors_ctx_init(errors_ctx_t *ctx) {
+    FILE *stream = current_ctx()->stream;
+    ctx->count = 0;
+    ctx->buffer = NULL;
+    ctx->stream = stream;
+}
+
+errors_ctx_t *errors_bind(errors_ctx_t *ctx) {
+    errors_ctx_t *prev = bound_ctx;
+    bound_ctx = ctx;
+    return prev;
+}
 
 void errors_init(void) {
-    error_count = 0;
-    error_buffer = NULL;
+    errors_ctx_init(current_ctx());
 }
 
 void errors_set_buffer(buffer_t *buffer) {
-    error_buffer = buffer;
+    current_ctx()->buffer = buffer;
 }
 
 void error(int line, const char *fmt, ...) {
-    error_count++;
-    
-    // Print to the output buffer if available
-    if (error_buffer != NULL) {
-        char buf[1024];
-        
-        // Format the prefix
-        int prefix_len = snprintf(buf, sizeof(buf), "Error on line %d: ", line);
-        if (prefix_len > 0) {
-            buffer_append_str(error_buffer, buf);
-        }
+    errors_ctx_t *ctx = current_ctx();
+    // The default context may be shared by several threads
+    __atomic_fetch_add(&ctx->count, 1, __ATOMIC_RELAXED);
 
-        // Format the message
+    // Format the whole message once: "Error on line N: <msg>\n"
+    char buf[ERRORS_MSG_SIZE];
+    int len = snprintf(buf, sizeof(buf), "Error on line %d: ", line);
+    if (len < 0) len = 0;
+    if (len < (int)sizeof(buf) - 1) {
         va_list args;
         va_start(args, fmt);
-        vsnprintf(buf, sizeof(buf), fmt, args);
+        int n = vsnprintf(buf + len, sizeof(buf) - (size_t)len - 1, fmt, args);
         va_end(args);
-        
-        buffer_append_str(error_buffer, buf);
-        buffer_append_char(error_buffer, '\n');
+        if (n > 0) len += n;
+    }
+    if (len > (int)sizeof(buf) - 2) len = (int)sizeof(buf) - 2;
+    buf[len++] = '\n';
+    buf[len] = '\0';
+
+    // Print to the output buffer if available
+    if (ctx->buffer != NULL) {
+        buffer_append_n(ctx->buffer, buf, len);
     }
 
-    // Also print to stderr for immediate user feedback
-    fprintf(stderr, "Error on line %d: ", line);
-    
-    va_list args_stderr;
-    va_start(args_stderr, fmt);
-    vfprintf(stderr, fmt, args_stderr);
-    va_end(args_stderr);
-    
-    fprintf(stderr, "\n");
+    // Also print to stderr (or the context's stream) for immediate user
+    // feedback (one call, so lines from parallel runs do not interleave)
+    fputs(buf, ctx->stream ? ctx->stream : stderr);
 }
 
 int get_error_count(void) {
-    return error_count;
+    return current_ctx()->count;
 }
 
 void reset_count(int count) {
-    error_count = 0;
-}
\ No newline at end of file
+    current_ctx()->count = 0;
+}
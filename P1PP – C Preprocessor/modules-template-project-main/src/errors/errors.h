@@ -5,6 +5,12 @@
  * Module: errors - Error reporting
  * Responsible for: error(line, msg) style function and line-number support
  *
+ * Errors are counted in an errors_ctx_t. Each thread reports into the context
+ * bound with errors_bind (a process-wide default when nothing is bound), so
+ * files preprocessed in parallel keep separate counts. Messages go to the
+ * context's stream, so requests served at once by -serve reach their own
+ * client.
+ *
  * -----------------------------------------------------------------------------
  */
 
@@ -15,6 +21,23 @@
 #include <stdarg.h>
 #include "../buffer/buffer.h"
 
+/* Error state of one unit of work (a file, a preprocessing run). */
+typedef struct {
+    /* Number of errors reported. */
+    int count;
+    /* Optional buffer that receives a copy of every message. */
+    buffer_t *buffer;
+    /* Where messages are printed (NULL: stderr). */
+    FILE *stream;
+} errors_ctx_t;
+
+/* Reset ctx; it prints to the stream of the context bound to the calling thread. */
+void errors_ctx_init(errors_ctx_t *ctx);
+/* Bind ctx to the calling thread (NULL restores the default); returns the
+ * previous binding so nested users can restore it. */
+errors_ctx_t *errors_bind(errors_ctx_t *ctx);
+
+/* The functions below act on the context bound to the calling thread. */
 void errors_init(void);
 void errors_set_buffer(buffer_t *buffer);
 void error(int line, const char *fmt, ...);
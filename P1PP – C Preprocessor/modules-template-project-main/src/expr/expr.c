@@ -0,0 +1,645 @@
+/*
+ * -----------------------------------------------------------------------------
+ * expr.c
+ *
+ * Module: expr - #if / #elif condition expressions
+ * Responsible for: Lexing and compiling conditions to bytecode (precedence
+ *                  climbing), evaluating bytecode, and the per-run cache of
+ *                  compiled conditions.
+ * -----------------------------------------------------------------------------
+ */
+
+#include "expr.h"
+#include "spec/pp_spec.h"
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Error messages (reported by the caller with file and line). */
+#define EXPR_ERR_SYNTAX "Invalid expression"
+#define EXPR_ERR_EMPTY "Missing expression"
+#define EXPR_ERR_TOO_COMPLEX "Expression too complex"
+#define EXPR_ERR_DIV_ZERO "Division by zero"
+#define EXPR_ERR_MACRO "Macro does not expand to an integer expression"
+#define EXPR_ERR_NESTING "Macros nested too deeply"
+#define EXPR_ERR_MEMORY "Out of memory"
+
+/* ---- Lexer ---------------------------------------------------------------- */
+
+typedef enum {
+    TOK_END = 0,
+    TOK_NUM,
+    TOK_IDENT,
+    TOK_PUNCT,
+    TOK_BAD
+} tok_kind_t;
+
+typedef struct {
+    tok_kind_t kind;
+    /* Punctuator code: the character, or a two-character code below. */
+    int punct;
+    long long value;
+    const char *start;
+    int len;
+} tok_t;
+
+/* Two-character punctuators. */
+enum {
+    P_SHL = 256, P_SHR, P_LE, P_GE, P_EQ, P_NE, P_AND, P_OR
+};
+
+typedef struct {
+    const char *p;
+    const char *end;
+    tok_t tok;
+    /* Recursion depth and current evaluation stack depth. */
+    int nesting;
+    int depth;
+    const char *err;
+    expr_program_t *prog;
+} parser_t;
+
+// Skip blanks and comments; a line comment ends the expression.
+static void skip_blank(parser_t *ps)
+{
+    while (ps->p < ps->end) {
+        char c = *ps->p;
+        if (isspace((unsigned char)c)) {
+            ps->p++;
+        } else if (c == '/' && ps->p + 1 < ps->end && ps->p[1] == '*') {
+            const char *q = ps->p + 2;
+            while (q + 1 < ps->end && !(q[0] == '*' && q[1] == '/')) q++;
+            ps->p = (q + 1 < ps->end) ? q + 2 : ps->end;
+        } else if (c == '/' && ps->p + 1 < ps->end && ps->p[1] == '/') {
+            ps->p = ps->end;
+        } else {
+            break;
+        }
+    }
+}
+
+// Value of a character literal body starting after the quote.
+static int lex_char(parser_t *ps, long long *value)
+{
+    const char *p = ps->p + 1;
+    if (p >= ps->end) return 1;
+    long long v;
+    if (*p == '\\') {
+        p++;
+        if (p >= ps->end) return 1;
+        char e = *p++;
+        switch (e) {
+        case 'n': v = '\n'; break;
+        case 't': v = '\t'; break;
+        case 'r': v = '\r'; break;
+        case 'a': v = '\a'; break;
+        case 'b': v = '\b'; break;
+        case 'f': v = '\f'; break;
+        case 'v': v = '\v'; break;
+        case 'x':
+            v = 0;
+            while (p < ps->end && isxdigit((unsigned char)*p)) {
+                int d = isdigit((unsigned char)*p) ? *p - '0' : (tolower((unsigned char)*p) - 'a' + 10);
+                v = v * 16 + d;
+                p++;
+            }
+            break;
+        default:
+            if (e >= '0' && e <= '7') {
+                v = e - '0';
+                for (int i = 0; i < 2 && p < ps->end && *p >= '0' && *p <= '7'; i++) v = v * 8 + (*p++ - '0');
+            } else {
+                v = (unsigned char)e;
+            }
+            break;
+        }
+    } else {
+        v = (unsigned char)*p++;
+    }
+    if (p >= ps->end || *p != '\'') return 1;
+    ps->p = p + 1;
+    *value = v;
+    return 0;
+}
+
+// Read the next token into ps->tok.
+static void next(parser_t *ps)
+{
+    skip_blank(ps);
+    tok_t *t = &ps->tok;
+    t->start = ps->p;
+    t->len = 0;
+    if (ps->p >= ps->end) {
+        t->kind = TOK_END;
+        return;
+    }
+
+    char c = *ps->p;
+    if (isdigit((unsigned char)c)) {
+        char *num_end = NULL;
+        // strtoull stops at the end of the digits; the line is not NUL-bounded
+        char digits[64];
+        int n = 0;
+        while (ps->p + n < ps->end && n < (int)sizeof(digits) - 1 && isalnum((unsigned char)ps->p[n])) {
+            digits[n] = ps->p[n];
+            n++;
+        }
+        digits[n] = '\0';
+        unsigned long long v = strtoull(digits, &num_end, 0);
+        // Integer suffixes only (u, l, ll in any case and order)
+        while (*num_end == 'u' || *num_end == 'U' || *num_end == 'l' || *num_end == 'L') num_end++;
+        if (*num_end != '\0') {
+            t->kind = TOK_BAD;
+            return;
+        }
+        ps->p += n;
+        t->kind = TOK_NUM;
+        t->value = (long long)v;
+        return;
+    }
+    if (isalpha((unsigned char)c) || c == '_') {
+        const char *q = ps->p;
+        while (q < ps->end && (isalnum((unsigned char)*q) || *q == '_')) q++;
+        t->kind = TOK_IDENT;
+        t->len = (int)(q - ps->p);
+        ps->p = q;
+        return;
+    }
+    if (c == '\'') {
+        t->kind = lex_char(ps, &t->value) == 0 ? TOK_NUM : TOK_BAD;
+        return;
+    }
+
+    char d = (ps->p + 1 < ps->end) ? ps->p[1] : '\0';
+    int two = 0;
+    if (c == '<' && d == '<') two = P_SHL;
+    else if (c == '>' && d == '>') two = P_SHR;
+    else if (c == '<' && d == '=') two = P_LE;
+    else if (c == '>' && d == '=') two = P_GE;
+    else if (c == '=' && d == '=') two = P_EQ;
+    else if (c == '!' && d == '=') two = P_NE;
+    else if (c == '&' && d == '&') two = P_AND;
+    else if (c == '|' && d == '|') two = P_OR;
+    t->kind = TOK_PUNCT;
+    if (two) {
+        t->punct = two;
+        ps->p += 2;
+    } else if (c != '\0' && strchr("()!~+-*/%<>&^|?:", c)) {
+        t->punct = c;
+        ps->p++;
+    } else {
+        t->kind = TOK_BAD;
+    }
+}
+
+static int is_punct(const parser_t *ps, int punct)
+{
+    return ps->tok.kind == TOK_PUNCT && ps->tok.punct == punct;
+}
+
+/* ---- Code generation ------------------------------------------------------ */
+
+// Append an instruction; stack_effect keeps track of the evaluation depth.
+static int emit(parser_t *ps, int op, long long value, int len, int stack_effect)
+{
+    expr_program_t *prog = ps->prog;
+    if (prog->count == prog->capacity) {
+        int new_capacity = prog->capacity ? prog->capacity * 2 : 16;
+        expr_insn_t *code = realloc(prog->code, sizeof(expr_insn_t) * (size_t)new_capacity);
+        if (!code) {
+            ps->err = EXPR_ERR_MEMORY;
+            return -1;
+        }
+        prog->code = code;
+        prog->capacity = new_capacity;
+    }
+    ps->depth += stack_effect;
+    if (ps->depth > PP_MAX_EXPR_STACK) {
+        ps->err = EXPR_ERR_TOO_COMPLEX;
+        return -1;
+    }
+    expr_insn_t *in = &prog->code[prog->count];
+    in->op = (unsigned char)op;
+    in->len = len;
+    in->value = value;
+    return prog->count++;
+}
+
+// Store an identifier in the name pool; returns its offset or -1.
+static long long add_name(parser_t *ps, const char *name, int len)
+{
+    expr_program_t *prog = ps->prog;
+    if (prog->names_len + len + 1 > prog->names_cap) {
+        int new_cap = prog->names_cap ? prog->names_cap * 2 : 64;
+        while (new_cap < prog->names_len + len + 1) new_cap *= 2;
+        char *names = realloc(prog->names, (size_t)new_cap);
+        if (!names) {
+            ps->err = EXPR_ERR_MEMORY;
+            return -1;
+        }
+        prog->names = names;
+        prog->names_cap = new_cap;
+    }
+    long long off = prog->names_len;
+    memcpy(prog->names + off, name, (size_t)len);
+    prog->names[off + len] = '\0';
+    prog->names_len += len + 1;
+    return off;
+}
+
+static int parse_conditional(parser_t *ps);
+
+// unary: (+|-|!|~) unary | ( conditional ) | number | defined name | identifier
+static int parse_unary(parser_t *ps)
+{
+    if (++ps->nesting > PP_MAX_EXPR_STACK) {
+        ps->err = EXPR_ERR_TOO_COMPLEX;
+        return 1;
+    }
+    int rc = 0;
+    tok_t t = ps->tok;
+
+    if (t.kind == TOK_NUM) {
+        next(ps);
+        rc = emit(ps, EXPR_OP_CONST, t.value, 0, 1) < 0;
+    } else if (t.kind == TOK_IDENT && t.len == 7 && memcmp(t.start, "defined", 7) == 0) {
+        next(ps);
+        int paren = is_punct(ps, '(');
+        if (paren) next(ps);
+        if (ps->tok.kind != TOK_IDENT) {
+            ps->err = EXPR_ERR_SYNTAX;
+            return 1;
+        }
+        long long off = add_name(ps, ps->tok.start, ps->tok.len);
+        int len = ps->tok.len;
+        next(ps);
+        if (paren) {
+            if (!is_punct(ps, ')')) {
+                ps->err = EXPR_ERR_SYNTAX;
+                return 1;
+            }
+            next(ps);
+        }
+        rc = off < 0 || emit(ps, EXPR_OP_DEFINED, off, len, 1) < 0;
+    } else if (t.kind == TOK_IDENT) {
+        next(ps);
+        long long off = add_name(ps, t.start, t.len);
+        rc = off < 0 || emit(ps, EXPR_OP_IDENT, off, t.len, 1) < 0;
+    } else if (t.kind == TOK_PUNCT && t.punct == '(') {
+        next(ps);
+        rc = parse_conditional(ps);
+        if (rc == 0 && !is_punct(ps, ')')) {
+            ps->err = EXPR_ERR_SYNTAX;
+            rc = 1;
+        }
+        if (rc == 0) next(ps);
+    } else if (t.kind == TOK_PUNCT && (t.punct == '+' || t.punct == '-' || t.punct == '!' || t.punct == '~')) {
+        next(ps);
+        rc = parse_unary(ps);
+        if (rc == 0 && t.punct != '+') {
+            int op = t.punct == '-' ? EXPR_OP_NEG : t.punct == '!' ? EXPR_OP_NOT : EXPR_OP_BITNOT;
+            rc = emit(ps, op, 0, 0, 0) < 0;
+        }
+    } else {
+        ps->err = (t.kind == TOK_END) ? EXPR_ERR_EMPTY : EXPR_ERR_SYNTAX;
+        rc = 1;
+    }
+
+    ps->nesting--;
+    return rc;
+}
+
+// Binary operator at the current token: its precedence (0 if none) and op.
+static int binary_prec(const parser_t *ps, int *op)
+{
+    if (ps->tok.kind != TOK_PUNCT) return 0;
+    switch (ps->tok.punct) {
+    case P_OR: *op = EXPR_OP_OR_JUMP; return 1;
+    case P_AND: *op = EXPR_OP_AND_JUMP; return 2;
+    case '|': *op = EXPR_OP_BITOR; return 3;
+    case '^': *op = EXPR_OP_BITXOR; return 4;
+    case '&': *op = EXPR_OP_BITAND; return 5;
+    case P_EQ: *op = EXPR_OP_EQ; return 6;
+    case P_NE: *op = EXPR_OP_NE; return 6;
+    case '<': *op = EXPR_OP_LT; return 7;
+    case '>': *op = EXPR_OP_GT; return 7;
+    case P_LE: *op = EXPR_OP_LE; return 7;
+    case P_GE: *op = EXPR_OP_GE; return 7;
+    case P_SHL: *op = EXPR_OP_SHL; return 8;
+    case P_SHR: *op = EXPR_OP_SHR; return 8;
+    case '+': *op = EXPR_OP_ADD; return 9;
+    case '-': *op = EXPR_OP_SUB; return 9;
+    case '*': *op = EXPR_OP_MUL; return 10;
+    case '/': *op = EXPR_OP_DIV; return 10;
+    case '%': *op = EXPR_OP_MOD; return 10;
+    default: return 0;
+    }
+}
+
+// Precedence climbing over the binary operators (all left-associative).
+static int parse_binary(parser_t *ps, int min_prec)
+{
+    if (parse_unary(ps) != 0) return 1;
+
+    int op;
+    int prec;
+    while ((prec = binary_prec(ps, &op)) >= min_prec && prec > 0) {
+        next(ps);
+        if (op == EXPR_OP_AND_JUMP || op == EXPR_OP_OR_JUMP) {
+            // Short-circuit: the right operand is skipped, so 1 || 1/0 is fine
+            int jump = emit(ps, op, 0, 0, -1);
+            if (jump < 0 || parse_binary(ps, prec + 1) != 0) return 1;
+            if (emit(ps, EXPR_OP_BOOL, 0, 0, 0) < 0) return 1;
+            ps->prog->code[jump].value = ps->prog->count;
+        } else {
+            if (parse_binary(ps, prec + 1) != 0) return 1;
+            if (emit(ps, op, 0, 0, -1) < 0) return 1;
+        }
+    }
+    return 0;
+}
+
+// conditional: binary [ ? conditional : conditional ]
+static int parse_conditional(parser_t *ps)
+{
+    if (parse_binary(ps, 1) != 0) return 1;
+    if (!is_punct(ps, '?')) return 0;
+    next(ps);
+
+    int to_else = emit(ps, EXPR_OP_JUMP_FALSE, 0, 0, -1);
+    int depth = ps->depth;
+    if (to_else < 0 || parse_conditional(ps) != 0) return 1;
+    if (!is_punct(ps, ':')) {
+        ps->err = EXPR_ERR_SYNTAX;
+        return 1;
+    }
+    next(ps);
+    int to_end = emit(ps, EXPR_OP_JUMP, 0, 0, 0);
+    if (to_end < 0) return 1;
+    ps->prog->code[to_else].value = ps->prog->count;
+    // Only one branch runs: the else branch starts from the same depth
+    ps->depth = depth;
+    if (parse_conditional(ps) != 0) return 1;
+    ps->prog->code[to_end].value = ps->prog->count;
+    return 0;
+}
+
+int expr_compile(const char *text, long len, expr_program_t *prog, const char **err)
+{
+    memset(prog, 0, sizeof(*prog));
+    parser_t ps;
+    memset(&ps, 0, sizeof(ps));
+    ps.p = text;
+    ps.end = text + len;
+    ps.prog = prog;
+
+    next(&ps);
+    if (parse_conditional(&ps) != 0 || ps.tok.kind != TOK_END) {
+        *err = ps.err ? ps.err : EXPR_ERR_SYNTAX;
+        expr_program_free(prog);
+        return 1;
+    }
+    return 0;
+}
+
+void expr_program_free(expr_program_t *prog)
+{
+    free(prog->code);
+    free(prog->names);
+    memset(prog, 0, sizeof(*prog));
+}
+
+/* ---- Evaluation ----------------------------------------------------------- */
+
+/* Macros being evaluated (a macro is not expanded inside itself). */
+typedef struct {
+    const macro_table_t *macros;
+    const char *active[PP_MAX_EXPR_MACRO_DEPTH];
+    int active_len[PP_MAX_EXPR_MACRO_DEPTH];
+    int depth;
+} eval_env_t;
+
+static int eval_program(const expr_program_t *prog, eval_env_t *env, long long *result,
+                        const char **err);
+
+// Value of an identifier: its macro's replacement evaluated as an expression.
+static int eval_ident(const char *name, int len, eval_env_t *env, long long *out, const char **err)
+{
+    *out = 0;
+    const char *value = macros_get(env->macros, name, len);
+    if (!value) return 0;
+    for (int i = 0; i < env->depth; i++) {
+        if (env->active_len[i] == len && memcmp(env->active[i], name, (size_t)len) == 0) return 0;
+    }
+    if (env->depth >= PP_MAX_EXPR_MACRO_DEPTH) {
+        *err = EXPR_ERR_NESTING;
+        return 1;
+    }
+
+    expr_program_t prog;
+    if (expr_compile(value, (long)strlen(value), &prog, err) != 0) {
+        *err = EXPR_ERR_MACRO;
+        return 1;
+    }
+    env->active[env->depth] = name;
+    env->active_len[env->depth] = len;
+    env->depth++;
+    int rc = eval_program(&prog, env, out, err);
+    env->depth--;
+    expr_program_free(&prog);
+    return rc;
+}
+
+static int eval_program(const expr_program_t *prog, eval_env_t *env, long long *result,
+                        const char **err)
+{
+    long long stack[PP_MAX_EXPR_STACK];
+    int sp = 0;
+
+    for (int pc = 0; pc < prog->count; pc++) {
+        const expr_insn_t *in = &prog->code[pc];
+        long long a, b;
+        switch (in->op) {
+        case EXPR_OP_CONST:
+            stack[sp++] = in->value;
+            break;
+        case EXPR_OP_DEFINED:
+            stack[sp++] = macros_is_defined(env->macros, prog->names + in->value, in->len) ? 1 : 0;
+            break;
+        case EXPR_OP_IDENT:
+            if (eval_ident(prog->names + in->value, in->len, env, &a, err) != 0) return 1;
+            stack[sp++] = a;
+            break;
+        case EXPR_OP_NEG:
+            stack[sp - 1] = (long long)(0ULL - (unsigned long long)stack[sp - 1]);
+            break;
+        case EXPR_OP_NOT:
+            stack[sp - 1] = !stack[sp - 1];
+            break;
+        case EXPR_OP_BITNOT:
+            stack[sp - 1] = ~stack[sp - 1];
+            break;
+        case EXPR_OP_AND_JUMP:
+            if (!stack[--sp]) {
+                stack[sp++] = 0;
+                pc = (int)in->value - 1;
+            }
+            break;
+        case EXPR_OP_OR_JUMP:
+            if (stack[--sp]) {
+                stack[sp++] = 1;
+                pc = (int)in->value - 1;
+            }
+            break;
+        case EXPR_OP_BOOL:
+            stack[sp - 1] = stack[sp - 1] != 0;
+            break;
+        case EXPR_OP_JUMP_FALSE:
+            if (!stack[--sp]) pc = (int)in->value - 1;
+            break;
+        case EXPR_OP_JUMP:
+            pc = (int)in->value - 1;
+            break;
+        default:
+            // Binary operators
+            b = stack[--sp];
+            a = stack[sp - 1];
+            switch (in->op) {
+            case EXPR_OP_MUL: a = (long long)((unsigned long long)a * (unsigned long long)b); break;
+            case EXPR_OP_ADD: a = (long long)((unsigned long long)a + (unsigned long long)b); break;
+            case EXPR_OP_SUB: a = (long long)((unsigned long long)a - (unsigned long long)b); break;
+            case EXPR_OP_DIV:
+            case EXPR_OP_MOD:
+                if (b == 0) {
+                    *err = EXPR_ERR_DIV_ZERO;
+                    return 1;
+                }
+                if (b == -1) {
+                    // Avoid the LLONG_MIN / -1 overflow trap
+                    a = (in->op == EXPR_OP_DIV) ? (long long)(0ULL - (unsigned long long)a) : 0;
+                } else {
+                    a = (in->op == EXPR_OP_DIV) ? a / b : a % b;
+                }
+                break;
+            case EXPR_OP_SHL: a = (b < 0 || b > 63) ? 0 : (long long)((unsigned long long)a << b); break;
+            case EXPR_OP_SHR: a = (b < 0 || b > 63) ? (a < 0 ? -1 : 0) : a >> b; break;
+            case EXPR_OP_LT: a = a < b; break;
+            case EXPR_OP_GT: a = a > b; break;
+            case EXPR_OP_LE: a = a <= b; break;
+            case EXPR_OP_GE: a = a >= b; break;
+            case EXPR_OP_EQ: a = a == b; break;
+            case EXPR_OP_NE: a = a != b; break;
+            case EXPR_OP_BITAND: a = a & b; break;
+            case EXPR_OP_BITXOR: a = a ^ b; break;
+            case EXPR_OP_BITOR: a = a | b; break;
+            default:
+                *err = EXPR_ERR_SYNTAX;
+                return 1;
+            }
+            stack[sp - 1] = a;
+            break;
+        }
+    }
+
+    *result = stack[0];
+    return 0;
+}
+
+int expr_eval(const expr_program_t *prog, const macro_table_t *macros,
+              long long *result, const char **err)
+{
+    eval_env_t env;
+    env.macros = macros;
+    env.depth = 0;
+    return eval_program(prog, &env, result, err);
+}
+
+/* ---- Cache ---------------------------------------------------------------- */
+
+void expr_cache_init(expr_cache_t *cache)
+{
+    cache->keys = NULL;
+    cache->progs = NULL;
+    cache->count = 0;
+    cache->capacity = 0;
+    cache->compiled = 0;
+    cache->reused = 0;
+}
+
+void expr_cache_free(expr_cache_t *cache)
+{
+    for (int i = 0; i < cache->capacity; i++) {
+        if (cache->keys[i]) expr_program_free(&cache->progs[i]);
+    }
+    free(cache->keys);
+    free(cache->progs);
+    cache->keys = NULL;
+    cache->progs = NULL;
+    cache->count = 0;
+    cache->capacity = 0;
+}
+
+// Slot of key (or the empty slot where it belongs).
+static int cache_slot(const void **keys, int capacity, const void *key)
+{
+    uintptr_t h = (uintptr_t)key;
+    h ^= h >> 17;
+    h *= (uintptr_t)0x9e3779b97f4a7c15ULL;
+    int i = (int)((h >> 7) & (uintptr_t)(capacity - 1));
+    while (keys[i] && keys[i] != key) i = (i + 1) & (capacity - 1);
+    return i;
+}
+
+// Double the table when it is half full.
+static int cache_grow(expr_cache_t *cache)
+{
+    if (cache->capacity && cache->count * 2 < cache->capacity) return 0;
+    int new_capacity = cache->capacity ? cache->capacity * 2 : 64;
+    const void **keys = calloc((size_t)new_capacity, sizeof(void *));
+    expr_program_t *progs = calloc((size_t)new_capacity, sizeof(expr_program_t));
+    if (!keys || !progs) {
+        free(keys);
+        free(progs);
+        return 1;
+    }
+    for (int i = 0; i < cache->capacity; i++) {
+        if (!cache->keys[i]) continue;
+        int slot = cache_slot(keys, new_capacity, cache->keys[i]);
+        keys[slot] = cache->keys[i];
+        progs[slot] = cache->progs[i];
+    }
+    free(cache->keys);
+    free(cache->progs);
+    cache->keys = keys;
+    cache->progs = progs;
+    cache->capacity = new_capacity;
+    return 0;
+}
+
+const expr_program_t *expr_cache_get(expr_cache_t *cache, const void *key,
+                                     const char *text, long len, const char **err)
+{
+    if (cache->capacity) {
+        int slot = cache_slot(cache->keys, cache->capacity, key);
+        if (cache->keys[slot]) {
+            cache->reused++;
+            return &cache->progs[slot];
+        }
+    }
+
+    expr_program_t prog;
+    if (expr_compile(text, len, &prog, err) != 0) return NULL;
+    cache->compiled++;
+    if (cache_grow(cache) != 0) {
+        expr_program_free(&prog);
+        *err = EXPR_ERR_MEMORY;
+        return NULL;
+    }
+    int slot = cache_slot(cache->keys, cache->capacity, key);
+    cache->keys[slot] = key;
+    cache->progs[slot] = prog;
+    cache->count++;
+    return &cache->progs[slot];
+}
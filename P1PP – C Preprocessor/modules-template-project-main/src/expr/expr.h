@@ -0,0 +1,106 @@
+/*
+ * -----------------------------------------------------------------------------
+ * expr.h
+ *
+ * Module: expr - #if / #elif condition expressions
+ * Responsible for: Compiling a condition into a small stack bytecode once and
+ *                  evaluating it against the current macro table as often as
+ *                  needed. Compiled conditions are cached by source location
+ *                  (the address of the line in the input or include cache,
+ *                  stable for a run), so a header included again under a
+ *                  different macro state is re-evaluated without re-lexing.
+ *
+ * Semantics follow C: integer arithmetic in 64 bits, `defined X` and
+ * `defined(X)`, unknown identifiers are 0, && || ?: short-circuit. A macro
+ * used in a condition evaluates its replacement text as an expression of its
+ * own (a macro is not expanded inside itself).
+ * -----------------------------------------------------------------------------
+ */
+
+#ifndef EXPR_H
+#define EXPR_H
+
+#include "macros/macros.h"
+
+/* Bytecode operations (stack machine). */
+typedef enum {
+    EXPR_OP_CONST = 0,  /* push value */
+    EXPR_OP_DEFINED,    /* push 1 if the name is a macro */
+    EXPR_OP_IDENT,      /* push the value of a macro (0 if undefined) */
+    EXPR_OP_NEG,
+    EXPR_OP_NOT,
+    EXPR_OP_BITNOT,
+    EXPR_OP_MUL,
+    EXPR_OP_DIV,
+    EXPR_OP_MOD,
+    EXPR_OP_ADD,
+    EXPR_OP_SUB,
+    EXPR_OP_SHL,
+    EXPR_OP_SHR,
+    EXPR_OP_LT,
+    EXPR_OP_GT,
+    EXPR_OP_LE,
+    EXPR_OP_GE,
+    EXPR_OP_EQ,
+    EXPR_OP_NE,
+    EXPR_OP_BITAND,
+    EXPR_OP_BITXOR,
+    EXPR_OP_BITOR,
+    EXPR_OP_AND_JUMP,   /* pop; if zero push 0 and jump to value */
+    EXPR_OP_OR_JUMP,    /* pop; if non-zero push 1 and jump to value */
+    EXPR_OP_BOOL,       /* top = (top != 0) */
+    EXPR_OP_JUMP_FALSE, /* pop; jump to value if zero */
+    EXPR_OP_JUMP        /* jump to value */
+} expr_op_t;
+
+/* One instruction. */
+typedef struct {
+    unsigned char op;
+    /* Name length (DEFINED / IDENT). */
+    int len;
+    /* Constant, offset of the name in names, or jump target. */
+    long long value;
+} expr_insn_t;
+
+/* A compiled condition. */
+typedef struct {
+    expr_insn_t *code;
+    int count;
+    int capacity;
+    /* Identifier names, referenced by offset. */
+    char *names;
+    int names_len;
+    int names_cap;
+} expr_program_t;
+
+/* Compiled conditions keyed by source location (open addressing). */
+typedef struct {
+    const void **keys;
+    expr_program_t *progs;
+    int count;
+    int capacity;
+    /* Statistics: conditions compiled and compiled conditions reused. */
+    long compiled;
+    long reused;
+} expr_cache_t;
+
+/* Compile text into prog. Returns 0, or 1 with *err set to a message. */
+int expr_compile(const char *text, long len, expr_program_t *prog, const char **err);
+/* Release a compiled program. */
+void expr_program_free(expr_program_t *prog);
+
+/* Evaluate prog with the current macros. Returns 0, or 1 with *err set. */
+int expr_eval(const expr_program_t *prog, const macro_table_t *macros,
+              long long *result, const char **err);
+
+/* Initialize an empty cache / release it (statistics are kept). */
+void expr_cache_init(expr_cache_t *cache);
+void expr_cache_free(expr_cache_t *cache);
+
+/* Return the program compiled for the condition at key, compiling text on
+ * first use. Returns NULL with *err set if text is not a valid expression
+ * (failures are not cached). */
+const expr_program_t *expr_cache_get(expr_cache_t *cache, const void *key,
+                                     const char *text, long len, const char **err);
+
+#endif // EXPR_H
@@ -0,0 +1,210 @@
+/* -----------------------------------------------------------------------------
+ * Program: C Preprocessor (Practice 1)
+ * Description:
+ *     This module implements the streaming 128-bit hash declared in hash.h.
+ *
+ * - Blocks of 16 bytes are mixed into two 64-bit lanes; a partial block is
+ *   kept in the state until more input arrives or the hash is finalized.
+ * - `hash_file` maps the file and hashes it in one pass, without reporting
+ *   errors (a missing dependency is an expected outcome for callers).
+ *
+ * Usage:
+ *     Called by the cache and depfile modules.
+ *
+ * Status:
+ *     Active - hashing primitive for the preprocessing cache.
+ * -------------------------------------------------------------------------- */
+
+#include <stdio.h>
+#include <string.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "hash.h"
+
+#define HASH_C1 0x87c37b91114253d5ULL
+#define HASH_C2 0x4cf5ad432745937fULL
+
+static uint64_t rotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t fmix64(uint64_t k)
+{
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+// Little-endian load of n (<= 8) bytes.
+static uint64_t load_le(const unsigned char *p, size_t n)
+{
+    uint64_t v = 0;
+    for (size_t i = 0; i < n; i++) v |= (uint64_t)p[i] << (8 * i);
+    return v;
+}
+
+// Mix one full 16-byte block into the lanes.
+static void mix_block(hash_state_t *st, const unsigned char *p)
+{
+    uint64_t k1 = load_le(p, 8);
+    uint64_t k2 = load_le(p + 8, 8);
+
+    k1 *= HASH_C1; k1 = rotl64(k1, 31); k1 *= HASH_C2; st->h1 ^= k1;
+    st->h1 = rotl64(st->h1, 27); st->h1 += st->h2; st->h1 = st->h1 * 5 + 0x52dce729;
+
+    k2 *= HASH_C2; k2 = rotl64(k2, 33); k2 *= HASH_C1; st->h2 ^= k2;
+    st->h2 = rotl64(st->h2, 31); st->h2 += st->h1; st->h2 = st->h2 * 5 + 0x38495ab5;
+}
+
+void hash_init(hash_state_t *st)
+{
+    st->h1 = 0;
+    st->h2 = 0;
+    st->tail_len = 0;
+    st->total = 0;
+}
+
+void hash_update(hash_state_t *st, const void *data, size_t len)
+{
+    const unsigned char *p = (const unsigned char *)data;
+    st->total += len;
+
+    // Complete a pending partial block first
+    if (st->tail_len > 0) {
+        size_t take = 16 - st->tail_len;
+        if (take > len) take = len;
+        memcpy(st->tail + st->tail_len, p, take);
+        st->tail_len += take;
+        p += take;
+        len -= take;
+        if (st->tail_len < 16) return;
+        mix_block(st, st->tail);
+        st->tail_len = 0;
+    }
+
+    for (; len >= 16; p += 16, len -= 16) mix_block(st, p);
+
+    memcpy(st->tail, p, len);
+    st->tail_len = len;
+}
+
+void hash_update_str(hash_state_t *st, const char *s)
+{
+    hash_update(st, s, strlen(s) + 1);
+}
+
+hash128_t hash_final(const hash_state_t *st)
+{
+    uint64_t h1 = st->h1;
+    uint64_t h2 = st->h2;
+
+    // Mix the partial block
+    if (st->tail_len > 8) {
+        uint64_t k2 = load_le(st->tail + 8, st->tail_len - 8);
+        k2 *= HASH_C2; k2 = rotl64(k2, 33); k2 *= HASH_C1; h2 ^= k2;
+    }
+    if (st->tail_len > 0) {
+        uint64_t k1 = load_le(st->tail, st->tail_len < 8 ? st->tail_len : 8);
+        k1 *= HASH_C1; k1 = rotl64(k1, 31); k1 *= HASH_C2; h1 ^= k1;
+    }
+
+    h1 ^= st->total;
+    h2 ^= st->total;
+    h1 += h2;
+    h2 += h1;
+    h1 = fmix64(h1);
+    h2 = fmix64(h2);
+    h1 += h2;
+    h2 += h1;
+
+    hash128_t h = {h1, h2};
+    return h;
+}
+
+hash128_t hash_bytes(const void *data, size_t len)
+{
+    hash_state_t st;
+    hash_init(&st);
+    hash_update(&st, data, len);
+    return hash_final(&st);
+}
+
+void hash_to_hex(hash128_t h, char *out)
+{
+    static const char digits[] = "0123456789abcdef";
+    for (int i = 0; i < 16; i++) {
+        uint64_t v = i < 8 ? h.hi : h.lo;
+        int shift = 8 * (7 - (i % 8));
+        unsigned byte = (unsigned)((v >> shift) & 0xff);
+        out[2 * i] = digits[byte >> 4];
+        out[2 * i + 1] = digits[byte & 0xf];
+    }
+    out[HASH_HEX_LEN] = '\0';
+}
+
+int hash_from_hex(const char *s, hash128_t *out)
+{
+    uint64_t v[2] = {0, 0};
+    for (int i = 0; i < HASH_HEX_LEN; i++) {
+        char c = s[i];
+        int d;
+        if (c >= '0' && c <= '9') d = c - '0';
+        else if (c >= 'a' && c <= 'f') d = c - 'a' + 10;
+        else return 1;
+        v[i / 16] = (v[i / 16] << 4) | (uint64_t)d;
+    }
+    out->hi = v[0];
+    out->lo = v[1];
+    return 0;
+}
+
+int hash_equal(hash128_t a, hash128_t b)
+{
+    return a.lo == b.lo && a.hi == b.hi;
+}
+
+int hash_file(const char *path, hash128_t *out)
+{
+#ifndef _WIN32
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 1;
+    struct stat sb;
+    if (fstat(fd, &sb) != 0 || !S_ISREG(sb.st_mode)) {
+        close(fd);
+        return 1;
+    }
+    if (sb.st_size == 0) {
+        close(fd);
+        *out = hash_bytes("", 0);
+        return 0;
+    }
+    void *data = mmap(NULL, (size_t)sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return 1;
+    *out = hash_bytes(data, (size_t)sb.st_size);
+    munmap(data, (size_t)sb.st_size);
+    return 0;
+#else
+    FILE *f = fopen(path, "rb");
+    if (!f) return 1;
+    hash_state_t st;
+    hash_init(&st);
+    char chunk[4096];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) hash_update(&st, chunk, n);
+    int failed = ferror(f);
+    fclose(f);
+    if (failed) return 1;
+    *out = hash_final(&st);
+    return 0;
+#endif
+}
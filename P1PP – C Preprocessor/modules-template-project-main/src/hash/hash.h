@@ -0,0 +1,65 @@
+/* -----------------------------------------------------------------------------
+ * Program: C Preprocessor (Practice 1)
+ * Description:
+ *     This module provides a streaming 128-bit hash (MurmurHash3 x64_128
+ *     block function) for content-addressed cache keys.
+ *
+ * - `hash_init` / `hash_update` / `hash_final`: Incremental hashing; the
+ *   result does not depend on how the input is split across updates.
+ * - `hash_bytes`: One-shot helper.
+ * - `hash_to_hex` / `hash_from_hex`: 32-character lowercase hex form.
+ * - `hash_file`: Hash of a file's contents.
+ *
+ * Usage:
+ *     Used by the preprocessing cache to key inputs, dependencies and options,
+ *     and by the depfile module to detect changed dependencies.
+ *
+ * Status:
+ *     Active - not a cryptographic hash (keys are never adversarial here).
+ * -------------------------------------------------------------------------- */
+
+#ifndef HASH_H
+#define HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Length of a hash in hex, without the terminating NUL. */
+#define HASH_HEX_LEN 32
+
+/* 128-bit hash value. */
+typedef struct {
+    uint64_t lo;
+    uint64_t hi;
+} hash128_t;
+
+/* Incremental hashing state. */
+typedef struct {
+    uint64_t h1;
+    uint64_t h2;
+    /* Bytes waiting for a full 16-byte block. */
+    unsigned char tail[16];
+    size_t tail_len;
+    /* Total bytes hashed. */
+    uint64_t total;
+} hash_state_t;
+
+void hash_init(hash_state_t *st);
+void hash_update(hash_state_t *st, const void *data, size_t len);
+/* Hash a string including its terminating NUL (keeps fields separated). */
+void hash_update_str(hash_state_t *st, const char *s);
+hash128_t hash_final(const hash_state_t *st);
+
+hash128_t hash_bytes(const void *data, size_t len);
+/* Hash the contents of a regular file. Returns 0, or 1 (silently) if it
+ * cannot be read. */
+int hash_file(const char *path, hash128_t *out);
+
+/* Write the hex form into out (HASH_HEX_LEN + 1 bytes). */
+void hash_to_hex(hash128_t h, char *out);
+/* Parse HASH_HEX_LEN hex digits from s. Returns 0, or 1 if malformed. */
+int hash_from_hex(const char *s, hash128_t *out);
+/* Non-zero if a and b are the same hash. */
+int hash_equal(hash128_t a, hash128_t b);
+
+#endif
@@ -0,0 +1,602 @@
+/*
+ * -----------------------------------------------------------------------------
+ * include_cache.c
+ *
+ * Module: include_cache - Per-run cache of #include targets
+ * Responsible for: Loading each included file once per run, keyed by its
+ *                  canonical identity (device + inode), together with a line
+ *                  index so repeated includes skip disk I/O and newline scans.
+ *                  On first load the file is also checked for the include-guard
+ *                  pattern (#ifndef X ... #endif around everything) and for
+ *                  #pragma once, so later inclusions can be skipped in O(1).
+ *                  An include_store_t keeps loaded files across runs.
+ *
+ * -----------------------------------------------------------------------------
+ */
+
+#include "include_cache.h"
+#include "scan/scan.h"
+#include "io/io.h"
+#include "errors/errors.h"
+#include "spec/pp_spec.h"
+#include "comments/comments.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#define INITIAL_ENTRIES 16
+#define STORE_BUCKETS 256
+#define INITIAL_SLOTS 32
+#define EMPTY_SLOT (-1)
+/* 64-bit golden-ratio multiplier used to spread (dev, ino) keys */
+#define KEY_MIX 0x9E3779B97F4A7C15ull
+
+static unsigned long long key_hash(unsigned long long dev, unsigned long long ino)
+{
+    unsigned long long h = (ino ^ (dev << 32) ^ (dev >> 32)) * KEY_MIX;
+    return h ^ (h >> 29);
+}
+
+/* A file kept by the store: the entry of its first load, with the size and
+ * mtime it had then. */
+struct include_stored {
+    include_entry_t entry;
+    long long size;
+    long long mtime_sec;
+    long long mtime_nsec;
+    /* Caches borrowing the item, plus one while it is in the store. */
+    int refs;
+    include_store_t *store;
+    include_stored_t *next;
+};
+
+/* Size and modification time of a file, as compared by the store. */
+typedef struct {
+    long long size;
+    long long mtime_sec;
+    long long mtime_nsec;
+} file_stamp_t;
+
+/* Resolve path to its (dev, ino) identity with a single stat call. */
+static int file_key(const char *path, unsigned long long *dev, unsigned long long *ino,
+                    file_stamp_t *stamp)
+{
+    struct stat st;
+    if (stat(path, &st) != 0) return 1;
+    *dev = (unsigned long long)st.st_dev;
+    *ino = (unsigned long long)st.st_ino;
+    stamp->size = (long long)st.st_size;
+#if defined(__APPLE__)
+    stamp->mtime_sec = (long long)st.st_mtimespec.tv_sec;
+    stamp->mtime_nsec = (long long)st.st_mtimespec.tv_nsec;
+#elif defined(_WIN32)
+    stamp->mtime_sec = (long long)st.st_mtime;
+    stamp->mtime_nsec = 0;
+#else
+    stamp->mtime_sec = (long long)st.st_mtim.tv_sec;
+    stamp->mtime_nsec = (long long)st.st_mtim.tv_nsec;
+#endif
+#ifdef _WIN32
+    /* No stable inode numbers: identify the file by its path instead */
+    *ino = 0;
+    for (const char *p = path; *p; p++) *ino = (*ino ^ (unsigned char)*p) * KEY_MIX;
+#endif
+    return 0;
+}
+
+/* Return the slot holding (dev, ino), or the empty slot where it would go. */
+static int find_slot(const include_cache_t *cache, unsigned long long dev, unsigned long long ino)
+{
+    int mask = cache->slot_capacity - 1;
+    int i = (int)(key_hash(dev, ino) & (unsigned long long)mask);
+
+    while (cache->slots[i] != EMPTY_SLOT) {
+        const include_entry_t *e = cache->entries[cache->slots[i]];
+        if (e->dev == dev && e->ino == ino) return i;
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+/* Keep the slot table at most half full. */
+static int grow_slots(include_cache_t *cache)
+{
+    if ((cache->count + 1) * 2 <= cache->slot_capacity) return 0;
+
+    int new_capacity = cache->slot_capacity * 2;
+    int *new_slots = malloc(sizeof(int) * (size_t)new_capacity);
+    if (!new_slots) return 1;
+
+    free(cache->slots);
+    cache->slots = new_slots;
+    cache->slot_capacity = new_capacity;
+    for (int i = 0; i < new_capacity; i++) cache->slots[i] = EMPTY_SLOT;
+
+    for (int n = 0; n < cache->count; n++) {
+        const include_entry_t *e = cache->entries[n];
+        cache->slots[find_slot(cache, e->dev, e->ino)] = n;
+    }
+    return 0;
+}
+
+static int grow_entries(include_cache_t *cache)
+{
+    if (cache->count < cache->capacity) return 0;
+
+    int new_capacity = cache->capacity * 2;
+    include_entry_t **new_entries = realloc(cache->entries,
+                                            sizeof(include_entry_t *) * (size_t)new_capacity);
+    if (!new_entries) return 1;
+    cache->entries = new_entries;
+    cache->capacity = new_capacity;
+    return 0;
+}
+
+/* Build the line-start index for a loaded file. */
+static int build_line_index(include_entry_t *e)
+{
+    const char *data = e->bytes.data;
+    long len = e->bytes.len;
+
+    int lines = 0;
+    for (const char *p = data, *end = data + len; p < end; lines++) {
+        const char *nl = scan_find_newline(p, end);
+        p = nl < end ? nl + 1 : end;
+    }
+
+    e->line_starts = malloc(sizeof(long) * (size_t)(lines + 1));
+    if (!e->line_starts) return 1;
+
+    long pos = 0;
+    for (int i = 0; i < lines; i++) {
+        e->line_starts[i] = pos;
+
+        // Note whether any line starts with the directive marker
+        if (!e->has_directives) {
+            long j = pos;
+            while (j < len && data[j] != PP_CHAR_NL && isspace((unsigned char)data[j])) j++;
+            e->has_directives = j < len && data[j] == PP_CHAR_HASH;
+        }
+
+        const char *nl = scan_find_newline(data + pos, data + len);
+        pos = nl < data + len ? (long)(nl - data) + 1 : len;
+    }
+    e->line_starts[lines] = len;
+    e->line_count = lines;
+    return 0;
+}
+
+/* Guard detection phases. */
+typedef enum {
+    GUARD_BEFORE = 0,   /* nothing significant seen yet */
+    GUARD_INSIDE,       /* inside the candidate #ifndef block */
+    GUARD_AFTER,        /* candidate block closed, only blank lines allowed */
+    GUARD_NONE          /* pattern broken */
+} guard_phase_t;
+
+static int is_ident_char(char c)
+{
+    return isalnum((unsigned char)c) || c == '_';
+}
+
+static int word_is(const char *w, int len, const char *kw)
+{
+    return (int)strlen(kw) == len && strncmp(w, kw, (size_t)len) == 0;
+}
+
+/* Split a comment-free directive line into keyword and first argument.
+ * Returns 1 if the line is a directive. rest_blank tells whether anything
+ * follows the argument. */
+static int split_directive(const char *s, long len,
+                           const char **kw, int *kw_len,
+                           const char **arg, int *arg_len,
+                           int *rest_blank)
+{
+    long i = 0;
+    while (i < len && isspace((unsigned char)s[i])) i++;
+    if (i >= len || s[i] != PP_CHAR_HASH) return 0;
+    i++;
+    while (i < len && (s[i] == ' ' || s[i] == '\t')) i++;
+
+    long k = i;
+    while (i < len && is_ident_char(s[i])) i++;
+    *kw = s + k;
+    *kw_len = (int)(i - k);
+    while (i < len && (s[i] == ' ' || s[i] == '\t')) i++;
+
+    long a = i;
+    while (i < len && is_ident_char(s[i])) i++;
+    *arg = s + a;
+    *arg_len = (int)(i - a);
+    while (i < len && isspace((unsigned char)s[i])) i++;
+    *rest_blank = (i >= len);
+    return 1;
+}
+
+/* Detect the include-guard pattern and #pragma once (run once per file). */
+static int detect_guard(include_entry_t *e)
+{
+    if (!e->has_directives) return 0;
+
+    comment_state_t cs;
+    comments_state_init(&cs);
+    buffer_t line;
+    buffer_init(&line);
+
+    guard_phase_t phase = GUARD_BEFORE;
+    int depth = 0;
+    const char *guard = NULL;
+    int guard_len = 0;
+
+    for (int n = 0; n < e->line_count; n++) {
+        const char *raw = e->bytes.data + e->line_starts[n];
+        long raw_len = e->line_starts[n + 1] - e->line_starts[n];
+        int start_in_block = cs.in_block_comment;
+
+        line.len = 0;
+        if (comments_process_line(raw, raw_len, &line, &cs) != 0) {
+            phase = GUARD_NONE;
+            break;
+        }
+
+        long i = 0;
+        while (i < line.len && isspace((unsigned char)line.data[i])) i++;
+        if (i == line.len) continue;  /* blank or comment-only line */
+
+        const char *kw = NULL, *arg = NULL;
+        int kw_len = 0, arg_len = 0, rest_blank = 0;
+        int is_dir = !start_in_block &&
+                     split_directive(line.data, line.len, &kw, &kw_len, &arg, &arg_len, &rest_blank);
+
+        if (is_dir && word_is(kw, kw_len, "pragma") && word_is(arg, arg_len, "once") &&
+            depth <= (phase == GUARD_INSIDE ? 1 : 0)) {
+            e->once = 1;
+            continue;
+        }
+
+        if (phase == GUARD_BEFORE) {
+            if (is_dir && word_is(kw, kw_len, "ifndef") && arg_len > 0 && rest_blank) {
+                guard = arg;
+                guard_len = arg_len;
+                /* arg points into the scratch line: copy it now */
+                e->guard = malloc((size_t)guard_len + 1);
+                if (e->guard) {
+                    memcpy(e->guard, guard, (size_t)guard_len);
+                    e->guard[guard_len] = '\0';
+                }
+                depth = 1;
+                phase = GUARD_INSIDE;
+                continue;
+            }
+            phase = GUARD_NONE;
+        } else if (phase == GUARD_AFTER) {
+            phase = GUARD_NONE;
+        }
+
+        if (!is_dir) continue;
+        if (word_is(kw, kw_len, "if") || word_is(kw, kw_len, "ifdef") || word_is(kw, kw_len, "ifndef")) {
+            depth++;
+        } else if (word_is(kw, kw_len, "endif") && depth > 0) {
+            depth--;
+            if (depth == 0 && phase == GUARD_INSIDE) phase = GUARD_AFTER;
+        } else if ((word_is(kw, kw_len, "else") || word_is(kw, kw_len, "elif")) &&
+                   depth == 1 && phase == GUARD_INSIDE) {
+            /* An #else branch of the guard would emit code when it is defined */
+            phase = GUARD_NONE;
+        }
+    }
+    buffer_free(&line);
+
+    if (phase == GUARD_AFTER && e->guard) {
+        e->guard_len = guard_len;
+    } else {
+        free(e->guard);
+        e->guard = NULL;
+        e->guard_len = 0;
+    }
+    return 0;
+}
+
+static void store_release(include_stored_t *item);
+
+/* Free the contents of e, not e itself. */
+static void entry_clear(include_entry_t *e)
+{
+    buffer_free(&e->bytes);
+    free(e->path);
+    free(e->base_dir);
+    free(e->line_starts);
+    free(e->guard);
+}
+
+static void entry_free(include_entry_t *e)
+{
+    if (!e) return;
+    if (e->stored) {
+        // Only the paths are the entry's own; the rest belongs to the store
+        store_release(e->stored);
+        free(e->path);
+        free(e->base_dir);
+    } else {
+        entry_clear(e);
+    }
+    free(e);
+}
+
+/* Load and index path into e (zeroed). Files kept by a store are read into
+ * memory rather than mapped: editing one in place must not fault a later run.
+ * Returns 0, or 1 on failure (e is then released by the caller). */
+static int entry_fill(include_entry_t *e, const char *path, unsigned long long dev,
+                      unsigned long long ino, int stored)
+{
+    e->dev = dev;
+    e->ino = ino;
+    e->active_frame = -1;
+    buffer_init(&e->bytes);
+
+    if ((stored ? io_read_file(path, &e->bytes) : io_map_file(path, &e->bytes)) != 0) return 1;
+
+    char base_dir[PP_MAX_PATH_LEN];
+    io_compute_base_dir(path, base_dir, sizeof(base_dir));
+    e->path = strdup(path);
+    e->base_dir = strdup(base_dir);
+    if (!e->path || !e->base_dir || build_line_index(e) != 0 || detect_guard(e) != 0) {
+        error(0, "Out of memory while indexing file: %s", path);
+        return 1;
+    }
+    return 0;
+}
+
+/* Load, index and return a new entry for path (NULL on failure). */
+static include_entry_t *entry_load(const char *path, unsigned long long dev, unsigned long long ino)
+{
+    include_entry_t *e = calloc(1, sizeof(include_entry_t));
+    if (!e) return NULL;
+    if (entry_fill(e, path, dev, ino, 0) != 0) {
+        entry_free(e);
+        return NULL;
+    }
+    return e;
+}
+
+/* ---- Store ----------------------------------------------------------------- */
+
+static void stored_free(include_stored_t *item)
+{
+    entry_clear(&item->entry);
+    free(item);
+}
+
+/* Drop a reference to item; the last one frees it. */
+static void store_release(include_stored_t *item)
+{
+    include_store_t *store = item->store;
+    pthread_mutex_lock(&store->lock);
+    int last = --item->refs == 0;
+    pthread_mutex_unlock(&store->lock);
+    if (last) stored_free(item);
+}
+
+/* Link pointing at the item for (dev, ino), or at the end of its chain (lock held). */
+static include_stored_t **store_find(include_store_t *store, unsigned long long dev,
+                                     unsigned long long ino)
+{
+    unsigned long long mask = (unsigned long long)(store->bucket_count - 1);
+    include_stored_t **link = &store->buckets[key_hash(dev, ino) & mask];
+    while (*link && ((*link)->entry.dev != dev || (*link)->entry.ino != ino)) link = &(*link)->next;
+    return link;
+}
+
+/* Keep chains short: double the buckets past two items per bucket (lock held). */
+static void store_grow(include_store_t *store)
+{
+    if (store->count < store->bucket_count * 2) return;
+
+    include_stored_t **old = store->buckets;
+    int old_count = store->bucket_count;
+    include_stored_t **buckets = calloc((size_t)old_count * 2, sizeof(include_stored_t *));
+    if (!buckets) return;
+    store->buckets = buckets;
+    store->bucket_count = old_count * 2;
+    for (int b = 0; b < old_count; b++) {
+        for (include_stored_t *item = old[b], *next; item; item = next) {
+            next = item->next;
+            include_stored_t **link = store_find(store, item->entry.dev, item->entry.ino);
+            item->next = NULL;
+            *link = item;
+        }
+    }
+    free(old);
+}
+
+static int stamp_equal(const include_stored_t *item, const file_stamp_t *stamp)
+{
+    return item->size == stamp->size && item->mtime_sec == stamp->mtime_sec &&
+           item->mtime_nsec == stamp->mtime_nsec;
+}
+
+/* Stored copy of path with the given stamp, with a reference for the caller.
+ * A missing or changed file is read (outside the lock) and replaces the old
+ * item; one modified this very second is not kept, as it may change again
+ * without its mtime moving. *hit tells whether nothing was read. */
+static include_stored_t *store_get(include_store_t *store, const char *path,
+                                   unsigned long long dev, unsigned long long ino,
+                                   const file_stamp_t *stamp, int *hit)
+{
+    pthread_mutex_lock(&store->lock);
+    include_stored_t *found = *store_find(store, dev, ino);
+    *hit = found && stamp_equal(found, stamp);
+    if (*hit) {
+        found->refs++;
+        store->hits++;
+    }
+    pthread_mutex_unlock(&store->lock);
+    if (*hit) return found;
+
+    include_stored_t *item = calloc(1, sizeof(include_stored_t));
+    if (!item) return NULL;
+    if (entry_fill(&item->entry, path, dev, ino, 1) != 0) {
+        stored_free(item);
+        return NULL;
+    }
+    item->size = stamp->size;
+    item->mtime_sec = stamp->mtime_sec;
+    item->mtime_nsec = stamp->mtime_nsec;
+    item->store = store;
+    item->refs = 1;
+    int keep = stamp->mtime_sec < (long long)time(NULL);
+
+    include_stored_t *stale = NULL;
+    pthread_mutex_lock(&store->lock);
+    store->loads++;
+    include_stored_t **link = store_find(store, dev, ino);
+    if (*link && stamp_equal(*link, stamp)) {
+        // Another run stored the same file meanwhile
+        found = *link;
+        found->refs++;
+        pthread_mutex_unlock(&store->lock);
+        stored_free(item);
+        return found;
+    }
+    if (*link) {
+        stale = *link;
+        *link = stale->next;
+        store->count--;
+        store->stale++;
+        if (--stale->refs > 0) stale = NULL;
+    }
+    if (keep) {
+        item->next = *link;
+        *link = item;
+        item->refs++;
+        store->count++;
+        store_grow(store);
+    }
+    pthread_mutex_unlock(&store->lock);
+    if (stale) stored_free(stale);
+    return item;
+}
+
+/* New entry for path borrowing the store's copy of the file (NULL on failure). */
+static include_entry_t *entry_borrow(include_cache_t *cache, const char *path,
+                                     unsigned long long dev, unsigned long long ino,
+                                     const file_stamp_t *stamp)
+{
+    include_entry_t *e = calloc(1, sizeof(include_entry_t));
+    if (!e) return NULL;
+    int hit;
+    include_stored_t *item = store_get(cache->store, path, dev, ino, stamp, &hit);
+    if (!item) {
+        free(e);
+        return NULL;
+    }
+    if (hit) cache->store_hits++;
+
+    // The path is the one of this inclusion: the stored file may have been
+    // reached through another name
+    *e = item->entry;
+    e->stored = item;
+    e->path = strdup(path);
+    char base_dir[PP_MAX_PATH_LEN];
+    io_compute_base_dir(path, base_dir, sizeof(base_dir));
+    e->base_dir = strdup(base_dir);
+    if (!e->path || !e->base_dir) {
+        error(0, "Out of memory while caching file: %s", path);
+        entry_free(e);
+        return NULL;
+    }
+    return e;
+}
+
+int include_store_init(include_store_t *store)
+{
+    memset(store, 0, sizeof(*store));
+    store->bucket_count = STORE_BUCKETS;
+    store->buckets = calloc((size_t)store->bucket_count, sizeof(include_stored_t *));
+    if (!store->buckets) return 1;
+    pthread_mutex_init(&store->lock, NULL);
+    return 0;
+}
+
+void include_store_free(include_store_t *store)
+{
+    for (int b = 0; b < store->bucket_count; b++) {
+        for (include_stored_t *item = store->buckets[b], *next; item; item = next) {
+            next = item->next;
+            if (--item->refs == 0) stored_free(item);
+        }
+    }
+    free(store->buckets);
+    store->buckets = NULL;
+    store->bucket_count = store->count = 0;
+    pthread_mutex_destroy(&store->lock);
+}
+
+/* ---- Per-run cache ----------------------------------------------------------- */
+
+void include_cache_init(include_cache_t *cache)
+{
+    cache->count = 0;
+    cache->capacity = INITIAL_ENTRIES;
+    cache->entries = malloc(sizeof(include_entry_t *) * (size_t)cache->capacity);
+    cache->slot_capacity = INITIAL_SLOTS;
+    cache->slots = malloc(sizeof(int) * (size_t)cache->slot_capacity);
+    if (cache->slots) {
+        for (int i = 0; i < cache->slot_capacity; i++) cache->slots[i] = EMPTY_SLOT;
+    }
+    cache->hits = 0;
+    cache->misses = 0;
+    cache->guard_skips = 0;
+    cache->store = NULL;
+    cache->store_hits = 0;
+}
+
+include_entry_t *include_cache_get(include_cache_t *cache, const char *path)
+{
+    if (!cache || !cache->entries || !cache->slots || !path) return NULL;
+
+    unsigned long long dev, ino;
+    file_stamp_t stamp;
+    if (file_key(path, &dev, &ino, &stamp) != 0) {
+        error(0, "Cannot open file: %s", path);
+        return NULL;
+    }
+
+    int slot = find_slot(cache, dev, ino);
+    if (cache->slots[slot] != EMPTY_SLOT) {
+        cache->hits++;
+        return cache->entries[cache->slots[slot]];
+    }
+
+    cache->misses++;
+    include_entry_t *e = cache->store ? entry_borrow(cache, path, dev, ino, &stamp)
+                                      : entry_load(path, dev, ino);
+    if (!e) return NULL;
+
+    if (grow_entries(cache) != 0 || grow_slots(cache) != 0) {
+        error(0, "Out of memory while caching file: %s", path);
+        entry_free(e);
+        return NULL;
+    }
+    cache->entries[cache->count] = e;
+    cache->slots[find_slot(cache, dev, ino)] = cache->count;
+    cache->count++;
+    return e;
+}
+
+void include_cache_free(include_cache_t *cache)
+{
+    if (!cache) return;
+
+    for (int i = 0; i < cache->count; i++) entry_free(cache->entries[i]);
+    free(cache->entries);
+    free(cache->slots);
+    cache->entries = NULL;
+    cache->slots = NULL;
+    cache->count = 0;
+    cache->capacity = 0;
+    cache->slot_capacity = 0;
+}
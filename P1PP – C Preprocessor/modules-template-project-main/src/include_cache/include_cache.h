@@ -0,0 +1,113 @@
+/*
+ * -----------------------------------------------------------------------------
+ * include_cache.h
+ *
+ * Module: include_cache - Per-run cache of #include targets
+ * Responsible for: Loading each included file once per run, keyed by its
+ *                  canonical identity (device + inode), together with a line
+ *                  index so repeated includes skip disk I/O and newline scans.
+ *                  On first load the file is also checked for the include-guard
+ *                  pattern (#ifndef X ... #endif around everything) and for
+ *                  #pragma once, so later inclusions can be skipped in O(1).
+ *                  An include_store_t keeps loaded files (with their index
+ *                  and guard) across runs for a long-lived process (-serve):
+ *                  a run's cache borrows them while their size and mtime
+ *                  are unchanged.
+ *
+ * -----------------------------------------------------------------------------
+ */
+
+#ifndef INCLUDE_CACHE_H
+#define INCLUDE_CACHE_H
+
+#include <pthread.h>
+
+#include "buffer/buffer.h"
+
+/* A file kept by an include_store_t. */
+typedef struct include_stored include_stored_t;
+
+/* One cached file. Entries are heap-allocated so pointers stay valid. */
+typedef struct {
+    /* Canonical identity of the file. */
+    unsigned long long dev;
+    unsigned long long ino;
+    /* Path used when the file was first resolved. */
+    char *path;
+    /* Directory of path, used to resolve nested includes. */
+    char *base_dir;
+    /* File contents (mapped or heap). */
+    buffer_t bytes;
+    /* Offset of each line start; line_starts[line_count] == bytes.len. */
+    long *line_starts;
+    int line_count;
+    /* Non-zero if some line's first non-blank character is '#' (files
+     * without one cannot have a guard and skip its detection). */
+    int has_directives;
+    /* Guard macro if the whole file is wrapped in #ifndef guard ... #endif. */
+    char *guard;
+    int guard_len;
+    /* Non-zero if the file contains a top-level #pragma once. */
+    int once;
+    /* Number of times the file has been processed in this run. */
+    int include_count;
+    /* Innermost include frame of pp_core processing the file (-1 if none),
+     * so finding an entry also tells whether it is open. */
+    int active_frame;
+    /* Stored file whose bytes, indexes and guard this entry borrows (NULL:
+     * they are owned by the entry). */
+    include_stored_t *stored;
+} include_entry_t;
+
+/* Files shared by the runs of a process, keyed by (dev, ino). Thread-safe;
+ * an item replaced while runs still borrow it is freed after the last one. */
+typedef struct {
+    pthread_mutex_t lock;
+    /* Hash chains. */
+    include_stored_t **buckets;
+    int bucket_count;
+    int count;
+    /* Statistics: files served without reading them, files (re)read, and
+     * items dropped because the file changed. */
+    long hits;
+    long loads;
+    long stale;
+} include_store_t;
+
+/* Cache of included files, keyed by (dev, ino). */
+typedef struct {
+    /* Entries in first-inclusion order. */
+    include_entry_t **entries;
+    int count;
+    int capacity;
+    /* Open-addressing index into entries (-1 marks an empty slot). */
+    int *slots;
+    int slot_capacity;
+    /* Lookup statistics (kept across include_cache_free). */
+    long hits;
+    long misses;
+    /* Inclusions skipped by the multiple-include optimization. */
+    long guard_skips;
+    /* Store consulted before reading a file (NULL: none), and the misses
+     * it served. */
+    include_store_t *store;
+    long store_hits;
+} include_cache_t;
+
+/* Initialize an empty cache without a store (statistics are reset). */
+void include_cache_init(include_cache_t *cache);
+
+/* Return the entry for path, loading and indexing the file on first use.
+ * Returns NULL (after reporting an error) if the file cannot be read. */
+include_entry_t *include_cache_get(include_cache_t *cache, const char *path);
+
+/* Release every cached entry (statistics are kept). */
+void include_cache_free(include_cache_t *cache);
+
+/* Initialize an empty store. Returns 0, or 1 if out of memory. */
+int include_store_init(include_store_t *store);
+
+/* Release every item (no cache may borrow from the store any more). */
+void include_store_free(include_store_t *store);
+
+#endif // INCLUDE_CACHE_H
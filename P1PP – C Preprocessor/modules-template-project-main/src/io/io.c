@@ -3,6 +3,7 @@
  * 
  * Input/output file operations
  *  Reads a specified file into a buffer and writes a buffer to a new file that ends in _pp.
+ *  io_map_file maps inputs read-only instead of copying them.
  * 
  * author: Emil Svensson
  */
@@ -10,6 +11,12 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
 #include "io.h"
 #include "buffer/buffer.h"
@@ -45,6 +52,45 @@ int io_read_file(const char *path, buffer_t *out)
     return 0;
 }
 
+// Maps a file read-only and hands it back as a BUFFER_KIND_MAPPED view (no copy)
+// out must be a freshly initialized buffer; buffer_free releases the mapping.
+// Empty files, non-regular files and platforms without mmap fall back to io_read_file.
+// Returns 0 on success, 1 if file cannot be opened, 2 if the fallback read fails
+int io_map_file(const char *path, buffer_t *out)
+{
+#ifdef _WIN32
+    return io_read_file(path, out);
+#else
+    int fd = path ? open(path, O_RDONLY) : -1;
+    if (fd < 0) {
+        const char *p = path ? path : "(null)";
+        error(0, "Cannot open file: %s", p);
+        return 1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0) {
+        close(fd);
+        return io_read_file(path, out);
+    }
+
+    size_t size = (size_t)st.st_size;
+    void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return io_read_file(path, out);
+
+    // Input is consumed front to back exactly once
+    madvise(map, size, MADV_SEQUENTIAL);
+
+    buffer_free(out);
+    out->data = (char *)map;
+    out->len = (long)size;
+    out->cap = (long)size;
+    out->kind = BUFFER_KIND_MAPPED;
+    return 0;
+#endif
+}
+
 // Writes the contents of a buffer to a file
 // Returns 0 on success, 1 if file cannot be opened
 int io_write_file(const char *path, const buffer_t *in)
@@ -1,26 +1,244 @@
 #include "macros.h"
+#include "../scan/scan.h"
 #include <stdlib.h>
 #include <string.h>
-#include <ctype.h>
 
 #define INITIAL_CAPACITY 8
+/* Arena block size for interned names and values */
+#define STRING_BLOCK_SIZE 16384
+/* Grow when more than 1/LOAD_FACTOR_DIV of the slots would be occupied */
+#define LOAD_FACTOR_DIV 2
+/* FNV-1a 32-bit parameters */
+#define HASH_OFFSET 2166136261u
+#define HASH_PRIME 16777619u
+
+/* -------------------------------------------------- */
+static unsigned int hash_name(const char *name, int name_len)
+{
+    unsigned int h = HASH_OFFSET;
+    for (int i = 0; i < name_len; i++) {
+        h ^= (unsigned char)name[i];
+        h *= HASH_PRIME;
+    }
+    return h;
+}
+
+/* -------------------------------------------------- */
+/* Prefilter bits of a name: mixes the bytes that differ most between names
+ * (first, second, last) with the length, so no loop over the name */
+static void bloom_bits(const char *name, int name_len, unsigned int *b1, unsigned int *b2)
+{
+    unsigned int h = (unsigned char)name[0] |
+                     (unsigned int)(unsigned char)name[name_len > 1] << 8 |
+                     (unsigned int)(unsigned char)name[name_len - 1] << 16 |
+                     (unsigned int)name_len << 24;
+    h *= 0x9e3779b1u;
+    *b1 = h >> 20;
+    *b2 = (h >> 8) & (MACROS_BLOOM_BITS - 1);
+}
+
+static void bloom_add(macro_table_t *table, const char *name, int name_len)
+{
+    unsigned int b1, b2;
+    bloom_bits(name, name_len, &b1, &b2);
+    table->bloom[b1 >> 6] |= (uint64_t)1 << (b1 & 63);
+    table->bloom[b2 >> 6] |= (uint64_t)1 << (b2 & 63);
+}
+
+static int bloom_may_contain(const macro_table_t *table, const char *name, int name_len)
+{
+    unsigned int b1, b2;
+    bloom_bits(name, name_len, &b1, &b2);
+    return (table->bloom[b1 >> 6] >> (b1 & 63) & 1) &&
+           (table->bloom[b2 >> 6] >> (b2 & 63) & 1);
+}
+
+/* -------------------------------------------------- */
+/* Return the slot holding name, or the empty slot where it would go */
+static int find_slot(const macro_t *items, int capacity,
+                     const char *name, int name_len, unsigned int hash)
+{
+    int mask = capacity - 1;
+    int i = (int)(hash & (unsigned int)mask);
+
+    while (items[i].name) {
+        if (items[i].hash == hash &&
+            items[i].name_len == name_len &&
+            memcmp(items[i].name, name, (size_t)name_len) == 0) {
+            return i;
+        }
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+/* -------------------------------------------------- */
+/* Return the slot holding the string, or the empty slot where it would go */
+static int find_string_slot(const macro_string_t *strings, int capacity,
+                            const char *str, int len, unsigned int hash)
+{
+    int mask = capacity - 1;
+    int i = (int)(hash & (unsigned int)mask);
+
+    while (strings[i].str) {
+        if (strings[i].hash == hash &&
+            strings[i].len == len &&
+            memcmp(strings[i].str, str, (size_t)len) == 0) {
+            return i;
+        }
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+/* -------------------------------------------------- */
+static int ensure_string_capacity(macro_table_t *table)
+{
+    if ((table->string_count + 1) * LOAD_FACTOR_DIV <= table->string_capacity) return 0;
+
+    int new_capacity = table->string_capacity ? table->string_capacity * 2 : INITIAL_CAPACITY;
+    macro_string_t *new_strings = calloc((size_t)new_capacity, sizeof(macro_string_t));
+    if (!new_strings) return 1;
+
+    for (int i = 0; i < table->string_capacity; i++) {
+        const macro_string_t *s = &table->strings[i];
+        if (!s->str) continue;
+        int j = find_string_slot(new_strings, new_capacity, s->str, s->len, s->hash);
+        new_strings[j] = *s;
+    }
+
+    free(table->strings);
+    table->strings = new_strings;
+    table->string_capacity = new_capacity;
+    return 0;
+}
+
+/* -------------------------------------------------- */
+/* Return the stored copy of str (NUL-terminated), storing it on first use.
+ * Strings of parent tables are reused; new ones are copied into the arena,
+ * or referenced in place when str is NUL-terminated at len and outlives the
+ * table (in_place) */
+static const char *intern_string(macro_table_t *table, const char *str, int len, int in_place)
+{
+    unsigned int hash = hash_name(str, len);
+    for (const macro_table_t *t = table; t; t = t->parent) {
+        if (!t->strings) continue;
+        int i = find_string_slot(t->strings, t->string_capacity, str, len, hash);
+        if (t->strings[i].str) {
+            table->intern_hits++;
+            return t->strings[i].str;
+        }
+    }
+
+    if (ensure_string_capacity(table) != 0) return NULL;
+    const char *copy = str;
+    if (!in_place) {
+        char *p = arena_alloc(&table->arena, (size_t)len + 1);
+        if (!p) return NULL;
+        memcpy(p, str, (size_t)len);
+        p[len] = '\0';
+        copy = p;
+    }
+
+    int i = find_string_slot(table->strings, table->string_capacity, str, len, hash);
+    table->strings[i].str = copy;
+    table->strings[i].len = len;
+    table->strings[i].hash = hash;
+    table->string_count++;
+    table->interned++;
+    return copy;
+}
+
+static const char *intern(macro_table_t *table, const char *str, int len)
+{
+    return intern_string(table, str, len, 0);
+}
+
+/* -------------------------------------------------- */
+static macro_t *find_macro(const macro_table_t *table,
+                           const char *name,
+                           int name_len)
+{
+    if (!table || !table->items || !name || name_len <= 0) return NULL;
+
+    /* A fork's own definitions shadow its parents' */
+    unsigned int hash = hash_name(name, name_len);
+    for (const macro_table_t *t = table; t; t = t->parent) {
+        int i = find_slot(t->items, t->capacity, name, name_len, hash);
+        if (t->items[i].name) return &t->items[i];
+    }
+    return NULL;
+}
 
 /* -------------------------------------------------- */
 void macros_init(macro_table_t *table)
 {
     table->size = 0;
     table->capacity = INITIAL_CAPACITY;
-    table->items = malloc(sizeof(macro_t) * table->capacity);
+    table->items = calloc((size_t)table->capacity, sizeof(macro_t));
+    table->strings = NULL;
+    table->string_count = 0;
+    table->string_capacity = 0;
+    arena_init(&table->arena, STRING_BLOCK_SIZE);
+    memset(table->bloom, 0, sizeof(table->bloom));
+    arena_init(&table->scratch, STRING_BLOCK_SIZE);
+    table->interned = 0;
+    table->intern_hits = 0;
+    table->prefilter_checked = 0;
+    table->prefilter_rejected = 0;
+    table->lines_expanded = 0;
+    table->lines_copied = 0;
+    table->generation = 0;
+    table->next_serial = 1;
+    table->deps = NULL;
+    table->dep_count = 0;
+    table->dep_capacity = 0;
+    table->paint = NULL;
+    table->paint_count = 0;
+    table->paint_capacity = 0;
+    table->memo_hits = 0;
+    table->memo_misses = 0;
+    table->memo_invalidated = 0;
+    table->invocations = 0;
+    table->invocations_direct = 0;
+    table->defined = 0;
+    table->parent_memos_kept = 0;
+    table->parent = NULL;
+    table->parent_memos = NULL;
+    table->parent_memo_count = 0;
+    table->parent_memo_capacity = 0;
+}
+
+/* -------------------------------------------------- */
+void macros_fork(macro_table_t *table, const macro_table_t *parent)
+{
+    macros_init(table);
+    table->parent = parent;
+    /* The prefilter must pass the parent's names too */
+    memcpy(table->bloom, parent->bloom, sizeof(table->bloom));
 }
 
 /* -------------------------------------------------- */
-static void ensure_capacity(macro_table_t *table)
+static int ensure_capacity(macro_table_t *table)
 {
-    if (table->size < table->capacity) return;
+    if ((table->size + 1) * LOAD_FACTOR_DIV <= table->capacity) return 0;
 
-    table->capacity *= 2;
-    table->items = realloc(table->items,
-                            sizeof(macro_t) * table->capacity);
+    int new_capacity = table->capacity * 2;
+    macro_t *new_items = calloc((size_t)new_capacity, sizeof(macro_t));
+    if (!new_items) return 1;
+
+    /* Rehash using the stored hashes: names are never re-read */
+    for (int i = 0; i < table->capacity; i++) {
+        const macro_t *m = &table->items[i];
+        if (!m->name) continue;
+        int j = find_slot(new_items, new_capacity, m->name, m->name_len, m->hash);
+        new_items[j] = *m;
+    }
+
+    free(table->items);
+    table->items = new_items;
+    table->capacity = new_capacity;
+    return 0;
 }
 
 /* -------------------------------------------------- */
@@ -28,89 +246,1090 @@ int macros_define(macro_table_t *table,
                   const char *name,
                   const char *value)
 {
-    if (!table || !name || !value) return 1;
+    if (!name || !value) return 1;
+    return macros_define_n(table, name, (int)strlen(name), value, (int)strlen(value));
+}
+
+/* -------------------------------------------------- */
+/* Store name -> value (already interned), replacing an existing definition */
+static int define_entry(macro_table_t *table, const char *name, int name_len,
+                        const char *value, int value_len, macro_template_t *tmpl, int in_place)
+{
+    unsigned int hash = hash_name(name, name_len);
+    /* Every memo has to re-check its dependencies */
+    table->generation++;
+    table->defined++;
+
+    /* Redefinition: replace the value in place (the old one stays interned) */
+    int i = find_slot(table->items, table->capacity, name, name_len, hash);
+    if (table->items[i].name) {
+        free(table->items[i].memo);
+        table->items[i].memo = NULL;
+        table->items[i].value = value;
+        table->items[i].value_len = value_len;
+        table->items[i].tmpl = tmpl;
+        return 0;
+    }
+
+    if (ensure_capacity(table) != 0) return 1;
+    i = find_slot(table->items, table->capacity, name, name_len, hash);
 
-    ensure_capacity(table);
+    const char *name_copy = intern_string(table, name, name_len, in_place);
+    if (!name_copy) return 1;
 
-    table->items[table->size].name = strdup(name);
-    table->items[table->size].value = strdup(value);
+    macro_t *m = &table->items[i];
+    m->name = name_copy;
+    m->value = value;
+    m->name_len = name_len;
+    m->value_len = value_len;
+    m->hash = hash;
+    m->memo = NULL;
+    m->tmpl = tmpl;
     table->size++;
+    bloom_add(table, name_copy, name_len);
 
     return 0;
 }
 
+/* -------------------------------------------------- */
+int macros_define_n(macro_table_t *table,
+                    const char *name, int name_len,
+                    const char *value, int value_len)
+{
+    if (!table || !table->items || !name || !value) return 1;
+    if (name_len <= 0 || value_len < 0) return 1;
+
+    const char *value_copy = intern(table, value, value_len);
+    if (!value_copy) return 1;
+    return define_entry(table, name, name_len, value_copy, value_len, NULL, 0);
+}
+
+/* -------------------------------------------------- */
+/* Next token of text[*pos..len), following the tokens module's rules
+ * (identifiers, digit runs, "strings", one-char symbols; a newline ends the
+ * text) without needing a terminator. Returns END when there is none. */
+static Token_type next_token(const char *text, long len, long *pos, long *start, int *tok_len)
+{
+    long i = *pos;
+    while (i < len && (text[i] == ' ' || text[i] == '\t')) i++;
+    if (i >= len || text[i] == '\n' || text[i] == '\0') {
+        *pos = i;
+        return END;
+    }
+
+    *start = i;
+    unsigned char c = (unsigned char)text[i++];
+    unsigned char cls = tokens_char_class[c];
+    Token_type type = SYMBOL;
+    if (cls & TK_IDENT_START) {
+        i = scan_find_non_ident(text + i, text + len) - text;
+        type = IDENTIFIER;
+    } else if (cls & TK_DIGIT) {
+        while (i < len && TK_IS(text[i], TK_DIGIT)) i++;
+        type = NUMBER;
+    } else if (c == '"') {
+        while (i < len && text[i] != '"' && text[i] != '\0') i++;
+        if (i < len && text[i] == '"') i++;
+        type = STRING;
+    }
+    *tok_len = (int)(i - *start);
+    *pos = i;
+    return type;
+}
+
+/* -------------------------------------------------- */
+static long skip_blanks(const char *text, long len, long i)
+{
+    while (i < len && (text[i] == ' ' || text[i] == '\t')) i++;
+    return i;
+}
+
+/* -------------------------------------------------- */
+/* Growable list of template items while a definition is parsed */
+typedef struct {
+    macro_item_t *items;
+    int count;
+    int capacity;
+} item_list_t;
+
+static int add_item(item_list_t *list, macro_item_kind_t kind, int param,
+                    const char *text, int len)
+{
+    if (kind == MACRO_ITEM_TEXT && len <= 0) return 0;
+    if (list->count == list->capacity) {
+        int new_capacity = list->capacity ? list->capacity * 2 : INITIAL_CAPACITY;
+        macro_item_t *items = realloc(list->items, (size_t)new_capacity * sizeof(macro_item_t));
+        if (!items) return 1;
+        list->items = items;
+        list->capacity = new_capacity;
+    }
+    macro_item_t *it = &list->items[list->count++];
+    it->kind = kind;
+    it->param = param;
+    it->text = text;
+    it->len = len;
+    return 0;
+}
+
+/* Parameter slot named by text, or -1 */
+static int param_index(const char *params, const int *offsets, const int *lengths, int count,
+                       int variadic, const char *text, int len)
+{
+    for (int i = 0; i < count; i++) {
+        if (lengths[i] == len && memcmp(params + offsets[i], text, (size_t)len) == 0) return i;
+    }
+    if (variadic && len == 11 && memcmp(text, "__VA_ARGS__", 11) == 0) return count;
+    return -1;
+}
+
+/* -------------------------------------------------- */
+/* Split "(params) body" into parameters and a template of text / argument
+ * items. def is the interned definition, so items can point into it. */
+static int parse_template(macro_table_t *table, const char *def, int def_len,
+                          macro_template_t **out)
+{
+    /* Parameters: identifiers separated by commas, optionally ending in ... */
+    int cap = 1;
+    for (int i = 0; i < def_len && def[i] != ')'; i++) cap += def[i] == ',';
+    int *offsets = malloc((size_t)cap * sizeof(int));
+    int *lengths = malloc((size_t)cap * sizeof(int));
+    item_list_t list = { NULL, 0, 0 };
+    int rc = MACROS_ERR_MEMORY;
+    if (!offsets || !lengths) goto done;
+
+    rc = MACROS_ERR_SYNTAX;
+    int count = 0, variadic = 0;
+    long i = skip_blanks(def, def_len, 1);
+    if (i < def_len && def[i] == ')') {
+        i++;
+    } else {
+        for (;;) {
+            i = skip_blanks(def, def_len, i);
+            if (i + 2 < def_len && memcmp(def + i, "...", 3) == 0) {
+                variadic = 1;
+                i = skip_blanks(def, def_len, i + 3);
+                if (i >= def_len || def[i] != ')') goto done;
+                i++;
+                break;
+            }
+            long start = i;
+            if (i >= def_len || !TK_IS(def[i], TK_IDENT_START)) goto done;
+            while (i < def_len && TK_IS(def[i], TK_IDENT)) i++;
+            if (param_index(def, offsets, lengths, count, 0, def + start, (int)(i - start)) >= 0) {
+                goto done;  /* duplicate parameter */
+            }
+            offsets[count] = (int)start;
+            lengths[count] = (int)(i - start);
+            count++;
+            i = skip_blanks(def, def_len, i);
+            if (i < def_len && def[i] == ',') { i++; continue; }
+            if (i < def_len && def[i] == ')') { i++; break; }
+            goto done;
+        }
+    }
+
+    /* Body: literal text between parameter uses, # and ## resolved now */
+    const char *body = def + i;
+    long body_len = def_len - i;
+    long pos = 0, lit = skip_blanks(body, body_len, 0);
+    long start;
+    int tok_len, rescan = 0, paste_next = 0;
+    Token_type type;
+    while ((type = next_token(body, body_len, &pos, &start, &tok_len)) != END) {
+        if (type == SYMBOL && body[start] == '\'') {
+            /* Character literal: nothing inside is a parameter or operator */
+            while (pos < body_len && body[pos] != '\'') pos += body[pos] == '\\' ? 2 : 1;
+            if (pos < body_len) pos++;
+            paste_next = 0;
+            continue;
+        }
+        int is_hash = type == SYMBOL && body[start] == '#';
+        if (is_hash && pos < body_len && body[pos] == '#') {
+            /* a ## b: drop the operator and the blanks around it; operands
+             * are used as written and the joined text is rescanned */
+            long end = start;
+            while (end > lit && (body[end - 1] == ' ' || body[end - 1] == '\t')) end--;
+            if (end == lit && list.count == 0) goto done;
+            if (add_item(&list, MACRO_ITEM_TEXT, -1, body + lit, (int)(end - lit)) != 0) goto oom;
+            macro_item_t *last = &list.items[list.count - 1];
+            if (last->kind == MACRO_ITEM_ARG) last->kind = MACRO_ITEM_ARG_RAW;
+            pos = lit = skip_blanks(body, body_len, pos + 1);
+            if (lit >= body_len) goto done;
+            paste_next = 1;
+            rescan = 1;
+            continue;
+        }
+        if (is_hash) {
+            /* #param: the argument as a string literal */
+            long after = pos;
+            long name_start;
+            int name_len;
+            int slot = -1;
+            if (next_token(body, body_len, &after, &name_start, &name_len) == IDENTIFIER) {
+                slot = param_index(def, offsets, lengths, count, variadic, body + name_start, name_len);
+            }
+            if (slot < 0) goto done;
+            if (add_item(&list, MACRO_ITEM_TEXT, -1, body + lit, (int)(start - lit)) != 0 ||
+                add_item(&list, MACRO_ITEM_STRINGIFY, slot, NULL, 0) != 0) goto oom;
+            pos = lit = after;
+            paste_next = 0;
+            continue;
+        }
+        if (type == IDENTIFIER) {
+            int slot = param_index(def, offsets, lengths, count, variadic, body + start, tok_len);
+            if (slot >= 0) {
+                if (add_item(&list, MACRO_ITEM_TEXT, -1, body + lit, (int)(start - lit)) != 0 ||
+                    add_item(&list, paste_next ? MACRO_ITEM_ARG_RAW : MACRO_ITEM_ARG,
+                             slot, NULL, 0) != 0) goto oom;
+                lit = pos;
+            } else {
+                rescan = 1;
+            }
+        }
+        paste_next = 0;
+    }
+    if (add_item(&list, MACRO_ITEM_TEXT, -1, body + lit, (int)(body_len - lit)) != 0) goto oom;
+
+    /* The template lives as long as the table, like the definition text */
+    macro_template_t *tmpl = arena_alloc(&table->arena, sizeof(macro_template_t) +
+                                         (size_t)list.count * sizeof(macro_item_t));
+    if (!tmpl) goto oom;
+    tmpl->param_count = count;
+    tmpl->variadic = variadic;
+    tmpl->rescan = rescan;
+    tmpl->item_count = list.count;
+    tmpl->items = (macro_item_t *)(tmpl + 1);
+    if (list.count) memcpy(tmpl->items, list.items, (size_t)list.count * sizeof(macro_item_t));
+    *out = tmpl;
+    rc = MACROS_OK;
+    goto done;
+
+oom:
+    rc = MACROS_ERR_MEMORY;
+done:
+    free(list.items);
+    free(offsets);
+    free(lengths);
+    return rc;
+}
+
+/* -------------------------------------------------- */
+int macros_define_function_n(macro_table_t *table,
+                             const char *name, int name_len,
+                             const char *definition, int definition_len)
+{
+    if (!table || !table->items || !name || !definition) return MACROS_ERR_MEMORY;
+    if (name_len <= 0 || definition_len <= 0 || definition[0] != '(') return MACROS_ERR_SYNTAX;
+
+    const char *def = intern(table, definition, definition_len);
+    if (!def) return MACROS_ERR_MEMORY;
+    macro_template_t *tmpl = NULL;
+    int rc = parse_template(table, def, definition_len, &tmpl);
+    if (rc != MACROS_OK) return rc;
+    return define_entry(table, name, name_len, def, definition_len, tmpl, 0) != 0
+               ? MACROS_ERR_MEMORY : MACROS_OK;
+}
+
+/* -------------------------------------------------- */
+int macros_define_in_place(macro_table_t *table,
+                           const char *name, int name_len,
+                           const char *value, int value_len,
+                           int function_like)
+{
+    if (!table || !table->items || !name || !value) return MACROS_ERR_MEMORY;
+    if (name_len <= 0 || value_len < 0 || name[name_len] != '\0' || value[value_len] != '\0') {
+        return MACROS_ERR_SYNTAX;
+    }
+
+    const char *stored = intern_string(table, value, value_len, 1);
+    if (!stored) return MACROS_ERR_MEMORY;
+    macro_template_t *tmpl = NULL;
+    if (function_like) {
+        if (value_len == 0 || stored[0] != '(') return MACROS_ERR_SYNTAX;
+        int rc = parse_template(table, stored, value_len, &tmpl);
+        if (rc != MACROS_OK) return rc;
+    }
+    return define_entry(table, name, name_len, stored, value_len, tmpl, 1) != 0
+               ? MACROS_ERR_MEMORY : MACROS_OK;
+}
+
 /* -------------------------------------------------- */
 int macros_is_defined(const macro_table_t *table,
                       const char *name,
                       int name_len)
 {
-    if (!table) return 0;
+    return find_macro(table, name, name_len) != NULL;
+}
+
+/* -------------------------------------------------- */
+const char *macros_get(const macro_table_t *table,
+                       const char *name,
+                       int name_len)
+{
+    const macro_t *m = find_macro(table, name, name_len);
+    return m && !m->tmpl ? m->value : NULL;
+}
+
+/* -------------------------------------------------- */
+/* Range of a rescanned text that came from an already expanded argument */
+typedef struct {
+    long start;
+    long end;
+} span_t;
+
+/* What is known about a text being rescanned: the ranges that came from
+ * expanded arguments, and the offsets of names painted in them */
+typedef struct {
+    const span_t *spans;
+    int span_count;
+    const long *painted;
+    int painted_count;
+} marks_t;
+
+/* Expansion in progress: the macros being expanded (the hide set) */
+typedef struct {
+    macro_table_t *table;
+    const macro_t *active[MACROS_MAX_DEPTH];
+    int depth;
+    int level;       /* nested scans, bounded like depth */
+    int recording;   /* object-like expansions being computed for a memo */
+    int hidden;      /* a name was left unexpanded because it is active */
+    long names_left; /* function-like names met without arguments */
+    long functions;  /* function-like names met (invoked or not) */
+    int rescanning;  /* function-like results being rescanned */
+    int error;       /* first MACROS_ERR_* met */
+    const token_list_t *tokens; /* tokens of the line, lexed by the caller (or NULL) */
+} expansion_t;
+
+/* -------------------------------------------------- */
+static void fail(expansion_t *ex, int code)
+{
+    if (!ex->error) ex->error = code;
+}
+
+static void emit(expansion_t *ex, buffer_t *out, const char *text, long len)
+{
+    if (len > 0 && buffer_append_n(out, text, len) != 0) fail(ex, MACROS_ERR_MEMORY);
+}
+
+static int is_active(const expansion_t *ex, const macro_t *m)
+{
+    for (int i = 0; i < ex->depth; i++) {
+        if (ex->active[i] == m) return 1;
+    }
+    return 0;
+}
+
+/* -------------------------------------------------- */
+static void paint(expansion_t *ex, const buffer_t *buf, long pos)
+{
+    macro_table_t *table = ex->table;
+    if (table->paint_count == table->paint_capacity) {
+        int new_capacity = table->paint_capacity ? table->paint_capacity * 2 : INITIAL_CAPACITY;
+        macro_paint_t *p = realloc(table->paint, (size_t)new_capacity * sizeof(macro_paint_t));
+        if (!p) {
+            fail(ex, MACROS_ERR_MEMORY);
+            return;
+        }
+        table->paint = p;
+        table->paint_capacity = new_capacity;
+    }
+    table->paint[table->paint_count].buf = buf;
+    table->paint[table->paint_count].pos = pos;
+    table->paint_count++;
+}
+
+static int is_painted(const expansion_t *ex, const buffer_t *buf, long pos)
+{
+    for (int i = 0; i < ex->table->paint_count; i++) {
+        if (ex->table->paint[i].buf == buf && ex->table->paint[i].pos == pos) return 1;
+    }
+    return 0;
+}
+
+/* Append an expanded argument, keeping its painted names painted */
+static void emit_arg(expansion_t *ex, buffer_t *out, const buffer_t *arg)
+{
+    long base = out->len;
+    int count = ex->table->paint_count;
+    emit(ex, out, arg->data, arg->len);
+    for (int i = 0; i < count; i++) {
+        if (ex->table->paint[i].buf == arg) paint(ex, out, base + ex->table->paint[i].pos);
+    }
+}
+
+/* -------------------------------------------------- */
+static macro_t *lookup(const macro_table_t *table, const char *name, int name_len)
+{
+    if (!bloom_may_contain(table, name, name_len)) return NULL;
+    return find_macro(table, name, name_len);
+}
+
+/* -------------------------------------------------- */
+/* Memos of the table's own macros live in their slots; those of a parent's
+ * macros in parent_memos (open addressing on the macro's address) */
+static int owns(const macro_table_t *table, const macro_t *m)
+{
+    return (uintptr_t)m - (uintptr_t)table->items < (uintptr_t)table->capacity * sizeof(macro_t);
+}
+
+static int find_memo_slot(const macro_memo_slot_t *slots, int capacity, const macro_t *m)
+{
+    int mask = capacity - 1;
+    int i = (int)(((uintptr_t)m / sizeof(macro_t)) * 0x9e3779b1u) & mask;
+    while (slots[i].macro && slots[i].macro != m) i = (i + 1) & mask;
+    return i;
+}
 
-    for (int i = 0; i < table->size; i++) {
-        if ((int)strlen(table->items[i].name) == name_len &&
-            strncmp(table->items[i].name, name, name_len) == 0) {
+static macro_memo_t *get_memo(const macro_table_t *table, const macro_t *m)
+{
+    if (owns(table, m)) return m->memo;
+    if (!table->parent_memos) return NULL;
+    return table->parent_memos[find_memo_slot(table->parent_memos,
+                                              table->parent_memo_capacity, m)].memo;
+}
+
+/* Replace m's memo (the old one is freed). Returns 1 if memo could not be
+ * kept (it is then freed too: the macro is simply expanded again). */
+static int set_memo(macro_table_t *table, macro_t *m, macro_memo_t *memo)
+{
+    if (owns(table, m)) {
+        free(m->memo);
+        m->memo = memo;
+        return 0;
+    }
+
+    if (!memo) {
+        if (table->parent_memos) {
+            macro_memo_slot_t *slot = &table->parent_memos[find_memo_slot(
+                table->parent_memos, table->parent_memo_capacity, m)];
+            free(slot->memo);
+            slot->memo = NULL;
+        }
+        return 0;
+    }
+    if ((table->parent_memo_count + 1) * LOAD_FACTOR_DIV > table->parent_memo_capacity) {
+        int new_capacity = table->parent_memo_capacity ? table->parent_memo_capacity * 2
+                                                       : INITIAL_CAPACITY;
+        macro_memo_slot_t *slots = calloc((size_t)new_capacity, sizeof(macro_memo_slot_t));
+        if (!slots) {
+            free(memo);
             return 1;
         }
+        for (int i = 0; i < table->parent_memo_capacity; i++) {
+            if (!table->parent_memos[i].macro) continue;
+            slots[find_memo_slot(slots, new_capacity, table->parent_memos[i].macro)] =
+                table->parent_memos[i];
+        }
+        free(table->parent_memos);
+        table->parent_memos = slots;
+        table->parent_memo_capacity = new_capacity;
+    }
+
+    macro_memo_slot_t *slot = &table->parent_memos[find_memo_slot(
+        table->parent_memos, table->parent_memo_capacity, m)];
+    if (!slot->macro) {
+        slot->macro = m;
+        table->parent_memo_count++;
+        table->parent_memos_kept++;
     }
+    free(slot->memo);
+    slot->memo = memo;
     return 0;
 }
 
 /* -------------------------------------------------- */
-const char *macros_get(const macro_table_t *table,
-                       const char *name,
-                       int name_len)
+static int push_dep(macro_table_t *table, const char *name, int name_len, const macro_t *m)
+{
+    if (table->dep_count == table->dep_capacity) {
+        int new_capacity = table->dep_capacity ? table->dep_capacity * 2 : INITIAL_CAPACITY;
+        macro_dep_t *deps = realloc(table->deps, (size_t)new_capacity * sizeof(macro_dep_t));
+        if (!deps) return 1;
+        table->deps = deps;
+        table->dep_capacity = new_capacity;
+    }
+    macro_dep_t *d = &table->deps[table->dep_count++];
+    d->name = name;
+    d->name_len = name_len;
+    d->value = m ? m->value : NULL;
+    const macro_memo_t *memo = m ? get_memo(table, m) : NULL;
+    d->serial = memo ? memo->serial : 0;
+    return 0;
+}
+
+/* -------------------------------------------------- */
+/* True if m's memo still holds; otherwise it is dropped.
+ * Memos only exist for expansions that never met an active name, so the
+ * dependency graph below a memo has no cycles. */
+static int memo_valid(macro_table_t *table, macro_t *m)
 {
-    if (!table) return NULL;
+    macro_memo_t *memo = get_memo(table, m);
+    if (!memo) return 0;
+    if (memo->generation == table->generation) return 1;
 
-    for (int i = 0; i < table->size; i++) {
-        if ((int)strlen(table->items[i].name) == name_len &&
-            strncmp(table->items[i].name, name, name_len) == 0) {
-            return table->items[i].value;
+    for (int i = 0; i < memo->dep_count; i++) {
+        const macro_dep_t *d = &memo->deps[i];
+        macro_t *cur = find_macro(table, d->name, d->name_len);
+        if ((cur ? cur->value : NULL) != d->value ||
+            (cur && (!memo_valid(table, cur) || get_memo(table, cur)->serial != d->serial))) {
+            set_memo(table, m, NULL);
+            table->memo_invalidated++;
+            return 0;
         }
     }
-    return NULL;
+    memo->generation = table->generation;
+    return 1;
 }
 
 /* -------------------------------------------------- */
-int macros_expand_line(const macro_table_t *table,
-                       const char *line,
-                       long line_len,
-                       buffer_t *output)
+/* Keep out[start..] (or the value itself when unchanged) as m's memo,
+ * depending on the identifiers recorded from dep_base on */
+static void memo_store(macro_table_t *table, macro_t *m, const buffer_t *out,
+                       long start, int unchanged, int dep_base, long names_left, int functions)
+{
+    int dep_count = table->dep_count - dep_base;
+    long text_len = out->len - start;
+    size_t size = sizeof(macro_memo_t) + (size_t)dep_count * sizeof(macro_dep_t);
+    if (!unchanged) size += (size_t)text_len + 1;
+
+    /* A memo bypassed inside a rescan is replaced */
+    set_memo(table, m, NULL);
+    macro_memo_t *memo = malloc(size);
+    if (!memo) return;  /* not fatal: the macro is expanded again next time */
+    memo->deps = (macro_dep_t *)(memo + 1);
+    if (dep_count > 0) {
+        memcpy(memo->deps, table->deps + dep_base, (size_t)dep_count * sizeof(macro_dep_t));
+    }
+    memo->dep_count = dep_count;
+    if (unchanged) {
+        memo->text = m->value;
+    } else {
+        char *text = (char *)(memo->deps + dep_count);
+        memcpy(text, out->data + start, (size_t)text_len);
+        text[text_len] = '\0';
+        memo->text = text;
+    }
+    memo->text_len = (int)text_len;
+    memo->serial = table->next_serial++;
+    memo->generation = table->generation;
+    memo->names_left = names_left;
+    memo->functions = functions;
+    set_memo(table, m, memo);
+}
+
+/* -------------------------------------------------- */
+/* Note that the expansion being memoized looked at name (m is its macro) */
+static void record_dep(expansion_t *ex, const char *name, int name_len, const macro_t *m)
 {
-    Tokenizer tk;
-    Token tok;
+    if (!ex->recording) return;
+    /* name may point into a temporary: keep the interned copy */
+    const char *stable = intern(ex->table, name, name_len);
+    if (!stable || push_dep(ex->table, stable, name_len, m) != 0) fail(ex, MACROS_ERR_MEMORY);
+}
 
-    tokens_init(&tk, 0, (char *)line);
+static int scan(expansion_t *ex, const char *text, long len,
+                const marks_t *marks, int top, buffer_t *out);
 
-    long last = 0;
-    while (tokenize(&tk, &tok)) {
-        long start = (long)(tok.word - line);
-        if (start > last) {
-            buffer_append_n(output, line + last, start - last);
+/* -------------------------------------------------- */
+/* Append the full expansion of object-like m, from its memo when valid */
+static void expand_object(expansion_t *ex, macro_t *m, buffer_t *out)
+{
+    macro_table_t *table = ex->table;
+    /* Expansions that met function-like macros read differently while one
+     * is rescanned (it is painted there): only reuse them outside */
+    if (memo_valid(table, m)) {
+        const macro_memo_t *memo = get_memo(table, m);
+        if (!(ex->rescanning && memo->functions)) {
+            table->memo_hits++;
+            ex->names_left += memo->names_left;
+            ex->functions += memo->functions;
+            emit(ex, out, memo->text, memo->text_len);
+            return;
         }
+    }
+    if (ex->depth >= MACROS_MAX_DEPTH) {
+        fail(ex, MACROS_ERR_DEPTH);
+        emit(ex, out, m->name, m->name_len);
+        return;
+    }
 
-        /* Never expand inside strings */
-        if (tok.type == STRING) {
-            buffer_append_n(output, tok.word, tok.length);
-        } else if (tok.type == IDENTIFIER) {
-            const char *val = macros_get(table, tok.word, tok.length);
-            if (val) {
-                buffer_append_n(output, val, (long)strlen(val));
-            } else {
-                buffer_append_n(output, tok.word, tok.length);
+    table->memo_misses++;
+    long start = out->len;
+    int dep_base = table->dep_count;
+    int outer_hidden = ex->hidden;
+    long names_before = ex->names_left;
+    long functions_before = ex->functions;
+    ex->hidden = 0;
+
+    ex->active[ex->depth++] = m;
+    ex->recording++;
+    int changed = scan(ex, m->value, m->value_len, NULL, 0, out);
+    ex->recording--;
+    ex->depth--;
+
+    /* Only context-free results can be reused */
+    if (!ex->hidden && !ex->error) {
+        memo_store(table, m, out, start, !changed, dep_base, ex->names_left - names_before,
+                   ex->functions != functions_before);
+    }
+    table->dep_count = dep_base;
+    ex->hidden |= outer_hidden;
+}
+
+/* -------------------------------------------------- */
+/* Argument of an invocation: a range of the text, blanks trimmed */
+typedef struct {
+    long start;
+    long end;
+} arg_t;
+
+/* Split the arguments of the invocation whose '(' is at text[open]. Returns
+ * the index after the closing ')', or -1 if it does not close in text. */
+static long split_args(expansion_t *ex, const char *text, long len, long open,
+                       arg_t **args, int *count)
+{
+    int n = 0;
+    arg_t *a = NULL;
+    /* Pass 0 counts the arguments, pass 1 records them */
+    for (int pass = 0; pass < 2; pass++) {
+        int depth = 0;
+        char quote = 0;
+        long arg_start = open + 1;
+        long close = -1;
+        n = 0;
+        for (long i = open; i < len && close < 0; i++) {
+            char c = text[i];
+            if (quote) {
+                if (c == '\\') i++;
+                else if (c == quote) quote = 0;
+                continue;
             }
-        } else {
-            buffer_append_n(output, tok.word, tok.length);
+            if (c == '"' || c == '\'') {
+                quote = c;
+            } else if (c == '(') {
+                depth++;
+            } else if ((c == ',' && depth == 1) || (c == ')' && --depth == 0)) {
+                if (a) {
+                    a[n].start = skip_blanks(text, i, arg_start);
+                    a[n].end = i;
+                    while (a[n].end > a[n].start &&
+                           (text[a[n].end - 1] == ' ' || text[a[n].end - 1] == '\t')) a[n].end--;
+                }
+                n++;
+                arg_start = i + 1;
+                if (c == ')') close = i;
+            } else if (c == '\n') {
+                break;
+            }
+        }
+        if (close < 0) return -1;
+        if (pass == 1) {
+            *args = a;
+            *count = n;
+            return close + 1;
+        }
+        a = arena_alloc(&ex->table->scratch, (size_t)n * sizeof(arg_t));
+        if (!a) {
+            fail(ex, MACROS_ERR_MEMORY);
+            return -1;
         }
+    }
+    return -1;
+}
+
+/* -------------------------------------------------- */
+/* The marks inside [start, end) of a text, shifted to be relative to start */
+static void slice_marks(expansion_t *ex, const marks_t *marks, long start, long end, marks_t *out)
+{
+    out->spans = NULL;
+    out->span_count = 0;
+    out->painted = NULL;
+    out->painted_count = 0;
+    if (!marks) return;
 
-        last = start + tok.length;
+    int n = 0, p = 0;
+    for (int i = 0; i < marks->span_count; i++) {
+        n += marks->spans[i].end > start && marks->spans[i].start < end;
+    }
+    for (int i = 0; i < marks->painted_count; i++) {
+        p += marks->painted[i] >= start && marks->painted[i] < end;
+    }
+    span_t *s = n ? arena_alloc(&ex->table->scratch, (size_t)n * sizeof(span_t)) : NULL;
+    long *q = p ? arena_alloc(&ex->table->scratch, (size_t)p * sizeof(long)) : NULL;
+    if ((n && !s) || (p && !q)) {
+        fail(ex, MACROS_ERR_MEMORY);
+        return;
     }
 
-    if (line_len > last) {
-        buffer_append_n(output, line + last, line_len - last);
+    n = 0;
+    for (int i = 0; i < marks->span_count; i++) {
+        const span_t *sp = &marks->spans[i];
+        if (sp->end <= start || sp->start >= end) continue;
+        s[n].start = (sp->start > start ? sp->start : start) - start;
+        s[n].end = (sp->end < end ? sp->end : end) - start;
+        n++;
+    }
+    p = 0;
+    for (int i = 0; i < marks->painted_count; i++) {
+        if (marks->painted[i] >= start && marks->painted[i] < end) q[p++] = marks->painted[i] - start;
     }
+    out->spans = s;
+    out->span_count = n;
+    out->painted = q;
+    out->painted_count = p;
+}
 
-    return 0;
+/* -------------------------------------------------- */
+/* Append text as a string literal (#param): blank runs become one space,
+ * quotes and backslashes inside literals are escaped */
+static void stringify(expansion_t *ex, buffer_t *out, const char *text, long len)
+{
+    char quote = 0;
+    int blank = 0;
+    emit(ex, out, "\"", 1);
+    for (long i = 0; i < len; i++) {
+        char c = text[i];
+        if (!quote && (c == ' ' || c == '\t')) {
+            blank = 1;
+            continue;
+        }
+        if (blank) emit(ex, out, " ", 1);
+        blank = 0;
+        if (quote && c == '\\' && i + 1 < len) {
+            emit(ex, out, "\\\\", 2);
+            c = text[++i];
+        } else if (quote && c == quote) {
+            quote = 0;
+        } else if (!quote && (c == '"' || c == '\'')) {
+            quote = c;
+        }
+        if (c == '"' || (c == '\\' && quote)) emit(ex, out, "\\", 1);
+        emit(ex, out, &c, 1);
+    }
+    emit(ex, out, "\"", 1);
+}
+
+/* -------------------------------------------------- */
+/* Expand the invocation of function-like f whose '(' is at text[open].
+ * Returns the index after its ')' or -1 (nothing appended) when the
+ * arguments do not close in text or do not match the parameters. */
+static long invoke(expansion_t *ex, macro_t *f, const char *text, long len, long open,
+                   const marks_t *marks, buffer_t *out)
+{
+    macro_table_t *table = ex->table;
+    const macro_template_t *tmpl = f->tmpl;
+    arg_t *args = NULL;
+    int n = 0;
+    long next = split_args(ex, text, len, open, &args, &n);
+    if (next < 0) return -1;
+
+    /* F() passes no arguments to a macro without parameters */
+    if (n == 1 && args[0].start == args[0].end && tmpl->param_count == 0) n = 0;
+    if (tmpl->variadic ? n < tmpl->param_count : n != tmpl->param_count) {
+        fail(ex, MACROS_ERR_ARGS);
+        return -1;
+    }
+    table->invocations++;
+    ex->functions++;
+
+    /* One slot per parameter; __VA_ARGS__ spans the remaining arguments */
+    int slots = tmpl->param_count + tmpl->variadic;
+    arg_t *slot = args;
+    buffer_t *expanded = NULL;
+    char *ready = NULL;
+    if (slots > 0) {
+        slot = arena_alloc(&table->scratch, (size_t)slots * sizeof(arg_t));
+        expanded = arena_alloc(&table->scratch, (size_t)slots * sizeof(buffer_t));
+        ready = arena_alloc(&table->scratch, (size_t)slots);
+        if (!slot || !expanded || !ready) {
+            fail(ex, MACROS_ERR_MEMORY);
+            return next;
+        }
+        memcpy(slot, args, (size_t)tmpl->param_count * sizeof(arg_t));
+        memset(ready, 0, (size_t)slots);
+        if (tmpl->variadic) {
+            slot[tmpl->param_count].start = n > tmpl->param_count ? args[tmpl->param_count].start : next - 1;
+            slot[tmpl->param_count].end = n > tmpl->param_count ? args[n - 1].end : next - 1;
+        }
+    }
+
+    /* Arguments are expanded once, in the caller's context */
+    long names_before = ex->names_left;
+    for (int i = 0; i < tmpl->item_count; i++) {
+        int p = tmpl->items[i].param;
+        if (tmpl->items[i].kind != MACRO_ITEM_ARG || ready[p]) continue;
+        ready[p] = 1;
+        buffer_init_arena(&expanded[p], &table->scratch);
+        marks_t sub;
+        slice_marks(ex, marks, slot[p].start, slot[p].end, &sub);
+        scan(ex, text + slot[p].start, slot[p].end - slot[p].start, &sub, 0, &expanded[p]);
+    }
+
+    /* Nothing in the result can expand further: substitute straight into out */
+    int direct = !tmpl->rescan && ex->names_left == names_before;
+    /* The result buffer lives in the scratch arena so that no other buffer of
+     * this line shares its address in the paint log */
+    buffer_t *result = NULL;
+    span_t *result_spans = NULL;
+    int result_span_count = 0;
+    buffer_t *dst = out;
+    if (!direct) {
+        result = arena_alloc(&table->scratch, sizeof(buffer_t));
+        result_spans = arena_alloc(&table->scratch, (size_t)tmpl->item_count * sizeof(span_t) + 1);
+        if (!result || !result_spans) {
+            fail(ex, MACROS_ERR_MEMORY);
+            return next;
+        }
+        buffer_init_arena(result, &table->scratch);
+        dst = result;
+    }
+
+    for (int i = 0; i < tmpl->item_count; i++) {
+        const macro_item_t *it = &tmpl->items[i];
+        const arg_t *a = it->kind == MACRO_ITEM_TEXT ? NULL : &slot[it->param];
+        switch (it->kind) {
+        case MACRO_ITEM_TEXT:
+            emit(ex, dst, it->text, it->len);
+            break;
+        case MACRO_ITEM_ARG:
+            if (!direct && expanded[it->param].len > 0) {
+                result_spans[result_span_count].start = dst->len;
+                result_spans[result_span_count].end = dst->len + expanded[it->param].len;
+                result_span_count++;
+            }
+            emit_arg(ex, dst, &expanded[it->param]);
+            break;
+        case MACRO_ITEM_ARG_RAW:
+            /* Painted names of the argument stay painted */
+            for (int k = 0; marks && k < marks->painted_count; k++) {
+                long at = marks->painted[k];
+                if (at >= a->start && at < a->end) paint(ex, dst, dst->len + (at - a->start));
+            }
+            emit(ex, dst, text + a->start, a->end - a->start);
+            break;
+        case MACRO_ITEM_STRINGIFY:
+            stringify(ex, dst, text + a->start, a->end - a->start);
+            break;
+        }
+    }
+
+    if (direct) {
+        table->invocations_direct++;
+        return next;
+    }
+    if (ex->depth >= MACROS_MAX_DEPTH) {
+        fail(ex, MACROS_ERR_DEPTH);
+        emit(ex, out, result->data, result->len);
+        return next;
+    }
+
+    marks_t result_marks;
+    result_marks.spans = result_spans;
+    result_marks.span_count = result_span_count;
+    result_marks.painted_count = 0;
+    for (int i = 0; i < table->paint_count; i++) result_marks.painted_count += table->paint[i].buf == result;
+    long *painted = arena_alloc(&table->scratch, (size_t)result_marks.painted_count * sizeof(long) + 1);
+    if (!painted) {
+        fail(ex, MACROS_ERR_MEMORY);
+        return next;
+    }
+    result_marks.painted_count = 0;
+    for (int i = 0; i < table->paint_count; i++) {
+        if (table->paint[i].buf == result) painted[result_marks.painted_count++] = table->paint[i].pos;
+    }
+    result_marks.painted = painted;
+
+    ex->active[ex->depth++] = f;
+    ex->rescanning++;
+    scan(ex, result->data, result->len, &result_marks, 0, out);
+    ex->rescanning--;
+    ex->depth--;
+    return next;
+}
+
+/* -------------------------------------------------- */
+/* A replacement (out from exp_start on) that ends in a function-like name
+ * takes its arguments from the text that follows it at text[at]. Returns
+ * where scanning continues. */
+static long trailing_call(expansion_t *ex, const char *text, long len, long at,
+                          long exp_start, const marks_t *marks, buffer_t *out)
+{
+    for (;;) {
+        long open = skip_blanks(text, len, at);
+        if (open >= len || text[open] != '(') return at;
+
+        long end = out->len, name = end;
+        while (name > exp_start && TK_IS(out->data[name - 1], TK_IDENT)) name--;
+        while (name < end && TK_IS(out->data[name], TK_DIGIT)) name++;
+        if (name == end || is_painted(ex, out, name)) return at;
+        macro_t *f = lookup(ex->table, out->data + name, (int)(end - name));
+        if (!f || !f->tmpl || is_active(ex, f)) return at;
+
+        long next = invoke(ex, f, text, len, open, marks, out);
+        if (next < 0) return at;
+        record_dep(ex, out->data + name, (int)(end - name), f);
+
+        /* The expansion replaces the name */
+        memmove(out->data + name, out->data + end, (size_t)(out->len - end));
+        out->len -= end - name;
+        out->data[out->len] = '\0';
+        for (int i = 0; i < ex->table->paint_count; i++) {
+            macro_paint_t *pt = &ex->table->paint[i];
+            if (pt->buf == out && pt->pos >= end) pt->pos -= end - name;
+        }
+        exp_start = name;
+        at = next;
+    }
+}
+
+/* -------------------------------------------------- */
+/* Next token of the line for the top-level scan: taken from the caller's
+ * list while pos is on a token boundary (between tokens there are only
+ * blanks). A jump into a token (an invocation that closed inside a string
+ * token, say) drops the list for the rest of the line. */
+static Token_type next_line_token(expansion_t *ex, int *k, const char *text, long len,
+                                  long *pos, long *start, int *tok_len)
+{
+    const token_list_t *list = ex->tokens;
+    if (!list) return next_token(text, len, pos, start, tok_len);
+
+    int i = *k;
+    while (i < list->count && list->items[i].start < *pos) i++;
+    if (i > 0 && list->items[i - 1].start + list->items[i - 1].length > *pos) {
+        ex->tokens = NULL;
+        return next_token(text, len, pos, start, tok_len);
+    }
+    if (i >= list->count) return END;
+
+    *k = i + 1;
+    *start = list->items[i].start;
+    *tok_len = list->items[i].length;
+    *pos = *start + *tok_len;
+    return list->items[i].type;
+}
+
+/* -------------------------------------------------- */
+/* Append text with its macros expanded. Identifiers inside spans come from
+ * arguments that were expanded already: of those, only function-like names
+ * (which may meet their '(' only now) are looked at again. Returns 1 if
+ * anything was replaced. */
+static int scan(expansion_t *ex, const char *text, long len,
+                const marks_t *marks, int top, buffer_t *out)
+{
+    macro_table_t *table = ex->table;
+    if (ex->level >= MACROS_MAX_DEPTH) {
+        fail(ex, MACROS_ERR_DEPTH);
+        emit(ex, out, text, len);
+        return 0;
+    }
+    ex->level++;
+
+    /* Text before `copied` is in the output; the rest is appended in one
+     * piece when a macro is found or the text ends */
+    long pos = 0, copied = 0, start;
+    int tok_len, span = 0, changed = 0, k = 0;
+    int span_count = marks ? marks->span_count : 0;
+    Token_type type;
+    while ((type = top ? next_line_token(ex, &k, text, len, &pos, &start, &tok_len)
+                       : next_token(text, len, &pos, &start, &tok_len)) != END) {
+        /* Never expand inside strings */
+        if (type != IDENTIFIER) continue;
+
+        const char *name = text + start;
+        if (top) table->prefilter_checked++;
+        macro_t *m = NULL;
+        if (bloom_may_contain(table, name, tok_len)) {
+            m = find_macro(table, name, tok_len);
+        } else if (top) {
+            table->prefilter_rejected++;
+        }
+        if (!m) {
+            if (ex->recording) record_dep(ex, name, tok_len, NULL);
+            continue;
+        }
+
+        while (span < span_count && marks->spans[span].end <= start) span++;
+        int from_arg = span < span_count && marks->spans[span].start <= start;
+        int painted = 0;
+        for (int i = 0; marks && i < marks->painted_count; i++) painted |= marks->painted[i] == start;
+        if ((from_arg && !m->tmpl) || painted || is_active(ex, m)) {
+            /* Left as written for good: the result depends on the context */
+            ex->hidden = 1;
+            paint(ex, out, out->len + (start - copied));
+            continue;
+        }
+
+        if (m->tmpl) {
+            long open = skip_blanks(text, len, start + tok_len);
+            if (open >= len || text[open] != '(') {
+                ex->names_left++;
+                ex->functions++;
+                record_dep(ex, name, tok_len, m);
+                continue;
+            }
+            emit(ex, out, text + copied, start - copied);
+            copied = start;
+            long exp_start = out->len;
+            long next = invoke(ex, m, text, len, open, marks, out);
+            record_dep(ex, name, tok_len, m);
+            if (next < 0) {
+                ex->names_left++;
+                ex->functions++;
+                continue;
+            }
+            pos = copied = trailing_call(ex, text, len, next, exp_start, marks, out);
+        } else {
+            emit(ex, out, text + copied, start - copied);
+            long exp_start = out->len;
+            expand_object(ex, m, out);
+            record_dep(ex, name, tok_len, m);
+            pos = copied = trailing_call(ex, text, len, start + tok_len, exp_start, marks, out);
+        }
+        changed = 1;
+    }
+
+    emit(ex, out, text + copied, len - copied);
+    ex->level--;
+    return changed;
+}
+
+/* -------------------------------------------------- */
+int macros_expand_line(macro_table_t *table,
+                       const char *line,
+                       long line_len,
+                       buffer_t *output)
+{
+    return macros_expand_tokens(table, line, line_len, NULL, output);
+}
+
+/* -------------------------------------------------- */
+int macros_expand_tokens(macro_table_t *table,
+                         const char *line,
+                         long line_len,
+                         const token_list_t *tokens,
+                         buffer_t *output)
+{
+    expansion_t ex;
+    ex.table = table;
+    ex.depth = 0;
+    ex.level = 0;
+    ex.recording = 0;
+    ex.hidden = 0;
+    ex.names_left = 0;
+    ex.functions = 0;
+    ex.rescanning = 0;
+    ex.error = MACROS_OK;
+    ex.tokens = tokens;
+
+    /* Arguments, substitutions and paint marks are temporaries of this line */
+    table->paint_count = 0;
+    arena_mark_t mark = arena_mark(&table->scratch);
+    int changed = scan(&ex, line, line_len, NULL, 1, output);
+    arena_release(&table->scratch, mark);
+
+    if (changed) table->lines_expanded++;
+    else table->lines_copied++;
+    return ex.error;
 }
 
 /* -------------------------------------------------- */
@@ -118,11 +1337,33 @@ void macros_free(macro_table_t *table)
 {
     if (!table) return;
 
-    for (int i = 0; i < table->size; i++) {
-        free(table->items[i].name);
-        free(table->items[i].value);
+    /* Names and values all live in the arena; memos are one block each */
+    for (int i = 0; table->items && i < table->capacity; i++) {
+        free(table->items[i].memo);
     }
     free(table->items);
+    table->items = NULL;
+    for (int i = 0; i < table->parent_memo_capacity; i++) free(table->parent_memos[i].memo);
+    free(table->parent_memos);
+    table->parent_memos = NULL;
+    table->parent_memo_count = 0;
+    table->parent_memo_capacity = 0;
+    table->parent = NULL;
+    free(table->strings);
+    table->strings = NULL;
+    table->string_count = 0;
+    table->string_capacity = 0;
+    arena_free(&table->arena);
+    arena_free(&table->scratch);
+    memset(table->bloom, 0, sizeof(table->bloom));
+    free(table->deps);
+    table->deps = NULL;
+    table->dep_count = 0;
+    table->dep_capacity = 0;
+    free(table->paint);
+    table->paint = NULL;
+    table->paint_count = 0;
+    table->paint_capacity = 0;
 
     table->size = 0;
     table->capacity = 0;
@@ -2,48 +2,231 @@
 #define MACROS_H
 
 #include <stdio.h>
+#include <stdint.h>
 #include "../tokens/tokens.h"
 #include "../buffer/buffer.h"
 #include "../comments/comments.h"
+#include "../arena/arena.h"
 
-/* Single macro entry */
+/* Deepest chain of macros expanding to macros (deeper is an error) */
+#define MACROS_MAX_DEPTH 256
+
+/* Results of macros_expand_line / macros_define_function_n */
+#define MACROS_OK 0
+#define MACROS_ERR_MEMORY 1
+#define MACROS_ERR_DEPTH 2
+#define MACROS_ERR_ARGS 3
+#define MACROS_ERR_SYNTAX 4
+
+/* Parts of a function-like macro's replacement list */
+typedef enum {
+    MACRO_ITEM_TEXT,      /* literal text */
+    MACRO_ITEM_ARG,       /* argument, fully macro-expanded */
+    MACRO_ITEM_ARG_RAW,   /* argument as written (operand of ##) */
+    MACRO_ITEM_STRINGIFY  /* #param: argument as a string literal */
+} macro_item_kind_t;
+
+typedef struct {
+    macro_item_kind_t kind;
+    int param;            /* argument slot (__VA_ARGS__ is slot param_count) */
+    const char *text;     /* literal text, inside the interned definition */
+    int len;
+} macro_item_t;
+
+/* Replacement list of a function-like macro, tokenized once by #define */
+typedef struct {
+    int param_count;      /* named parameters */
+    int variadic;         /* last parameter is ... */
+    int rescan;           /* literal text has identifiers or ## is used */
+    int item_count;
+    macro_item_t *items;
+} macro_template_t;
+
+/* Identifier met while expanding a macro value, and what it meant then */
 typedef struct {
-    char *name;    
-    char *value;   
+    const char *name;  /* points into the interned value */
+    int name_len;
+    const char *value; /* its macro's value then (NULL if undefined) */
+    long serial;       /* serial of its macro's memo then */
+} macro_dep_t;
+
+/* Name left unexpanded for good ("painted"), at pos in one of the buffers of
+ * the expansion in progress; it stays so when the buffer is substituted */
+typedef struct {
+    const buffer_t *buf;
+    long pos;
+} macro_paint_t;
+
+/* Fully expanded value of a macro, valid while its dependencies keep
+ * the values they had when it was computed */
+typedef struct {
+    const char *text;  /* the value itself when nothing in it expands */
+    int text_len;
+    long serial;       /* unique per memo, so dependents see recomputation */
+    long generation;   /* table generation it was last checked at */
+    long names_left;   /* function-like names in text, without arguments */
+    int functions;     /* function-like macros were invoked or left in it */
+    int dep_count;
+    macro_dep_t *deps;
+} macro_memo_t;
+
+/* Single macro entry (one open-addressing slot, name == NULL when empty).
+ * name and value are interned strings owned by the table. */
+typedef struct {
+    const char *name;
+    const char *value;
+    int name_len;      /* cached strlen(name) */
+    int value_len;     /* cached strlen(value) */
+    unsigned int hash; /* precomputed hash of name */
+    macro_memo_t *memo; /* full expansion (NULL until used, or self-referencing) */
+    macro_template_t *tmpl; /* function-like macros only; value is "(params) body" */
 } macro_t;
 
-/* Macro table */
+/* Bits in the identifier prefilter (a power of two) */
+#define MACROS_BLOOM_BITS 4096
+
+/* Interned string (one open-addressing slot, str == NULL when empty) */
 typedef struct {
-    macro_t *items;
-    int size;
-    int capacity;
+    const char *str;   /* NUL-terminated bytes in the table's arena */
+    int len;
+    unsigned int hash;
+} macro_string_t;
+
+/* Memo of a parent table's macro, computed by the forked table holding it
+ * (macro == NULL when the slot is empty) */
+typedef struct {
+    const macro_t *macro;
+    macro_memo_t *memo;
+} macro_memo_slot_t;
+
+/* Macro table: open-addressing hash table with linear probing */
+typedef struct macro_table {
+    macro_t *items;    /* slot array, capacity is a power of two */
+    int size;          /* number of occupied slots */
+    int capacity;      /* number of slots */
+
+    /* Every name and value is stored once here and lives until macros_free */
+    macro_string_t *strings;
+    int string_count;
+    int string_capacity;
+    arena_t arena;
+
+    /* Bloom filter over the names' first/second/last bytes and length: an
+     * identifier whose bits are not all set cannot be a macro */
+    uint64_t bloom[MACROS_BLOOM_BITS / 64];
+
+    /* Table this one was forked from (NULL if none). It is only read: names
+     * not defined here are looked up in it, and the memos of its macros
+     * expanded here are kept in parent_memos, keyed by macro address */
+    const struct macro_table *parent;
+    macro_memo_slot_t *parent_memos;
+    int parent_memo_count;
+    int parent_memo_capacity;
+
+    /* Temporaries of one macros_expand_line call (arguments, substitutions) */
+    arena_t scratch;
+
+    /* Bumped by every #define; memos older than this re-check their deps */
+    long generation;
+    long next_serial;
+    /* Dependencies collected while expanding (one range per nesting level) */
+    macro_dep_t *deps;
+    int dep_count;
+    int dep_capacity;
+    /* Painted names of the line being expanded */
+    macro_paint_t *paint;
+    int paint_count;
+    int paint_capacity;
+
+    /* Statistics (kept across macros_free): strings stored, and defines
+     * that found their name or value already stored */
+    long interned;
+    long intern_hits;
+    /* Statistics: identifiers checked / rejected by the prefilter, and lines
+     * expanded / copied whole because no identifier could be a macro */
+    long prefilter_checked;
+    long prefilter_rejected;
+    long lines_expanded;
+    long lines_copied;
+    /* Statistics: macros served from their memo, expanded from the value,
+     * and memos dropped because a dependency changed */
+    long memo_hits;
+    long memo_misses;
+    long memo_invalidated;
+    /* Statistics: function-like invocations, and those whose substituted
+     * template needed no rescan */
+    long invocations;
+    long invocations_direct;
+    /* Statistics: #defines stored, and memos kept for a parent's macros */
+    long defined;
+    long parent_memos_kept;
 } macro_table_t;
 
 /* Initialize macro table */
 void macros_init(macro_table_t *table);
 
-/* Define a macro (called by Directives) */
+/* Start table as a fork of parent, in constant time: parent's macros are
+ * visible and can be redefined here without touching it. parent must not
+ * change or be freed while forks of it exist; several forks (on different
+ * threads) may share it. */
+void macros_fork(macro_table_t *table, const macro_table_t *parent);
+
+/* Define a macro (called by Directives).
+ * Redefining an existing name replaces its value in place. */
 int macros_define(macro_table_t *table,
                   const char *name,
                   const char *value);
 
+/* Define a macro from counted strings (no terminator or length limit) */
+int macros_define_n(macro_table_t *table,
+                    const char *name, int name_len,
+                    const char *value, int value_len);
+
+/* Define a function-like macro; definition is "(params) body", starting at
+ * the '(' that follows the name. Returns MACROS_OK, MACROS_ERR_SYNTAX for a
+ * malformed parameter list or # / ## use, or MACROS_ERR_MEMORY. */
+int macros_define_function_n(macro_table_t *table,
+                             const char *name, int name_len,
+                             const char *definition, int definition_len);
+
+/* Define a macro whose name and value are NUL-terminated at their lengths
+ * and outlive the table (e.g. inside a mapped snapshot): they are referenced
+ * instead of copied. A function-like value is "(params) body". Returns
+ * MACROS_OK, MACROS_ERR_SYNTAX or MACROS_ERR_MEMORY. */
+int macros_define_in_place(macro_table_t *table,
+                           const char *name, int name_len,
+                           const char *value, int value_len,
+                           int function_like);
+
 /* Check if macro exists */
 int macros_is_defined(const macro_table_t *table,
                       const char *name,
                       int name_len);
 
-/* Get macro value (NULL if not found) */
+/* Get an object-like macro's value (NULL if not found or function-like) */
 const char *macros_get(const macro_table_t *table,
                        const char *name,
                        int name_len);
 
-/* Expand macros in a normal code line */
-int macros_expand_line(const macro_table_t *table,
+/* Expand macros in a normal code line. Replacements are rescanned (a macro
+ * is not expanded inside itself) and full expansions of object-like macros
+ * are memoized. Function-like invocations must close on the same line. A
+ * line without macros is appended in one piece. Returns MACROS_OK or the
+ * first MACROS_ERR_* met (the line is still appended). */
+int macros_expand_line(macro_table_t *table,
                        const char *line,
                        long line_len,
                        buffer_t *output);
 
-/* Free all macro memory */
+/* Same, for a line whose tokens the caller lexed already (see
+ * tokens_list_feed); the line is not tokenized again. */
+int macros_expand_tokens(macro_table_t *table,
+                         const char *line,
+                         long line_len,
+                         const token_list_t *tokens,
+                         buffer_t *output);
+
+/* Free all macro memory (statistics are kept; a parent is left alone) */
 void macros_free(macro_table_t *table);
 
 #endif
@@ -5,12 +5,30 @@
  * Description:
  *     This module provides the program entry point and orchestrates execution.
  *
- * - `get_input_path`: Extracts the input filename from argv.
- * - `run_preprocessor`: Coordinates CLI parsing, IO, and preprocessing.
- * - `main`: Thin wrapper that calls `run_preprocessor`.
+ * - `collect_input_paths`: Extracts the input filenames from argv.
+ * - `preprocess_file`: Preprocesses one file with its own context. Output is
+ *   streamed to <name>_pp.<ext> (or stdout) through a bounded sink.
+ *   With -cache, unchanged inputs are copied from the persistent cache and
+ *   misses are recorded into it as they stream out. With -incremental, an
+ *   output whose stamp still matches is skipped before the input is read;
+ *   -MD writes the included files as a Make rule. Every input may start from
+ *   a -snapshot prefix header, and -snapshot-out saves the state left by one.
+ *   Includes are resolved through one -I / -isystem search path per run,
+ *   whose directory listings are shared by every file. With -d, I/O threads
+ *   read the headers named by each input ahead of its preprocessing.
+ * - `run_preprocessor`: Coordinates CLI parsing and runs every input, in
+ *   parallel on a work-stealing thread pool when there are several (a single
+ *   large input in comments-only mode is split into chunks instead). Output
+ *   and messages go where its run_env_t says.
+ * - `serve`: -serve daemon. Runs the command lines of -connect clients on
+ *   -jN workers, keeping included files and -snapshot prefixes warm between
+ *   requests (both revalidated by stat for every request).
+ * - `run_remote`: -connect client; the command runs here when no daemon
+ *   answers.
+ * - `main`: Dispatches to the three above.
  *
  * Usage:
- *     Invoked by the OS to run the preprocessor on a given input file.
+ *     Invoked by the OS to run the preprocessor on one or more input files.
  *
  * Status:
  *     Active - core application entry point.
@@ -22,28 +40,516 @@
 #include "pp_core/pp_context.h"
 #include "buffer/buffer.h"
 #include "io/io.h"
+#include "sink/sink.h"
+#include "pool/pool.h"
 #include "errors/errors.h"
+#include "cache/cache.h"
+#include "depfile/depfile.h"
+#include "hash/hash.h"
+#include "snapshot/snapshot.h"
+#include "search_path/search_path.h"
+#include "prefetch/prefetch.h"
+#include "include_cache/include_cache.h"
+#include "server/server.h"
 #include "spec/pp_spec.h"
 
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
-/* Return the last non-flag argument, assumed to be the input path. */
-static const char *get_input_path(int argc, char **argv)
+/* -snapshot prefixes kept by the daemon (most recently used first). */
+#define WARM_PREFIXES 8
+
+/* A -snapshot prefix opened by one request and forked by later ones with
+ * the same snapshot file (same inode, size and mtime) and stages. */
+typedef struct warm_prefix {
+    unsigned long long dev;
+    unsigned long long ino;
+    long long size;
+    long long mtime;
+    unsigned stages;
+    snapshot_t snapshot;
+    pp_context_t prefix;
+    /* Requests using it; a prefix dropped from the list is freed by the last. */
+    int users;
+    int dropped;
+    struct warm_prefix *next;
+} warm_prefix_t;
+
+/* State a -serve daemon keeps between requests. */
+typedef struct {
+    include_store_t includes;
+    pthread_mutex_t lock;
+    warm_prefix_t *prefixes;
+    int prefix_count;
+    long prefix_reuses;
+} warm_state_t;
+
+/* Where one run writes and what it may reuse. */
+typedef struct {
+    /* Destination of -stdout, and the stream for messages and statistics. */
+    int out_fd;
+    FILE *err;
+    /* Daemon state (NULL: a standalone run). */
+    warm_state_t *warm;
+} run_env_t;
+
+/* One input file to preprocess (a thread pool task). */
+typedef struct {
+    const char *path;
+    const cli_options_t *opt;
+    /* Print a file header before the statistics (several inputs). */
+    int show_name;
+    /* Workers for splitting this file itself (0 or 1: serial). */
+    int split_workers;
+    /* Persistent cache shared by all files (NULL without -cache). */
+    cache_t *cache;
+    /* Context every file is forked from (NULL without -snapshot). */
+    const pp_context_t *prefix;
+    /* Include search path shared by all files, and its key. */
+    search_path_t *search;
+    hash128_t search_key;
+    /* Include read-ahead shared by all files (NULL when disabled). */
+    prefetch_t *prefetch;
+    /* Included files kept by the daemon (NULL: standalone run). */
+    include_store_t *include_store;
+    /* Where -stdout output, messages and statistics go. */
+    int out_fd;
+    FILE *err;
+    /* 0 on success, 1 if the file had errors. */
+    int rc;
+} file_job_t;
+
+/* Store the non-flag arguments (the input paths) in paths; return their count. */
+static int collect_input_paths(int argc, char **argv, const char **paths)
 {
-    const char *path = 0;
+    int count = 0;
     for (int i = 1; i < argc; i++) {
-        // Last non-flag argument is treated as the input file
-        if (argv[i][0] != PP_CHAR_DASH) path = argv[i];
+        // Every non-flag argument is an input file
+        if (argv[i][0] != PP_CHAR_DASH) paths[count++] = argv[i];
     }
-    return path;
+    return count;
 }
 
-/* Orchestrate CLI parsing, file IO, and preprocessing. */
-static int run_preprocessor(int argc, char **argv)
+/* Option bits of the processing stages (recorded in snapshots). */
+static unsigned stage_bits(const cli_options_t *opt)
 {
-    // Initialize error handling
-    errors_init();
+    return (opt->do_comments ? 1u : 0u) | (opt->do_directives ? 2u : 0u);
+}
+
+/* Option bits recorded in cache keys and stamps. */
+static unsigned option_bits(const cli_options_t *opt)
+{
+    return stage_bits(opt) | (opt->snapshot ? 4u : 0u);
+}
+
+/* Build "<out_name><suffix>" into name; returns 0 or 1 (error reported). */
+static int make_sidecar_name(const buffer_t *out_name, const char *suffix, buffer_t *name)
+{
+    if (buffer_append_n(name, out_name->data, out_name->len) != 0 ||
+        buffer_append_str(name, suffix) != 0) {
+        error(0, "%s: %s", out_name->data, PP_ERR_OUT_OF_MEMORY);
+        return 1;
+    }
+    return 0;
+}
+
+/* After a successful run: write the depfile and stamp (a failed run leaves
+ * no stamp, output_up_to_date dropped it). */
+static void write_sidecars(const cli_options_t *opt, hash128_t search_key, const char *in_path,
+                           const buffer_t *out_name, const buffer_t *in, const cache_deps_t *deps,
+                           time_t run_start, int ok)
+{
+    if (!ok) return;
+    buffer_t name;
+    if (opt->write_depfile) {
+        buffer_init(&name);
+        if (make_sidecar_name(out_name, PP_DEPFILE_SUFFIX, &name) == 0) {
+            depfile_write(name.data, out_name->data, in_path, deps);
+        }
+        buffer_free(&name);
+    }
+    if (opt->incremental && !opt->to_stdout) {
+        buffer_init(&name);
+        if (make_sidecar_name(out_name, PP_STAMP_SUFFIX, &name) == 0) {
+            hash128_t input_hash = hash_bytes(in->data, (size_t)in->len);
+            depfile_stamp_write(name.data, option_bits(opt), search_key, out_name->data, in_path,
+                                input_hash, deps, run_start);
+        }
+        buffer_free(&name);
+    }
+}
+
+/* Return 1 if -incremental finds the output of in_path up to date. Otherwise
+ * its stamp is removed before the output is rewritten, so a run that stops
+ * halfway cannot leave a truncated output behind a valid stamp. */
+static int output_up_to_date(const cli_options_t *opt, hash128_t search_key,
+                             const buffer_t *out_name)
+{
+    if (!opt->incremental || opt->to_stdout) return 0;
+
+    buffer_t stamp, depfile;
+    buffer_init(&stamp);
+    buffer_init(&depfile);
+    int named = make_sidecar_name(out_name, PP_STAMP_SUFFIX, &stamp) == 0;
+    int fresh = named &&
+                depfile_stamp_check(stamp.data, option_bits(opt), search_key, out_name->data);
+    // A missing depfile must be regenerated even if the output is current
+    if (fresh && opt->write_depfile) {
+        fresh = make_sidecar_name(out_name, PP_DEPFILE_SUFFIX, &depfile) == 0 &&
+                access(depfile.data, F_OK) == 0;
+    }
+    if (named && !fresh) unlink(stamp.data);
+    buffer_free(&stamp);
+    buffer_free(&depfile);
+    return fresh;
+}
+
+/* -snapshot-out: save the captured state with the output just written. */
+static void save_snapshot(const cli_options_t *opt, const char *in_path, const buffer_t *in,
+                          const buffer_t *out_name, const snapshot_state_t *state,
+                          const cache_deps_t *deps, time_t run_start)
+{
+    buffer_t output;
+    buffer_init(&output);
+    if (io_map_file(out_name->data, &output) == 0) {
+        snapshot_write(opt->snapshot_out, state, stage_bits(opt), in_path,
+                       hash_bytes(in->data, (size_t)in->len), deps, output.data, output.len,
+                       run_start);
+    }
+    buffer_free(&output);
+}
+
+/* Preprocess one file; returns 0 on success, 1 if any error was reported. */
+static int preprocess_file(const file_job_t *job)
+{
+    const char *in_path = job->path;
+    const cli_options_t *opt = job->opt;
+    cache_t *cache = job->cache;
+    const pp_context_t *prefix = job->prefix;
+
+    // Errors of this file (I/O and preprocessing) are counted separately
+    // from other files processed at the same time
+    errors_ctx_t file_errors;
+    errors_ctx_init(&file_errors);
+    file_errors.stream = job->err;
+    errors_ctx_t *prev_errors = errors_bind(&file_errors);
+    FILE *err = job->err;
+
+    // Buffers for input file and output filename (the input is only set up
+    // once it is known to be read)
+    buffer_t in, out_name;
+    buffer_init(&out_name);
+
+    if (io_make_output_name(in_path, &out_name) != 0) {
+        buffer_free(&out_name);
+        errors_bind(prev_errors);
+        return 1;
+    }
+
+    // -incremental: nothing recorded for this output changed, so the input
+    // is not even read
+    if (output_up_to_date(opt, job->search_key, &out_name)) {
+        if (opt->do_stats) {
+            flockfile(err);
+            if (job->show_name) fprintf(err, PP_FMT_STATS_FILE, in_path);
+            fprintf(err, PP_FMT_STATS_UP_TO_DATE);
+            funlockfile(err);
+        }
+        buffer_free(&out_name);
+        errors_bind(prev_errors);
+        return 0;
+    }
+
+    // Map input file (zero-copy)
+    time_t run_start = time(NULL);
+    buffer_init(&in);
+    if (io_map_file(in_path, &in) != 0) {
+        buffer_free(&in);
+        buffer_free(&out_name);
+        errors_bind(prev_errors);
+        return 1;
+    }
+
+    // Open the output: lines are flushed as they complete, so memory stays
+    // bounded whatever the size of the translation unit
+    sink_t sink;
+    if (opt->to_stdout) {
+        sink_init_fd(&sink, job->out_fd, PP_SINK_FLUSH_THRESHOLD);
+    } else if (sink_open_path(&sink, out_name.data, PP_SINK_FLUSH_THRESHOLD) != 0) {
+        buffer_free(&in);
+        buffer_free(&out_name);
+        errors_bind(prev_errors);
+        return 1;
+    }
+
+    // Compute base directory for resolving relative includes
+    char base_dir[PP_MAX_PATH_LEN];
+    io_compute_base_dir(in_path, base_dir, sizeof(base_dir));
+
+    // Included files are collected when something records them
+    cache_deps_t deps;
+    cache_deps_init(&deps);
+    int track_deps = cache || opt->write_depfile || (opt->incremental && !opt->to_stdout) ||
+                     opt->snapshot_out;
+
+    // Serve an unchanged input from the cache; a hit skips preprocessing
+    // (never taken when the run's final state must be saved, though its
+    // output is still stored under the same key)
+    hash128_t key;
+    int hit = 0;
+    if (cache) {
+        key = cache_input_key(&in, option_bits(opt), base_dir,
+                              prefix ? snapshot_header_path(prefix->snapshot) : NULL,
+                              job->search->count > 0 ? &job->search_key : NULL);
+        if (!opt->snapshot_out) hit = cache_lookup(cache, key, &sink, &deps);
+        if (hit < 0) error(0, "%s: %s", in_path, PP_ERR_OUTPUT_WRITE);
+    }
+
+    // Set up preprocessing context (forked from the prefix in constant time;
+    // a prefix kept by the daemon was opened for another request, whose
+    // options beyond the stages may differ)
+    pp_context_t ctx;
+    if (prefix) {
+        pp_context_fork(&ctx, prefix, in_path);
+        ctx.opt = *opt;
+    } else {
+        pp_context_init(&ctx, opt, in_path);
+    }
+    if (track_deps) ctx.deps = &deps;
+    ctx.search = job->search;
+    ctx.prefetch = job->prefetch;
+    ctx.include_store = job->include_store;
+    snapshot_state_t state;
+    snapshot_state_init(&state);
+    if (opt->snapshot_out) ctx.snapshot_out = &state;
+
+    if (hit == 0) {
+        // On a miss, record the output as it is produced
+        cache_store_t store;
+        int storing = cache && cache_store_begin(cache, &store) == 0;
+        if (storing) sink.tee_fd = store.fd;
+
+        // A large input in comments-only mode is split into chunks processed on
+        // a pool of its own (created only when the file is big enough)
+        pool_t pool;
+        if (job->split_workers > 1 && !opt->do_directives && in.len >= 2 * PP_PARALLEL_CHUNK &&
+            pool_create(&pool, job->split_workers) == 0) {
+            ctx.pool = &pool;
+        }
+
+        // Start reading the headers of this input while it is processed (the
+        // input itself is already mapped: only its #include lines are looked at)
+        if (job->prefetch) prefetch_buffer(job->prefetch, in.data, in.len, base_dir);
+
+        // Run the preprocessor (comments, directives, macros)
+        pp_run_stream(&ctx, &in, &sink, base_dir);
+        if (opt->do_stats) {
+            // Keep the lines of one file together when several run in parallel
+            flockfile(err);
+            if (job->show_name) fprintf(err, PP_FMT_STATS_FILE, in_path);
+            pp_print_stats(&ctx, err);
+            if (ctx.pool) {
+                fprintf(err, PP_FMT_STATS_POOL, pool.nthreads, pool.executed, pool.steals);
+            }
+            funlockfile(err);
+        }
+        if (ctx.pool) pool_destroy(&pool);
+
+        // Only complete, error-free outputs are published to the cache
+        if (storing) {
+            if (ctx.errors.count == 0 && file_errors.count == 0 && !sink.tee_failed) {
+                cache_store_commit(cache, &store, key, &deps);
+            } else {
+                cache_store_abort(cache, &store);
+            }
+        }
+    }
+
+    if (sink_close(&sink) != 0 && hit > 0) error(0, "%s: %s", in_path, PP_ERR_OUTPUT_WRITE);
 
+    int ok = file_errors.count == 0 && ctx.errors.count == 0;
+    write_sidecars(opt, job->search_key, in_path, &out_name, &in, &deps, run_start, ok);
+    ok = ok && file_errors.count == 0;
+    if (ok && opt->snapshot_out) {
+        save_snapshot(opt, in_path, &in, &out_name, &state, &deps, run_start);
+        ok = file_errors.count == 0;
+    }
+
+    snapshot_state_free(&state);
+    cache_deps_free(&deps);
+    buffer_free(&in);
+    buffer_free(&out_name);
+
+    errors_bind(prev_errors);
+    return ok ? 0 : 1;
+}
+
+/* Thread pool entry point for one file. */
+static void file_job_run(void *arg)
+{
+    file_job_t *job = (file_job_t *)arg;
+    job->rc = preprocess_file(job);
+}
+
+/* Map, validate and apply the -snapshot prefix into prefix. Returns 0, or 1
+ * (error reported, nothing left open). */
+static int open_prefix(const cli_options_t *opt, search_path_t *search, snapshot_t *snapshot,
+                       pp_context_t *prefix)
+{
+    static const char *const reasons[] = {
+        [SNAPSHOT_ERR_READ] = PP_ERR_SNAPSHOT_READ,
+        [SNAPSHOT_ERR_FORMAT] = PP_ERR_SNAPSHOT_FORMAT,
+        [SNAPSHOT_ERR_OPTIONS] = PP_ERR_SNAPSHOT_OPTIONS,
+        [SNAPSHOT_ERR_STALE] = PP_ERR_SNAPSHOT_STALE,
+    };
+    int src = snapshot_open(opt->snapshot, stage_bits(opt), snapshot);
+    if (src != SNAPSHOT_OK) {
+        error(0, "%s: %s", opt->snapshot, reasons[src]);
+        return 1;
+    }
+    pp_context_init(prefix, opt, snapshot_header_path(snapshot));
+    prefix->snapshot = snapshot;
+    prefix->search = search;
+    buffer_t empty, header_output;
+    buffer_init(&empty);
+    buffer_init(&header_output);
+    int prc = pp_run_prefix(prefix, &empty, &header_output, ".");
+    buffer_free(&empty);
+    buffer_free(&header_output);
+    if (prc != PP_RUN_SUCCESS) {
+        pp_context_free(prefix);
+        snapshot_close(snapshot);
+        return 1;
+    }
+    return 0;
+}
+
+static int warm_init(warm_state_t *warm)
+{
+    memset(warm, 0, sizeof(*warm));
+    if (include_store_init(&warm->includes) != 0) return 1;
+    pthread_mutex_init(&warm->lock, NULL);
+    return 0;
+}
+
+static void warm_prefix_free(warm_prefix_t *entry)
+{
+    pp_context_free(&entry->prefix);
+    snapshot_close(&entry->snapshot);
+    free(entry);
+}
+
+/* Unlink the entry *link points to (lock held); it is freed now or by its
+ * last user. */
+static void warm_prefix_drop(warm_state_t *warm, warm_prefix_t **link)
+{
+    warm_prefix_t *entry = *link;
+    *link = entry->next;
+    warm->prefix_count--;
+    entry->dropped = 1;
+    if (entry->users == 0) warm_prefix_free(entry);
+}
+
+static void warm_free(warm_state_t *warm)
+{
+    while (warm->prefixes) warm_prefix_drop(warm, &warm->prefixes);
+    pthread_mutex_destroy(&warm->lock);
+    include_store_free(&warm->includes);
+}
+
+/* The daemon's prefix for opt->snapshot, opened on first use and checked
+ * against the files it was saved from on every later one. Returns it with a
+ * user counted, or NULL (error reported). */
+static warm_prefix_t *warm_prefix_get(warm_state_t *warm, const cli_options_t *opt)
+{
+    struct stat st;
+    int known = stat(opt->snapshot, &st) == 0;
+    unsigned stages = stage_bits(opt);
+
+    pthread_mutex_lock(&warm->lock);
+    for (warm_prefix_t **link = &warm->prefixes; known && *link; link = &(*link)->next) {
+        warm_prefix_t *entry = *link;
+        if (entry->dev != (unsigned long long)st.st_dev ||
+            entry->ino != (unsigned long long)st.st_ino || entry->size != (long long)st.st_size ||
+            entry->mtime != (long long)st.st_mtime || entry->stages != stages) {
+            continue;
+        }
+        if (!snapshot_check(&entry->snapshot)) {
+            // A header changed: snapshot_open below reports it
+            warm_prefix_drop(warm, link);
+            break;
+        }
+        *link = entry->next;
+        entry->next = warm->prefixes;
+        warm->prefixes = entry;
+        entry->users++;
+        warm->prefix_reuses++;
+        pthread_mutex_unlock(&warm->lock);
+        return entry;
+    }
+    pthread_mutex_unlock(&warm->lock);
+
+    warm_prefix_t *entry = calloc(1, sizeof(warm_prefix_t));
+    if (!entry) {
+        error(0, "%s: %s", opt->snapshot, PP_ERR_OUT_OF_MEMORY);
+        return NULL;
+    }
+    // Forks resolve includes through their own request's search path
+    if (open_prefix(opt, NULL, &entry->snapshot, &entry->prefix) != 0) {
+        free(entry);
+        return NULL;
+    }
+    // Its options point into this request's argv (forks take their own)
+    entry->prefix.opt.snapshot = NULL;
+    entry->prefix.opt.snapshot_out = NULL;
+    entry->users = 1;
+    entry->dropped = !known;
+    entry->stages = stages;
+    if (known) {
+        entry->dev = (unsigned long long)st.st_dev;
+        entry->ino = (unsigned long long)st.st_ino;
+        entry->size = (long long)st.st_size;
+        entry->mtime = (long long)st.st_mtime;
+    }
+
+    pthread_mutex_lock(&warm->lock);
+    if (known) {
+        entry->next = warm->prefixes;
+        warm->prefixes = entry;
+        if (++warm->prefix_count > WARM_PREFIXES) {
+            warm_prefix_t **link = &warm->prefixes;
+            while ((*link)->next) link = &(*link)->next;
+            warm_prefix_drop(warm, link);
+        }
+    }
+    pthread_mutex_unlock(&warm->lock);
+    return entry;
+}
+
+/* Release the prefix of a run: the daemon's entry, or the run's own one
+ * (prefix NULL when none was opened). */
+static void release_prefix(const run_env_t *env, warm_prefix_t *entry, pp_context_t *prefix,
+                           snapshot_t *snapshot)
+{
+    if (entry) {
+        pthread_mutex_lock(&env->warm->lock);
+        int last = --entry->users == 0 && entry->dropped;
+        pthread_mutex_unlock(&env->warm->lock);
+        if (last) warm_prefix_free(entry);
+    } else if (prefix) {
+        pp_context_free(prefix);
+        snapshot_close(snapshot);
+    }
+}
+
+/* Run the inputs of a command line; returns 1 if one of them failed. */
+static int run_inputs(int argc, char **argv, const run_env_t *env)
+{
     // Parse command-line options (help, comments-only, directives/macros)
     cli_options_t opt = cli_parse(argc, argv);
 
@@ -53,49 +559,262 @@ static int run_preprocessor(int argc, char **argv)
         return 0;
     }
 
-    // Determine which file to preprocess
-    const char *in_path = get_input_path(argc, argv);
-    if (!in_path) {
+    // Determine which files to preprocess
+    const char **paths = malloc(sizeof(const char *) * (size_t)argc);
+    if (!paths) return 1;
+    int count = collect_input_paths(argc, argv, paths);
+    if (count == 0) {
+        free(paths);
         cli_print_help(argv[0]);
         return 1;
     }
+    if (opt.to_stdout && count > 1) {
+        error(0, PP_ERR_STDOUT_MULTI);
+        free(paths);
+        return 1;
+    }
+    if (opt.snapshot_out && (count > 1 || opt.to_stdout)) {
+        error(0, PP_ERR_SNAPSHOT_OUT_USAGE);
+        free(paths);
+        return 1;
+    }
+    if (opt.max_include_depth < 0) {
+        error(0, PP_ERR_INCLUDE_DEPTH_USAGE);
+        free(paths);
+        return 1;
+    }
 
-    // Buffers for input file, processed output, and output filename
-    buffer_t in, out, out_name;
-    buffer_init(&in);
-    buffer_init(&out);
-    buffer_init(&out_name);
+    // Search directories in command-line order (-isystem ones are searched last)
+    search_path_t search;
+    search_path_init(&search);
+    for (int i = 1; i < argc && opt.search_dirs > 0; i++) {
+        int system;
+        const char *dir = cli_search_dir(argv[i], &system);
+        if (!dir) continue;
+        if (!dir[0] || search_path_add(&search, dir, system) != 0) {
+            error(0, dir[0] ? PP_ERR_OUT_OF_MEMORY : PP_ERR_SEARCH_DIR_USAGE);
+            search_path_free(&search);
+            free(paths);
+            return 1;
+        }
+    }
+    hash128_t search_key = search_path_key(&search);
 
-    // Read input file and compute output filename
-    if (io_read_file(in_path, &in) != 0) return 1;
-    if (io_make_output_name(in_path, &out_name) != 0) return 1;
+    // The prefix snapshot is mapped, validated and applied once; every file
+    // is then forked from that context, sharing its macros read-only (the
+    // daemon keeps it for later requests)
+    snapshot_t snapshot;
+    pp_context_t prefix;
+    const pp_context_t *prefix_ptr = NULL;
+    warm_prefix_t *warm_prefix = NULL;
+    if (opt.snapshot) {
+        if (env->warm) {
+            warm_prefix = warm_prefix_get(env->warm, &opt);
+            if (warm_prefix) prefix_ptr = &warm_prefix->prefix;
+        } else if (open_prefix(&opt, &search, &snapshot, &prefix) == 0) {
+            prefix_ptr = &prefix;
+        }
+        if (!prefix_ptr) {
+            search_path_free(&search);
+            free(paths);
+            return 1;
+        }
+    }
 
-    // Set up preprocessing context
-    pp_context_t ctx;
-    ctx.opt = opt;
-    ctx.current_file = in_path;
-    ctx.current_line = 0;
+    // The cache is optional: when its directory is unusable, run uncached
+    cache_t cache;
+    cache_t *cache_ptr = NULL;
+    if (opt.use_cache && cache_open(&cache, NULL) == 0) cache_ptr = &cache;
 
-    // Compute base directory for resolving relative includes
-    char base_dir[PP_MAX_PATH_LEN];
-    io_compute_base_dir(in_path, base_dir, sizeof(base_dir));
+    file_job_t *jobs = malloc(sizeof(file_job_t) * (size_t)count);
+    if (!jobs) {
+        if (cache_ptr) cache_close(cache_ptr);
+        release_prefix(env, warm_prefix, prefix_ptr ? &prefix : NULL, &snapshot);
+        search_path_free(&search);
+        free(paths);
+        return 1;
+    }
+    // Headers are read ahead on a few I/O threads of their own (runs go on
+    // without read-ahead if they cannot be started). The daemon has them
+    // in its include store after the first request
+    prefetch_t prefetch;
+    prefetch_t *prefetch_ptr = NULL;
+    if (opt.do_directives && !opt.no_prefetch && !env->warm &&
+        prefetch_init(&prefetch, PP_PREFETCH_THREADS, &search) == 0) {
+        prefetch_ptr = &prefetch;
+    }
 
-    // Run the preprocessor (comments, directives, macros)
-    pp_run(&ctx, &in, &out, base_dir);
+    for (int i = 0; i < count; i++) {
+        jobs[i].path = paths[i];
+        jobs[i].opt = &opt;
+        jobs[i].show_name = count > 1;
+        jobs[i].split_workers = 0;
+        jobs[i].cache = cache_ptr;
+        jobs[i].prefix = prefix_ptr;
+        jobs[i].search = &search;
+        jobs[i].search_key = search_key;
+        jobs[i].prefetch = prefetch_ptr;
+        jobs[i].include_store = env->warm ? &env->warm->includes : NULL;
+        jobs[i].out_fd = env->out_fd;
+        jobs[i].err = env->err;
+        jobs[i].rc = 0;
+    }
 
-    // Write processed output to the generated filename
-    io_write_file(out_name.data, &out);
+    // Several inputs: one task per file on a work-stealing pool; each task
+    // owns its context, so files never share state. A single input may
+    // instead be split into chunks (see preprocess_file)
+    int workers = opt.jobs > 0 ? opt.jobs : pool_cpu_count();
+    if (count == 1) {
+        jobs[0].split_workers = workers;
+        workers = 1;
+    }
+    if (workers > count) workers = count;
 
-    buffer_free(&in);
-    buffer_free(&out);
-    buffer_free(&out_name);
+    pool_t pool;
+    if (workers > 1 && pool_create(&pool, workers) == 0) {
+        for (int i = 0; i < count; i++) {
+            if (pool_submit(&pool, file_job_run, &jobs[i]) != 0) file_job_run(&jobs[i]);
+        }
+        pool_wait(&pool);
+        if (opt.do_stats) {
+            fprintf(env->err, PP_FMT_STATS_POOL, pool.nthreads, pool.executed, pool.steals);
+        }
+        pool_destroy(&pool);
+    } else {
+        for (int i = 0; i < count; i++) file_job_run(&jobs[i]);
+    }
+
+    int failed = 0;
+    for (int i = 0; i < count; i++) failed |= jobs[i].rc;
+
+    if (cache_ptr) {
+        cache_close(cache_ptr);
+        if (opt.do_stats) cache_print_stats(cache_ptr, env->err);
+    }
+    if (prefetch_ptr) {
+        prefetch_free(prefetch_ptr);
+        if (opt.do_stats) prefetch_print_stats(prefetch_ptr, env->err);
+    }
+    if (opt.do_stats && search.lookups > 0) search_path_print_stats(&search, env->err);
+
+    release_prefix(env, warm_prefix, prefix_ptr ? &prefix : NULL, &snapshot);
+    search_path_free(&search);
+    free(jobs);
+    free(paths);
+    return failed;
+}
+
+/* Orchestrate CLI parsing, file IO, and preprocessing. */
+static int run_preprocessor(int argc, char **argv, const run_env_t *env)
+{
+    // Errors of the run are counted (and printed) apart from those of other
+    // runs the daemon serves at the same time
+    errors_ctx_t run_errors;
+    errors_ctx_init(&run_errors);
+    run_errors.stream = env->err;
+    errors_ctx_t *prev_errors = errors_bind(&run_errors);
+    int failed = run_inputs(argc, argv, env);
+    errors_bind(prev_errors);
+    return (failed || run_errors.count > 0) ? 1 : 0;
+}
+
+/* Server handler: one -connect request. */
+static int serve_request(int argc, char **argv, const server_io_t *io, void *arg)
+{
+    run_env_t env = {io->out_fd, io->err, (warm_state_t *)arg};
+    return run_preprocessor(argc, argv, &env);
+}
+
+/* The daemon stopped by SIGINT and SIGTERM. */
+static server_t *serving = NULL;
+
+static void stop_serving(int sig)
+{
+    (void)sig;
+    if (serving) server_stop(serving);
+}
+
+/* -serve: run the requests of -connect clients on -jN workers until SIGINT
+ * or SIGTERM. Returns the exit status. */
+static int serve(int argc, char **argv, const cli_options_t *opt)
+{
+    errors_init();
+    for (int i = 1; i < argc; i++) {
+        if (argv[i][0] != PP_CHAR_DASH) {
+            error(0, PP_ERR_SERVE_USAGE);
+            return 1;
+        }
+    }
 
-    return get_error_count() > 0 ? 1 : 0;
-    
+    warm_state_t warm;
+    if (warm_init(&warm) != 0) {
+        error(0, PP_ERR_OUT_OF_MEMORY);
+        return 1;
+    }
+    server_t srv;
+    int rc = server_open(&srv, opt->serve, opt->jobs, serve_request, &warm);
+    if (rc != SERVER_OK) {
+        error(0, "%s: %s", opt->serve,
+              rc == SERVER_ERR_IN_USE ? PP_ERR_SERVE_IN_USE : PP_ERR_SERVE_SOCKET);
+        warm_free(&warm);
+        return 1;
+    }
+
+    serving = &srv;
+    signal(SIGINT, stop_serving);
+    signal(SIGTERM, stop_serving);
+    server_run(&srv);
+    server_close(&srv);
+    serving = NULL;
+
+    if (opt->do_stats) {
+        fprintf(stderr, PP_FMT_STATS_SERVER, srv.served, warm.includes.count, warm.includes.hits,
+                warm.includes.loads, warm.includes.stale, warm.prefix_reuses);
+    }
+    warm_free(&warm);
+    return 0;
 }
 
-//Minimal wrapper for program entry point.
+/* -connect: have the daemon at socket_path run the command line (without
+ * -connect itself). Returns 0 with the exit status in status, or 1 if it
+ * must run here (no input to send, or no daemon took it). */
+static int run_remote(int argc, char **argv, const char *socket_path, int *status)
+{
+    char **args = malloc(sizeof(char *) * ((size_t)argc + 1));
+    if (!args) return 1;
+    int count = 0, inputs = 0;
+    for (int i = 0; i < argc; i++) {
+        if (i > 0 && strncmp(argv[i], PP_FLAG_CONNECT, strlen(PP_FLAG_CONNECT)) == 0) continue;
+        if (i > 0 && argv[i][0] != PP_CHAR_DASH) inputs++;
+        args[count++] = argv[i];
+    }
+    args[count] = NULL;
+
+    int rc = 1;
+    if (inputs > 0) {
+        int src = server_request(socket_path, count, args, STDOUT_FILENO, STDERR_FILENO, status);
+        if (src == SERVER_ERR_LOST) {
+            // Part of the work may be done: running it again here could repeat it
+            error(0, "%s: %s", socket_path, PP_ERR_CONNECT_LOST);
+            *status = 1;
+        }
+        rc = src == SERVER_ERR_SOCKET;
+    }
+    free(args);
+    return rc;
+}
+
+// Program entry point: daemon, client of a daemon, or a run of its own.
 int main(int argc, char **argv)
 {
-    return run_preprocessor(argc, argv);
+    cli_options_t opt = cli_parse(argc, argv);
+    if (opt.serve && !opt.do_help) return serve(argc, argv, &opt);
+
+    int status;
+    if (opt.connect && !opt.do_help && run_remote(argc, argv, opt.connect, &status) == 0) {
+        return status;
+    }
+
+    run_env_t env = {STDOUT_FILENO, stderr, NULL};
+    return run_preprocessor(argc, argv, &env);
 }
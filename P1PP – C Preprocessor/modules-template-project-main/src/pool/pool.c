@@ -0,0 +1,271 @@
+/* -----------------------------------------------------------------------------
+ * Program: C Preprocessor (Practice 1)
+ * Description:
+ *     This module implements the work-stealing thread pool declared in pool.h.
+ *
+ * - Deque helpers: push at the bottom, pop the bottom (owner, LIFO) or
+ *   steal the top (thieves, FIFO).
+ * - `worker_main`: Own deque first, then steal, then sleep until work arrives.
+ *
+ * Usage:
+ *     Called by main to preprocess several input files in parallel.
+ *
+ * Status:
+ *     Active - on _WIN32 (no pthreads) tasks run inline in pool_submit.
+ * -------------------------------------------------------------------------- */
+
+#include <stdlib.h>
+#ifndef _WIN32
+#include <sched.h>
+#include <unistd.h>
+#endif
+
+#include "pool.h"
+
+// Initial capacity of each worker deque.
+#define POOL_DEQUE_INITIAL 64
+
+// Pool and worker index of the calling thread (NULL / -1 outside a pool).
+static _Thread_local pool_t *worker_pool = NULL;
+static _Thread_local int worker_index = -1;
+
+// Number of online CPUs.
+int pool_cpu_count(void)
+{
+#ifndef _WIN32
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+#else
+    return 1;
+#endif
+}
+
+#ifndef _WIN32
+
+// Append a task at the bottom of a deque (caller holds q->lock).
+static int deque_push(pool_deque_t *q, pool_task_t task)
+{
+    if (q->count == q->capacity) {
+        int new_capacity = q->capacity ? q->capacity * 2 : POOL_DEQUE_INITIAL;
+        pool_task_t *items = malloc(sizeof(pool_task_t) * (size_t)new_capacity);
+        if (!items) return 1;
+        for (int i = 0; i < q->count; i++) items[i] = q->items[(q->head + i) % q->capacity];
+        free(q->items);
+        q->items = items;
+        q->head = 0;
+        q->capacity = new_capacity;
+    }
+    q->items[(q->head + q->count) % q->capacity] = task;
+    q->count++;
+    return 0;
+}
+
+// Take the newest task (owner side).
+static int deque_pop_bottom(pool_deque_t *q, pool_task_t *out)
+{
+    pthread_mutex_lock(&q->lock);
+    int ok = q->count > 0;
+    if (ok) {
+        q->count--;
+        *out = q->items[(q->head + q->count) % q->capacity];
+    }
+    pthread_mutex_unlock(&q->lock);
+    return ok;
+}
+
+// Take the oldest task (thief side).
+static int deque_steal_top(pool_deque_t *q, pool_task_t *out)
+{
+    pthread_mutex_lock(&q->lock);
+    int ok = q->count > 0;
+    if (ok) {
+        *out = q->items[q->head];
+        q->head = (q->head + 1) % q->capacity;
+        q->count--;
+    }
+    pthread_mutex_unlock(&q->lock);
+    return ok;
+}
+
+// Find work for worker id: own deque first, then the other deques in turn.
+static int find_task(pool_t *pool, int id, pool_task_t *out)
+{
+    if (deque_pop_bottom(&pool->queues[id], out)) return 1;
+    for (int k = 1; k < pool->nthreads; k++) {
+        int victim = (id + k) % pool->nthreads;
+        if (deque_steal_top(&pool->queues[victim], out)) {
+            pthread_mutex_lock(&pool->lock);
+            pool->steals++;
+            pthread_mutex_unlock(&pool->lock);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Worker thread body.
+static void *worker_main(void *arg)
+{
+    pool_worker_t *self = (pool_worker_t *)arg;
+    pool_t *pool = self->pool;
+    worker_pool = pool;
+    worker_index = self->id;
+
+    for (;;) {
+        pool_task_t task;
+        if (find_task(pool, self->id, &task)) {
+            pthread_mutex_lock(&pool->lock);
+            pool->queued--;
+            pthread_mutex_unlock(&pool->lock);
+
+            task.fn(task.arg);
+
+            pthread_mutex_lock(&pool->lock);
+            pool->executed++;
+            if (--pool->pending == 0) pthread_cond_broadcast(&pool->done_cond);
+            pthread_mutex_unlock(&pool->lock);
+            continue;
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        // queued > 0 with nothing found: a submitter is between counting the
+        // task and pushing it; retry shortly instead of sleeping
+        if (pool->queued > 0) {
+            pthread_mutex_unlock(&pool->lock);
+            sched_yield();
+            continue;
+        }
+        if (pool->shutdown) {
+            pthread_mutex_unlock(&pool->lock);
+            break;
+        }
+        pthread_cond_wait(&pool->work_cond, &pool->lock);
+        pthread_mutex_unlock(&pool->lock);
+    }
+    return NULL;
+}
+
+#endif
+
+// Start the worker threads.
+int pool_create(pool_t *pool, int nthreads)
+{
+    pool->queues = NULL;
+    pool->nthreads = 0;
+    pool->pending = 0;
+    pool->queued = 0;
+    pool->next_queue = 0;
+    pool->shutdown = 0;
+    pool->executed = 0;
+    pool->steals = 0;
+#ifndef _WIN32
+    if (nthreads <= 0) nthreads = pool_cpu_count();
+
+    pool->threads = calloc((size_t)nthreads, sizeof(pthread_t));
+    pool->workers = calloc((size_t)nthreads, sizeof(pool_worker_t));
+    pool->queues = calloc((size_t)nthreads, sizeof(pool_deque_t));
+    if (!pool->threads || !pool->workers || !pool->queues) {
+        free(pool->threads);
+        free(pool->workers);
+        free(pool->queues);
+        return 1;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_cond, NULL);
+    pthread_cond_init(&pool->done_cond, NULL);
+    for (int i = 0; i < nthreads; i++) pthread_mutex_init(&pool->queues[i].lock, NULL);
+
+    // Deques must exist before any worker can try to steal
+    pool->nthreads = nthreads;
+    for (int i = 0; i < nthreads; i++) {
+        pool->workers[i].pool = pool;
+        pool->workers[i].id = i;
+        if (pthread_create(&pool->threads[i], NULL, worker_main, &pool->workers[i]) != 0) {
+            // Run with the workers that did start
+            for (int j = i; j < nthreads; j++) pthread_mutex_destroy(&pool->queues[j].lock);
+            pool->nthreads = i;
+            break;
+        }
+    }
+    if (pool->nthreads == 0) {
+        pool_destroy(pool);
+        return 1;
+    }
+#else
+    (void)nthreads;
+#endif
+    return 0;
+}
+
+// Queue a task on the caller's own deque (workers) or round-robin (others).
+int pool_submit(pool_t *pool, pool_task_fn fn, void *arg)
+{
+#ifndef _WIN32
+    pool_task_t task = {fn, arg};
+
+    pthread_mutex_lock(&pool->lock);
+    int q = (worker_pool == pool) ? worker_index : pool->next_queue++ % pool->nthreads;
+    pool->pending++;
+    pool->queued++;
+    pthread_mutex_unlock(&pool->lock);
+
+    pthread_mutex_lock(&pool->queues[q].lock);
+    int rc = deque_push(&pool->queues[q], task);
+    pthread_mutex_unlock(&pool->queues[q].lock);
+
+    pthread_mutex_lock(&pool->lock);
+    if (rc != 0) {
+        pool->pending--;
+        pool->queued--;
+        if (pool->pending == 0) pthread_cond_broadcast(&pool->done_cond);
+    } else {
+        pthread_cond_signal(&pool->work_cond);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return rc;
+#else
+    fn(arg);
+    pool->executed++;
+    return 0;
+#endif
+}
+
+// Wait until every task has finished.
+void pool_wait(pool_t *pool)
+{
+#ifndef _WIN32
+    pthread_mutex_lock(&pool->lock);
+    while (pool->pending > 0) pthread_cond_wait(&pool->done_cond, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+#else
+    (void)pool;
+#endif
+}
+
+// Stop and join the workers, then release all memory.
+void pool_destroy(pool_t *pool)
+{
+#ifndef _WIN32
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&pool->work_cond);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->nthreads; i++) pthread_join(pool->threads[i], NULL);
+
+    for (int i = 0; i < pool->nthreads; i++) {
+        pthread_mutex_destroy(&pool->queues[i].lock);
+        free(pool->queues[i].items);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work_cond);
+    pthread_cond_destroy(&pool->done_cond);
+    free(pool->threads);
+    free(pool->workers);
+    pool->threads = NULL;
+    pool->workers = NULL;
+#endif
+    free(pool->queues);
+    pool->queues = NULL;
+    pool->nthreads = 0;
+}
@@ -0,0 +1,95 @@
+/* -----------------------------------------------------------------------------
+ * Program: C Preprocessor (Practice 1)
+ * Description:
+ *     This module provides a work-stealing thread pool.
+ *
+ * - `pool_create` / `pool_destroy`: Start and join the worker threads.
+ * - `pool_submit`: Queue a task (workers push to their own deque, other
+ *   threads spread tasks round-robin).
+ * - `pool_wait`: Block until every submitted task has finished.
+ * - `pool_cpu_count`: Number of online CPUs.
+ *
+ * Usage:
+ *     Each worker owns a deque: it pops its newest task first and, when its
+ *     deque is empty, steals the oldest task of another worker. Tasks may
+ *     submit further tasks.
+ *
+ * Status:
+ *     Active - runs one task per input file in the CLI. Deques are guarded
+ *     by a mutex each, which is cheap at file granularity.
+ * -------------------------------------------------------------------------- */
+
+#ifndef POOL_H
+#define POOL_H
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+/* Task entry point. */
+typedef void (*pool_task_fn)(void *arg);
+
+/* One queued task. */
+typedef struct {
+    pool_task_fn fn;
+    void *arg;
+} pool_task_t;
+
+/* Per-worker double-ended queue (ring buffer). */
+typedef struct {
+#ifndef _WIN32
+    pthread_mutex_t lock;
+#endif
+    pool_task_t *items;
+    int head;
+    int count;
+    int capacity;
+} pool_deque_t;
+
+struct pool;
+
+/* Start argument of one worker thread. */
+typedef struct {
+    struct pool *pool;
+    int id;
+} pool_worker_t;
+
+/* Thread pool state. */
+typedef struct pool {
+#ifndef _WIN32
+    pthread_t *threads;
+    pool_worker_t *workers;
+    /* Protects the counters below and the two condition variables. */
+    pthread_mutex_t lock;
+    pthread_cond_t work_cond;
+    pthread_cond_t done_cond;
+#endif
+    pool_deque_t *queues;
+    int nthreads;
+    /* Tasks submitted and not finished / not yet taken by a worker. */
+    long pending;
+    long queued;
+    /* Next deque used for submissions from outside the pool. */
+    int next_queue;
+    int shutdown;
+    /* Statistics. */
+    long executed;
+    long steals;
+} pool_t;
+
+/* Start nthreads workers (<= 0 means one per CPU). Returns 0 on success. */
+int pool_create(pool_t *pool, int nthreads);
+
+/* Queue fn(arg). Returns 0 on success, 1 if out of memory. */
+int pool_submit(pool_t *pool, pool_task_fn fn, void *arg);
+
+/* Wait until all submitted tasks (including ones they submit) are done. */
+void pool_wait(pool_t *pool);
+
+/* Stop and join the workers (queued tasks are finished first). */
+void pool_destroy(pool_t *pool);
+
+/* Number of online CPUs (at least 1). */
+int pool_cpu_count(void);
+
+#endif
@@ -5,7 +5,12 @@
  * Description:
  *     This module defines the shared preprocessing context structure.
  *
- * - `pp_context_t`: Stores options, current file/line, error count, and state.
+ * - `pp_context_t`: Stores options, current file/line, error count, and state
+ *   (including the per-run include cache, the line scratch arena, the
+ *   optional streaming output sink and the run's error count). Contexts share
+ *   nothing but a read-only prefix (snapshot or forked parent) and the
+ *   thread-safe search path, read-ahead and include store, so several runs
+ *   can proceed on different threads.
  *
  * Usage:
  *     Included by core, directives, and macro modules to share run state.
@@ -22,9 +27,44 @@
 #include "comments/comments.h"
 #include "macros/macros.h"
 #include "directives/directives.h"
+#include "include_cache/include_cache.h"
+#include "arena/arena.h"
+#include "sink/sink.h"
+#include "errors/errors.h"
+#include "pool/pool.h"
+#include "cache/cache.h"
+#include "snapshot/snapshot.h"
+#include "search_path/search_path.h"
+#include "prefetch/prefetch.h"
 
-/* Shared state for a preprocessing run. */
+/* One file being processed: the input or an included file. */
 typedef struct {
+    /* Contents of the file. */
+    const char *data;
+    long len;
+    /* Cached included file with its line index (NULL for the input). */
+    include_entry_t *entry;
+    /* Next byte to process (input) or next line (included file). */
+    long pos;
+    int next_line;
+    /* Directory for nested includes, and the name used in errors. */
+    const char *base_dir;
+    const char *file;
+    /* Lines consumed when a nested file was entered (current_line is
+     * restored from it when that file is done). */
+    int line;
+    /* Macro table generation when the file was entered (cycle check). */
+    long generation;
+    /* Frame that had entry open before this one (-1 if none). */
+    int prev_active;
+    /* The #include line, passed to the comment tracker once the file is done
+     * (NULL for the input). */
+    const char *include_line;
+    long include_line_len;
+} pp_frame_t;
+
+/* Shared state for a preprocessing run. */
+typedef struct pp_context {
     /* Parsed CLI options for this run. */
     cli_options_t opt;
 
@@ -39,8 +79,69 @@ typedef struct {
     /* Macro table for #define storage and expansion. */
     macro_table_t macros;
     
-    /* Conditional compilation stack for #ifdef/#endif. */
+    /* Conditional compilation stack for #if/#ifdef/#elif/#else/#endif. */
     ifdef_stack_t ifdef_stack;
+
+    /* Compiled #if/#elif conditions keyed by source line address (included
+     * files stay loaded for the run, so each condition is compiled once). */
+    expr_cache_t conditions;
+
+    /* Included files loaded during this run, keyed by device + inode. */
+    include_cache_t includes;
+
+    /* Files being processed, the input at the bottom and the innermost
+     * #include on top (the active-include set is kept in the include cache,
+     * see include_entry_t.active_frame). */
+    pp_frame_t *frames;
+    int frame_count;
+    int frame_capacity;
+
+    /* Tokens of the current line (directives on only): started when the
+     * line is read, completed if its macros are expanded. */
+    token_list_t line_tokens;
+
+    /* Scratch memory for line-scoped temporaries, released after every line. */
+    arena_t scratch;
+
+    /* Streaming destination drained after every line (NULL when pp_run
+     * collects the whole output in a buffer). */
+    sink_t *sink;
+
+    /* Errors reported during the run (bound to the running thread). */
+    errors_ctx_t errors;
+
+    /* Optional thread pool for splitting one large input (set by the caller;
+     * NULL runs serially). */
+    pool_t *pool;
+
+    /* Optional list receiving every file included by the run, with its
+     * content hash (set by the caller for the persistent cache; NULL skips). */
+    cache_deps_t *deps;
+
+    /* Optional prefix header state the run starts from (-snapshot; NULL
+     * starts empty). Shared read-only between runs. */
+    const snapshot_t *snapshot;
+
+    /* Context this one was forked from (NULL if none): the run starts from
+     * the macros and #if state its pp_run_prefix left, shared read-only. */
+    const struct pp_context *parent;
+
+    /* Optional state captured at the end of an error-free run (-snapshot-out;
+     * NULL skips). */
+    snapshot_state_t *snapshot_out;
+
+    /* Optional -I / -isystem search path, shared with other runs (NULL:
+     * quoted includes resolve next to the including file only and angled
+     * ones are kept as written). */
+    search_path_t *search;
+
+    /* Optional include read-ahead, shared with other runs (NULL: headers
+     * are only read when their #include is reached). */
+    prefetch_t *prefetch;
+
+    /* Optional store of included files kept across runs (-serve; NULL: every
+     * run reads its headers). */
+    include_store_t *include_store;
 } pp_context_t;
 
 #endif
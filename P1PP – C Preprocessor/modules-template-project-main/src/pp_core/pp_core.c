@@ -7,9 +7,26 @@
  *
  * - `pp_run`: Executes preprocessing (comments, directives, macros) over input.
  * - `process_line`: Applies comment handling, directives, and macro expansion.
- * - `handle_directive_line`: Executes #include/#define/#ifdef handling.
+ * - `handle_directive_line`: Executes #include/#define/#ifdef handling and
+ *   skips redundant inclusions of guarded / #pragma once headers.
+ * - `push_frame` / `pop_frame`: Enter and leave an included file on the
+ *   explicit include stack (ctx->frames), with the depth and cycle checks.
+ * - `resolve_include`: Finds an include through the -I / -isystem search path
+ *   (ctx->search) when one is set.
+ * - Headers loaded for the first time in a run are reported to the include
+ *   read-ahead (ctx->prefetch), which looks further ahead from them.
  * - `handle_non_directive_line`: Handles macro expansion or raw output.
  * - `build_line_buffer`: Builds a line buffer with/without comment removal.
+ * - `pp_run_frames`: Processes the top file of the include stack line by line
+ *   until the stack is empty (included files use their line index).
+ * - `pp_process_comment_chunks`: Comments-only mode split across the thread
+ *   pool for large inputs (chunk outputs are stitched in order).
+ * - `pp_print_stats`: Prints run statistics.
+ *
+ * Line-scoped temporaries (line buffer, directive output, include name,
+ * expansion) are arena-backed buffers released once per line.
+ * A run may start from a prefix header snapshot (ctx->snapshot) and capture
+ * its own final state for one (ctx->snapshot_out).
  *
  * Usage:
  *     Called by the main application after input is loaded into a buffer.
@@ -24,31 +41,35 @@
 #include "macros/macros.h"
 #include "errors/errors.h"
 #include "io/io.h"
+#include "include_cache/include_cache.h"
+#include "scan/scan.h"
+#include "pool/pool.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <ctype.h>
+#include <string.h>
+
+// Include stack frames allocated at the start of a run (grown by doubling).
+#define INITIAL_FRAMES 16
 
-// Check if line starts with a directive marker (first non-space is '#').
-static int is_directive_line(const char *line, long line_len)
+// Resolve an include name into out. Without a search path, quoted names are
+// taken relative to base_dir and angled ones are never found. A quoted name
+// found nowhere resolves to its base_dir path, so the open error names it.
+static int resolve_include(pp_context_t *ctx, const char *base_dir, const char *name,
+                           int angled, char *out, size_t size)
 {
-    // Scan through the line character by character
-    for (long i = 0; i < line_len; i++) {
-        // If we find a '#' before any non-whitespace, it's a directive
-        if (line[i] == PP_CHAR_HASH) return 1;
-        // If we hit a non-whitespace character that isn't '#', it's not a directive
-        if (!isspace((unsigned char)line[i])) return 0;
-    }
-    // Empty or whitespace-only line is not a directive
-    return 0;
+    if (ctx->search) {
+        int rc = search_path_find(ctx->search, base_dir, name, angled, out, size, ctx->deps);
+        if (rc != SEARCH_NOT_FOUND || angled) return rc;
+    } else if (angled) {
+        return SEARCH_NOT_FOUND;
+    }
+    // If we have a base directory, prepend it to the include filename
+    int n = (base_dir && base_dir[0]) ? snprintf(out, size, "%s/%s", base_dir, name)
+                                      : snprintf(out, size, "%s", name);
+    return (n < 0 || (size_t)n >= size) ? SEARCH_ERR_TOO_LONG : SEARCH_FOUND;
 }
 
-// Process a full buffer with the current context state (no re-init).
-static int pp_process_buffer(pp_context_t *ctx,
-                             const buffer_t *input,
-                             buffer_t *output,
-                             const char *base_dir,
-                             int err_code,
-                             int err_code_last);
-
 // Append to a buffer and report out-of-memory errors.
 static int append_or_report(pp_context_t *ctx, buffer_t *dst, const char *data, long len, int err_code)
 {
@@ -62,13 +83,44 @@ static int append_or_report(pp_context_t *ctx, buffer_t *dst, const char *data,
     return PP_RUN_SUCCESS;
 }
 
-// Build the current line buffer with or without comment removal.
+// Build the current line buffer with or without comment removal; *text is
+// the line to work on from then on. With directives on, ctx->line_tokens is
+// started on the line: enough to find a leading '#' and the head of a
+// directive; a code line is lexed completely only if its macros are expanded
+// (handle_non_directive_line). Without comment removal a code line is used
+// in place, only a directive line (which must end in NUL) is copied.
 static int build_line_buffer(pp_context_t *ctx,
                              const char *line_data,
                              long line_len,
                              buffer_t *line_buf,
+                             const char **text,
+                             long *text_len,
                              int err_code)
 {
+    *text = line_data;
+    *text_len = line_len;
+    if (ctx->opt.do_directives) {
+        token_list_t *tokens = &ctx->line_tokens;
+        tokens_list_reset(tokens);
+        if (ctx->opt.do_comments) {
+            if (comments_process_line_tokens(line_data, line_len, line_buf, &ctx->comment_state,
+                                             tokens) != 0) {
+                error(ctx->current_line, "%s: %s", ctx->current_file,
+                      tokens->failed ? PP_ERR_OUT_OF_MEMORY : PP_ERR_COMMENTS_PROCESS);
+                return err_code;
+            }
+            *text = line_buf->data;
+            *text_len = line_buf->len;
+            return PP_RUN_SUCCESS;
+        }
+        tokens_list_feed(tokens, line_data, line_len);
+        if (tokens->failed) {
+            error(ctx->current_line, "%s: %s", ctx->current_file, PP_ERR_OUT_OF_MEMORY);
+            return err_code;
+        }
+        if (tokens->hash < 0) return PP_RUN_SUCCESS;
+    }
+
     // If comment processing is enabled, strip out comments from this line
     if (ctx->opt.do_comments) {
         // Call the comment processor to remove C-style and C++ comments
@@ -77,11 +129,90 @@ static int build_line_buffer(pp_context_t *ctx,
             error(ctx->current_line, "%s: %s", ctx->current_file, PP_ERR_COMMENTS_PROCESS);
             return err_code;
         }
+        *text = line_buf->data;
+        *text_len = line_buf->len;
         return PP_RUN_SUCCESS;
     }
 
     // If comment processing is disabled, just copy the line as-is
-    return append_or_report(ctx, line_buf, line_data, line_len, err_code);
+    int rc = append_or_report(ctx, line_buf, line_data, line_len, err_code);
+    *text = line_buf->data;
+    *text_len = line_buf->len;
+    return rc;
+}
+
+// True if including entry again cannot produce any code.
+static int include_is_redundant(const pp_context_t *ctx, const include_entry_t *entry)
+{
+    // #pragma once: only the first inclusion counts
+    if (entry->once && entry->include_count > 0) return 1;
+    // Include guard: the whole file sits inside #ifndef guard ... #endif
+    return entry->guard && macros_is_defined(&ctx->macros, entry->guard, entry->guard_len);
+}
+
+// Enter entry, included by the line in include_line: its lines are processed
+// next, then those after the #include. Fails past the include depth limit, and
+// when entry is already open and no macro was defined since it was entered
+// (processing it again would reach this same #include forever).
+static int push_frame(pp_context_t *ctx, include_entry_t *entry,
+                      const char *include_line, long include_line_len, int err_code)
+{
+    int limit = ctx->opt.max_include_depth > 0 ? ctx->opt.max_include_depth : PP_MAX_INCLUDE_DEPTH;
+    if (ctx->frame_count > limit) {
+        error(ctx->current_line, "%s: %s: %s", ctx->current_file, PP_ERR_INCLUDE_DEPTH, entry->path);
+        return err_code;
+    }
+    if (entry->active_frame >= 0 &&
+        ctx->frames[entry->active_frame].generation == ctx->macros.generation) {
+        error(ctx->current_line, "%s: %s: %s", ctx->current_file, PP_ERR_INCLUDE_CYCLE, entry->path);
+        return err_code;
+    }
+    if (ctx->frame_count == ctx->frame_capacity) {
+        int capacity = ctx->frame_capacity * 2;
+        pp_frame_t *frames = realloc(ctx->frames, sizeof(pp_frame_t) * (size_t)capacity);
+        if (!frames) {
+            error(ctx->current_line, "%s: %s", ctx->current_file, PP_ERR_OUT_OF_MEMORY);
+            return err_code;
+        }
+        ctx->frames = frames;
+        ctx->frame_capacity = capacity;
+    }
+
+    // The including file resumes at the line after the #include
+    ctx->frames[ctx->frame_count - 1].line = ctx->current_line;
+    pp_frame_t *f = &ctx->frames[ctx->frame_count];
+    memset(f, 0, sizeof(*f));
+    f->data = entry->bytes.data;
+    f->len = entry->bytes.len;
+    f->entry = entry;
+    f->base_dir = entry->base_dir;
+    f->file = entry->path;
+    f->generation = ctx->macros.generation;
+    f->prev_active = entry->active_frame;
+    f->include_line = include_line;
+    f->include_line_len = include_line_len;
+    entry->active_frame = ctx->frame_count++;
+    entry->include_count++;
+
+    ctx->current_file = entry->path;
+    ctx->current_line = 0;
+    return PP_RUN_SUCCESS;
+}
+
+// Leave the top file and continue the one that included it.
+static void pop_frame(pp_context_t *ctx)
+{
+    pp_frame_t *f = &ctx->frames[--ctx->frame_count];
+    if (f->entry) f->entry->active_frame = f->prev_active;
+    if (ctx->frame_count == 0) return;
+
+    const pp_frame_t *parent = &ctx->frames[ctx->frame_count - 1];
+    ctx->current_file = parent->file;
+    ctx->current_line = parent->line;
+    // If comment removal is disabled, the #include line itself is tracked too
+    if (f->include_line && !ctx->opt.do_comments) {
+        comments_update_state(f->include_line, f->include_line_len, &ctx->comment_state);
+    }
 }
 
 // Handle a directive line (if enabled) and append directive output if needed.
@@ -98,18 +229,17 @@ static int handle_directive_line(pp_context_t *ctx,
     // Initially mark as not handled
     *handled = 0;
     // Skip directive processing if: directives are disabled, we're in a block comment,
-    // or this line doesn't start with '#'
-    if (!ctx->opt.do_directives || start_in_block_comment ||
-        !is_directive_line(line_buf->data, line_buf->len)) {
+    // or this line doesn't start with '#' (found while the line was lexed)
+    if (!ctx->opt.do_directives || start_in_block_comment || ctx->line_tokens.hash < 0) {
         return PP_RUN_SUCCESS;
     }
 
     // We have a directive to process, mark it as handled
     *handled = 1;
     buffer_t directive_output;
-    buffer_init(&directive_output);
+    buffer_init_arena(&directive_output, &ctx->scratch);
     buffer_t include_name;
-    buffer_init(&include_name);
+    buffer_init_arena(&include_name, &ctx->scratch);
 
     // Parse and execute the directive (#include, #define, #ifdef, etc.)
     int result = directives_process_line(line_buf->data, line_buf->len,
@@ -119,50 +249,57 @@ static int handle_directive_line(pp_context_t *ctx,
                                          ctx->opt.do_comments,
                                          &ctx->comment_state,
                                          &directive_output,
-                                         &include_name);
-
-    // If this is an #include directive, we need to recursively process the included file
-    if (result == DIR_INCLUDE && include_name.len > 0) {
-        // Build the full path to the included file
-        char full_path[PP_MAX_PATH_LEN];
-        int path_len;
-        // If we have a base directory, prepend it to the include filename
-        if (base_dir && base_dir[0]) {
-            path_len = snprintf(full_path, sizeof(full_path), "%s/%s", base_dir, include_name.data);
-        } else {
-            // Otherwise, use the include name as-is
-            path_len = snprintf(full_path, sizeof(full_path), "%s", include_name.data);
-        }
-        // Check if the path is too long for our buffer
-        if (path_len < 0 || path_len >= (int)sizeof(full_path)) {
-            error(ctx->current_line, "%s: Include path too long: %s", ctx->current_file, include_name.data);
+                                         &include_name,
+                                         &ctx->conditions, line_data,
+                                         &ctx->line_tokens);
+
+    // Resolve the name of an #include; an angled one found nowhere is kept as written
+    char full_path[PP_MAX_PATH_LEN];
+    int found = SEARCH_NOT_FOUND;
+    if ((result == DIR_INCLUDE || result == DIR_INCLUDE_ANGLED) && include_name.len > 0) {
+        found = resolve_include(ctx, base_dir, include_name.data, result == DIR_INCLUDE_ANGLED,
+                                full_path, sizeof(full_path));
+        if (found == SEARCH_ERR_TOO_LONG || found == SEARCH_ERR_MEMORY) {
+            if (found == SEARCH_ERR_TOO_LONG) {
+                error(ctx->current_line, "%s: Include path too long: %s", ctx->current_file,
+                      include_name.data);
+            } else {
+                error(ctx->current_line, "%s: %s", ctx->current_file, PP_ERR_OUT_OF_MEMORY);
+            }
             buffer_free(&include_name);
             buffer_free(&directive_output);
             return err_code;
         }
+        if (found == SEARCH_NOT_FOUND) result = DIR_OK;
+    }
 
-        // Read the contents of the included file into a buffer
-        buffer_t included;
-        buffer_init(&included);
-        if (io_read_file(full_path, &included) != 0) {
-            buffer_free(&included);
+    // An #include opens the file on the include stack; its lines come next
+    if (found == SEARCH_FOUND) {
+
+        // Fetch the included file from the per-run cache (read and indexed once)
+        long misses = ctx->includes.misses;
+        include_entry_t *entry = include_cache_get(&ctx->includes, full_path);
+        if (!entry) {
             buffer_free(&include_name);
             buffer_free(&directive_output);
             return err_code;
         }
+        if (ctx->prefetch && ctx->includes.misses != misses) prefetch_note(ctx->prefetch, full_path);
 
-        // Extract the directory part of the included file's path for nested includes
-        char included_base_dir[PP_MAX_PATH_LEN];
-        io_compute_base_dir(full_path, included_base_dir, sizeof(included_base_dir));
-        // Recursively preprocess the included file with the same context
-        int rc = pp_process_buffer(ctx, &included, output, included_base_dir, err_code, err_code);
-        buffer_free(&included);
-        // Check if processing the included file failed
-        if (rc != PP_RUN_SUCCESS) {
+        // Multiple-include optimization: a guarded header whose guard is defined,
+        // or a #pragma once header seen before, would produce no code; skip it
+        if (include_is_redundant(ctx, entry)) {
+            ctx->includes.guard_skips++;
             buffer_free(&include_name);
             buffer_free(&directive_output);
-            return rc;
+            return PP_RUN_SUCCESS;
         }
+
+        // The rest of this line's handling happens when the file is done
+        // (see pop_frame)
+        buffer_free(&include_name);
+        buffer_free(&directive_output);
+        return push_frame(ctx, entry, line_data, line_len, err_code);
     } else if (result == DIR_OK && directive_output.len > 0) {
         // For other directives (like #define output), append their result to the output
         if (append_or_report(ctx, output, directive_output.data,
@@ -187,7 +324,8 @@ static int handle_directive_line(pp_context_t *ctx,
 
 // Handle macro expansion or raw output for non-directive lines.
 static int handle_non_directive_line(pp_context_t *ctx,
-                                     const buffer_t *line_buf,
+                                     const char *text,
+                                     long text_len,
                                      const char *line_data,
                                      long line_len,
                                      buffer_t *output,
@@ -195,26 +333,27 @@ static int handle_non_directive_line(pp_context_t *ctx,
 {
     // If directives are enabled and we're not in a skipped #ifdef block, expand macros
     if (ctx->opt.do_directives && ifdef_should_include(&ctx->ifdef_stack)) {
-        // Create a buffer to hold the macro-expanded version of the line
-        buffer_t expanded;
-        buffer_init(&expanded);
-
-        // Replace all macro invocations with their defined values
-        if (macros_expand_line(&ctx->macros, line_buf->data, line_buf->len, &expanded) != 0) {
-            error(ctx->current_line, "%s: %s", ctx->current_file, PP_ERR_MACRO_EXPANSION);
-            buffer_free(&expanded);
+        // Replace all macro invocations with their defined values, appending straight
+        // to the output (a line without macros is copied in one piece); the
+        // line's tokens were started by build_line_buffer
+        tokens_list_finish(&ctx->line_tokens, text, text_len);
+        if (ctx->line_tokens.failed) {
+            error(ctx->current_line, "%s: %s", ctx->current_file, PP_ERR_OUT_OF_MEMORY);
             return err_code;
         }
-
-        // Append the expanded line to the output
-        if (append_or_report(ctx, output, expanded.data, expanded.len, err_code) != PP_RUN_SUCCESS) {
-            buffer_free(&expanded);
+        int rc = macros_expand_tokens(&ctx->macros, text, text_len, &ctx->line_tokens, output);
+        if (rc == MACROS_ERR_ARGS) {
+            error(ctx->current_line, "%s: %s", ctx->current_file, PP_ERR_MACRO_ARGS);
+        } else if (rc == MACROS_ERR_DEPTH) {
+            error(ctx->current_line, "%s: %s", ctx->current_file, PP_ERR_MACRO_DEPTH);
+            return err_code;
+        } else if (rc != MACROS_OK) {
+            error(ctx->current_line, "%s: %s", ctx->current_file, PP_ERR_MACRO_EXPANSION);
             return err_code;
         }
-        buffer_free(&expanded);
     } else if (!ctx->opt.do_directives || ifdef_should_include(&ctx->ifdef_stack)) {
         // No macro expansion needed - just output the line as processed
-        if (append_or_report(ctx, output, line_buf->data, line_buf->len, err_code) != PP_RUN_SUCCESS) {
+        if (append_or_report(ctx, output, text, text_len, err_code) != PP_RUN_SUCCESS) {
             return err_code;
         }
     }
@@ -236,16 +375,20 @@ static int process_line(pp_context_t *ctx,
                         const char *base_dir,
                         int err_code)
 {
-    // Create a temporary buffer for this line
+    // Every temporary of this line comes from the scratch arena and is
+    // released in one step when the line is done
+    arena_mark_t mark = arena_mark(&ctx->scratch);
     buffer_t line_buf;
-    buffer_init(&line_buf);
+    buffer_init_arena(&line_buf, &ctx->scratch);
 
     // Remember if we started this line inside a block comment
     int start_in_block_comment = ctx->comment_state.in_block_comment;
     // Build the line buffer, potentially removing comments
-    int rc = build_line_buffer(ctx, line_data, line_len, &line_buf, err_code);
+    const char *text;
+    long text_len;
+    int rc = build_line_buffer(ctx, line_data, line_len, &line_buf, &text, &text_len, err_code);
     if (rc != PP_RUN_SUCCESS) {
-        buffer_free(&line_buf);
+        arena_release(&ctx->scratch, mark);
         return rc;
     }
 
@@ -254,103 +397,600 @@ static int process_line(pp_context_t *ctx,
     rc = handle_directive_line(ctx, &line_buf, line_data, line_len,
                                output, base_dir, start_in_block_comment, err_code, &handled);
     if (rc != PP_RUN_SUCCESS) {
-        buffer_free(&line_buf);
+        arena_release(&ctx->scratch, mark);
         return rc;
     }
 
     // If it wasn't a directive, handle it as a regular code line (with potential macro expansion)
     if (!handled) {
-        rc = handle_non_directive_line(ctx, &line_buf, line_data, line_len, output, err_code);
+        rc = handle_non_directive_line(ctx, text, text_len, line_data, line_len, output, err_code);
         if (rc != PP_RUN_SUCCESS) {
-            buffer_free(&line_buf);
+            arena_release(&ctx->scratch, mark);
             return rc;
         }
     }
 
-    buffer_free(&line_buf);
+    arena_release(&ctx->scratch, mark);
+
+    // When streaming, hand finished lines to the sink once its buffer is full
+    if (ctx->sink && sink_maybe_flush(ctx->sink) != 0) {
+        error(ctx->current_line, "%s: %s", ctx->current_file, PP_ERR_OUTPUT_WRITE);
+        return err_code;
+    }
     return PP_RUN_SUCCESS;
 }
 
-// Process a full buffer with current context state (no re-initialization).
-static int pp_process_buffer(pp_context_t *ctx,
-                             const buffer_t *input,
-                             buffer_t *output,
-                             const char *base_dir,
-                             int err_code,
-                             int err_code_last)
+// Comments-only mode: strip comments from large newline-terminated spans.
+// The comment state machine carries its state across newlines exactly as
+// line-by-line calls do, so no per-line work is needed.
+static int pp_process_comment_spans(pp_context_t *ctx,
+                                    const buffer_t *input,
+                                    buffer_t *output,
+                                    int err_code,
+                                    int err_code_last)
 {
-    // Track our position in the input buffer
-    long i = 0;
-    long line_start = 0;
-
-    // Process the buffer line by line, looking for newline characters
-    while (i < input->len) {
-        // Found a newline - process this complete line
-        if (input->data[i] == PP_CHAR_NL) {
-            // Calculate the length of this line (including the newline)
-            long line_len = (i - line_start) + 1;
-            // Increment line counter for error reporting
+    const char *p = input->data;
+    const char *end = input->data + input->len;
+
+    while (p < end) {
+        // Take about PP_COMMENT_SPAN bytes, extended to the next line end
+        const char *stop = (end - p > PP_COMMENT_SPAN) ? p + PP_COMMENT_SPAN : end;
+        const char *nl = scan_find_newline(stop, end);
+        const char *span_end = (nl < end) ? nl + 1 : end;
+        int last = (span_end == end && end[-1] != PP_CHAR_NL);
+
+        // Errors are reported against the first line of the span
+        ctx->current_line++;
+        const char *text;
+        long text_len;
+        int rc = build_line_buffer(ctx, p, (long)(span_end - p), output, &text, &text_len,
+                                   last ? err_code_last : err_code);
+        if (rc != PP_RUN_SUCCESS) {
+            return rc;
+        }
+        for (const char *q = scan_find_newline(p, span_end); q < span_end - 1;
+             q = scan_find_newline(q + 1, span_end)) {
             ctx->current_line++;
+        }
 
-            // Get a pointer to the start of this line
-            const char *line_data = input->data + line_start;
-            // Process this line (comments, directives, macros)
-            int rc = process_line(ctx, line_data, line_len, output, base_dir, err_code);
-            if (rc != PP_RUN_SUCCESS) {
-                return rc;
+        if (ctx->sink && sink_maybe_flush(ctx->sink) != 0) {
+            error(ctx->current_line, "%s: %s", ctx->current_file, PP_ERR_OUTPUT_WRITE);
+            return err_code;
+        }
+        p = span_end;
+    }
+
+    return PP_RUN_SUCCESS;
+}
+
+// One chunk of the parallel comments-only mode. A chunk always starts at a
+// line boundary, where the only state that survives is "inside a block
+// comment or not" (literals end at the newline). The worker strips the chunk
+// assuming normal code and also computes the exit state for a block-comment
+// entry, so the real entry states can be chained afterwards.
+typedef struct {
+    const char *data;
+    long len;
+    // Entry state used to produce out
+    comment_state_t entry;
+    buffer_t out;
+    // Exit state for the speculated entry and for a block-comment entry
+    comment_state_t exit_spec;
+    comment_state_t exit_block;
+    // Lines in the chunk
+    int lines;
+    // Set when the speculation was wrong and out was redone from a block comment
+    int redone;
+    int rc;
+} comment_chunk_t;
+
+// State at the start of a line that begins inside a block comment (the
+// previous line's '\n' is the last character seen).
+static void comment_state_block_entry(comment_state_t *st)
+{
+    comments_state_init(st);
+    st->in_block_comment = 1;
+    st->prev_char = PP_CHAR_NL;
+}
+
+// Thread pool task: strip one chunk.
+static void comment_chunk_run(void *arg)
+{
+    comment_chunk_t *c = (comment_chunk_t *)arg;
+    c->out.len = 0;
+    if (c->out.data) c->out.data[0] = BUFFER_CHAR_NUL;
+
+    comment_state_t st = c->entry;
+    c->rc = comments_process_line(c->data, c->len, &c->out, &st);
+    if (c->redone) return;
+    c->exit_spec = st;
+
+    comment_state_block_entry(&st);
+    comments_update_state(c->data, c->len, &st);
+    c->exit_block = st;
+
+    c->lines = 0;
+    const char *end = c->data + c->len;
+    for (const char *q = scan_find_newline(c->data, end); q < end; q = scan_find_newline(q + 1, end)) {
+        c->lines++;
+    }
+    if (c->len > 0 && end[-1] != PP_CHAR_NL) c->lines++;
+}
+
+// Comments-only mode on the thread pool: the input is cut into waves of one
+// chunk per worker. Each wave is stripped speculatively in parallel, the
+// real entry states are chained in order, mispredicted chunks (those that
+// start inside a block comment) are redone in parallel, and the outputs are
+// appended in order. The result is byte-identical to the serial path and
+// at most one wave of output is held in memory.
+static int pp_process_comment_chunks(pp_context_t *ctx,
+                                     const buffer_t *input,
+                                     buffer_t *output,
+                                     int err_code)
+{
+    pool_t *pool = ctx->pool;
+    int nchunks = pool->nthreads;
+    comment_chunk_t *chunks = calloc((size_t)nchunks, sizeof(comment_chunk_t));
+    if (!chunks) {
+        error(ctx->current_line, "%s: %s", ctx->current_file, PP_ERR_OUT_OF_MEMORY);
+        return err_code;
+    }
+    for (int k = 0; k < nchunks; k++) buffer_init(&chunks[k].out);
+
+    const char *p = input->data;
+    const char *end = input->data + input->len;
+    int rc = PP_RUN_SUCCESS;
+
+    while (p < end && rc == PP_RUN_SUCCESS) {
+        // Cut the next wave on line boundaries
+        int n = 0;
+        while (n < nchunks && p < end) {
+            const char *stop = (end - p > PP_PARALLEL_CHUNK) ? p + PP_PARALLEL_CHUNK : end;
+            const char *nl = scan_find_newline(stop, end);
+            const char *chunk_end = (nl < end) ? nl + 1 : end;
+            comment_chunk_t *c = &chunks[n++];
+            c->data = p;
+            c->len = (long)(chunk_end - p);
+            comments_state_init(&c->entry);
+            c->redone = 0;
+            p = chunk_end;
+        }
+        // The first chunk of the wave continues from the known state
+        chunks[0].entry = ctx->comment_state;
+
+        for (int k = 0; k < n; k++) {
+            if (pool_submit(pool, comment_chunk_run, &chunks[k]) != 0) comment_chunk_run(&chunks[k]);
+        }
+        pool_wait(pool);
+
+        // Chain the real entry states; redo the chunks that were mispredicted
+        int redo = 0;
+        for (int k = 1; k < n; k++) {
+            const comment_chunk_t *prev = &chunks[k - 1];
+            if ((prev->redone ? prev->exit_block : prev->exit_spec).in_block_comment) {
+                comment_state_block_entry(&chunks[k].entry);
+                chunks[k].redone = 1;
+                redo = 1;
             }
+        }
+        if (redo) {
+            for (int k = 1; k < n; k++) {
+                if (!chunks[k].redone) continue;
+                if (pool_submit(pool, comment_chunk_run, &chunks[k]) != 0) comment_chunk_run(&chunks[k]);
+            }
+            pool_wait(pool);
+        }
 
-            // Move past the newline and mark the start of the next line
-            i++;
-            line_start = i;
-        } else {
-            // Not a newline, continue scanning
-            i++;
+        // Stitch the outputs in order
+        for (int k = 0; k < n; k++) {
+            comment_chunk_t *c = &chunks[k];
+            ctx->current_line++;
+            if (c->rc != 0) {
+                error(ctx->current_line, "%s: %s", ctx->current_file, PP_ERR_COMMENTS_PROCESS);
+                rc = err_code;
+                break;
+            }
+            ctx->current_line += c->lines - 1;
+            ctx->comment_state = c->redone ? c->exit_block : c->exit_spec;
+            rc = append_or_report(ctx, output, c->out.data, c->out.len, err_code);
+            if (rc != PP_RUN_SUCCESS) break;
+            if (ctx->sink && sink_maybe_flush(ctx->sink) != 0) {
+                error(ctx->current_line, "%s: %s", ctx->current_file, PP_ERR_OUTPUT_WRITE);
+                rc = err_code;
+                break;
+            }
         }
     }
 
-    // Handle the last line if it doesn't end with a newline
-    if (line_start < input->len) {
-        // Calculate length of the final line (no trailing newline)
-        long line_len = input->len - line_start;
+    for (int k = 0; k < nchunks; k++) buffer_free(&chunks[k].out);
+    free(chunks);
+    return rc;
+}
+
+// Fast-forward over an inactive #ifdef region. Nothing is output there, so
+// lines that cannot be directives are skipped without line buffers: only the
+// comment state is carried over them (one state update per skipped span).
+// Lines counted as skipped advance current_line. Returns the offset of the
+// first line needing normal processing: a possible directive (first
+// non-blank '#', or '/' when comment removal may expose one) outside a block
+// comment, or an unterminated last line.
+static long skip_inactive_lines(pp_context_t *ctx, const char *data, long start, long len)
+{
+    const char *end = data + len;
+    const char *line = data + start;
+    const char *span = line;
+
+    while (line < end) {
+        const char *nl = scan_find_newline(line, end);
+        if (nl == end) break;
+
+        const char *q = line;
+        while (q < nl && isspace((unsigned char)*q)) q++;
+        if (q < nl && (*q == PP_CHAR_HASH || (ctx->opt.do_comments && *q == '/'))) {
+            // Candidate directive: it counts only outside a block comment
+            comments_update_state(span, (long)(line - span), &ctx->comment_state);
+            span = line;
+            if (!ctx->comment_state.in_block_comment) break;
+        }
+
         ctx->current_line++;
+        line = nl + 1;
+    }
 
-        // Process the last line with a different error code
-        const char *line_data = input->data + line_start;
-        int rc = process_line(ctx, line_data, line_len, output, base_dir, err_code_last);
+    comments_update_state(span, (long)(line - span), &ctx->comment_state);
+    return (long)(line - data);
+}
+
+// True if the physical line ends with a backslash right before its newline.
+static int line_continues(const char *line, long line_len)
+{
+    if (line_len < 2 || line[line_len - 1] != PP_CHAR_NL) return 0;
+    long i = line_len - 2;
+    if (line[i] == '\r' && i > 0) i--;
+    return line[i] == '\\';
+}
+
+// A #define continued with backslash-newline is processed as one line. If the
+// line at data[start] is one, join it with its continuation lines into joined
+// (scratch arena) and set *line_len to the bytes consumed. Returns the number of
+// lines joined after the first (0 if the line does not continue).
+static int join_continued_define(pp_context_t *ctx, const char *data, long start, long len,
+                                 long *line_len, buffer_t *joined)
+{
+    const char *line = data + start;
+    if (!line_continues(line, *line_len)) return 0;
+
+    // Only '#' define, blanks allowed around the '#'
+    long i = 0;
+    while (i < *line_len && (line[i] == ' ' || line[i] == '\t')) i++;
+    if (i >= *line_len || line[i] != PP_CHAR_HASH) return 0;
+    i++;
+    while (i < *line_len && (line[i] == ' ' || line[i] == '\t')) i++;
+    if (*line_len - i < 7 || strncmp(line + i, "define", 6) != 0 ||
+        isalnum((unsigned char)line[i + 6]) || line[i + 6] == '_') {
+        return 0;
+    }
+
+    buffer_init_arena(joined, &ctx->scratch);
+    long pos = start, cur = *line_len;
+    int extra = 0;
+    while (line_continues(data + pos, cur) && pos + cur < len) {
+        // Drop the backslash (and a CR) together with the newline
+        long keep = cur - 2;
+        if (data[pos + keep] != '\\') keep--;
+        if (buffer_append_n(joined, data + pos, keep) != 0) return -1;
+        pos += cur;
+        const char *nl = scan_find_newline(data + pos, data + len);
+        cur = nl == data + len ? len - pos : (long)(nl - data) - pos + 1;
+        extra++;
+    }
+    if (buffer_append_n(joined, data + pos, cur) != 0) return -1;
+    *line_len = pos + cur - start;
+    return extra;
+}
+
+// Process the file on top of the include stack, and every file it includes,
+// until the stack is empty. A line is taken from the top frame and the frame
+// is advanced before the line is processed: an #include on it pushes the
+// included file, whose lines then come first.
+static int pp_run_frames(pp_context_t *ctx, buffer_t *output, int err_code, int err_code_last)
+{
+    while (ctx->frame_count > 0) {
+        pp_frame_t *f = &ctx->frames[ctx->frame_count - 1];
+        const include_entry_t *entry = f->entry;
+        long line_start, line_len;
+        int last = 0;
+
+        if (entry) {
+            // Walk the precomputed line index: no newline scanning on repeat includes
+            if (!ifdef_should_include(&ctx->ifdef_stack) && f->next_line < entry->line_count) {
+                // Inside a false #ifdef, jump to the next possible directive
+                int first_line = ctx->current_line;
+                skip_inactive_lines(ctx, f->data, entry->line_starts[f->next_line], f->len);
+                f->next_line += ctx->current_line - first_line;
+            }
+            if (f->next_line >= entry->line_count) {
+                pop_frame(ctx);
+                continue;
+            }
+            line_start = entry->line_starts[f->next_line];
+            line_len = entry->line_starts[f->next_line + 1] - line_start;
+        } else {
+            // The input: jump from newline to newline
+            if (!ifdef_should_include(&ctx->ifdef_stack)) {
+                f->pos = skip_inactive_lines(ctx, f->data, f->pos, f->len);
+            }
+            if (f->pos >= f->len) {
+                pop_frame(ctx);
+                continue;
+            }
+            const char *end = f->data + f->len;
+            const char *nl = scan_find_newline(f->data + f->pos, end);
+            line_start = f->pos;
+            // The last line may not end with a newline (reported with a different error code)
+            last = nl == end;
+            line_len = last ? f->len - line_start : (long)(nl - f->data) - line_start + 1;
+        }
+        // Increment line counter for error reporting
+        ctx->current_line++;
+
+        // A #define continued on the next lines is processed as one line
+        arena_mark_t mark = arena_mark(&ctx->scratch);
+        buffer_t joined;
+        int extra = join_continued_define(ctx, f->data, line_start, f->len, &line_len, &joined);
+        if (extra < 0) {
+            error(ctx->current_line, "%s: %s", ctx->current_file, PP_ERR_OUT_OF_MEMORY);
+            return err_code;
+        }
+        if (entry) f->next_line += 1 + extra;
+        else f->pos = line_start + line_len;
+
+        // Process this line (comments, directives, macros); f may move if it
+        // pushes a frame
+        const char *base_dir = f->base_dir;
+        int rc = extra ? process_line(ctx, joined.data, joined.len, output, base_dir, err_code)
+                       : process_line(ctx, f->data + line_start, line_len, output, base_dir,
+                                      last ? err_code_last : err_code);
+        arena_release(&ctx->scratch, mark);
         if (rc != PP_RUN_SUCCESS) {
             return rc;
         }
+        // A continued #define never opens a file, so these lines are still ours
+        ctx->current_line += extra;
     }
 
     return PP_RUN_SUCCESS;
 }
 
-// Run preprocessing over the input buffer and write results to output.
-int pp_run(pp_context_t *ctx, const buffer_t *input, buffer_t *output, const char *base_dir)
+// Process a full buffer with current context state (no re-initialization).
+static int pp_process_buffer(pp_context_t *ctx,
+                             const buffer_t *input,
+                             buffer_t *output,
+                             const char *base_dir,
+                             int err_code,
+                             int err_code_last)
 {
-    // Validate all required parameters
-    if (!ctx || !input || !output || !input->data) {
-        return PP_RUN_ERR_INVALID_ARGS;
+    // Without directives nothing depends on line boundaries; large inputs are
+    // split across the thread pool when one is available
+    if (!ctx->opt.do_directives) {
+        if (ctx->pool && ctx->pool->nthreads > 1 && input->len >= 2 * PP_PARALLEL_CHUNK) {
+            return pp_process_comment_chunks(ctx, input, output, err_code);
+        }
+        return pp_process_comment_spans(ctx, input, output, err_code, err_code_last);
     }
 
-    // Initialize the preprocessing state: comment tracking, macro table, and #ifdef stack
+    // The input is the bottom of the include stack
+    if (ctx->frame_capacity == 0) {
+        ctx->frames = malloc(sizeof(pp_frame_t) * INITIAL_FRAMES);
+        if (!ctx->frames) {
+            error(ctx->current_line, "%s: %s", ctx->current_file, PP_ERR_OUT_OF_MEMORY);
+            return err_code;
+        }
+        ctx->frame_capacity = INITIAL_FRAMES;
+    }
+    pp_frame_t *f = &ctx->frames[0];
+    memset(f, 0, sizeof(*f));
+    f->data = input->data;
+    f->len = input->len;
+    f->base_dir = base_dir;
+    f->file = ctx->current_file;
+    f->prev_active = -1;
+    ctx->frame_count = 1;
+
+    return pp_run_frames(ctx, output, err_code, err_code_last);
+}
+
+// Initialize per-run state, process the input and release the state again.
+static int pp_run_internal(pp_context_t *ctx, const buffer_t *input, buffer_t *output,
+                           const char *base_dir, int keep_state)
+{
+    // Initialize the preprocessing state: comment tracking, macro table, #ifdef stack,
+    // the condition cache, the include cache and the scratch arena. A fork
+    // starts from its parent's macros and #if levels instead
     comments_state_init(&ctx->comment_state);
-    macros_init(&ctx->macros);
-    ifdef_stack_init(&ctx->ifdef_stack);
+    if (ctx->parent) {
+        macros_fork(&ctx->macros, &ctx->parent->macros);
+        ctx->ifdef_stack = ctx->parent->ifdef_stack;
+    } else {
+        macros_init(&ctx->macros);
+        ifdef_stack_init(&ctx->ifdef_stack);
+    }
+    expr_cache_init(&ctx->conditions);
+    include_cache_init(&ctx->includes);
+    ctx->includes.store = ctx->include_store;
+    arena_init(&ctx->scratch, PP_SCRATCH_BLOCK_SIZE);
+    tokens_list_init(&ctx->line_tokens);
+
+    // Errors raised while this context runs are counted in the context
+    errors_ctx_init(&ctx->errors);
+    errors_ctx_t *prev_errors = errors_bind(&ctx->errors);
 
     // Start at line 0 (will be incremented to 1 when processing first line)
     ctx->current_line = 0;
 
+    // -snapshot: start where the prefix header left off, as if the input
+    // began by including it (its output comes first)
+    // (a fork already has the snapshot's state through its parent)
+    int rc = PP_RUN_SUCCESS;
+    if (ctx->snapshot &&
+        ((!ctx->parent && snapshot_apply(ctx->snapshot, &ctx->macros, &ctx->ifdef_stack) != 0) ||
+         snapshot_emit(ctx->snapshot, output, ctx->deps) != 0)) {
+        error(ctx->current_line, PP_ERR_OUT_OF_MEMORY);
+        rc = PP_RUN_ERR_PROCESSING;
+    }
+
     // Process the entire input buffer, applying all preprocessing steps
-    int rc = pp_process_buffer(ctx, input, output, base_dir,
+    if (rc == PP_RUN_SUCCESS) {
+        rc = pp_process_buffer(ctx, input, output, base_dir,
                                PP_RUN_ERR_PROCESSING,
                                PP_RUN_ERR_PROCESSING_LAST_LINE);
-    if (rc != PP_RUN_SUCCESS) {
-        return rc;
     }
 
-    // Clean up the macro table before returning
-    macros_free(&ctx->macros);
-    return PP_RUN_SUCCESS;
+    // A run stopped inside an included file reports later errors against the input
+    if (ctx->frame_count > 1) {
+        ctx->current_file = ctx->frames[0].file;
+        ctx->current_line = ctx->frames[0].line;
+    }
+
+    // Report what the output depended on before the cached files go away
+    if (ctx->deps) {
+        for (int i = 0; i < ctx->includes.count; i++) {
+            include_entry_t *e = ctx->includes.entries[i];
+            if (cache_deps_add(ctx->deps, e->path, e->bytes.data, e->bytes.len) != 0) {
+                error(ctx->current_line, PP_ERR_OUT_OF_MEMORY);
+                rc = PP_RUN_ERR_PROCESSING;
+                break;
+            }
+        }
+    }
+
+    // -snapshot-out: keep the final state of an error-free run
+    if (ctx->snapshot_out && rc == PP_RUN_SUCCESS && ctx->errors.count == 0 &&
+        snapshot_capture(ctx->snapshot_out, &ctx->macros, &ctx->ifdef_stack) != 0) {
+        error(ctx->current_line, PP_ERR_OUT_OF_MEMORY);
+        rc = PP_RUN_ERR_PROCESSING;
+    }
+
+    // Clean up the macro table (unless it is kept for forks), conditions,
+    // cached includes and scratch memory
+    if (!keep_state) macros_free(&ctx->macros);
+    expr_cache_free(&ctx->conditions);
+    include_cache_free(&ctx->includes);
+    free(ctx->frames);
+    ctx->frames = NULL;
+    ctx->frame_count = ctx->frame_capacity = 0;
+    tokens_list_free(&ctx->line_tokens);
+    arena_free(&ctx->scratch);
+    errors_bind(prev_errors);
+    return rc;
+}
+
+// Prepare a context for a run; callers set pool/deps afterwards if needed.
+void pp_context_init(pp_context_t *ctx, const cli_options_t *opt, const char *file)
+{
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->opt = *opt;
+    ctx->current_file = file;
+    ctx->current_line = 0;
+    ctx->sink = NULL;
+    ctx->pool = NULL;
+    ctx->deps = NULL;
+}
+
+// Run preprocessing over the input buffer and write results to output.
+int pp_run(pp_context_t *ctx, const buffer_t *input, buffer_t *output, const char *base_dir)
+{
+    // Validate all required parameters
+    if (!ctx || !input || !output || !input->data) {
+        return PP_RUN_ERR_INVALID_ARGS;
+    }
+
+    ctx->sink = NULL;
+    return pp_run_internal(ctx, input, output, base_dir, 0);
+}
+
+// Run a prefix whose macros and #if state are kept for pp_context_fork.
+int pp_run_prefix(pp_context_t *ctx, const buffer_t *input, buffer_t *output,
+                  const char *base_dir)
+{
+    // Validate all required parameters
+    if (!ctx || !input || !output || !input->data) {
+        return PP_RUN_ERR_INVALID_ARGS;
+    }
+
+    ctx->sink = NULL;
+    return pp_run_internal(ctx, input, output, base_dir, 1);
+}
+
+// Start child from parent's prefix state (nothing is copied).
+void pp_context_fork(pp_context_t *child, const pp_context_t *parent, const char *file)
+{
+    pp_context_init(child, &parent->opt, file);
+    child->parent = parent;
+    child->snapshot = parent->snapshot;
+    child->search = parent->search;
+    child->prefetch = parent->prefetch;
+    child->include_store = parent->include_store;
+}
+
+// Release the macro table kept by pp_run_prefix.
+void pp_context_free(pp_context_t *ctx)
+{
+    if (ctx) macros_free(&ctx->macros);
+}
+
+// Run preprocessing over the input buffer, streaming results through sink.
+int pp_run_stream(pp_context_t *ctx, const buffer_t *input, sink_t *sink, const char *base_dir)
+{
+    // Validate all required parameters
+    if (!ctx || !input || !sink || !input->data) {
+        return PP_RUN_ERR_INVALID_ARGS;
+    }
+
+    // Lines are appended to the sink's staging buffer and drained as it fills
+    ctx->sink = sink;
+    int rc = pp_run_internal(ctx, input, &sink->buf, base_dir, 0);
+
+    // Write whatever is still staged
+    if (sink_flush(sink) != 0) {
+        errors_ctx_t *prev_errors = errors_bind(&ctx->errors);
+        error(ctx->current_line, "%s: %s", ctx->current_file, PP_ERR_OUTPUT_WRITE);
+        errors_bind(prev_errors);
+        if (rc == PP_RUN_SUCCESS) rc = PP_RUN_ERR_PROCESSING;
+    }
+    return rc;
+}
+
+// Print statistics gathered by the last run.
+void pp_print_stats(const pp_context_t *ctx, FILE *out)
+{
+    if (!ctx || !out) return;
+
+    long lookups = ctx->includes.hits + ctx->includes.misses;
+    fprintf(out, PP_FMT_STATS_INCLUDES, ctx->includes.hits, ctx->includes.misses, lookups,
+            ctx->includes.guard_skips);
+    if (ctx->include_store) fprintf(out, PP_FMT_STATS_INCLUDE_STORE, ctx->includes.store_hits);
+    fprintf(out, PP_FMT_STATS_CONDITIONS, ctx->conditions.compiled, ctx->conditions.reused);
+    fprintf(out, PP_FMT_STATS_MACROS, ctx->macros.interned, ctx->macros.intern_hits,
+            ctx->macros.arena.heap_allocs);
+    long checked = ctx->macros.prefilter_checked;
+    fprintf(out, PP_FMT_STATS_PREFILTER, checked, ctx->macros.prefilter_rejected,
+            checked ? 100.0 * (double)ctx->macros.prefilter_rejected / (double)checked : 0.0,
+            ctx->macros.lines_copied, ctx->macros.lines_copied + ctx->macros.lines_expanded);
+    fprintf(out, PP_FMT_STATS_EXPANSION, ctx->macros.memo_hits, ctx->macros.memo_misses,
+            ctx->macros.memo_invalidated);
+    fprintf(out, PP_FMT_STATS_FUNCTIONS, ctx->macros.invocations, ctx->macros.invocations_direct);
+    if (ctx->snapshot) {
+        fprintf(out, PP_FMT_STATS_SNAPSHOT, (int)ctx->snapshot->header->macro_count,
+                (long)ctx->snapshot->header->output_size);
+    }
+    if (ctx->parent) {
+        fprintf(out, PP_FMT_STATS_FORK, ctx->parent->macros.size, ctx->macros.defined,
+                ctx->macros.parent_memos_kept);
+    }
+    fprintf(out, PP_FMT_STATS_SCRATCH, ctx->scratch.heap_allocs);
+    if (ctx->sink) {
+        fprintf(out, PP_FMT_STATS_SINK, ctx->sink->bytes_written, ctx->sink->flushes,
+                ctx->sink->peak_pending);
+    }
 }
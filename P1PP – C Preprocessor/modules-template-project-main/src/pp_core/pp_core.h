@@ -6,6 +6,10 @@
  *     This module declares the core preprocessing engine entry point.
  *
  * - `pp_run`: Executes preprocessing over a buffer and writes output.
+ * - `pp_run_stream`: Same, streaming output through a bounded sink.
+ * - `pp_run_prefix` / `pp_context_fork` / `pp_context_free`: Run a common
+ *   prefix once, then start any number of contexts from its state.
+ * - `pp_print_stats`: Prints run statistics (include cache hits/misses).
  *
  * Usage:
  *     Include this header in main or integration modules to run preprocessing.
@@ -17,10 +21,38 @@
 #ifndef PP_CORE_H
 #define PP_CORE_H
 
+#include <stdio.h>
+
 #include "pp_context.h"
 #include "buffer/buffer.h"
+#include "sink/sink.h"
+
+/* Set up ctx for a run over file with opt (no pool, sink or dependency list). */
+void pp_context_init(pp_context_t *ctx, const cli_options_t *opt, const char *file);
 
 /* Run the preprocessor on input, writing results to output. */
 int pp_run(pp_context_t *ctx, const buffer_t *input, buffer_t *output, const char *base_dir);
 
+/* Run the preprocessor on input, flushing output through sink as lines complete. */
+int pp_run_stream(pp_context_t *ctx, const buffer_t *input, sink_t *sink, const char *base_dir);
+
+/* Run input as a prefix shared by later runs: the macros and #if state it
+ * leaves stay in ctx (release them with pp_context_free). */
+int pp_run_prefix(pp_context_t *ctx, const buffer_t *input, buffer_t *output,
+                  const char *base_dir);
+
+/* Set up child for a run over file that continues from the state left in
+ * parent by pp_run_prefix. Constant time: the parent's macros are shared
+ * read-only and the child only stores what it defines or memoizes itself.
+ * parent must outlive child; forks may run on different threads. The
+ * parent's snapshot (if any) is inherited, so its output is repeated, and so
+ * are its search path and include read-ahead. */
+void pp_context_fork(pp_context_t *child, const pp_context_t *parent, const char *file);
+
+/* Release the state kept by pp_run_prefix. */
+void pp_context_free(pp_context_t *ctx);
+
+/* Print statistics gathered by the last pp_run on ctx. */
+void pp_print_stats(const pp_context_t *ctx, FILE *out);
+
 #endif
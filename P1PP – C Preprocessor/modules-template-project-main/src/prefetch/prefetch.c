@@ -0,0 +1,255 @@
+/* -----------------------------------------------------------------------------
+ * Program: C Preprocessor (Practice 1)
+ * Description:
+ *     This module implements the include read-ahead declared in prefetch.h.
+ *
+ * - `read_ahead`: I/O thread task. Maps the file and walks it line by line;
+ *   the walk both faults every page in and finds the #include lines.
+ * - `prefetch_buffer`: Resolves the targets of one file and queues the new
+ *   ones (the pool lets tasks submit further tasks).
+ * - Paths are remembered by their 64-bit hash; a collision only costs a
+ *   missed read-ahead.
+ *
+ * Usage:
+ *     main passes each input it has just mapped to prefetch_buffer, pp_core
+ *     notes every header it loads.
+ *
+ * Status:
+ *     Active - #include names built from macros are not followed.
+ * -------------------------------------------------------------------------- */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "prefetch.h"
+#include "buffer/buffer.h"
+#include "hash/hash.h"
+#include "io/io.h"
+#include "scan/scan.h"
+#include "spec/pp_spec.h"
+
+#define INITIAL_SLOTS 64
+
+/* States of a path seen by the read-ahead. */
+enum {
+    STATE_QUEUED = 1,   /* waiting for or being read by an I/O thread */
+    STATE_DONE,         /* read: its pages are in memory */
+    STATE_MISSING       /* could not be opened */
+};
+
+/* Task argument: the path to read (owned by the task). */
+typedef struct {
+    prefetch_t *pf;
+    char path[];
+} prefetch_job_t;
+
+static uint64_t key_of(const char *path)
+{
+    uint64_t key = hash_bytes(path, strlen(path)).lo;
+    return key ? key : 1;
+}
+
+// Slot holding key, or the empty slot where it would go (lock held).
+static prefetch_slot_t *find_slot(const prefetch_t *pf, uint64_t key)
+{
+    int mask = pf->slot_capacity - 1;
+    int i = (int)(key & (uint64_t)mask);
+    while (pf->slots[i].key != 0 && pf->slots[i].key != key) i = (i + 1) & mask;
+    return &pf->slots[i];
+}
+
+// Keep the slot table at most half full (lock held). Returns 0 or 1.
+static int grow(prefetch_t *pf)
+{
+    if ((pf->slot_count + 1) * 2 <= pf->slot_capacity) return 0;
+
+    int capacity = pf->slot_capacity ? pf->slot_capacity * 2 : INITIAL_SLOTS;
+    prefetch_slot_t *old = pf->slots;
+    int old_capacity = pf->slot_capacity;
+    pf->slots = calloc((size_t)capacity, sizeof(prefetch_slot_t));
+    if (!pf->slots) {
+        pf->slots = old;
+        return 1;
+    }
+    pf->slot_capacity = capacity;
+    for (int i = 0; i < old_capacity; i++) {
+        if (old[i].key != 0) *find_slot(pf, old[i].key) = old[i];
+    }
+    free(old);
+    return 0;
+}
+
+// Set the state of a path already in the table.
+static void set_state(prefetch_t *pf, const char *path, int state)
+{
+    uint64_t key = key_of(path);
+    pthread_mutex_lock(&pf->lock);
+    prefetch_slot_t *slot = find_slot(pf, key);
+    if (slot->key == key) slot->state = state;
+    pthread_mutex_unlock(&pf->lock);
+}
+
+// Resolve one include name found in a file of base_dir, as pp_core would.
+// Returns 1 with the path in out, 0 if there is nothing to read.
+static int resolve(const prefetch_t *pf, const char *base_dir, const char *name, int angled,
+                   char *out, size_t size)
+{
+    if (pf->search) {
+        return search_path_find(pf->search, base_dir, name, angled, out, size, NULL) == SEARCH_FOUND;
+    }
+    if (angled) return 0;
+    int n = base_dir[0] ? snprintf(out, size, "%s/%s", base_dir, name) : snprintf(out, size, "%s", name);
+    return n >= 0 && (size_t)n < size;
+}
+
+// Lines are not checked for comments or #if: reading an unused header is
+// harmless.
+void prefetch_buffer(prefetch_t *pf, const char *data, long len, const char *base_dir)
+{
+    const char *end = data + len;
+    char name[PP_MAX_PATH_LEN];
+    char path[PP_MAX_PATH_LEN];
+
+    for (const char *p = data; p < end;) {
+        const char *nl = scan_find_newline(p, end);
+        const char *q = p;
+        p = nl < end ? nl + 1 : end;
+
+        while (q < nl && (*q == ' ' || *q == '\t')) q++;
+        if (q == nl || *q != PP_CHAR_HASH) continue;
+        q++;
+        while (q < nl && (*q == ' ' || *q == '\t')) q++;
+        if (nl - q < 8 || memcmp(q, "include", 7) != 0) continue;
+        q += 7;
+        while (q < nl && (*q == ' ' || *q == '\t')) q++;
+        if (q == nl || (*q != '"' && *q != '<')) continue;
+
+        int angled = *q == '<';
+        const char *start = ++q;
+        while (q < nl && *q != (angled ? '>' : '"')) q++;
+        long name_len = (long)(q - start);
+        if (q == nl || name_len == 0 || name_len >= (long)sizeof(name)) continue;
+        memcpy(name, start, (size_t)name_len);
+        name[name_len] = '\0';
+
+        if (resolve(pf, base_dir, name, angled, path, sizeof(path))) prefetch_file(pf, path);
+    }
+}
+
+// I/O thread task: read one file and queue what it includes.
+static void read_ahead(void *arg)
+{
+    prefetch_job_t *job = (prefetch_job_t *)arg;
+    prefetch_t *pf = job->pf;
+    if (__atomic_load_n(&pf->stopping, __ATOMIC_RELAXED)) {
+        free(job);
+        return;
+    }
+
+    // Checked first so that io_map_file has nothing to report
+    FILE *f = fopen(job->path, "rb");
+    if (!f) {
+        __atomic_fetch_add(&pf->not_found, 1, __ATOMIC_RELAXED);
+        set_state(pf, job->path, STATE_MISSING);
+        free(job);
+        return;
+    }
+    fclose(f);
+
+    buffer_t bytes;
+    buffer_init(&bytes);
+    if (io_map_file(job->path, &bytes) == 0) {
+        char base_dir[PP_MAX_PATH_LEN];
+        io_compute_base_dir(job->path, base_dir, sizeof(base_dir));
+        prefetch_buffer(pf, bytes.data, bytes.len, base_dir);
+        __atomic_fetch_add(&pf->read, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&pf->bytes, bytes.len, __ATOMIC_RELAXED);
+    }
+    buffer_free(&bytes);
+    set_state(pf, job->path, STATE_DONE);
+    free(job);
+}
+
+int prefetch_init(prefetch_t *pf, int nthreads, search_path_t *search)
+{
+    memset(pf, 0, sizeof(*pf));
+#ifdef _WIN32
+    // The pool runs tasks inline there: reading ahead would only delay the run
+    (void)nthreads;
+    (void)search;
+    return 1;
+#else
+    pf->search = search;
+    if (grow(pf) != 0) return 1;
+    if (pool_create(&pf->pool, nthreads) != 0) {
+        free(pf->slots);
+        return 1;
+    }
+    pthread_mutex_init(&pf->lock, NULL);
+    return 0;
+#endif
+}
+
+void prefetch_free(prefetch_t *pf)
+{
+    __atomic_store_n(&pf->stopping, 1, __ATOMIC_RELAXED);
+    pool_destroy(&pf->pool);
+    pthread_mutex_destroy(&pf->lock);
+    free(pf->slots);
+    pf->slots = NULL;
+    pf->slot_count = pf->slot_capacity = 0;
+}
+
+void prefetch_file(prefetch_t *pf, const char *path)
+{
+    uint64_t key = key_of(path);
+    pthread_mutex_lock(&pf->lock);
+    prefetch_slot_t *slot = find_slot(pf, key);
+    int seen = slot->key == key;
+    if (!seen && grow(pf) == 0) {
+        slot = find_slot(pf, key);
+        slot->key = key;
+        slot->state = STATE_QUEUED;
+        pf->slot_count++;
+    } else {
+        seen = 1;
+    }
+    pthread_mutex_unlock(&pf->lock);
+    if (seen) return;
+
+    size_t len = strlen(path);
+    prefetch_job_t *job = malloc(sizeof(prefetch_job_t) + len + 1);
+    if (job) {
+        job->pf = pf;
+        memcpy(job->path, path, len + 1);
+        if (pool_submit(&pf->pool, read_ahead, job) == 0) return;
+        free(job);
+    }
+    set_state(pf, path, STATE_MISSING);
+}
+
+void prefetch_note(prefetch_t *pf, const char *path)
+{
+    uint64_t key = key_of(path);
+    pthread_mutex_lock(&pf->lock);
+    prefetch_slot_t *slot = find_slot(pf, key);
+    int state = slot->key == key ? slot->state : 0;
+    if (state == STATE_DONE) pf->ready++;
+    else if (state == STATE_QUEUED) pf->in_flight++;
+    else pf->unseen++;
+    pthread_mutex_unlock(&pf->lock);
+
+    // Not reached by the read-ahead yet: still look ahead into its includes
+    if (state == 0) prefetch_file(pf, path);
+}
+
+void prefetch_wait(prefetch_t *pf)
+{
+    pool_wait(&pf->pool);
+}
+
+void prefetch_print_stats(const prefetch_t *pf, FILE *out)
+{
+    fprintf(out, PP_FMT_STATS_PREFETCH, pf->read, pf->bytes, pf->not_found, pf->ready,
+            pf->in_flight, pf->unseen);
+}
@@ -0,0 +1,89 @@
+/* -----------------------------------------------------------------------------
+ * Program: C Preprocessor (Practice 1)
+ * Description:
+ *     This module reads #include targets ahead of the preprocessor on a small
+ *     pool of I/O threads, so a header is already in memory (page cache) when
+ *     its directive is reached.
+ *
+ * - `prefetch_buffer`: Look ahead in a file already in memory (an input the
+ *   preprocessor mapped) and queue the targets of its #include lines.
+ * - `prefetch_file`: Queue a file: an I/O thread maps it, which reads every
+ *   page, looks for #include lines on the way and queues their targets.
+ * - `prefetch_note`: Called when the preprocessor loads a header; counts
+ *   whether the read-ahead got there first and queues headers it missed.
+ * - `prefetch_wait` / `prefetch_print_stats`.
+ *
+ * Usage:
+ *     Created once per run by main (with -d) and shared by every file.
+ *     Targets are resolved like pp_core does (next to the including file,
+ *     then through the search path) but without regard to #if, so headers
+ *     of inactive branches may be read too. Nothing is reported from the
+ *     I/O threads: a target that cannot be opened is only counted.
+ *
+ * Status:
+ *     Active - not available on _WIN32 (prefetch_init fails, the run goes on
+ *     without read-ahead).
+ * -------------------------------------------------------------------------- */
+
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "pool/pool.h"
+#include "search_path/search_path.h"
+
+/* One path seen by the read-ahead (key 0 marks an empty slot). */
+typedef struct {
+    uint64_t key;
+    int state;
+} prefetch_slot_t;
+
+typedef struct {
+    /* I/O threads. */
+    pool_t pool;
+    /* Search path used to resolve targets (NULL: next to the includer). */
+    search_path_t *search;
+    /* Paths seen so far and their state (open addressing). */
+    prefetch_slot_t *slots;
+    int slot_count;
+    int slot_capacity;
+    pthread_mutex_t lock;
+    /* Set by prefetch_free: queued reads are dropped. */
+    int stopping;
+    /* Statistics (read, bytes and not_found updated atomically; the load
+     * counters under lock). */
+    long read;
+    long bytes;
+    long not_found;
+    long ready;
+    long in_flight;
+    long unseen;
+} prefetch_t;
+
+/* Start nthreads I/O threads. Returns 0, or 1 if they cannot be started. */
+int prefetch_init(prefetch_t *pf, int nthreads, search_path_t *search);
+
+/* Drop queued reads, then stop the threads. */
+void prefetch_free(prefetch_t *pf);
+
+/* Queue the targets of the #include lines in data (a file whose directory is
+ * base_dir), and transitively what they include; data itself is not read
+ * again. */
+void prefetch_buffer(prefetch_t *pf, const char *data, long len, const char *base_dir);
+
+/* Queue path (and, transitively, what it includes) unless already seen. */
+void prefetch_file(prefetch_t *pf, const char *path);
+
+/* Record that the preprocessor loaded the header at path. */
+void prefetch_note(prefetch_t *pf, const char *path);
+
+/* Wait until every queued read is done. */
+void prefetch_wait(prefetch_t *pf);
+
+/* Print this run's read-ahead counters. */
+void prefetch_print_stats(const prefetch_t *pf, FILE *out);
+
+#endif
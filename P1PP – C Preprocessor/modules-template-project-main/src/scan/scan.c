@@ -0,0 +1,315 @@
+/* -----------------------------------------------------------------------------
+ * Program: C Preprocessor (Practice 1)
+ * Description:
+ *     This module implements the byte scanners declared in scan.h.
+ *
+ * - Scalar kernels: portable loops, also used for the tail of SIMD scans.
+ * - SSE2 kernels: 16 bytes per step (baseline on x86-64).
+ * - AVX2 kernels: 32 bytes per step, compiled with a target attribute and
+ *   selected only when the CPU reports AVX2 support.
+ *
+ * Usage:
+ *     The first call picks the best kernel set; later calls go straight to it.
+ *
+ * Status:
+ *     Active - scanning primitives for the preprocessing engine.
+ * -------------------------------------------------------------------------- */
+
+#include <string.h>
+
+#include "scan.h"
+
+#if (defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))) && defined(__GNUC__)
+#define SCAN_HAVE_X86 1
+#include <immintrin.h>
+#endif
+
+/* Bytes the scanners look for. */
+#define SCAN_NL '\n'
+#define SCAN_SLASH '/'
+#define SCAN_DQUOTE '"'
+#define SCAN_SQUOTE '\''
+#define SCAN_STAR '*'
+
+/* One kernel set; all kernels share the (p, end) -> match-or-end contract. */
+typedef struct {
+    const char *(*special)(const char *p, const char *end);
+    const char *(*block_special)(const char *p, const char *end);
+    const char *(*non_ident)(const char *p, const char *end);
+    void (*classify32)(const char *p, scan_classes_t *out);
+    const char *name;
+} scan_impl_t;
+
+/* --- Scalar kernels ------------------------------------------------------ */
+
+static const char *special_scalar(const char *p, const char *end)
+{
+    for (; p < end; p++) {
+        char c = *p;
+        if (c == SCAN_SLASH || c == SCAN_DQUOTE || c == SCAN_SQUOTE || c == SCAN_NL) return p;
+    }
+    return end;
+}
+
+static const char *block_special_scalar(const char *p, const char *end)
+{
+    for (; p < end; p++) {
+        if (*p == SCAN_STAR || *p == SCAN_NL) return p;
+    }
+    return end;
+}
+
+// [A-Za-z0-9_] without a locale: folding case maps letters onto a-z only.
+static int is_ident(unsigned char c)
+{
+    return (unsigned)((c | 0x20) - 'a') < 26u || (unsigned)(c - '0') < 10u || c == '_';
+}
+
+static const char *non_ident_scalar(const char *p, const char *end)
+{
+    for (; p < end; p++) {
+        if (!is_ident((unsigned char)*p)) return p;
+    }
+    return end;
+}
+
+static void classify32_scalar(const char *p, scan_classes_t *out)
+{
+    uint32_t ident = 0, digit = 0, quote = 0, end = 0;
+    for (int i = 0; i < 32; i++) {
+        unsigned char c = (unsigned char)p[i];
+        ident |= (uint32_t)is_ident(c) << i;
+        digit |= (uint32_t)((unsigned)(c - '0') < 10u) << i;
+        quote |= (uint32_t)(c == SCAN_DQUOTE) << i;
+        end |= (uint32_t)(c == SCAN_NL || c == 0) << i;
+    }
+    out->ident = ident;
+    out->digit = digit;
+    out->quote = quote;
+    out->end = end;
+}
+
+#ifdef SCAN_HAVE_X86
+
+/* --- SSE2 kernels -------------------------------------------------------- */
+
+static const char *special_sse2(const char *p, const char *end)
+{
+    const __m128i slash = _mm_set1_epi8(SCAN_SLASH);
+    const __m128i dq = _mm_set1_epi8(SCAN_DQUOTE);
+    const __m128i sq = _mm_set1_epi8(SCAN_SQUOTE);
+    const __m128i nl = _mm_set1_epi8(SCAN_NL);
+    while (end - p >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        __m128i m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, slash), _mm_cmpeq_epi8(v, dq)),
+                                 _mm_or_si128(_mm_cmpeq_epi8(v, sq), _mm_cmpeq_epi8(v, nl)));
+        int mask = _mm_movemask_epi8(m);
+        if (mask) return p + __builtin_ctz((unsigned)mask);
+        p += 16;
+    }
+    return special_scalar(p, end);
+}
+
+static const char *block_special_sse2(const char *p, const char *end)
+{
+    const __m128i star = _mm_set1_epi8(SCAN_STAR);
+    const __m128i nl = _mm_set1_epi8(SCAN_NL);
+    while (end - p >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, star), _mm_cmpeq_epi8(v, nl)));
+        if (mask) return p + __builtin_ctz((unsigned)mask);
+        p += 16;
+    }
+    return block_special_scalar(p, end);
+}
+
+// Identifier bytes of v as a bit mask. Unsigned range checks: x - lo <= n
+// exactly when min(x - lo, n) == x - lo.
+static int ident_mask_sse2(__m128i v)
+{
+    __m128i letter = _mm_sub_epi8(_mm_or_si128(v, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+    __m128i digit = _mm_sub_epi8(v, _mm_set1_epi8('0'));
+    __m128i m = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(_mm_min_epu8(letter, _mm_set1_epi8(25)), letter),
+                     _mm_cmpeq_epi8(_mm_min_epu8(digit, _mm_set1_epi8(9)), digit)),
+        _mm_cmpeq_epi8(v, _mm_set1_epi8('_')));
+    return _mm_movemask_epi8(m);
+}
+
+static const char *non_ident_sse2(const char *p, const char *end)
+{
+    while (end - p >= 16) {
+        int mask = ~ident_mask_sse2(_mm_loadu_si128((const __m128i *)p)) & 0xFFFF;
+        if (mask) return p + __builtin_ctz((unsigned)mask);
+        p += 16;
+    }
+    return non_ident_scalar(p, end);
+}
+
+static void classify32_sse2(const char *p, scan_classes_t *out)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i dq = _mm_set1_epi8(SCAN_DQUOTE);
+    const __m128i nl = _mm_set1_epi8(SCAN_NL);
+    uint32_t ident = 0, digit = 0, quote = 0, end = 0;
+    for (int half = 0; half < 2; half++) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + 16 * half));
+        __m128i d = _mm_sub_epi8(v, _mm_set1_epi8('0'));
+        int shift = 16 * half;
+        ident |= (uint32_t)ident_mask_sse2(v) << shift;
+        digit |= (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(9)), d)) << shift;
+        quote |= (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, dq)) << shift;
+        end |= (uint32_t)_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, zero), _mm_cmpeq_epi8(v, nl))) << shift;
+    }
+    out->ident = ident;
+    out->digit = digit;
+    out->quote = quote;
+    out->end = end;
+}
+
+/* --- AVX2 kernels -------------------------------------------------------- */
+
+__attribute__((target("avx2")))
+static const char *special_avx2(const char *p, const char *end)
+{
+    const __m256i slash = _mm256_set1_epi8(SCAN_SLASH);
+    const __m256i dq = _mm256_set1_epi8(SCAN_DQUOTE);
+    const __m256i sq = _mm256_set1_epi8(SCAN_SQUOTE);
+    const __m256i nl = _mm256_set1_epi8(SCAN_NL);
+    while (end - p >= 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)p);
+        __m256i m = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, slash), _mm256_cmpeq_epi8(v, dq)),
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, sq), _mm256_cmpeq_epi8(v, nl)));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(m);
+        if (mask) return p + __builtin_ctz(mask);
+        p += 32;
+    }
+    return special_sse2(p, end);
+}
+
+__attribute__((target("avx2")))
+static const char *block_special_avx2(const char *p, const char *end)
+{
+    const __m256i star = _mm256_set1_epi8(SCAN_STAR);
+    const __m256i nl = _mm256_set1_epi8(SCAN_NL);
+    while (end - p >= 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)p);
+        unsigned mask = (unsigned)_mm256_movemask_epi8(
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, star), _mm256_cmpeq_epi8(v, nl)));
+        if (mask) return p + __builtin_ctz(mask);
+        p += 32;
+    }
+    return block_special_sse2(p, end);
+}
+
+__attribute__((target("avx2")))
+static const char *non_ident_avx2(const char *p, const char *end)
+{
+    const __m256i fold = _mm256_set1_epi8(0x20);
+    const __m256i a = _mm256_set1_epi8('a');
+    const __m256i zero = _mm256_set1_epi8('0');
+    const __m256i letters = _mm256_set1_epi8(25);
+    const __m256i digits = _mm256_set1_epi8(9);
+    const __m256i underscore = _mm256_set1_epi8('_');
+    while (end - p >= 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)p);
+        __m256i letter = _mm256_sub_epi8(_mm256_or_si256(v, fold), a);
+        __m256i digit = _mm256_sub_epi8(v, zero);
+        __m256i m = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(_mm256_min_epu8(letter, letters), letter),
+                            _mm256_cmpeq_epi8(_mm256_min_epu8(digit, digits), digit)),
+            _mm256_cmpeq_epi8(v, underscore));
+        unsigned mask = ~(unsigned)_mm256_movemask_epi8(m);
+        if (mask) return p + __builtin_ctz(mask);
+        p += 32;
+    }
+    return non_ident_sse2(p, end);
+}
+
+__attribute__((target("avx2")))
+static void classify32_avx2(const char *p, scan_classes_t *out)
+{
+    __m256i v = _mm256_loadu_si256((const __m256i *)p);
+    __m256i letter = _mm256_sub_epi8(_mm256_or_si256(v, _mm256_set1_epi8(0x20)), _mm256_set1_epi8('a'));
+    __m256i digit = _mm256_sub_epi8(v, _mm256_set1_epi8('0'));
+    __m256i is_digit = _mm256_cmpeq_epi8(_mm256_min_epu8(digit, _mm256_set1_epi8(9)), digit);
+    __m256i is_ident = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(_mm256_min_epu8(letter, _mm256_set1_epi8(25)), letter), is_digit),
+        _mm256_cmpeq_epi8(v, _mm256_set1_epi8('_')));
+    out->ident = (uint32_t)_mm256_movemask_epi8(is_ident);
+    out->digit = (uint32_t)_mm256_movemask_epi8(is_digit);
+    out->quote = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(SCAN_DQUOTE)));
+    out->end = (uint32_t)_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_setzero_si256()),
+                                                               _mm256_cmpeq_epi8(v, _mm256_set1_epi8(SCAN_NL))));
+}
+
+#endif /* SCAN_HAVE_X86 */
+
+static const scan_impl_t scan_scalar = {special_scalar, block_special_scalar, non_ident_scalar,
+                                        classify32_scalar, "scalar"};
+#ifdef SCAN_HAVE_X86
+static const scan_impl_t scan_sse2 = {special_sse2, block_special_sse2, non_ident_sse2,
+                                      classify32_sse2, "sse2"};
+static const scan_impl_t scan_avx2 = {special_avx2, block_special_avx2, non_ident_avx2,
+                                      classify32_avx2, "avx2"};
+#endif
+
+/* Kernel set in use (NULL until the first call). */
+static const scan_impl_t *scan_impl = NULL;
+
+// Pick the widest kernel set the CPU supports.
+static const scan_impl_t *scan_select(void)
+{
+    if (scan_impl) return scan_impl;
+    const scan_impl_t *impl = &scan_scalar;
+#ifdef SCAN_HAVE_X86
+    impl = &scan_sse2;
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) impl = &scan_avx2;
+#endif
+    // Every thread computes the same value, so a racy first store is harmless
+    scan_impl = impl;
+    return impl;
+}
+
+// First '\n' in [p, end): libc's memchr is already vectorized for one byte.
+const char *scan_find_newline(const char *p, const char *end)
+{
+    if (p >= end) return end;
+    const char *nl = memchr(p, SCAN_NL, (size_t)(end - p));
+    return nl ? nl : end;
+}
+
+// First byte that can change the comment state in normal code.
+const char *scan_find_special(const char *p, const char *end)
+{
+    if (p >= end) return end;
+    return scan_select()->special(p, end);
+}
+
+// First byte that can end a block comment or must be kept inside one.
+const char *scan_find_block_special(const char *p, const char *end)
+{
+    if (p >= end) return end;
+    return scan_select()->block_special(p, end);
+}
+
+// First byte that cannot continue an identifier.
+const char *scan_find_non_ident(const char *p, const char *end)
+{
+    if (p >= end) return end;
+    return scan_select()->non_ident(p, end);
+}
+
+// Class masks of one 32-byte block.
+void scan_classify32(const char *p, scan_classes_t *out)
+{
+    scan_select()->classify32(p, out);
+}
+
+// Name of the kernel set in use.
+const char *scan_impl_name(void)
+{
+    return scan_select()->name;
+}
@@ -0,0 +1,59 @@
+/* -----------------------------------------------------------------------------
+ * Program: C Preprocessor (Practice 1)
+ * Description:
+ *     This module provides vectorized byte scanners used to split lines and
+ *     to skip runs of ordinary characters in the comment stripper.
+ *
+ * - `scan_find_newline`: First '\n' in a range (libc memchr, which is
+ *   already vectorized for a single byte).
+ * - `scan_find_special`: First byte that can change the comment state in
+ *   normal code ('/', '"', '\'' or '\n').
+ * - `scan_find_block_special`: First byte that matters inside a block
+ *   comment ('*' or '\n').
+ * - `scan_find_non_ident`: End of an identifier: first byte outside
+ *   [A-Za-z0-9_].
+ * - `scan_classify32`: Bit masks of the identifier bytes, digits, '"' and
+ *   line ends in a 32-byte block (for the tokens module's line lexer).
+ * - `scan_impl_name`: Name of the implementation selected at runtime.
+ *
+ * Usage:
+ *     Called by pp_core, include_cache, comments and macros. Each function
+ *     returns a pointer to the match, or `end` when the range has none.
+ *
+ * Status:
+ *     Active - AVX2 and SSE2 kernels on x86 (chosen at first use from the
+ *     CPU features), portable scalar code elsewhere.
+ * -------------------------------------------------------------------------- */
+
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stdint.h>
+
+/* Classes of a 32-byte block, bit i for byte i. */
+typedef struct {
+    uint32_t ident;  /* [A-Za-z0-9_] */
+    uint32_t digit;  /* [0-9] */
+    uint32_t quote;  /* '"' */
+    uint32_t end;    /* '\n' or '\0' */
+} scan_classes_t;
+
+/* First '\n' in [p, end), or end. */
+const char *scan_find_newline(const char *p, const char *end);
+
+/* First '/', '"', '\'' or '\n' in [p, end), or end. */
+const char *scan_find_special(const char *p, const char *end);
+
+/* First '*' or '\n' in [p, end), or end. */
+const char *scan_find_block_special(const char *p, const char *end);
+
+/* First byte outside [A-Za-z0-9_] in [p, end), or end. */
+const char *scan_find_non_ident(const char *p, const char *end);
+
+/* Classify the 32 bytes at p (all must be readable). */
+void scan_classify32(const char *p, scan_classes_t *out);
+
+/* Implementation in use: "avx2", "sse2" or "scalar". */
+const char *scan_impl_name(void);
+
+#endif
@@ -0,0 +1,366 @@
+/* -----------------------------------------------------------------------------
+ * Program: C Preprocessor (Practice 1)
+ * Description:
+ *     This module implements the include search declared in search_path.h.
+ *
+ * - Candidates are split into the directory to list and the entry name
+ *   ("sub/x.h" in dir is entry "x.h" of "dir/sub").
+ * - A directory is read with readdir the first time a candidate falls in it;
+ *   its entry names go in a hash set. Directories that do not exist are
+ *   remembered too, and ones that cannot be read fall back to stat.
+ * - Listings are only added, never changed, so lookups hold the read lock
+ *   and a listing stays valid after it is released.
+ *
+ * Usage:
+ *     Called by pp_core for every #include when a search path is set.
+ *
+ * Status:
+ *     Active - entries are matched by exact name (case-sensitive).
+ * -------------------------------------------------------------------------- */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <dirent.h>
+#endif
+
+#include "search_path.h"
+#include "buffer/buffer.h"
+#include "spec/pp_spec.h"
+
+#define INITIAL_DIRS 8
+#define INITIAL_SLOTS 32
+#define EMPTY_SLOT (-1)
+// Version of the search key derivation.
+#define SEARCH_KEY_VERSION "P1PP-SEARCH 1"
+
+/* Listing states. */
+typedef enum {
+    LISTING_ENTRIES = 0,   /* names holds every non-directory entry */
+    LISTING_ABSENT,        /* the directory does not exist */
+    LISTING_UNREADABLE     /* exists but cannot be read: probe with stat */
+} listing_state_t;
+
+struct search_listing {
+    char *dir;
+    uint64_t dir_hash;
+    listing_state_t state;
+    /* NUL-terminated entry names, indexed by an open-addressing set of
+     * offset + 1 (0 marks an empty slot) */
+    buffer_t names;
+    uint32_t *slots;
+    uint32_t slot_mask;
+};
+
+static uint64_t key_of(const char *s, size_t len)
+{
+    return hash_bytes(s, len).lo;
+}
+
+/* ---- Listings ------------------------------------------------------------- */
+
+static void listing_free(search_listing_t *l)
+{
+    if (!l) return;
+    free(l->dir);
+    buffer_free(&l->names);
+    free(l->slots);
+    free(l);
+}
+
+// Index the names read into l->names (count of them given).
+static int listing_index(search_listing_t *l, int count)
+{
+    uint32_t capacity = 8;
+    while (capacity < (uint32_t)count * 2) capacity *= 2;
+    l->slots = calloc(capacity, sizeof(uint32_t));
+    if (!l->slots) return 1;
+    l->slot_mask = capacity - 1;
+
+    for (long off = 0; off < l->names.len;) {
+        const char *name = l->names.data + off;
+        size_t len = strlen(name);
+        uint32_t i = (uint32_t)key_of(name, len) & l->slot_mask;
+        while (l->slots[i] != 0) i = (i + 1) & l->slot_mask;
+        l->slots[i] = (uint32_t)off + 1;
+        off += (long)len + 1;
+    }
+    return 0;
+}
+
+// Read dir into a new listing (NULL if out of memory).
+static search_listing_t *listing_read(const char *dir, uint64_t dir_hash)
+{
+    search_listing_t *l = calloc(1, sizeof(*l));
+    if (!l) return NULL;
+    buffer_init(&l->names);
+    l->dir = strdup(dir);
+    l->dir_hash = dir_hash;
+    if (!l->dir) {
+        listing_free(l);
+        return NULL;
+    }
+
+#ifdef _WIN32
+    l->state = LISTING_UNREADABLE;
+    return l;
+#else
+    DIR *d = opendir(dir);
+    if (!d) {
+        l->state = (errno == ENOENT || errno == ENOTDIR) ? LISTING_ABSENT : LISTING_UNREADABLE;
+        return l;
+    }
+    int count = 0, failed = 0;
+    struct dirent *ent;
+    while (!failed && (ent = readdir(d)) != NULL) {
+        // Directories can never be included; "." and ".." are among them
+#ifdef DT_DIR
+        if (ent->d_type == DT_DIR) continue;
+#endif
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) continue;
+        failed = buffer_append_n(&l->names, ent->d_name, (long)strlen(ent->d_name) + 1) != 0;
+        count++;
+    }
+    closedir(d);
+    if (failed || l->names.len >= (long)UINT32_MAX || listing_index(l, count) != 0) {
+        listing_free(l);
+        return NULL;
+    }
+    l->state = LISTING_ENTRIES;
+    return l;
+#endif
+}
+
+static int listing_has(const search_listing_t *l, const char *name)
+{
+    size_t len = strlen(name);
+    uint32_t i = (uint32_t)key_of(name, len) & l->slot_mask;
+    while (l->slots[i] != 0) {
+        if (strcmp(l->names.data + l->slots[i] - 1, name) == 0) return 1;
+        i = (i + 1) & l->slot_mask;
+    }
+    return 0;
+}
+
+/* ---- Listing cache -------------------------------------------------------- */
+
+// Slot holding dir, or the empty slot where it would go (lock held).
+static int find_slot(const search_path_t *sp, const char *dir, uint64_t dir_hash)
+{
+    int mask = sp->slot_capacity - 1;
+    int i = (int)(dir_hash & (uint64_t)mask);
+    while (sp->slots[i] != EMPTY_SLOT) {
+        const search_listing_t *l = sp->listings[sp->slots[i]];
+        if (l->dir_hash == dir_hash && strcmp(l->dir, dir) == 0) return i;
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+// Make room for one more listing (write lock held).
+static int grow(search_path_t *sp)
+{
+    if (sp->listing_count == sp->listing_capacity) {
+        int capacity = sp->listing_capacity ? sp->listing_capacity * 2 : INITIAL_SLOTS / 2;
+        search_listing_t **listings = realloc(sp->listings, sizeof(*listings) * (size_t)capacity);
+        if (!listings) return 1;
+        sp->listings = listings;
+        sp->listing_capacity = capacity;
+    }
+    if ((sp->listing_count + 1) * 2 <= sp->slot_capacity) return 0;
+
+    int capacity = sp->slot_capacity ? sp->slot_capacity * 2 : INITIAL_SLOTS;
+    int *slots = malloc(sizeof(int) * (size_t)capacity);
+    if (!slots) return 1;
+    free(sp->slots);
+    sp->slots = slots;
+    sp->slot_capacity = capacity;
+    for (int i = 0; i < capacity; i++) sp->slots[i] = EMPTY_SLOT;
+    for (int n = 0; n < sp->listing_count; n++) {
+        const search_listing_t *l = sp->listings[n];
+        sp->slots[find_slot(sp, l->dir, l->dir_hash)] = n;
+    }
+    return 0;
+}
+
+// Listing of dir, read on first use (NULL if out of memory). The directory
+// is read outside the lock; a thread that loses the race drops its copy.
+static const search_listing_t *get_listing(search_path_t *sp, const char *dir)
+{
+    uint64_t dir_hash = key_of(dir, strlen(dir));
+    const search_listing_t *found = NULL;
+    pthread_rwlock_rdlock(&sp->lock);
+    if (sp->slot_capacity > 0) {
+        int slot = find_slot(sp, dir, dir_hash);
+        if (sp->slots[slot] != EMPTY_SLOT) found = sp->listings[sp->slots[slot]];
+    }
+    pthread_rwlock_unlock(&sp->lock);
+    if (found) return found;
+
+    search_listing_t *fresh = listing_read(dir, dir_hash);
+    if (!fresh) return NULL;
+
+    pthread_rwlock_wrlock(&sp->lock);
+    if (sp->slot_capacity > 0) {
+        int slot = find_slot(sp, dir, dir_hash);
+        if (sp->slots[slot] != EMPTY_SLOT) found = sp->listings[sp->slots[slot]];
+    }
+    if (!found && grow(sp) == 0) {
+        sp->listings[sp->listing_count] = fresh;
+        sp->slots[find_slot(sp, dir, dir_hash)] = sp->listing_count;
+        sp->listing_count++;
+        found = fresh;
+        fresh = NULL;
+        __atomic_fetch_add(&sp->dirs_listed, 1, __ATOMIC_RELAXED);
+    }
+    pthread_rwlock_unlock(&sp->lock);
+    listing_free(fresh);
+    return found;
+}
+
+/* ---- Search --------------------------------------------------------------- */
+
+// Try "<dir>/<name>" (just name if dir is NULL); the path is left in out.
+static int probe(search_path_t *sp, const char *dir, const char *name, char *out, size_t size,
+                 cache_deps_t *missing)
+{
+    int n = dir ? snprintf(out, size, "%s/%s", dir, name) : snprintf(out, size, "%s", name);
+    if (n < 0 || (size_t)n >= size) return SEARCH_ERR_TOO_LONG;
+    __atomic_fetch_add(&sp->candidates, 1, __ATOMIC_RELAXED);
+
+    // Split into the directory to list and the entry looked up in it
+    char list_dir[PP_MAX_PATH_LEN];
+    const char *slash = strrchr(out, '/');
+    const char *entry = slash ? slash + 1 : out;
+    if (!slash) {
+        strcpy(list_dir, ".");
+    } else if (slash == out) {
+        strcpy(list_dir, "/");
+    } else if ((size_t)(slash - out) >= sizeof(list_dir)) {
+        return SEARCH_ERR_TOO_LONG;
+    } else {
+        memcpy(list_dir, out, (size_t)(slash - out));
+        list_dir[slash - out] = '\0';
+    }
+
+    const search_listing_t *l = get_listing(sp, list_dir);
+    if (!l) return SEARCH_ERR_MEMORY;
+
+    int exists;
+    if (l->state == LISTING_UNREADABLE) {
+        __atomic_fetch_add(&sp->stat_probes, 1, __ATOMIC_RELAXED);
+        struct stat sb;
+        exists = stat(out, &sb) == 0 && !S_ISDIR(sb.st_mode);
+    } else {
+        exists = l->state == LISTING_ENTRIES && entry[0] && listing_has(l, entry);
+        if (!exists) __atomic_fetch_add(&sp->probes_avoided, 1, __ATOMIC_RELAXED);
+    }
+    if (exists) return SEARCH_FOUND;
+    if (missing && cache_deps_add_missing(missing, out) != 0) return SEARCH_ERR_MEMORY;
+    return SEARCH_NOT_FOUND;
+}
+
+int search_path_find(search_path_t *sp, const char *from_dir, const char *name, int angled,
+                     char *out, size_t size, cache_deps_t *missing)
+{
+    __atomic_fetch_add(&sp->lookups, 1, __ATOMIC_RELAXED);
+
+    // Absolute names are used as written
+    if (name[0] == '/') return probe(sp, NULL, name, out, size, missing);
+
+    int rc = SEARCH_NOT_FOUND;
+    if (!angled) {
+        rc = probe(sp, from_dir && from_dir[0] ? from_dir : NULL, name, out, size, missing);
+        if (rc != SEARCH_NOT_FOUND) return rc;
+    }
+    // User directories, then system ones, each in command-line order
+    for (int system = 0; system <= 1; system++) {
+        for (int i = 0; i < sp->count; i++) {
+            if (sp->system[i] != system) continue;
+            rc = probe(sp, sp->dirs[i], name, out, size, missing);
+            if (rc != SEARCH_NOT_FOUND) return rc;
+        }
+    }
+    return SEARCH_NOT_FOUND;
+}
+
+/* ---- Setup ---------------------------------------------------------------- */
+
+void search_path_init(search_path_t *sp)
+{
+    memset(sp, 0, sizeof(*sp));
+    pthread_rwlock_init(&sp->lock, NULL);
+}
+
+void search_path_free(search_path_t *sp)
+{
+    for (int i = 0; i < sp->count; i++) free(sp->dirs[i]);
+    for (int i = 0; i < sp->listing_count; i++) listing_free(sp->listings[i]);
+    free(sp->dirs);
+    free(sp->system);
+    free(sp->listings);
+    free(sp->slots);
+    pthread_rwlock_destroy(&sp->lock);
+    sp->dirs = NULL;
+    sp->system = NULL;
+    sp->listings = NULL;
+    sp->slots = NULL;
+    sp->count = sp->capacity = 0;
+    sp->listing_count = sp->listing_capacity = sp->slot_capacity = 0;
+}
+
+int search_path_add(search_path_t *sp, const char *dir, int system)
+{
+    if (sp->count == sp->capacity) {
+        int capacity = sp->capacity ? sp->capacity * 2 : INITIAL_DIRS;
+        char **dirs = realloc(sp->dirs, sizeof(char *) * (size_t)capacity);
+        if (!dirs) return 1;
+        sp->dirs = dirs;
+        unsigned char *kinds = realloc(sp->system, (size_t)capacity);
+        if (!kinds) return 1;
+        sp->system = kinds;
+        sp->capacity = capacity;
+    }
+
+    // "dir/" and "dir" name the same candidates
+    size_t len = strlen(dir);
+    while (len > 1 && dir[len - 1] == '/') len--;
+    char *copy = malloc(len + 1);
+    if (!copy) return 1;
+    memcpy(copy, dir, len);
+    copy[len] = '\0';
+
+    sp->dirs[sp->count] = copy;
+    sp->system[sp->count] = system ? 1 : 0;
+    sp->count++;
+    return 0;
+}
+
+hash128_t search_path_key(const search_path_t *sp)
+{
+    hash_state_t st;
+    hash_init(&st);
+    hash_update_str(&st, SEARCH_KEY_VERSION);
+    for (int system = 0; system <= 1; system++) {
+        for (int i = 0; i < sp->count; i++) {
+            if (sp->system[i] != system) continue;
+            const char *dir = sp->dirs[i];
+            char abs_dir[PP_MAX_PATH_LEN];
+#ifndef _WIN32
+            if (realpath(dir, abs_dir)) dir = abs_dir;
+#endif
+            hash_update(&st, &sp->system[i], 1);
+            hash_update_str(&st, dir);
+        }
+    }
+    return hash_final(&st);
+}
+
+void search_path_print_stats(const search_path_t *sp, FILE *out)
+{
+    fprintf(out, PP_FMT_STATS_SEARCH, sp->lookups, sp->candidates, sp->probes_avoided,
+            sp->dirs_listed, sp->stat_probes);
+}
@@ -0,0 +1,84 @@
+/* -----------------------------------------------------------------------------
+ * Program: C Preprocessor (Practice 1)
+ * Description:
+ *     This module resolves #include names against the directory of the
+ *     including file and the -I / -isystem search directories.
+ *
+ * - `search_path_add`: Append a user (-I) or system (-isystem) directory.
+ *   System directories are searched after every user directory.
+ * - `search_path_find`: Resolve a quoted name (including file's directory
+ *   first) or an angled one (search directories only). Candidates are
+ *   answered from a cache of directory entries: each directory is read once
+ *   per run, so a candidate that does not exist costs no syscall and a hit
+ *   leaves only the open of the file itself. Missing candidates tried before
+ *   the hit are recorded as negative dependencies.
+ * - `search_path_key`: Hash of the directory list, for cache keys and stamps.
+ *
+ * Status:
+ *     Active - the entry cache is shared by every file of a run (read-write
+ *     lock); on _WIN32 directories are not listed and candidates are probed
+ *     with stat.
+ * -------------------------------------------------------------------------- */
+
+#ifndef SEARCH_PATH_H
+#define SEARCH_PATH_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "hash/hash.h"
+#include "cache/cache.h"
+
+// Result codes of search_path_find.
+#define SEARCH_FOUND 0
+#define SEARCH_NOT_FOUND 1
+#define SEARCH_ERR_TOO_LONG 2
+#define SEARCH_ERR_MEMORY 3
+
+/* Cached entries of one directory (defined in search_path.c). */
+typedef struct search_listing search_listing_t;
+
+typedef struct {
+    /* Search directories in command-line order; system[i] marks -isystem. */
+    char **dirs;
+    unsigned char *system;
+    int count;
+    int capacity;
+    /* Listings keyed by directory path (open addressing, -1 marks empty). */
+    search_listing_t **listings;
+    int listing_count;
+    int listing_capacity;
+    int *slots;
+    int slot_capacity;
+    pthread_rwlock_t lock;
+    /* Statistics (updated atomically; files may resolve in parallel):
+     * names resolved, candidate paths tried, missing candidates answered
+     * from a listing without a syscall, directories read, stat fallbacks */
+    long lookups;
+    long candidates;
+    long probes_avoided;
+    long dirs_listed;
+    long stat_probes;
+} search_path_t;
+
+void search_path_init(search_path_t *sp);
+void search_path_free(search_path_t *sp);
+
+/* Append dir (user or system). Returns 0, or 1 if out of memory. */
+int search_path_add(search_path_t *sp, const char *dir, int system);
+
+/* Resolve name, written between quotes (angled == 0) or angle brackets.
+ * Quoted names are tried in from_dir first. On SEARCH_FOUND the path is in
+ * out. If missing is not NULL, the candidates that did not exist are added
+ * to it (all of them when nothing is found). */
+int search_path_find(search_path_t *sp, const char *from_dir, const char *name, int angled,
+                     char *out, size_t size, cache_deps_t *missing);
+
+/* Hash of the directories and their kinds (absolute paths). */
+hash128_t search_path_key(const search_path_t *sp);
+
+/* Print this run's lookup counters. */
+void search_path_print_stats(const search_path_t *sp, FILE *out);
+
+#endif
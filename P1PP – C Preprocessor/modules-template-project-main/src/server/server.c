@@ -0,0 +1,454 @@
+/* -----------------------------------------------------------------------------
+ * Program: C Preprocessor (Practice 1)
+ * Description:
+ *     This module implements the request server declared in server.h.
+ *
+ * - `serve_connection`: Worker task: read one request with its descriptors,
+ *   enter the client's directory, run the handler and send its status.
+ * - `enter_client_dir`: Gives the worker thread a working directory of its
+ *   own the first time (unshare(CLONE_FS)); pools the handler starts share
+ *   it. Without that, the process's directory is changed under cwd_lock.
+ * - `send_request`: Client side framing.
+ *
+ * Usage:
+ *     See server.h.
+ *
+ * Status:
+ *     Active - one request per connection; a client that goes away only
+ *     makes the writes of its request fail (SIGPIPE is ignored).
+ * -------------------------------------------------------------------------- */
+
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include "server.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+// Descriptors passed with a request: working directory, stdout, stderr.
+#define REQUEST_FDS 3
+
+#ifndef _WIN32
+
+/* One accepted connection (a pool task). */
+typedef struct {
+    server_t *srv;
+    int fd;
+} server_conn_t;
+
+// Fill addr with path. Returns 0, or 1 if the path does not fit.
+static int make_address(const char *path, struct sockaddr_un *addr)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path)) return 1;
+    strcpy(addr->sun_path, path);
+    return 0;
+}
+
+// Socket connected to path, or -1.
+static int connect_to(const char *path)
+{
+    struct sockaddr_un addr;
+    if (make_address(path, &addr) != 0) return -1;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Read or write exactly len bytes. Returns 0, or 1 on error or end of file.
+static int read_full(int fd, void *data, size_t len)
+{
+    char *p = (char *)data;
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return 1;
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static int write_full(int fd, const void *data, size_t len)
+{
+    const char *p = (const char *)data;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return 1;
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static void close_fds(int *fds, int count)
+{
+    for (int i = 0; i < count; i++) {
+        if (fds[i] >= 0) close(fds[i]);
+    }
+}
+
+// Receive the request header and its descriptors. Returns 0 with all
+// REQUEST_FDS descriptors in fds, or 1 (nothing is left open).
+static int receive_header(int fd, server_request_t *req, int *fds)
+{
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int) * REQUEST_FDS)];
+    } control;
+    struct iovec iov = {req, sizeof(*req)};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    ssize_t n;
+    do {
+        n = recvmsg(fd, &msg, 0);
+    } while (n < 0 && errno == EINTR);
+
+    int count = 0;
+    for (struct cmsghdr *c = n > 0 ? CMSG_FIRSTHDR(&msg) : NULL; c; c = CMSG_NXTHDR(&msg, c)) {
+        if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS) continue;
+        int received = (int)((c->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+        for (int i = 0; i < received; i++) {
+            int passed;
+            memcpy(&passed, CMSG_DATA(c) + i * sizeof(int), sizeof(int));
+            if (count < REQUEST_FDS) fds[count++] = passed;
+            else close(passed);
+        }
+    }
+
+    // The header may arrive in pieces; the descriptors come with its first byte
+    if (n > 0 && (size_t)n < sizeof(*req) &&
+        read_full(fd, (char *)req + n, sizeof(*req) - (size_t)n) != 0) {
+        n = -1;
+    }
+    if (n <= 0 || count != REQUEST_FDS || (msg.msg_flags & MSG_CTRUNC) ||
+        req->magic != SERVER_MAGIC || req->version != SERVER_VERSION) {
+        close_fds(fds, count);
+        return 1;
+    }
+    return 0;
+}
+
+// Split bytes into argc NUL-terminated strings. Returns argv, or NULL if the
+// strings do not match argc.
+static char **split_argv(char *bytes, uint32_t len, uint32_t argc)
+{
+    if (argc == 0 || len == 0 || bytes[len - 1] != '\0') return NULL;
+    char **argv = malloc(sizeof(char *) * ((size_t)argc + 1));
+    if (!argv) return NULL;
+    uint32_t n = 0;
+    for (char *p = bytes, *end = bytes + len; p < end; p += strlen(p) + 1) {
+        if (n == argc) {
+            free(argv);
+            return NULL;
+        }
+        argv[n++] = p;
+    }
+    if (n != argc) {
+        free(argv);
+        return NULL;
+    }
+    argv[n] = NULL;
+    return argv;
+}
+
+#ifdef __linux__
+// Set once the calling thread has a working directory of its own.
+static _Thread_local int private_dir = 0;
+#endif
+
+// Move the calling thread into dir_fd. Returns 1 if only this thread moved,
+// 0 if the process did (cwd_lock is then held and *saved is the directory
+// to return to), -1 on failure.
+static int enter_client_dir(server_t *srv, int dir_fd, int *saved)
+{
+#ifdef __linux__
+    if (!private_dir && unshare(CLONE_FS) == 0) private_dir = 1;
+    if (private_dir) return fchdir(dir_fd) == 0 ? 1 : -1;
+#endif
+    pthread_mutex_lock(&srv->cwd_lock);
+    *saved = open(".", O_RDONLY);
+    if (*saved < 0 || fchdir(dir_fd) != 0) {
+        if (*saved >= 0) close(*saved);
+        pthread_mutex_unlock(&srv->cwd_lock);
+        return -1;
+    }
+    return 0;
+}
+
+static void leave_client_dir(server_t *srv, int entered, int saved)
+{
+    if (entered != 0) return;
+    // Best effort: every request enters its client's directory anyway
+    int rc = fchdir(saved);
+    (void)rc;
+    close(saved);
+    pthread_mutex_unlock(&srv->cwd_lock);
+}
+
+// Worker task: serve one connection.
+static void serve_connection(void *arg)
+{
+    server_conn_t *conn = (server_conn_t *)arg;
+    server_t *srv = conn->srv;
+    int fd = conn->fd;
+    free(conn);
+
+    server_request_t req;
+    int fds[REQUEST_FDS];
+    if (receive_header(fd, &req, fds) != 0) {
+        close(fd);
+        return;
+    }
+
+    char *bytes = NULL;
+    char **argv = NULL;
+    if (req.bytes > 0 && req.bytes <= SERVER_MAX_REQUEST && (bytes = malloc(req.bytes)) &&
+        read_full(fd, bytes, req.bytes) == 0) {
+        argv = split_argv(bytes, req.bytes, req.argc);
+    }
+
+    int saved = -1;
+    int entered = argv ? enter_client_dir(srv, fds[0], &saved) : -1;
+    FILE *err = entered >= 0 ? fdopen(fds[2], "w") : NULL;
+    int32_t status = 1;
+    if (err) {
+        fds[2] = -1;
+        // One message per line reaches the client as it is reported
+        setvbuf(err, NULL, _IOLBF, 0);
+        server_io_t io = {fds[1], err};
+        status = (int32_t)srv->handler((int)req.argc, argv, &io, srv->arg);
+        fclose(err);
+        __atomic_fetch_add(&srv->served, 1, __ATOMIC_RELAXED);
+    }
+    if (entered >= 0) leave_client_dir(srv, entered, saved);
+
+    // Output is complete before the client learns the status
+    close_fds(fds, REQUEST_FDS);
+    if (argv) write_full(fd, &status, sizeof(status));
+    close(fd);
+    free(argv);
+    free(bytes);
+}
+
+int server_open(server_t *srv, const char *path, int workers, server_handler_fn handler,
+                void *arg)
+{
+    memset(srv, 0, sizeof(*srv));
+    srv->fd = -1;
+    struct sockaddr_un addr;
+    if (make_address(path, &addr) != 0) return SERVER_ERR_SOCKET;
+
+    // A socket nobody answers on was left by a server that is gone
+    int probe = connect_to(path);
+    if (probe >= 0) {
+        close(probe);
+        return SERVER_ERR_IN_USE;
+    }
+    struct stat st;
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) unlink(path);
+
+    srv->path = strdup(path);
+    srv->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (!srv->path || srv->fd < 0 || bind(srv->fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        if (srv->fd >= 0) close(srv->fd);
+        free(srv->path);
+        return SERVER_ERR_SOCKET;
+    }
+    fcntl(srv->fd, F_SETFD, FD_CLOEXEC);
+    if (listen(srv->fd, SOMAXCONN) != 0 || pool_create(&srv->pool, workers) != 0) {
+        close(srv->fd);
+        unlink(path);
+        free(srv->path);
+        return SERVER_ERR_SOCKET;
+    }
+    srv->handler = handler;
+    srv->arg = arg;
+    pthread_mutex_init(&srv->cwd_lock, NULL);
+
+    // A client that goes away must not take the server with it
+    signal(SIGPIPE, SIG_IGN);
+    return SERVER_OK;
+}
+
+void server_run(server_t *srv)
+{
+    while (!__atomic_load_n(&srv->stopping, __ATOMIC_RELAXED)) {
+        int fd = accept(srv->fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+                // Out of descriptors: let running requests release some
+                pool_wait(&srv->pool);
+                continue;
+            }
+            break;
+        }
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        server_conn_t *conn = malloc(sizeof(server_conn_t));
+        if (!conn) {
+            close(fd);
+            continue;
+        }
+        conn->srv = srv;
+        conn->fd = fd;
+        if (pool_submit(&srv->pool, serve_connection, conn) != 0) serve_connection(conn);
+    }
+    pool_wait(&srv->pool);
+}
+
+void server_stop(server_t *srv)
+{
+    __atomic_store_n(&srv->stopping, 1, __ATOMIC_RELAXED);
+    // Wakes a blocked accept
+    shutdown(srv->fd, SHUT_RDWR);
+}
+
+void server_close(server_t *srv)
+{
+    pool_destroy(&srv->pool);
+    close(srv->fd);
+    unlink(srv->path);
+    free(srv->path);
+    pthread_mutex_destroy(&srv->cwd_lock);
+    srv->fd = -1;
+    srv->path = NULL;
+}
+
+// Send the header with the descriptors, then argv. Returns 0 or 1.
+static int send_request(int fd, int argc, char **argv, int *fds)
+{
+    size_t len = 0;
+    for (int i = 0; i < argc; i++) len += strlen(argv[i]) + 1;
+    if (argc <= 0 || len > SERVER_MAX_REQUEST) return 1;
+    char *bytes = malloc(len);
+    if (!bytes) return 1;
+    char *p = bytes;
+    for (int i = 0; i < argc; i++) {
+        size_t n = strlen(argv[i]) + 1;
+        memcpy(p, argv[i], n);
+        p += n;
+    }
+
+    server_request_t req = {SERVER_MAGIC, SERVER_VERSION, (uint32_t)argc, (uint32_t)len};
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int) * REQUEST_FDS)];
+    } control;
+    memset(&control, 0, sizeof(control));
+    struct iovec iov = {&req, sizeof(req)};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+    c->cmsg_level = SOL_SOCKET;
+    c->cmsg_type = SCM_RIGHTS;
+    c->cmsg_len = CMSG_LEN(sizeof(int) * REQUEST_FDS);
+    memcpy(CMSG_DATA(c), fds, sizeof(int) * REQUEST_FDS);
+
+    ssize_t n;
+    do {
+        n = sendmsg(fd, &msg, 0);
+    } while (n < 0 && errno == EINTR);
+    int rc = n <= 0 || ((size_t)n < sizeof(req) &&
+                        write_full(fd, (char *)&req + n, sizeof(req) - (size_t)n) != 0) ||
+             write_full(fd, bytes, len) != 0;
+    free(bytes);
+    return rc;
+}
+
+int server_request(const char *path, int argc, char **argv, int out_fd, int err_fd,
+                   int *status)
+{
+    int fd = connect_to(path);
+    if (fd < 0) return SERVER_ERR_SOCKET;
+    int dir_fd = open(".", O_RDONLY);
+    if (dir_fd < 0) {
+        close(fd);
+        return SERVER_ERR_SOCKET;
+    }
+
+    // Writing to a server that died must fail, not kill the client
+    void (*prev_pipe)(int) = signal(SIGPIPE, SIG_IGN);
+    int fds[REQUEST_FDS] = {dir_fd, out_fd, err_fd};
+    int rc = SERVER_ERR_SOCKET;
+    if (send_request(fd, argc, argv, fds) == 0) {
+        // Nothing else is sent: the server holds our descriptors now
+        int32_t result;
+        rc = read_full(fd, &result, sizeof(result)) == 0 ? SERVER_OK : SERVER_ERR_LOST;
+        if (rc == SERVER_OK) *status = (int)result;
+    }
+    signal(SIGPIPE, prev_pipe);
+    close(dir_fd);
+    close(fd);
+    return rc;
+}
+
+#else
+
+int server_open(server_t *srv, const char *path, int workers, server_handler_fn handler,
+                void *arg)
+{
+    (void)path;
+    (void)workers;
+    (void)handler;
+    (void)arg;
+    memset(srv, 0, sizeof(*srv));
+    return SERVER_ERR_SOCKET;
+}
+
+void server_run(server_t *srv)
+{
+    (void)srv;
+}
+
+void server_stop(server_t *srv)
+{
+    (void)srv;
+}
+
+void server_close(server_t *srv)
+{
+    (void)srv;
+}
+
+int server_request(const char *path, int argc, char **argv, int out_fd, int err_fd,
+                   int *status)
+{
+    (void)path;
+    (void)argc;
+    (void)argv;
+    (void)out_fd;
+    (void)err_fd;
+    (void)status;
+    return SERVER_ERR_SOCKET;
+}
+
+#endif
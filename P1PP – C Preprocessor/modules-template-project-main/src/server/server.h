@@ -0,0 +1,108 @@
+/* -----------------------------------------------------------------------------
+ * Program: C Preprocessor (Practice 1)
+ * Description:
+ *     This module runs command lines on behalf of other processes over a
+ *     Unix domain socket, so one long-lived process (-serve) can keep its
+ *     caches warm between invocations of the tool (-connect).
+ *
+ * - `server_open` / `server_run` / `server_stop` / `server_close`: Listen on
+ *   a socket path, hand each connection to a worker of a thread pool, stop
+ *   accepting (from a signal handler too) and remove the socket.
+ * - `server_request`: Client side: send a command line and wait for its
+ *   exit status.
+ *
+ * Protocol (one request per connection, native byte order):
+ *     client -> server_request_t, with the client's working directory,
+ *               stdout and stderr passed as descriptors (SCM_RIGHTS)
+ *     client -> argv as `argc` NUL-terminated strings (`bytes` in all)
+ *     server -> int32_t exit status, once the handler returned
+ *     The handler writes to the client's own stdout and stderr, and paths
+ *     resolve against the client's directory: each worker thread gets a
+ *     working directory of its own (Linux unshare), elsewhere requests take
+ *     turns changing the process's.
+ *
+ * Usage:
+ *     main serves the preprocessor's command line through the handler and
+ *     falls back to running it locally when no daemon answers.
+ *
+ * Status:
+ *     Active - POSIX only; on _WIN32 server_open and server_request fail.
+ * -------------------------------------------------------------------------- */
+
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "pool/pool.h"
+
+// First word of a request ("P1PP") and the protocol version.
+#define SERVER_MAGIC 0x50503150u
+#define SERVER_VERSION 1u
+// Largest argv a request may carry, in bytes.
+#define SERVER_MAX_REQUEST (1 << 20)
+
+// Result codes.
+#define SERVER_OK 0
+#define SERVER_ERR_SOCKET 1    /* cannot listen / no daemon answered */
+#define SERVER_ERR_IN_USE 2    /* another server listens on the path */
+#define SERVER_ERR_LOST 3      /* the request was sent, the status never came */
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t argc;
+    uint32_t bytes;
+} server_request_t;
+
+/* Where a request's output goes: the client's stdout and stderr. */
+typedef struct {
+    int out_fd;
+    FILE *err;
+} server_io_t;
+
+/* Run one request; returns its exit status. Called on a worker thread whose
+ * working directory is the client's. */
+typedef int (*server_handler_fn)(int argc, char **argv, const server_io_t *io, void *arg);
+
+typedef struct {
+    /* Listening socket and its path. */
+    int fd;
+    char *path;
+    /* Workers serving the connections. */
+    pool_t pool;
+    server_handler_fn handler;
+    void *arg;
+    /* Held around requests that change the process's working directory. */
+    pthread_mutex_t cwd_lock;
+    /* Set by server_stop. */
+    int stopping;
+    /* Requests served (updated atomically). */
+    long served;
+} server_t;
+
+/* Listen on path with workers threads (0: one per CPU). A stale socket left
+ * by a server that is gone is replaced. Returns SERVER_OK, SERVER_ERR_IN_USE
+ * if a server answers there, or SERVER_ERR_SOCKET. */
+int server_open(server_t *srv, const char *path, int workers, server_handler_fn handler,
+                void *arg);
+
+/* Accept and serve connections until server_stop; returns once the
+ * requests in progress are done. */
+void server_run(server_t *srv);
+
+/* Make server_run return (async-signal-safe). */
+void server_stop(server_t *srv);
+
+/* Stop the workers, close the socket and remove its path. */
+void server_close(server_t *srv);
+
+/* Have the server at path run argv, writing to out_fd and err_fd; the exit
+ * status is stored in status. Returns SERVER_OK, SERVER_ERR_SOCKET if no
+ * server took the request (nothing was run) or SERVER_ERR_LOST. */
+int server_request(const char *path, int argc, char **argv, int out_fd, int err_fd,
+                   int *status);
+
+#endif
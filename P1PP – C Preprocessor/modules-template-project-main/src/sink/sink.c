@@ -0,0 +1,147 @@
+/* -----------------------------------------------------------------------------
+ * Program: C Preprocessor (Practice 1)
+ * Description:
+ *     This module implements the bounded output sink declared in sink.h.
+ *
+ * - `sink_init_fd` / `sink_open_path`: Set up the destination descriptor.
+ * - `sink_write`: Appends bytes, writing large blocks directly.
+ * - `sink_maybe_flush` / `sink_flush`: Drain the staging buffer with write().
+ * - `sink_close`: Final flush and cleanup.
+ *
+ * Usage:
+ *     Called by main and pp_core when output is streamed to a file or stdout.
+ *
+ * Status:
+ *     Active - streaming output for the preprocessor CLI.
+ * -------------------------------------------------------------------------- */
+
+#include <errno.h>
+#include <fcntl.h>
+#ifdef _WIN32
+#include <io.h>
+#define write _write
+#define close _close
+#define open _open
+#else
+#include <unistd.h>
+#endif
+
+#include "sink.h"
+#include "errors/errors.h"
+
+// Permissions for newly created output files (before umask).
+#define SINK_FILE_MODE 0644
+
+// Wrap an already open descriptor.
+void sink_init_fd(sink_t *sink, int fd, long threshold)
+{
+    sink->fd = fd;
+    sink->owns_fd = 0;
+    sink->tee_fd = -1;
+    sink->tee_failed = 0;
+    buffer_init(&sink->buf);
+    sink->threshold = threshold > 0 ? threshold : 1;
+    sink->bytes_written = 0;
+    sink->flushes = 0;
+    sink->peak_pending = 0;
+    sink->failed = 0;
+}
+
+// Create or truncate path and wrap its descriptor.
+int sink_open_path(sink_t *sink, const char *path, long threshold)
+{
+    sink_init_fd(sink, -1, threshold);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, SINK_FILE_MODE);
+    if (fd < 0) {
+        error(0, "Cannot open output file: %s", path ? path : "(null)");
+        sink->failed = 1;
+        return 1;
+    }
+    sink->fd = fd;
+    sink->owns_fd = 1;
+    return 0;
+}
+
+// Write len bytes to fd, retrying short and interrupted writes.
+static int write_all(int fd, const char *p, long left)
+{
+    while (left > 0) {
+        long n = (long)write(fd, p, (size_t)left);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return 1;
+        p += n;
+        left -= n;
+    }
+    return 0;
+}
+
+// Write all staged bytes (and copy them to the tee descriptor).
+int sink_flush(sink_t *sink)
+{
+    if (sink->failed) return 1;
+    if (sink->buf.len > sink->peak_pending) sink->peak_pending = sink->buf.len;
+    if (sink->buf.len == 0) return 0;
+
+    if (write_all(sink->fd, sink->buf.data, sink->buf.len) != 0) {
+        // Reported by the caller, which knows the current file and line
+        sink->failed = 1;
+        return 1;
+    }
+    if (sink->tee_fd >= 0 && !sink->tee_failed &&
+        write_all(sink->tee_fd, sink->buf.data, sink->buf.len) != 0) {
+        sink->tee_failed = 1;
+    }
+
+    sink->bytes_written += sink->buf.len;
+    sink->flushes++;
+    // Keep the allocation: the next batch reuses it
+    sink->buf.len = 0;
+    sink->buf.data[0] = BUFFER_CHAR_NUL;
+    return 0;
+}
+
+// Append bytes; blocks of at least threshold bytes bypass the staging buffer.
+int sink_write(sink_t *sink, const char *data, long len)
+{
+    if (sink->failed) return 1;
+    if (len < sink->threshold) {
+        if (buffer_append_n(&sink->buf, data, len) != 0) {
+            sink->failed = 1;
+            return 1;
+        }
+        return sink_maybe_flush(sink);
+    }
+
+    if (sink_flush(sink) != 0) return 1;
+    if (write_all(sink->fd, data, len) != 0) {
+        sink->failed = 1;
+        return 1;
+    }
+    if (sink->tee_fd >= 0 && !sink->tee_failed && write_all(sink->tee_fd, data, len) != 0) {
+        sink->tee_failed = 1;
+    }
+    sink->bytes_written += len;
+    sink->flushes++;
+    return 0;
+}
+
+// Flush only once the threshold has been reached.
+int sink_maybe_flush(sink_t *sink)
+{
+    if (sink->buf.len < sink->threshold) return sink->failed;
+    return sink_flush(sink);
+}
+
+// Final flush and cleanup.
+int sink_close(sink_t *sink)
+{
+    int rc = sink_flush(sink);
+    if (sink->owns_fd && sink->fd >= 0 && close(sink->fd) != 0) {
+        error(0, "Failed to close output file");
+        rc = 1;
+    }
+    sink->fd = -1;
+    sink->owns_fd = 0;
+    buffer_free(&sink->buf);
+    return rc;
+}
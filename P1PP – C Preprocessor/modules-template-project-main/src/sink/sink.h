@@ -0,0 +1,71 @@
+/* -----------------------------------------------------------------------------
+ * Program: C Preprocessor (Practice 1)
+ * Description:
+ *     This module provides a bounded output sink: bytes are staged in a
+ *     buffer and written to a file descriptor once the buffer reaches a
+ *     fixed threshold, so memory use does not grow with the output size.
+ *
+ * - `sink_init_fd`: Wraps an already open descriptor (e.g. stdout).
+ * - `sink_open_path`: Creates/truncates a file and wraps its descriptor.
+ * - `sink_write`: Appends bytes produced outside pp_core (e.g. cached output).
+ * - `sink_maybe_flush`: Writes the staged bytes once the threshold is reached.
+ * - `sink_flush`: Writes all staged bytes.
+ * - `sink_close`: Flushes, closes owned descriptors and frees the buffer.
+ *
+ * An optional tee descriptor receives a copy of every byte (used to fill the
+ * preprocessing cache while the output is written).
+ *
+ * Usage:
+ *     Owned by the caller of pp_run_stream; pp_core appends each finished
+ *     line to `buf` and calls sink_maybe_flush.
+ *
+ * Status:
+ *     Active - streaming output for the preprocessor CLI.
+ * -------------------------------------------------------------------------- */
+
+#ifndef SINK_H
+#define SINK_H
+
+#include "buffer/buffer.h"
+
+/* Output sink that flushes a bounded buffer to a file descriptor. */
+typedef struct {
+    /* Destination descriptor. */
+    int fd;
+    /* Non-zero if sink_close must close fd. */
+    int owns_fd;
+    /* Second destination (-1 for none; never closed by the sink). */
+    int tee_fd;
+    /* Non-zero once writing to tee_fd has failed (the copy is incomplete). */
+    int tee_failed;
+    /* Bytes staged but not yet written. */
+    buffer_t buf;
+    /* Staged size that triggers a write. */
+    long threshold;
+    /* Statistics: bytes written, write batches and largest staged size. */
+    long bytes_written;
+    long flushes;
+    long peak_pending;
+    /* Non-zero once a write has failed (later flushes are no-ops). */
+    int failed;
+} sink_t;
+
+/* Wrap an open descriptor; the sink does not close it. */
+void sink_init_fd(sink_t *sink, int fd, long threshold);
+
+/* Create or truncate path for writing. Returns 0 on success, 1 on failure. */
+int sink_open_path(sink_t *sink, const char *path, long threshold);
+
+/* Append len bytes (large blocks are written straight through). Returns 0 or 1. */
+int sink_write(sink_t *sink, const char *data, long len);
+
+/* Write staged bytes if at least threshold are pending. Returns 0 or 1. */
+int sink_maybe_flush(sink_t *sink);
+
+/* Write every staged byte. Returns 0 on success, 1 on failure. */
+int sink_flush(sink_t *sink);
+
+/* Flush, close an owned descriptor and free the buffer. Returns 0 or 1. */
+int sink_close(sink_t *sink);
+
+#endif
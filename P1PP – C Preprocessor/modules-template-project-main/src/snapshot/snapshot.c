@@ -0,0 +1,374 @@
+/* -----------------------------------------------------------------------------
+ * Program: C Preprocessor (Practice 1)
+ * Description:
+ *     This module implements the prefix header snapshots declared in
+ *     snapshot.h.
+ *
+ * - The image is assembled in one buffer and written under a temporary name,
+ *   so runs mapping the previous snapshot keep a consistent file.
+ * - Loading checks every offset against the mapping before anything is read
+ *   through it; strings are used in place, never copied.
+ *
+ * Usage:
+ *     Called by pp_core (capture, apply, emit) and main (write, open, close).
+ *
+ * Status:
+ *     Active - see snapshot.h for the file layout.
+ * -------------------------------------------------------------------------- */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "snapshot.h"
+#include "io/io.h"
+#include "errors/errors.h"
+#include "spec/pp_spec.h"
+
+// Value of snapshot_header_t.byte_order on the machine that wrote the file.
+#define SNAPSHOT_BYTE_ORDER 0x01020304u
+
+/* ---- Capture -------------------------------------------------------------- */
+
+void snapshot_state_init(snapshot_state_t *state)
+{
+    buffer_init(&state->macros);
+    buffer_init(&state->strings);
+    state->macro_count = 0;
+    ifdef_stack_init(&state->ifs);
+    state->captured = 0;
+}
+
+void snapshot_state_free(snapshot_state_t *state)
+{
+    buffer_free(&state->macros);
+    buffer_free(&state->strings);
+    state->macro_count = 0;
+    state->captured = 0;
+}
+
+// Append s[0..len) and a NUL to the pool; its offset goes to *offset.
+static int pool_add(buffer_t *pool, const char *s, long len, uint64_t *offset)
+{
+    *offset = (uint64_t)pool->len;
+    return buffer_append_n(pool, s, len) || buffer_append_char(pool, '\0');
+}
+
+int snapshot_capture(snapshot_state_t *state, const macro_table_t *macros,
+                     const ifdef_stack_t *ifs)
+{
+    state->macros.len = 0;
+    state->strings.len = 0;
+    state->macro_count = 0;
+    for (int i = 0; i < macros->capacity; i++) {
+        const macro_t *m = &macros->items[i];
+        if (!m->name) continue;
+
+        snapshot_macro_t rec;
+        memset(&rec, 0, sizeof(rec));
+        rec.name_len = (uint32_t)m->name_len;
+        rec.value_len = (uint32_t)m->value_len;
+        rec.function_like = m->tmpl != NULL;
+        if (pool_add(&state->strings, m->name, m->name_len, &rec.name) ||
+            pool_add(&state->strings, m->value, m->value_len, &rec.value) ||
+            buffer_append_n(&state->macros, (const char *)&rec, (long)sizeof(rec))) {
+            return 1;
+        }
+        state->macro_count++;
+    }
+    state->ifs = *ifs;
+    state->captured = 1;
+    return 0;
+}
+
+/* ---- Write ---------------------------------------------------------------- */
+
+// Pad the image to the next 8-byte boundary.
+static int align8(buffer_t *b)
+{
+    while (b->len % 8 != 0) {
+        if (buffer_append_char(b, '\0') != 0) return 1;
+    }
+    return 0;
+}
+
+// Fill the stat fields of rec; files modified since run_start keep a zero mtime.
+static void file_stamp(const char *path, snapshot_file_t *rec, time_t run_start)
+{
+    rec->size = -1;
+    rec->mtime_sec = 0;
+    rec->mtime_nsec = 0;
+    struct stat sb;
+    if (stat(path, &sb) != 0) return;
+    rec->size = (int64_t)sb.st_size;
+#if defined(__APPLE__)
+    int64_t sec = (int64_t)sb.st_mtimespec.tv_sec, nsec = (int64_t)sb.st_mtimespec.tv_nsec;
+#elif defined(_WIN32)
+    int64_t sec = 0, nsec = 0;
+#else
+    int64_t sec = (int64_t)sb.st_mtim.tv_sec, nsec = (int64_t)sb.st_mtim.tv_nsec;
+#endif
+    if (sec < (int64_t)run_start) {
+        rec->mtime_sec = sec;
+        rec->mtime_nsec = nsec;
+    }
+}
+
+// Assemble the whole snapshot file into image.
+static int build_image(buffer_t *image, const snapshot_state_t *state, unsigned options,
+                       const char *header_path, hash128_t header_hash, const cache_deps_t *deps,
+                       const char *output, long output_len, time_t run_start)
+{
+    snapshot_header_t head;
+    memset(&head, 0, sizeof(head));
+    memcpy(head.magic, SNAPSHOT_MAGIC, sizeof(head.magic));
+    head.version = SNAPSHOT_VERSION;
+    head.byte_order = SNAPSHOT_BYTE_ORDER;
+    head.options = options;
+    head.file_count = (uint32_t)(deps->count + 1);
+    head.macro_count = (uint32_t)state->macro_count;
+    head.if_top = state->ifs.top;
+    head.if_first_inactive = state->ifs.first_inactive;
+
+    // File paths go first in the pool, then the macro strings (whose
+    // offsets are shifted by the size of the paths)
+    buffer_t paths;
+    buffer_init(&paths);
+    snapshot_file_t *files = calloc((size_t)head.file_count, sizeof(snapshot_file_t));
+    int rc = files == NULL;
+    char abs_header[PP_MAX_PATH_LEN];
+    const char *first = header_path;
+#ifndef _WIN32
+    if (realpath(header_path, abs_header)) first = abs_header;
+#endif
+    for (uint32_t i = 0; rc == 0 && i < head.file_count; i++) {
+        const char *path = i == 0 ? first : deps->paths[i - 1];
+        files[i].hash = i == 0 ? header_hash : deps->hashes[i - 1];
+        file_stamp(path, &files[i], run_start);
+        rc = pool_add(&paths, path, (long)strlen(path), &files[i].path);
+    }
+
+    head.files_offset = sizeof(head);
+    head.macros_offset = head.files_offset + head.file_count * sizeof(snapshot_file_t);
+    head.levels_offset = head.macros_offset + (uint64_t)state->macros.len;
+    uint64_t levels_size = (uint64_t)(state->ifs.top + 1) * 3 * sizeof(int32_t);
+    head.strings_offset = (head.levels_offset + levels_size + 7) & ~(uint64_t)7;
+    head.strings_size = (uint64_t)(paths.len + state->strings.len);
+    head.output_offset = (head.strings_offset + head.strings_size + 7) & ~(uint64_t)7;
+    head.output_size = (uint64_t)output_len;
+
+    if (rc == 0) {
+        rc = buffer_append_n(image, (const char *)&head, (long)sizeof(head)) ||
+             buffer_append_n(image, (const char *)files,
+                             (long)(head.file_count * sizeof(snapshot_file_t)));
+    }
+    const snapshot_macro_t *recs = (const snapshot_macro_t *)state->macros.data;
+    for (int i = 0; rc == 0 && i < state->macro_count; i++) {
+        snapshot_macro_t rec = recs[i];
+        rec.name += (uint64_t)paths.len;
+        rec.value += (uint64_t)paths.len;
+        rc = buffer_append_n(image, (const char *)&rec, (long)sizeof(rec));
+    }
+    for (int level = 0; rc == 0 && level <= state->ifs.top; level++) {
+        int32_t v[3] = { state->ifs.stack[level], state->ifs.taken[level],
+                         state->ifs.seen_else[level] };
+        rc = buffer_append_n(image, (const char *)v, (long)sizeof(v));
+    }
+    if (rc == 0) {
+        rc = align8(image) || buffer_append_n(image, paths.data, paths.len) ||
+             buffer_append_n(image, state->strings.data, state->strings.len) ||
+             align8(image) || buffer_append_n(image, output, output_len);
+    }
+
+    free(files);
+    buffer_free(&paths);
+    return rc;
+}
+
+int snapshot_write(const char *path, const snapshot_state_t *state, unsigned options,
+                   const char *header_path, hash128_t header_hash, const cache_deps_t *deps,
+                   const char *output, long output_len, time_t run_start)
+{
+    buffer_t image;
+    buffer_init(&image);
+    if (!state->captured ||
+        build_image(&image, state, options, header_path, header_hash, deps, output, output_len,
+                    run_start) != 0) {
+        error(0, "%s: %s", path, PP_ERR_OUT_OF_MEMORY);
+        buffer_free(&image);
+        return 1;
+    }
+
+    // Write next to the target, then rename over it
+    char tmp[PP_MAX_PATH_LEN];
+    int n = snprintf(tmp, sizeof(tmp), "%s.tmpXXXXXX", path);
+    int fd = (n > 0 && n < (int)sizeof(tmp)) ? mkstemp(tmp) : -1;
+    int rc = fd < 0 || fchmod(fd, 0644) != 0;
+    for (long done = 0; rc == 0 && done < image.len;) {
+        ssize_t w = write(fd, image.data + done, (size_t)(image.len - done));
+        if (w <= 0) rc = 1;
+        else done += (long)w;
+    }
+    if (fd >= 0 && close(fd) != 0) rc = 1;
+    if (rc == 0 && rename(tmp, path) != 0) rc = 1;
+    if (rc != 0) {
+        if (fd >= 0) unlink(tmp);
+        error(0, "%s: %s", path, PP_ERR_SNAPSHOT_WRITE);
+    }
+    buffer_free(&image);
+    return rc;
+}
+
+/* ---- Open ----------------------------------------------------------------- */
+
+// Non-zero if [offset, offset + size) lies inside a mapping of len bytes.
+static int in_bounds(uint64_t offset, uint64_t size, uint64_t len)
+{
+    return offset <= len && size <= len - offset;
+}
+
+// Non-zero if the pool string at offset has length len and is NUL-terminated.
+static int valid_string(const snapshot_t *snap, uint64_t offset, uint64_t len)
+{
+    return in_bounds(offset, len + 1, snap->header->strings_size) &&
+           snap->strings[offset + len] == '\0';
+}
+
+// Check the header and every record against the mapping.
+static int validate_layout(snapshot_t *snap)
+{
+    uint64_t len = (uint64_t)snap->map.len;
+    const snapshot_header_t *h = (const snapshot_header_t *)snap->map.data;
+    if (len < sizeof(*h) || memcmp(h->magic, SNAPSHOT_MAGIC, sizeof(h->magic)) != 0 ||
+        h->version != SNAPSHOT_VERSION || h->byte_order != SNAPSHOT_BYTE_ORDER ||
+        h->file_count == 0 || h->if_top < -1 || h->if_top >= PP_MAX_IF_DEPTH ||
+        h->if_first_inactive < -1 || h->if_first_inactive > h->if_top ||
+        !in_bounds(h->files_offset, (uint64_t)h->file_count * sizeof(snapshot_file_t), len) ||
+        !in_bounds(h->macros_offset, (uint64_t)h->macro_count * sizeof(snapshot_macro_t), len) ||
+        !in_bounds(h->levels_offset, (uint64_t)(h->if_top + 1) * 3 * sizeof(int32_t), len) ||
+        !in_bounds(h->strings_offset, h->strings_size, len) ||
+        !in_bounds(h->output_offset, h->output_size, len) ||
+        (h->files_offset | h->macros_offset | h->levels_offset) % 8 != 0) {
+        return 1;
+    }
+
+    snap->header = h;
+    snap->files = (const snapshot_file_t *)(snap->map.data + h->files_offset);
+    snap->macros = (const snapshot_macro_t *)(snap->map.data + h->macros_offset);
+    snap->levels = (const int32_t *)(snap->map.data + h->levels_offset);
+    snap->strings = snap->map.data + h->strings_offset;
+    snap->output = snap->map.data + h->output_offset;
+
+    for (uint32_t i = 0; i < h->file_count; i++) {
+        uint64_t off = snap->files[i].path;
+        if (off >= h->strings_size || !memchr(snap->strings + off, '\0', h->strings_size - off)) {
+            return 1;
+        }
+    }
+    for (uint32_t i = 0; i < h->macro_count; i++) {
+        const snapshot_macro_t *m = &snap->macros[i];
+        if (m->name_len == 0 || m->name_len > INT32_MAX || m->value_len > INT32_MAX ||
+            !valid_string(snap, m->name, m->name_len) ||
+            !valid_string(snap, m->value, m->value_len)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Non-zero if the file still has the recorded contents.
+static int file_current(const snapshot_file_t *rec, const char *path)
+{
+    snapshot_file_t now;
+    file_stamp(path, &now, (time_t)INT64_MAX);
+    // An include candidate that did not exist must still be absent
+    if (hash_equal(rec->hash, CACHE_DEP_MISSING)) return now.size < 0;
+    if (now.size < 0) return 0;
+    if (rec->mtime_sec != 0 && now.mtime_sec == rec->mtime_sec &&
+        now.mtime_nsec == rec->mtime_nsec && now.size == rec->size) {
+        return 1;
+    }
+    hash128_t hash;
+    return hash_file(path, &hash) == 0 && hash_equal(hash, rec->hash);
+}
+
+int snapshot_check(const snapshot_t *snap)
+{
+    for (uint32_t i = 0; i < snap->header->file_count; i++) {
+        if (!file_current(&snap->files[i], snap->strings + snap->files[i].path)) return 0;
+    }
+    return 1;
+}
+
+int snapshot_open(const char *path, unsigned options, snapshot_t *snap)
+{
+    memset(snap, 0, sizeof(*snap));
+    buffer_init(&snap->map);
+    if (io_map_file(path, &snap->map) != 0) {
+        buffer_free(&snap->map);
+        return SNAPSHOT_ERR_READ;
+    }
+
+    int rc = SNAPSHOT_OK;
+    if (validate_layout(snap) != 0) {
+        rc = SNAPSHOT_ERR_FORMAT;
+    } else if (snap->header->options != options) {
+        rc = SNAPSHOT_ERR_OPTIONS;
+    } else if (!snapshot_check(snap)) {
+        rc = SNAPSHOT_ERR_STALE;
+    }
+    if (rc != SNAPSHOT_OK) snapshot_close(snap);
+    return rc;
+}
+
+void snapshot_close(snapshot_t *snap)
+{
+    buffer_free(&snap->map);
+    memset(snap, 0, sizeof(*snap));
+}
+
+const char *snapshot_header_path(const snapshot_t *snap)
+{
+    return snap->strings + snap->files[0].path;
+}
+
+/* ---- Apply ---------------------------------------------------------------- */
+
+int snapshot_apply(const snapshot_t *snap, macro_table_t *macros, ifdef_stack_t *ifs)
+{
+    const snapshot_header_t *h = snap->header;
+    for (uint32_t i = 0; i < h->macro_count; i++) {
+        const snapshot_macro_t *m = &snap->macros[i];
+        int rc = macros_define_in_place(macros, snap->strings + m->name, (int)m->name_len,
+                                        snap->strings + m->value, (int)m->value_len,
+                                        (int)m->function_like);
+        if (rc != MACROS_OK) return 1;
+    }
+
+    ifdef_stack_init(ifs);
+    ifs->top = h->if_top;
+    ifs->first_inactive = h->if_first_inactive;
+    for (int level = 0; level <= h->if_top; level++) {
+        ifs->stack[level] = snap->levels[3 * level];
+        ifs->taken[level] = snap->levels[3 * level + 1];
+        ifs->seen_else[level] = snap->levels[3 * level + 2];
+    }
+    return 0;
+}
+
+int snapshot_emit(const snapshot_t *snap, buffer_t *output, cache_deps_t *deps)
+{
+    const snapshot_header_t *h = snap->header;
+    if (h->output_size > 0 && buffer_append_n(output, snap->output, (long)h->output_size) != 0) {
+        return 1;
+    }
+    for (uint32_t i = 0; deps && i < h->file_count; i++) {
+        if (cache_deps_add_hash(deps, snap->strings + snap->files[i].path,
+                                snap->files[i].hash) != 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,150 @@
+/* -----------------------------------------------------------------------------
+ * Program: C Preprocessor (Practice 1)
+ * Description:
+ *     This module saves the state left by preprocessing a prefix header into
+ *     a binary snapshot (-snapshot-out=) and starts later runs from it
+ *     (-snapshot=) without processing the header again.
+ *
+ * - `snapshot_capture`: Copy the macro table and #if stack at the end of the
+ *   header's run.
+ * - `snapshot_write`: Write the captured state, the files it came from and
+ *   the header's output.
+ * - `snapshot_open` / `snapshot_close`: Map a snapshot and validate it: the
+ *   options must match, every recorded file must still have the content
+ *   hash it had (checked by stat first, hashed only if mtime or size moved)
+ *   and include candidates that were missing must still be missing.
+ * - `snapshot_check`: Repeat the file checks on an open snapshot.
+ * - `snapshot_apply`: Define the saved macros (names and values stay in the
+ *   mapping) and restore the #if stack.
+ * - `snapshot_emit`: Write the header's output and record its files as
+ *   dependencies (once per input).
+ *
+ * Layout (native byte order; offsets from the start of the file, sections
+ * 8-byte aligned so records are read in place):
+ *     snapshot_header_t
+ *     snapshot_file_t  x file_count    header first, then what it included
+ *     snapshot_macro_t x macro_count
+ *     int32_t x 3 x (if_top + 1)       stack/taken/seen_else per open level
+ *     string pool                      NUL-terminated paths, names and values
+ *     output                           what the header itself produced
+ *
+ * Status:
+ *     Active - POSIX stat timestamps; on _WIN32 every file is hashed.
+ * -------------------------------------------------------------------------- */
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdint.h>
+#include <time.h>
+
+#include "hash/hash.h"
+#include "buffer/buffer.h"
+#include "cache/cache.h"
+#include "macros/macros.h"
+#include "directives/directives.h"
+
+// First bytes of a snapshot and its format version.
+#define SNAPSHOT_MAGIC "P1PPSNAP"
+#define SNAPSHOT_VERSION 1u
+
+// Result codes of snapshot_open.
+#define SNAPSHOT_OK 0
+#define SNAPSHOT_ERR_READ 1
+#define SNAPSHOT_ERR_FORMAT 2
+#define SNAPSHOT_ERR_OPTIONS 3
+#define SNAPSHOT_ERR_STALE 4
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;   /* 0x01020304 as written */
+    uint32_t options;      /* option bits of the run that saved it */
+    uint32_t file_count;
+    uint32_t macro_count;
+    int32_t if_top;
+    int32_t if_first_inactive;
+    uint32_t reserved;
+    uint64_t files_offset;
+    uint64_t macros_offset;
+    uint64_t levels_offset;
+    uint64_t strings_offset;
+    uint64_t strings_size;
+    uint64_t output_offset;
+    uint64_t output_size;
+} snapshot_header_t;
+
+typedef struct {
+    uint64_t path;         /* string pool offset */
+    int64_t size;
+    int64_t mtime_sec;     /* 0: always compare hashes */
+    int64_t mtime_nsec;
+    hash128_t hash;        /* CACHE_DEP_MISSING: must not exist */
+} snapshot_file_t;
+
+typedef struct {
+    uint64_t name;         /* string pool offsets */
+    uint64_t value;
+    uint32_t name_len;
+    uint32_t value_len;
+    uint32_t function_like; /* value is "(params) body" */
+    uint32_t reserved;
+} snapshot_macro_t;
+
+/* State captured at the end of a header's run. */
+typedef struct {
+    buffer_t macros;       /* snapshot_macro_t records */
+    buffer_t strings;      /* pool for the macro records */
+    int macro_count;
+    ifdef_stack_t ifs;
+    int captured;
+} snapshot_state_t;
+
+/* A mapped, validated snapshot (read-only, shared by every run using it). */
+typedef struct {
+    buffer_t map;
+    const snapshot_header_t *header;
+    const snapshot_file_t *files;
+    const snapshot_macro_t *macros;
+    const int32_t *levels;
+    const char *strings;
+    const char *output;
+} snapshot_t;
+
+void snapshot_state_init(snapshot_state_t *state);
+void snapshot_state_free(snapshot_state_t *state);
+
+/* Copy the macros and #if stack of a finished run. Returns 0, or 1 if out of memory. */
+int snapshot_capture(snapshot_state_t *state, const macro_table_t *macros,
+                     const ifdef_stack_t *ifs);
+
+/* Write state to path (through a temporary file renamed into place).
+ * header_path/header_hash identify the header, deps are the files it
+ * included, output is what it produced. Files modified at or after
+ * run_start are recorded without a timestamp, so they are always hashed.
+ * Returns 0, or 1 on failure (nothing is left at path). */
+int snapshot_write(const char *path, const snapshot_state_t *state, unsigned options,
+                   const char *header_path, hash128_t header_hash, const cache_deps_t *deps,
+                   const char *output, long output_len, time_t run_start);
+
+/* Map and validate path for a run with the given option bits.
+ * Returns SNAPSHOT_OK or one of the SNAPSHOT_ERR_* codes (snap is then empty). */
+int snapshot_open(const char *path, unsigned options, snapshot_t *snap);
+void snapshot_close(snapshot_t *snap);
+
+/* Non-zero if every file recorded in an open snapshot is still as it was
+ * (snapshot_open checks this once; a long-lived process checks again). */
+int snapshot_check(const snapshot_t *snap);
+
+/* Path of the header the snapshot was saved from. */
+const char *snapshot_header_path(const snapshot_t *snap);
+
+/* Define the macros of snap and restore its #if stack. Returns 0, or 1 if
+ * out of memory. */
+int snapshot_apply(const snapshot_t *snap, macro_table_t *macros, ifdef_stack_t *ifs);
+
+/* Append the header's output to output and, if deps is not NULL, record the
+ * header files with their hashes. Returns 0, or 1 if out of memory. */
+int snapshot_emit(const snapshot_t *snap, buffer_t *output, cache_deps_t *deps);
+
+#endif
@@ -5,7 +5,8 @@
  * Description:
  *     This module provides centralized constants for preprocessing behavior.
  *
- * - `PP_MAX_IF_DEPTH`, `PP_MAX_PATH_LEN`: Limits for nesting and paths.
+ * - `PP_MAX_IF_DEPTH`, `PP_MAX_INCLUDE_DEPTH`, `PP_MAX_PATH_LEN`: Limits for
+ *   nesting and paths.
  * - `PP_FLAG_*`: Command-line flags.
  * - `PP_STR_*`, `PP_FMT_*`: Help/usage strings and formats.
  * - `PP_ERR_*`: Standardized error messages.
@@ -25,21 +26,47 @@
 // Max nesting depth for conditional compilation (#ifdef).
 // This prevents infinite recursion and limits how deep #ifdef blocks can nest
 #define PP_MAX_IF_DEPTH 64
+// Evaluation stack (and nesting) limit of one #if / #elif expression.
+// Deeper expressions are rejected when they are compiled
+#define PP_MAX_EXPR_STACK 256
+// Maximum depth of macros expanding to other macros inside #if.
+// Guards against runaway recursion in conditions
+#define PP_MAX_EXPR_MACRO_DEPTH 64
 // Maximum path length used when composing include paths.
 // This should be large enough to handle deeply nested directory structures
 #define PP_MAX_PATH_LEN 4096
 // Maximum length of a quoted include filename.
 // e.g., #include "myfile.h" where "myfile.h" must fit within this limit
 #define PP_MAX_INCLUDE_NAME 256
-// Maximum length of a macro name in a #define directive.
-// e.g., #define MACRO_NAME where MACRO_NAME must fit within this limit
-#define PP_MAX_DEFINE_NAME 128
-// Maximum length of a macro value in a #define directive.
-// e.g., #define NAME value where value must fit within this limit
-#define PP_MAX_DEFINE_VALUE 512
+// Default limit of #include nesting (the input is depth 0).
+// Changed with -max-include-depth=<n>
+#define PP_MAX_INCLUDE_DEPTH 200
+// Block size of the per-run scratch arena used for line temporaries.
+// Lines longer than this get a dedicated block that is then reused
+#define PP_SCRATCH_BLOCK_SIZE 65536
+// Staged output size that triggers a write in streaming mode.
+// Memory used for output stays near this size whatever the input size
+#define PP_SINK_FLUSH_THRESHOLD 65536
+// Bytes handed to the comment stripper at once in comments-only mode.
+// Spans always end on a line boundary
+#define PP_COMMENT_SPAN 65536
+// Bytes per task when comments-only mode is split across the thread pool.
+// Inputs shorter than two chunks are processed serially
+#define PP_PARALLEL_CHUNK (4L * 1024 * 1024)
+// Environment variable naming the persistent cache directory (-cache).
+// Defaults to $HOME/PP_CACHE_DEFAULT_SUBDIR when unset
+#define PP_CACHE_ENV_DIR "PP_CACHE_DIR"
+#define PP_CACHE_DEFAULT_SUBDIR ".cache/p1pp"
+// Environment variable limiting the cache size (bytes, or K/M/G suffix).
+// Least recently used entries are evicted past this size
+#define PP_CACHE_ENV_MAX_SIZE "PP_CACHE_MAX_SIZE"
+#define PP_CACHE_DEFAULT_MAX_SIZE (1LL << 30)
 // Chunk size used when reading files into buffers.
 // Files are read in 4KB chunks for efficiency
 #define PP_IO_READ_CHUNK 4096
+// I/O threads reading #include targets ahead of the preprocessor (-d).
+// Disabled with -no-prefetch
+#define PP_PREFETCH_THREADS 2
 
 // CLI flag for comment removal mode.
 // When this flag is used, the preprocessor removes C-style and C++ comments
@@ -53,6 +80,51 @@
 // CLI flag that prints the help page and exits.
 // Shows usage information and available options
 #define PP_FLAG_HELP "-help"
+// CLI flag that prints run statistics to stderr after preprocessing.
+// Does not select a processing stage, so it keeps the -c default
+#define PP_FLAG_STATS "-stats"
+// CLI flag that writes the result to stdout instead of <name>_pp.<ext>.
+// Does not select a processing stage, so it keeps the -c default
+#define PP_FLAG_STDOUT "-stdout"
+// CLI flag prefix selecting the number of worker threads (-jN, e.g. -j8).
+// Without it one worker per CPU is used when several inputs are given
+#define PP_FLAG_JOBS "-j"
+// CLI flag enabling the persistent preprocessing cache.
+// Unchanged inputs (and includes) are served from disk instead of reprocessed
+#define PP_FLAG_CACHE "-cache"
+// CLI flag writing a Make dependency file next to each output.
+// The rule lists the input and every included file (<output>.d)
+#define PP_FLAG_MD "-MD"
+// CLI flag skipping inputs whose output is up to date.
+// Compares the <output>.stamp recorded by the last run with the file system
+#define PP_FLAG_INCREMENTAL "-incremental"
+// CLI flag saving the state left by a prefix header (-snapshot-out=<file>).
+// The single input is the header; its macros and #if stack are written to <file>
+#define PP_FLAG_SNAPSHOT_OUT "-snapshot-out="
+// CLI flag starting every input from a saved prefix header (-snapshot=<file>).
+// Inputs behave as if they began with #include "<header>"
+#define PP_FLAG_SNAPSHOT "-snapshot="
+// CLI flag adding a user include directory (-I<dir>).
+// Searched, in order, for quoted names not found next to the including file and for angled names
+#define PP_FLAG_INCLUDE_DIR "-I"
+// CLI flag adding a system include directory (-isystem<dir>).
+// Searched after every -I directory
+#define PP_FLAG_SYSTEM_DIR "-isystem"
+// CLI flag disabling the background read-ahead of #include targets.
+// Does not select a processing stage, so it keeps the -c default
+#define PP_FLAG_NO_PREFETCH "-no-prefetch"
+// CLI flag limiting #include nesting (-max-include-depth=<n>).
+// Does not select a processing stage, so it keeps the -c default
+#define PP_FLAG_MAX_INCLUDE_DEPTH "-max-include-depth="
+// CLI flag running the tool as a daemon on a Unix socket (-serve=<socket>).
+// Does not select a processing stage: each request brings its own flags
+#define PP_FLAG_SERVE "-serve="
+// CLI flag sending the rest of the command line to a daemon (-connect=<socket>).
+// Does not select a processing stage, so it keeps the -c default
+#define PP_FLAG_CONNECT "-connect="
+// Suffixes of the files written next to an output.
+#define PP_DEPFILE_SUFFIX ".d"
+#define PP_STAMP_SUFFIX ".stamp"
 
 // Default program name used when argv[0] is not available.
 // Fallback name for the executable if we can't determine it from command line
@@ -66,15 +138,43 @@
 #define PP_STR_OPTIONS_LABEL "\nOptions:\n"
 // Format line for the usage synopsis.
 // Shows how to invoke the program with options and input file
-#define PP_FMT_USAGE_LINE "  %s [options] <file.c|file.h>\n"
+#define PP_FMT_USAGE_LINE "  %s [options] <file.c|file.h>...\n"
 // Format line for the -c option description.
 #define PP_FMT_OPTION_C "  %s     Remove comments (default if no flags)\n"
 // Format line for the -d option description.
-#define PP_FMT_OPTION_D "  %s     Process directives (#include, #define, #ifdef/#endif) + macro expansion\n"
+#define PP_FMT_OPTION_D "  %s     Process directives (#include, #define, #if/#ifdef/#ifndef/#elif/#else/#endif) + macro expansion\n"
 // Format line for the -all option description.
 #define PP_FMT_OPTION_ALL "  %s   Equivalent to %s %s\n"
 // Format line for the -help option description.
 #define PP_FMT_OPTION_HELP "  %s  Show this help\n"
+// Format line for the -stats option description.
+#define PP_FMT_OPTION_STATS "  %s Print cache statistics to stderr\n"
+// Format line for the -stdout option description.
+#define PP_FMT_OPTION_STDOUT "  %s Write the result to stdout instead of <name>_pp.<ext>\n"
+// Format line for the -jN option description.
+#define PP_FMT_OPTION_JOBS "  %sN     Preprocess up to N input files in parallel (default: one per CPU)\n"
+// Format line for the -cache option description.
+#define PP_FMT_OPTION_CACHE "  %s Reuse outputs of unchanged inputs from $PP_CACHE_DIR (default ~/.cache/p1pp)\n"
+// Format line for the -MD option description.
+#define PP_FMT_OPTION_MD "  %s    Also write a Make dependency file <output>.d\n"
+// Format line for the -incremental option description.
+#define PP_FMT_OPTION_INCREMENTAL "  %s Skip inputs whose output is up to date (see <output>.stamp)\n"
+// Format line for the -snapshot-out= option description.
+#define PP_FMT_OPTION_SNAPSHOT_OUT "  %s<file> Save the macros and #if state left by the input header in <file>\n"
+// Format line for the -snapshot= option description.
+#define PP_FMT_OPTION_SNAPSHOT "  %s<file> Start every input from a header saved with -snapshot-out\n"
+// Format line for the -I option description.
+#define PP_FMT_OPTION_INCLUDE_DIR "  %s<dir> Search <dir> for #include \"...\" and #include <...>\n"
+// Format line for the -isystem option description.
+#define PP_FMT_OPTION_SYSTEM_DIR "  %s<dir> Search <dir> after every -I directory\n"
+// Format line for the -no-prefetch option description.
+#define PP_FMT_OPTION_NO_PREFETCH "  %s Do not read #include targets ahead on background threads\n"
+// Format line for the -max-include-depth= option description.
+#define PP_FMT_OPTION_MAX_INCLUDE_DEPTH "  %s<n> Stop at #include nesting deeper than n (default: %d)\n"
+// Help line for -serve=<socket>.
+#define PP_FMT_OPTION_SERVE "  %s<socket> Run as a daemon serving -connect requests (-jN: requests at once)\n"
+// Help line for -connect=<socket>.
+#define PP_FMT_OPTION_CONNECT "  %s<socket> Let the daemon at <socket> run the command (runs here if none)\n"
 // Label for the examples section.
 #define PP_STR_EXAMPLES_LABEL "\nExamples:\n"
 // Example: default behavior (comments only).
@@ -84,8 +184,55 @@
 // Example: full preprocessing.
 #define PP_FMT_EXAMPLE_ALL "  %s -all input.c          Full preprocessing (comments + directives + macros)\n"
 // Label for output behavior section.
-#define PP_STR_OUTPUT_LABEL "\nOutput:\n  Writes processed content to stdout. Redirect to a file if needed.\n"
+#define PP_STR_OUTPUT_LABEL "\nOutput:\n  Writes processed content to <name>_pp.<ext> (or stdout with -stdout).\n"
 
+// Statistics line for the include cache (hits, misses, lookups, guard skips).
+#define PP_FMT_STATS_INCLUDES "include cache: %ld hits, %ld misses (%ld lookups), %ld skipped by include guard\n"
+// Statistics line for the -serve include store (misses served without reading the file).
+#define PP_FMT_STATS_INCLUDE_STORE "include store: %ld files reused from earlier requests\n"
+// Statistics line for #if/#elif conditions (compiled once, reused on later visits).
+#define PP_FMT_STATS_CONDITIONS "conditions: %ld compiled, %ld reused\n"
+// Statistics line for the macro string arena (stored once, reused, heap blocks).
+#define PP_FMT_STATS_MACROS "macro strings: %ld interned, %ld reused, %ld heap allocations\n"
+// Statistics line for the macro prefilter (identifiers rejected without a lookup,
+// lines copied whole because none of their identifiers can be a macro).
+#define PP_FMT_STATS_PREFILTER "macro prefilter: %ld identifiers, %ld rejected (%.1f%%), %ld of %ld lines copied whole\n"
+// Statistics line for macro expansion (served from memo, expanded, memos invalidated).
+#define PP_FMT_STATS_EXPANSION "macro expansion: %ld memo hits, %ld expanded, %ld invalidated\n"
+// Statistics line for function-like macros (invocations, those substituted without
+// a rescan because nothing in their result could expand further).
+#define PP_FMT_STATS_FUNCTIONS "function-like macros: %ld invocations, %ld without rescan\n"
+// Statistics line for a -snapshot run (macros saved, output bytes replayed).
+#define PP_FMT_STATS_SNAPSHOT "snapshot: %d macros, %ld output bytes\n"
+// Statistics line for a forked context (macros shared with the parent, defined
+// by this run, parent macros whose expansion this run memoized for itself).
+#define PP_FMT_STATS_FORK "forked context: %d macros shared, %ld defined here, %ld shared ones memoized here\n"
+// Statistics line for the scratch arena (heap blocks allocated in the run).
+#define PP_FMT_STATS_SCRATCH "scratch arena: %ld heap allocations\n"
+// Statistics line for the output sink (bytes written, writes, largest staged size).
+#define PP_FMT_STATS_SINK "output sink: %ld bytes in %ld writes, peak %ld bytes staged\n"
+// Header printed before the statistics of each file when several are given.
+#define PP_FMT_STATS_FILE "%s:\n"
+// Statistics line for the thread pool (workers, tasks, steals).
+#define PP_FMT_STATS_POOL "thread pool: %d workers, %ld tasks, %ld steals\n"
+// Statistics line for an input skipped by -incremental.
+#define PP_FMT_STATS_UP_TO_DATE "up to date, skipped\n"
+// Statistics line for the include search path (names resolved, candidate paths
+// tried, missing candidates answered from a cached directory listing, directories
+// read, candidates probed with stat because their directory could not be read).
+#define PP_FMT_STATS_SEARCH "include search: %ld lookups, %ld candidates, %ld missing answered without a syscall, %ld directories listed, %ld stat probes\n"
+// Statistics line for the include read-ahead (files read ahead, their bytes,
+// targets that could not be opened, then how each header load went: already
+// read, still being read, never seen by the read-ahead).
+#define PP_FMT_STATS_PREFETCH "include prefetch: %ld files read ahead (%ld bytes), %ld not found, loads: %ld ready, %ld in flight, %ld not prefetched\n"
+// Statistics line for the persistent cache in this run (hits, misses, stores).
+#define PP_FMT_STATS_CACHE_RUN "preprocessing cache: %ld hits, %ld misses, %ld stored\n"
+// Statistics line for the cache directory (total hits, misses, size, limit, evictions).
+#define PP_FMT_STATS_CACHE_TOTAL "preprocessing cache totals: %ld hits, %ld misses, %lld of %lld bytes, %ld evicted now\n"
+// Statistics line printed when a -serve daemon stops (requests served, files
+// in the include store, misses it served, files it read, items replaced
+// because the file changed, requests started from a warm -snapshot prefix).
+#define PP_FMT_STATS_SERVER "daemon: %ld requests, include store: %d files, %ld hits, %ld loads, %ld replaced, %ld warm snapshot prefixes reused\n"
 
 // Error message when comment processing fails.
 // Displayed when the comment removal module encounters an error
@@ -96,6 +243,40 @@
 // Error message when macro expansion fails.
 // Displayed when the macro expansion module encounters an error
 #define PP_ERR_MACRO_EXPANSION "Macro expansion failed"
+// Error message when a function-like macro gets the wrong number of arguments.
+// The invocation is left as written and processing continues
+#define PP_ERR_MACRO_ARGS "Wrong number of arguments for a function-like macro"
+// Error message when macros expand into each other deeper than MACROS_MAX_DEPTH.
+#define PP_ERR_MACRO_DEPTH "Macro expansion nested too deeply"
+// Error message when #include nesting exceeds the limit (-max-include-depth).
+#define PP_ERR_INCLUDE_DEPTH "#include nested too deeply"
+// Error message when a file includes itself again with no macro defined in
+// between, which would repeat forever.
+#define PP_ERR_INCLUDE_CYCLE "#include cycle"
+// Error message when -max-include-depth= is not a positive number.
+#define PP_ERR_INCLUDE_DEPTH_USAGE "-max-include-depth needs a positive number (-max-include-depth=<n>)"
+// Error message when streamed output cannot be written.
+#define PP_ERR_OUTPUT_WRITE "Failed to write output"
+// Error message when -incremental cannot read back the output it stamps.
+#define PP_ERR_OUTPUT_READ "Failed to read back output"
+// Error message when -stdout is combined with several inputs.
+#define PP_ERR_STDOUT_MULTI "-stdout accepts a single input file"
+// Error message when -snapshot-out is given several inputs or -stdout.
+#define PP_ERR_SNAPSHOT_OUT_USAGE "-snapshot-out needs a single input file and no -stdout"
+// Error message when -I or -isystem is given without a directory.
+#define PP_ERR_SEARCH_DIR_USAGE "-I and -isystem need a directory (-I<dir>, -isystem<dir>)"
+// Error messages when a -snapshot file cannot be used.
+#define PP_ERR_SNAPSHOT_READ "Cannot read snapshot"
+#define PP_ERR_SNAPSHOT_FORMAT "Not a snapshot, or written by another version of the tool"
+#define PP_ERR_SNAPSHOT_OPTIONS "Snapshot was saved with other -c/-d options"
+#define PP_ERR_SNAPSHOT_STALE "Snapshot is out of date (a header changed); save it again with -snapshot-out"
+// Error message when a snapshot cannot be saved.
+#define PP_ERR_SNAPSHOT_WRITE "Failed to write snapshot"
+// Error messages of -serve and -connect.
+#define PP_ERR_SERVE_USAGE "-serve takes no input files"
+#define PP_ERR_SERVE_IN_USE "Another daemon is serving this socket"
+#define PP_ERR_SERVE_SOCKET "Cannot listen on this socket"
+#define PP_ERR_CONNECT_LOST "Lost the connection to the daemon"
 
 // Preprocessor directive marker character ('#').
 // All preprocessor directives start with this character
@@ -10,7 +10,15 @@
  */
 
 #include "tokens.h"
+#include "../scan/scan.h"
 
+const unsigned char tokens_char_class[256] = {
+    [' '] = TK_BLANK, ['\t'] = TK_BLANK,
+    ['\n'] = TK_END, ['\0'] = TK_END,
+    ['0' ... '9'] = TK_DIGIT,
+    ['a' ... 'z'] = TK_IDENT_START, ['A' ... 'Z'] = TK_IDENT_START, ['_'] = TK_IDENT_START,
+    ['"'] = TK_QUOTE,
+};
 
 void tokens_init(Tokenizer *tk, int line_num, char *full_line) {
     tk->line_n = line_num;
@@ -19,44 +27,42 @@ void tokens_init(Tokenizer *tk, int line_num, char *full_line) {
 }
 
 int tokenize(Tokenizer *tkz, Token *token_out){
-    char *line = tkz->full_line;
+    const char *line = tkz->full_line;
     int i = tkz->position;
 
     // skip whitespaces
-    while(line[i] == ' ' || line[i] == '\t'){
+    while(TK_IS(line[i], TK_BLANK)){
         i++;
     }
 
     // return 0 when end of line
-    if(line[i] == '\n' || line[i] == '\0'){
+    unsigned char cls = tokens_char_class[(unsigned char)line[i]];
+    if(cls & TK_END){
         return 0;
     }
 
-    token_out->word = &line[i];
+    token_out->word = &tkz->full_line[i];
     token_out->line_n = tkz->line_n;
+    int start = i;
 
-    if (isalpha((unsigned char)line[i]) || line[i] == '_'){
-        int start = i;
+    // one table lookup per character: '\0' has no class, so the loops stop at the end
+    if (cls & TK_IDENT_START){
         i++;
-        while (isalnum(line[i]) || line[i] == '_') {
+        while (TK_IS(line[i], TK_IDENT)) {
             i++;
         }
         token_out->type = IDENTIFIER;
-        token_out->length = i - start;
     }
 
-    else if (isdigit((unsigned char)line[i])) {
-        int start = i;
+    else if (cls & TK_DIGIT) {
         i++;
-        while (isdigit((unsigned char)line[i])) {
+        while (TK_IS(line[i], TK_DIGIT)) {
             i++;
         }
         token_out->type = NUMBER;
-        token_out->length = i - start;
     }
 
     else if (line[i] == '"') {
-        int start = i;
         // skip opening quote to avoid immediate return
         i++;
         while (line[i] != '"' && line[i] != '\0') {
@@ -67,20 +73,257 @@ int tokenize(Tokenizer *tkz, Token *token_out){
             i++;
         }
         token_out->type = STRING;
-        token_out->length = i - start;
     }
 
      else {
         token_out->type = SYMBOL;
-        token_out->length = 1;
         i++;
     }
 
+    token_out->length = i - start;
     tkz->position = i;
     return 1;
 
 }
 
+void tokens_list_init(token_list_t *list) {
+    memset(list, 0, sizeof(*list));
+    tokens_list_reset(list);
+}
+
+void tokens_list_reset(token_list_t *list) {
+    list->count = 0;
+    list->hash = -1;
+    list->pos = 0;
+    list->open = END;
+    list->done = 0;
+    list->leading = 1;
+    list->code = 0;
+    list->failed = 0;
+}
+
+void tokens_list_free(token_list_t *list) {
+    free(list->items);
+    memset(list, 0, sizeof(*list));
+}
+
+// add text[start..end) as a token of type
+static inline void list_push(token_list_t *list, const char *text, Token_type type, long start, long end) {
+    // directive detection: the first token that is not a whitespace byte ('\f', '\r', ...)
+    if (list->leading && !(type == SYMBOL && isspace((unsigned char)text[start]))) {
+        list->leading = 0;
+        if (type == SYMBOL && text[start] == '#') list->hash = list->count;
+        else list->code = 1;
+    }
+    // macro expansion only looks at identifiers, and strings it must not enter
+    if (list->code && (type == SYMBOL || type == NUMBER)) return;
+
+    if (list->count == list->capacity) {
+        int capacity = list->capacity ? list->capacity * 2 : 32;
+        line_token_t *items = realloc(list->items, sizeof(line_token_t) * (size_t)capacity);
+        if (!items) {
+            list->failed = 1;
+            return;
+        }
+        list->items = items;
+        list->capacity = capacity;
+    }
+    list->items[list->count++] = (line_token_t){type, (int)start, (int)(end - start)};
+}
+
+// End of the identifier, number or string running from i (at most len).
+static long token_end(Token_type type, const char *text, long i, long len) {
+    if (type == IDENTIFIER) return scan_find_non_ident(text + i, text + len) - text;
+    if (type == NUMBER) {
+        while (i < len && TK_IS(text[i], TK_DIGIT)) i++;
+        return i;
+    }
+    while (i < len && text[i] != '"' && text[i] != '\0') i++;
+    return i;
+}
+
+// Nothing more for tokens_list_feed to lex.
+static inline int head_done(const token_list_t *list) {
+    return list->code || (list->hash >= 0 && list->count >= list->hash + TK_DIRECTIVE_HEAD);
+}
+
+// Lex text[list->pos..len) with the rules of tokenize. A token reaching len
+// stays open: more of it may follow in the next call. With head_only the
+// walk stops at the token boundary where the line turns out not to be a
+// directive, or past the head of a directive.
+static void lex(token_list_t *list, const char *text, long len, int head_only) {
+    long i = list->pos;
+    if (list->done || i >= len || (head_only && head_done(list))) return;
+
+    // finish the token left open by the previous call
+    if (list->open != END) {
+        Token_type type = list->open;
+        i = token_end(type, text, i, len);
+        if (i == len) {
+            list->pos = i;
+            return;
+        }
+        if (type == STRING && text[i] == '"') i++;
+        list->open = END;
+        list_push(list, text, type, list->open_start, i);
+    }
+
+    // no token yet: the first byte past the blanks tells a directive apart
+    // (a whitespace byte such as '\f' is a token of its own: lexed below)
+    if (list->leading && list->open == END) {
+        while (i < len && TK_IS(text[i], TK_BLANK)) i++;
+        unsigned char c = (unsigned char)(i < len ? text[i] : '#');
+        if (c != '#' && !isspace(c) && c != '\0') {
+            list->leading = 0;
+            list->code = 1;
+        }
+    }
+
+    while (i < len && !(head_only && head_done(list))) {
+        // past the start of a non-directive, numbers and symbols are not kept:
+        // skip to what can start an identifier or a string (digits can't, and
+        // an identifier never starts inside a number run)
+        if (list->code) {
+            while (i < len && !TK_IS(text[i], TK_IDENT_START | TK_QUOTE | TK_END)) i++;
+            if (i == len) break;
+        }
+        unsigned char cls = tokens_char_class[(unsigned char)text[i]];
+        if (cls & TK_BLANK) {
+            i++;
+            continue;
+        }
+        if (cls & TK_END) {
+            list->done = 1;
+            break;
+        }
+
+        long start = i++;
+        Token_type type = (cls & TK_IDENT_START) ? IDENTIFIER : (cls & TK_DIGIT) ? NUMBER
+                        : (cls & TK_QUOTE) ? STRING : SYMBOL;
+        if (type == SYMBOL) {
+            if (!list->code) list_push(list, text, type, start, i);
+            continue;
+        }
+        i = token_end(type, text, i, len);
+        if (i == len) {
+            list->open = type;
+            list->open_start = start;
+            break;
+        }
+        if (type == STRING && text[i] == '"') i++;
+        if (type != NUMBER || !list->code) list_push(list, text, type, start, i);
+    }
+    list->pos = i;
+}
+
+// Lex as far as the directive check needs; the rest is left to finish.
+void tokens_list_feed(token_list_t *list, const char *text, long len) {
+    lex(list, text, len, 1);
+}
+
+// xor of bits 0..i of x, in bit i: 1 from an opening quote up to its closing one
+static inline uint32_t prefix_xor(uint32_t x) {
+    x ^= x << 1;
+    x ^= x << 2;
+    x ^= x << 4;
+    x ^= x << 8;
+    x ^= x << 16;
+    return x;
+}
+
+// Lex text[i..len) of a line known not to be a directive, 32 bytes at a time:
+// the identifiers and strings come out of bit masks of the block (strings are
+// quote pairs, identifiers the runs of [A-Za-z0-9_] outside them, less any
+// leading digits); i must be a token boundary. Returns 1, with the tokens it
+// added dropped again, if a '\n' or '\0' comes before the last byte:
+// tokens_list_feed handles those lines.
+static int lex_code_line(token_list_t *list, const char *text, long i, long len) {
+    uint32_t in_string = 0;     // all ones while a string runs into the next block
+    uint32_t prev_ident = 0;    // the last byte of the previous block was an identifier byte
+    int in_run = 0;             // an identifier-byte run is in progress
+    long ident_start = -1;      // start of its identifier (-1 while only digits were seen)
+    long string_start = 0;
+    int count = list->count;
+    char tail[32];
+
+    for (long base = i; base < len; base += 32) {
+        long n = len - base;
+        scan_classes_t cls;
+        uint32_t valid = ~0u;
+        if (n >= 32) {
+            scan_classify32(text + base, &cls);
+        } else {
+            memset(tail, 0, sizeof(tail));
+            memcpy(tail, text + base, (size_t)n);
+            scan_classify32(tail, &cls);
+            valid = (1u << n) - 1;
+        }
+        uint32_t last_newline = (n <= 32 && text[len - 1] == '\n') ? 1u << (n - 1) : 0;
+        if (cls.end & valid & ~last_newline) {
+            list->count = count;
+            return 1;
+        }
+
+        uint32_t quote = cls.quote & valid;
+        uint32_t inside = prefix_xor(quote) ^ in_string;
+        uint32_t ident = cls.ident & valid & ~inside;
+        uint32_t letters = ident & ~cls.digit;
+        uint32_t follows = (ident << 1) | prev_ident;
+        uint32_t stops = ~ident & follows;
+
+        // run starts and quotes in position order; a run is closed at its stop
+        uint32_t events = (ident & ~follows) | quote;
+        int at = 0;
+        for (;;) {
+            if (in_run) {
+                uint32_t above = ~0u << at;
+                uint32_t stop = stops & above;
+                int s = stop ? __builtin_ctz(stop) : 32;
+                uint32_t letter = letters & above;
+                if (ident_start < 0 && letter && __builtin_ctz(letter) < s) {
+                    ident_start = base + __builtin_ctz(letter);
+                }
+                if (s == 32) break;
+                if (ident_start >= 0) list_push(list, text, IDENTIFIER, ident_start, base + s);
+                in_run = 0;
+                ident_start = -1;
+            }
+            if (!events) break;
+            at = __builtin_ctz(events);
+            events &= events - 1;
+            if (quote & (1u << at)) {
+                if (inside & (1u << at)) string_start = base + at;
+                else list_push(list, text, STRING, string_start, base + at + 1);
+            } else {
+                in_run = 1;
+                ident_start = (letters & (1u << at)) ? base + at : -1;
+            }
+        }
+        in_string = (inside >> 31) ? ~0u : 0;
+        prev_ident = ident >> 31;
+    }
+    if (in_run && ident_start >= 0) list_push(list, text, IDENTIFIER, ident_start, len);
+    if (in_string) list_push(list, text, STRING, string_start, len);
+    list->pos = len;
+    list->done = 1;
+    return 0;
+}
+
+// The line is complete: close the token running at its end.
+void tokens_list_finish(token_list_t *list, const char *text, long len) {
+    // the rest of a code line, from a token boundary, is lexed with masks
+    lex(list, text, len, 1);
+    if (!list->done && list->open == END && list->code &&
+        lex_code_line(list, text, list->pos, len) == 0) {
+        return;
+    }
+    lex(list, text, len, 0);
+    if (list->open != END) {
+        list_push(list, text, list->open, list->open_start, len);
+        list->open = END;
+    }
+}
+
 // only used to get the wanted tokens
 char* get_word(Token tok) {
     char *word = malloc(tok.length + 1);
@@ -18,8 +18,6 @@
 #include <ctype.h>
 #include <stdlib.h>
 
-extern FILE* ofile;
-
 typedef enum {
     IDENTIFIER,     // define, MAX, ifdef, x...
     NUMBER,         // numbers 
@@ -36,6 +34,20 @@ typedef struct {
     int line_n;       // get this from PP_Core directly | here use it to make error line handling easier
 } Token;
 
+// character classes: bit flags stored in tokens_char_class
+#define TK_BLANK        0x01    // ' ', '\t'
+#define TK_END          0x02    // '\n', '\0'
+#define TK_DIGIT        0x04    // 0-9
+#define TK_IDENT_START  0x08    // a-z, A-Z, _
+#define TK_QUOTE        0x10    // '"'
+#define TK_IDENT        (TK_IDENT_START | TK_DIGIT)
+
+// one entry per byte value; bytes >= 0x80 have no class (like isalpha in the "C" locale)
+extern const unsigned char tokens_char_class[256];
+
+// nonzero if byte c has any of the classes in cls
+#define TK_IS(c, cls) (tokens_char_class[(unsigned char)(c)] & (cls))
+
 // tokenizer 
 typedef struct {
     int line_n;       // current line from file (save here and pass it to all tokens)
@@ -57,9 +69,60 @@ while( tokenize(&tkz, &token_out) ){
 
 */
 
+// one token of a lexed line, as an offset: the line may still move while it is built
+typedef struct {
+    Token_type type;
+    int start;
+    int length;
+} line_token_t;
+
+// tokens lexed by tokens_list_feed on a directive line: the '#', the directive
+// name and its first argument (what directives reads before the raw text)
+#define TK_DIRECTIVE_HEAD 3
+
+// tokens of one line: tokens_list_feed lexes the line while it is written, as far
+// as needed to find a leading '#' (and TK_DIRECTIVE_HEAD tokens from it);
+// tokens_list_finish lexes the rest. Complete for a directive line, identifiers
+// and strings only for other lines
+typedef struct {
+    line_token_t *items;
+    int count;
+    int capacity;
+    int hash;       // index of the '#' token if only whitespace comes before it, else -1
+    long pos;       // next byte of the line to look at
+    Token_type open; // type of the token still running at pos (END if none)
+    long open_start; // where that token started
+    int done;       // reached '\n' or '\0': tokenize would stop there too
+    int leading;    // no token other than a whitespace symbol seen yet
+    int code;       // not a directive: from then on only identifiers and strings are kept
+    int failed;     // out of memory: the list is incomplete
+} token_list_t;
+
+/*
+way to use it:
+
+token_list_t list;
+tokens_list_init(&list);
+tokens_list_reset(&list);                       // for every line
+... append text to the line, then tokens_list_feed(&list, line, len_so_far) ...
+tokens_list_feed(&list, line, len);             // list.hash >= 0: a directive line, lexed
+                                                // through its first tokens
+tokens_list_finish(&list, line, len);           // when the tokens are needed: same tokens as
+                                                // the tokenize loop (numbers and symbols
+                                                // dropped if list.hash < 0)
+
+*/
+
 // Functions that other modules should call
 void tokens_init(Tokenizer *tk, int line_num, char *full_line);
 
+// list operations; feed and finish take the whole line so far (text[0..len))
+void tokens_list_init(token_list_t *list);
+void tokens_list_reset(token_list_t *list);
+void tokens_list_feed(token_list_t *list, const char *text, long len);
+void tokens_list_finish(token_list_t *list, const char *text, long len);
+void tokens_list_free(token_list_t *list);
+
 // 1 if word has been tokenized, 0 if end of line, so it works with while loop
 int tokenize(Tokenizer *tkz, Token *token_out); // line is raw line text gotten from PP_core
 
@@ -14,6 +14,10 @@
 //#define PATHDIRLOGS "I:/Mi unidad/UPFdrive/docencia/github/compilers/modules_template/logs/" 
 #define PATHDIRLOGS "./logs/" // For running yml
 
+// Log output of the template modules and their tests (defined by each test
+// program). The preprocessing modules never write to it
+extern FILE *ofile;
+
 // Function prototypes
 FILE* set_output_test_file(const char* filename);
 
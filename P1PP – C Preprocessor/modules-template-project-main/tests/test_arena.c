@@ -0,0 +1,64 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "../src/arena/arena.h"
+
+int main(void)
+{
+    arena_t arena;
+    arena_init(&arena, 256);
+
+    /* Test 1: Allocations are aligned and distinct */
+    char *a = arena_alloc(&arena, 10);
+    char *b = arena_alloc(&arena, 10);
+    if (a && b && a != b && ((size_t)b % ARENA_ALIGNMENT) == 0) {
+        printf("[PASS] Arena alloc works\n");
+    } else {
+        printf("[FAIL] Arena alloc failed\n");
+        return 1;
+    }
+
+    /* Test 2: The last allocation grows in place */
+    memcpy(b, "abcdefghi", 10);
+    char *c = arena_realloc(&arena, b, 10, 64);
+    if (c == b && strcmp(c, "abcdefghi") == 0) {
+        printf("[PASS] Arena realloc grows in place\n");
+    } else {
+        printf("[FAIL] Arena realloc failed\n");
+        return 1;
+    }
+
+    /* Test 3: Release hands the same memory out again */
+    arena_mark_t mark = arena_mark(&arena);
+    char *d = arena_alloc(&arena, 32);
+    arena_release(&arena, mark);
+    char *e = arena_alloc(&arena, 32);
+    if (d == e) {
+        printf("[PASS] Arena release reuses memory\n");
+    } else {
+        printf("[FAIL] Arena release did not reuse memory\n");
+        return 1;
+    }
+
+    /* Test 4: Oversized requests and repeated cycles reuse the same blocks */
+    arena_release(&arena, mark);
+    for (int i = 0; i < 1000; i++) {
+        arena_mark_t m = arena_mark(&arena);
+        char *big = arena_alloc(&arena, 1000);
+        char *small = arena_alloc(&arena, 100);
+        if (!big || !small) {
+            printf("[FAIL] Arena alloc failed in cycle %d\n", i);
+            return 1;
+        }
+        arena_release(&arena, m);
+    }
+    if (arena.heap_allocs == 3) {
+        printf("[PASS] Arena blocks reused across cycles\n");
+    } else {
+        printf("[FAIL] Arena made %ld heap allocations\n", arena.heap_allocs);
+        return 1;
+    }
+
+    arena_free(&arena);
+    return 0;
+}
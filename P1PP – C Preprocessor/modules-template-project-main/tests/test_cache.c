@@ -0,0 +1,168 @@
+#define _XOPEN_SOURCE 700
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../src/cache/cache.h"
+#include "../src/spec/pp_spec.h"
+
+/* Template of the fresh cache directory created next to the test binary. */
+#define TEST_CACHE_DIR "test_cache_XXXXXX"
+/* Included file recorded as a dependency. */
+#define TEST_DEP_NAME "test_cache_dep.h"
+/* Include candidate recorded as missing, created later. */
+#define TEST_SHADOW_NAME "test_cache_shadow.h"
+/* Output file receiving cache hits. */
+#define TEST_OUT_NAME "test_cache_out.c"
+
+/* Write content to path (replacing it). */
+static void write_file(const char *path, const char *content)
+{
+    FILE *f = fopen(path, "w");
+    fputs(content, f);
+    fclose(f);
+}
+
+/* nftw callback removing one entry of the test cache directory. */
+static int remove_entry(const char *path, const struct stat *sb, int flag, struct FTW *ftw)
+{
+    (void)sb;
+    (void)flag;
+    (void)ftw;
+    return remove(path);
+}
+
+/* Store output for key with TEST_DEP_NAME as its only dependency. */
+static int store_result(cache_t *cache, hash128_t key, const char *output, const char *dep)
+{
+    cache_store_t store;
+    if (cache_store_begin(cache, &store) != 0) return 1;
+    if (write(store.fd, output, strlen(output)) != (ssize_t)strlen(output)) {
+        cache_store_abort(cache, &store);
+        return 1;
+    }
+    cache_deps_t deps;
+    cache_deps_init(&deps);
+    cache_deps_add(&deps, TEST_DEP_NAME, dep, (long)strlen(dep));
+    int rc = cache_store_commit(cache, &store, key, &deps);
+    cache_deps_free(&deps);
+    return rc;
+}
+
+/* Look key up, copying a hit into TEST_OUT_NAME; returns the lookup result. */
+static int lookup(cache_t *cache, hash128_t key, char *got, size_t size)
+{
+    sink_t sink;
+    if (sink_open_path(&sink, TEST_OUT_NAME, PP_SINK_FLUSH_THRESHOLD) != 0) return -1;
+    int rc = cache_lookup(cache, key, &sink, NULL);
+    sink_close(&sink);
+
+    got[0] = '\0';
+    FILE *f = fopen(TEST_OUT_NAME, "rb");
+    size_t n = fread(got, 1, size - 1, f);
+    got[n] = '\0';
+    fclose(f);
+    return rc;
+}
+
+int main(void)
+{
+#ifdef _WIN32
+    printf("[SKIP] Persistent cache is disabled on Windows\n");
+    return 0;
+#else
+    const char *dep_v1 = "#define X 1\n";
+    const char *dep_v2 = "#define X 2\n";
+    write_file(TEST_DEP_NAME, dep_v1);
+
+    char dir[] = TEST_CACHE_DIR;
+    cache_t cache;
+    if (!mkdtemp(dir) || cache_open(&cache, dir) != 0) {
+        printf("[FAIL] Cache could not be opened\n");
+        return 1;
+    }
+
+    buffer_t in;
+    buffer_init(&in);
+    buffer_append_str(&in, "#include \"" TEST_DEP_NAME "\"\nint x = X;\n");
+    hash128_t key = cache_input_key(&in, 3, ".", NULL, NULL);
+    char got[256];
+
+    /* Test 1: Unknown input is a miss */
+    if (lookup(&cache, key, got, sizeof(got)) == 0 && got[0] == '\0') {
+        printf("[PASS] Cache miss on new input\n");
+    } else {
+        printf("[FAIL] Unexpected cache hit\n");
+        return 1;
+    }
+
+    /* Test 2: A stored output is served back */
+    if (store_result(&cache, key, "int x = 1;\n", dep_v1) == 0 &&
+        lookup(&cache, key, got, sizeof(got)) == 1 && strcmp(got, "int x = 1;\n") == 0) {
+        printf("[PASS] Cache hit returns the stored output\n");
+    } else {
+        printf("[FAIL] Cache hit failed\n");
+        return 1;
+    }
+
+    /* Test 3: Changing an included file invalidates the entry */
+    write_file(TEST_DEP_NAME, dep_v2);
+    if (lookup(&cache, key, got, sizeof(got)) == 0) {
+        printf("[PASS] Changed dependency causes a miss\n");
+    } else {
+        printf("[FAIL] Stale output served after dependency change\n");
+        return 1;
+    }
+
+    /* Test 4: Other options, another prefix header or search path give another key */
+    hash128_t other = cache_input_key(&in, 1, ".", NULL, NULL);
+    hash128_t prefixed = cache_input_key(&in, 3, ".", "/tmp/prefix.h", NULL);
+    hash128_t search = hash_bytes("-Iinclude", 9);
+    hash128_t searched = cache_input_key(&in, 3, ".", NULL, &search);
+    if (!hash_equal(other, key) && !hash_equal(prefixed, key) && !hash_equal(searched, key)) {
+        printf("[PASS] Options, prefix and search path are part of the key\n");
+    } else {
+        printf("[FAIL] Options do not change the key\n");
+        return 1;
+    }
+
+    /* Test 5: A missing include candidate must stay missing (recorded once) */
+    cache_deps_t deps;
+    cache_deps_init(&deps);
+    cache_store_t store;
+    unlink(TEST_SHADOW_NAME);
+    int stored = cache_deps_add_missing(&deps, TEST_SHADOW_NAME) == 0 &&
+                 cache_deps_add_missing(&deps, TEST_SHADOW_NAME) == 0 && deps.count == 1 &&
+                 cache_deps_is_missing(&deps, 0) && cache_store_begin(&cache, &store) == 0 &&
+                 write(store.fd, "int y;\n", 7) == 7 &&
+                 cache_store_commit(&cache, &store, searched, &deps) == 0;
+    int before = stored ? lookup(&cache, searched, got, sizeof(got)) : -1;
+    write_file(TEST_SHADOW_NAME, "#define X 3\n");
+    int after = lookup(&cache, searched, got, sizeof(got));
+    if (before == 1 && after == 0) {
+        printf("[PASS] A file appearing where one was missing causes a miss\n");
+    } else {
+        printf("[FAIL] Missing dependency: stored=%d before=%d after=%d\n", stored, before, after);
+        return 1;
+    }
+    cache_deps_free(&deps);
+    unlink(TEST_SHADOW_NAME);
+
+    /* Test 6: Statistics are merged into the cache directory */
+    cache_close(&cache);
+    if (cache.total_hits == 2 && cache.total_misses == 3 && cache.total_size > 0) {
+        printf("[PASS] Cache statistics recorded\n");
+    } else {
+        printf("[FAIL] Cache statistics missing\n");
+        return 1;
+    }
+
+    buffer_free(&in);
+    unlink(TEST_DEP_NAME);
+    unlink(TEST_OUT_NAME);
+    nftw(dir, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+    return 0;
+#endif
+}
@@ -10,6 +10,7 @@
 
 #include <assert.h>
 #include <stdio.h>
+#include <string.h>
 
 /* Test program name used in argv vectors. */
 #define TEST_PROGNAME "pp"
@@ -86,6 +87,142 @@ static void test_cli_flag_help(void)
     assert(opt.do_help == 1);
 }
 
+/* Verify -stats does not disable the -c default. */
+static void test_cli_flag_stats(void)
+{
+    char *argv[] = {TEST_PROGNAME, PP_FLAG_STATS, TEST_INPUT_FILE, 0};
+    int argc = 3;
+
+    cli_options_t opt = cli_parse(argc, argv);
+    assert(opt.do_stats == 1);
+    assert(opt.do_comments == 1);
+    assert(opt.do_directives == 0);
+}
+
+/* Verify -stdout is an option flag that keeps the -c default. */
+static void test_cli_flag_stdout(void)
+{
+    char *argv[] = {TEST_PROGNAME, PP_FLAG_STDOUT, TEST_INPUT_FILE, 0};
+    int argc = 3;
+
+    cli_options_t opt = cli_parse(argc, argv);
+    assert(opt.to_stdout == 1);
+    assert(opt.do_comments == 1);
+    assert(opt.do_directives == 0);
+}
+
+/* Verify -jN sets the worker count and keeps the -c default. */
+static void test_cli_flag_jobs(void)
+{
+    char *argv[] = {TEST_PROGNAME, "-j4", TEST_INPUT_FILE, 0};
+    int argc = 3;
+
+    cli_options_t opt = cli_parse(argc, argv);
+    assert(opt.jobs == 4);
+    assert(opt.do_comments == 1);
+    assert(opt.do_directives == 0);
+}
+
+/* Verify -cache enables the persistent cache and keeps the -c default. */
+static void test_cli_flag_cache(void)
+{
+    char *argv[] = {TEST_PROGNAME, PP_FLAG_CACHE, TEST_INPUT_FILE, 0};
+    int argc = 3;
+
+    cli_options_t opt = cli_parse(argc, argv);
+    assert(opt.use_cache == 1);
+    assert(opt.do_comments == 1);
+    assert(opt.do_directives == 0);
+}
+
+/* Verify -MD and -incremental are option flags that keep the -c default. */
+static void test_cli_flag_incremental(void)
+{
+    char *argv[] = {TEST_PROGNAME, PP_FLAG_MD, PP_FLAG_INCREMENTAL, TEST_INPUT_FILE, 0};
+    int argc = 4;
+
+    cli_options_t opt = cli_parse(argc, argv);
+    assert(opt.write_depfile == 1);
+    assert(opt.incremental == 1);
+    assert(opt.do_comments == 1);
+    assert(opt.do_directives == 0);
+}
+
+/* Verify -snapshot-out= and -snapshot= keep their file names and the -c default. */
+static void test_cli_flag_snapshot(void)
+{
+    char *argv[] = {TEST_PROGNAME, PP_FLAG_SNAPSHOT_OUT "out.snap", PP_FLAG_SNAPSHOT "in.snap",
+                    TEST_INPUT_FILE, 0};
+    int argc = 4;
+
+    cli_options_t opt = cli_parse(argc, argv);
+    assert(opt.snapshot_out != NULL && strcmp(opt.snapshot_out, "out.snap") == 0);
+    assert(opt.snapshot != NULL && strcmp(opt.snapshot, "in.snap") == 0);
+    assert(opt.do_comments == 1);
+    assert(opt.do_directives == 0);
+}
+
+/* Verify -I<dir> / -isystem<dir> are counted and read back without selecting a stage. */
+static void test_cli_flag_search_dirs(void)
+{
+    char *argv[] = {TEST_PROGNAME, PP_FLAG_INCLUDE_DIR "include", PP_FLAG_SYSTEM_DIR "/usr/include",
+                    PP_FLAG_INCREMENTAL, TEST_INPUT_FILE, 0};
+    int argc = 5;
+
+    cli_options_t opt = cli_parse(argc, argv);
+    assert(opt.search_dirs == 2);
+    assert(opt.do_comments == 1);
+    assert(opt.do_directives == 0);
+
+    int system = -1;
+    assert(strcmp(cli_search_dir(argv[1], &system), "include") == 0 && system == 0);
+    assert(strcmp(cli_search_dir(argv[2], &system), "/usr/include") == 0 && system == 1);
+    assert(cli_search_dir(argv[3], &system) == NULL);
+}
+
+/* Verify -no-prefetch is recorded without selecting a stage. */
+static void test_cli_flag_no_prefetch(void)
+{
+    char *argv[] = {TEST_PROGNAME, PP_FLAG_NO_PREFETCH, TEST_INPUT_FILE, 0};
+    int argc = 3;
+
+    cli_options_t opt = cli_parse(argc, argv);
+    assert(opt.no_prefetch == 1);
+    assert(opt.do_comments == 1);
+    assert(opt.do_directives == 0);
+}
+
+static void test_cli_flag_max_include_depth(void)
+{
+    char *argv[] = {TEST_PROGNAME, "-d", PP_FLAG_MAX_INCLUDE_DEPTH "12", TEST_INPUT_FILE, 0};
+    int argc = 4;
+
+    cli_options_t opt = cli_parse(argc, argv);
+    assert(opt.max_include_depth == 12);
+    assert(opt.do_directives == 1);
+
+    char *bad[] = {TEST_PROGNAME, PP_FLAG_MAX_INCLUDE_DEPTH "0", TEST_INPUT_FILE, 0};
+    opt = cli_parse(3, bad);
+    assert(opt.max_include_depth == -1);
+}
+
+/* Verify -serve= and -connect= keep their socket path without selecting a stage. */
+static void test_cli_flag_serve_connect(void)
+{
+    char *serve[] = {TEST_PROGNAME, PP_FLAG_SERVE "/tmp/pp.sock", "-j4", 0};
+    cli_options_t opt = cli_parse(3, serve);
+    assert(opt.serve != NULL && strcmp(opt.serve, "/tmp/pp.sock") == 0);
+    assert(opt.connect == NULL);
+    assert(opt.jobs == 4);
+
+    char *connect[] = {TEST_PROGNAME, PP_FLAG_CONNECT "pp.sock", TEST_INPUT_FILE, 0};
+    opt = cli_parse(3, connect);
+    assert(opt.connect != NULL && strcmp(opt.connect, "pp.sock") == 0);
+    assert(opt.serve == NULL);
+    assert(opt.do_comments == 1);
+    assert(opt.do_directives == 0);
+}
+
 int main(void)
 {
     printf("=== CLI Module Test Suite ===\n\n");
@@ -96,6 +233,16 @@ int main(void)
     test_cli_flag_all();
     test_cli_flag_combo();
     test_cli_flag_help();
+    test_cli_flag_stats();
+    test_cli_flag_stdout();
+    test_cli_flag_jobs();
+    test_cli_flag_cache();
+    test_cli_flag_incremental();
+    test_cli_flag_snapshot();
+    test_cli_flag_search_dirs();
+    test_cli_flag_no_prefetch();
+    test_cli_flag_max_include_depth();
+    test_cli_flag_serve_connect();
 
     printf("=== All CLI tests passed! ===\n\n");
     return 0;
@@ -0,0 +1,131 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../src/depfile/depfile.h"
+
+/* Files written next to the test binary. */
+#define TEST_INPUT_NAME "test_depfile_in.c"
+#define TEST_HEADER_NAME "test_depfile dep.h"
+#define TEST_OUTPUT_NAME "test_depfile_in_pp.c"
+#define TEST_DEPFILE_NAME "test_depfile_in_pp.c.d"
+#define TEST_STAMP_NAME "test_depfile_in_pp.c.stamp"
+#define TEST_SHADOW_NAME "test_depfile_shadow.h"
+
+/* Write content to path (replacing it). */
+static void write_file(const char *path, const char *content)
+{
+    FILE *f = fopen(path, "w");
+    fputs(content, f);
+    fclose(f);
+}
+
+int main(void)
+{
+    const char *input = "#include \"" TEST_HEADER_NAME "\"\n";
+    write_file(TEST_INPUT_NAME, input);
+    write_file(TEST_HEADER_NAME, "int h;\n");
+    write_file(TEST_OUTPUT_NAME, "int h;\n");
+
+    cache_deps_t deps;
+    cache_deps_init(&deps);
+    cache_deps_add(&deps, TEST_HEADER_NAME, "int h;\n", 7);
+    unlink(TEST_SHADOW_NAME);
+    cache_deps_add_missing(&deps, TEST_SHADOW_NAME);
+    hash128_t search = hash_bytes("-Iinclude", 9);
+
+    /* Test 1: Dependency rule lists the header with escaped spaces */
+    char text[4096] = {0};
+    if (depfile_write(TEST_DEPFILE_NAME, TEST_OUTPUT_NAME, TEST_INPUT_NAME, &deps) == 0) {
+        FILE *f = fopen(TEST_DEPFILE_NAME, "r");
+        size_t n = fread(text, 1, sizeof(text) - 1, f);
+        text[n] = '\0';
+        fclose(f);
+    }
+    const char *rule = TEST_OUTPUT_NAME ": " TEST_INPUT_NAME " \\\n";
+    if (strncmp(text, rule, strlen(rule)) == 0 &&
+        strstr(text, "test_depfile\\ dep.h:\n") != NULL && strstr(text, TEST_SHADOW_NAME) == NULL) {
+        printf("[PASS] Depfile rule written\n");
+    } else {
+        printf("[FAIL] Unexpected depfile:\n%s\n", text);
+        return 1;
+    }
+
+    /* Test 2: A fresh stamp reports the output as up to date */
+    hash128_t input_hash = hash_bytes(input, strlen(input));
+    time_t later = time(NULL) + 10;
+    if (depfile_stamp_write(TEST_STAMP_NAME, 3, search, TEST_OUTPUT_NAME, TEST_INPUT_NAME,
+                            input_hash, &deps, later) == 0 &&
+        depfile_stamp_check(TEST_STAMP_NAME, 3, search, TEST_OUTPUT_NAME) == 1) {
+        printf("[PASS] Unchanged input is up to date\n");
+    } else {
+        printf("[FAIL] Unchanged input reported as stale\n");
+        return 1;
+    }
+
+    /* Test 3: Other options or another search path make the output stale */
+    if (depfile_stamp_check(TEST_STAMP_NAME, 1, search, TEST_OUTPUT_NAME) == 0 &&
+        depfile_stamp_check(TEST_STAMP_NAME, 3, input_hash, TEST_OUTPUT_NAME) == 0) {
+        printf("[PASS] Option change detected\n");
+    } else {
+        printf("[FAIL] Option change ignored\n");
+        return 1;
+    }
+
+    /* Test 4: Rewriting a header with the same bytes keeps it up to date,
+     * different bytes of the same size do not */
+    write_file(TEST_HEADER_NAME, "int h;\n");
+    int same = depfile_stamp_check(TEST_STAMP_NAME, 3, search, TEST_OUTPUT_NAME);
+    write_file(TEST_HEADER_NAME, "int k;\n");
+    int changed = depfile_stamp_check(TEST_STAMP_NAME, 3, search, TEST_OUTPUT_NAME);
+    if (same == 1 && changed == 0) {
+        printf("[PASS] Header changes detected by content\n");
+    } else {
+        printf("[FAIL] Header check: same=%d changed=%d\n", same, changed);
+        return 1;
+    }
+
+    /* Test 5: A file appearing where an include candidate was missing */
+    write_file(TEST_SHADOW_NAME, "int s;\n");
+    if (depfile_stamp_check(TEST_STAMP_NAME, 3, search, TEST_OUTPUT_NAME) == 0) {
+        printf("[PASS] New file shadowing a header detected\n");
+    } else {
+        printf("[FAIL] New file shadowing a header ignored\n");
+        return 1;
+    }
+    unlink(TEST_SHADOW_NAME);
+
+    /* Test 6: An output emptied (or cut short by an interrupted run) or
+     * edited to other bytes of the same size is stale */
+    write_file(TEST_HEADER_NAME, "int h;\n");
+    write_file(TEST_OUTPUT_NAME, "");
+    int emptied = depfile_stamp_check(TEST_STAMP_NAME, 3, search, TEST_OUTPUT_NAME);
+    write_file(TEST_OUTPUT_NAME, "int x;\n");
+    int edited = depfile_stamp_check(TEST_STAMP_NAME, 3, search, TEST_OUTPUT_NAME);
+    write_file(TEST_OUTPUT_NAME, "int h;\n");
+    int restored = depfile_stamp_check(TEST_STAMP_NAME, 3, search, TEST_OUTPUT_NAME);
+    if (emptied == 0 && edited == 0 && restored == 1) {
+        printf("[PASS] Changed output detected\n");
+    } else {
+        printf("[FAIL] Output check: emptied=%d edited=%d restored=%d\n", emptied, edited,
+               restored);
+        return 1;
+    }
+
+    /* Test 7: A missing output is never up to date */
+    unlink(TEST_OUTPUT_NAME);
+    if (depfile_stamp_check(TEST_STAMP_NAME, 3, search, TEST_OUTPUT_NAME) == 0) {
+        printf("[PASS] Missing output detected\n");
+    } else {
+        printf("[FAIL] Missing output ignored\n");
+        return 1;
+    }
+
+    cache_deps_free(&deps);
+    unlink(TEST_INPUT_NAME);
+    unlink(TEST_HEADER_NAME);
+    unlink(TEST_DEPFILE_NAME);
+    unlink(TEST_STAMP_NAME);
+    return 0;
+}
@@ -43,6 +43,29 @@ void test_reporting() {
     printf("Error reporting tests passed!\n");
 }
 
+void test_bound_contexts() {
+    printf("Testing per-context error counts...\n");
+
+    errors_init();
+    errors_ctx_t a, b;
+    errors_ctx_init(&a);
+    errors_ctx_init(&b);
+
+    // Errors go to whichever context is bound to the thread
+    errors_ctx_t *prev = errors_bind(&a);
+    error(1, "first");
+    errors_bind(&b);
+    error(2, "second");
+    error(3, "third");
+    errors_bind(prev);
+
+    assert(a.count == 1);
+    assert(b.count == 2);
+    assert(get_error_count() == 0);
+
+    printf("Per-context error tests passed!\n");
+}
+
 int main(void) {
     printf("Starting test_errors main...\n");
     printf("Running tests...\n");
@@ -50,6 +73,7 @@ int main(void) {
     printf("=== Test Run: Errors Module ===\n");
     
     test_reporting();
+    test_bound_contexts();
     
     printf("=== Test Run Finished ===\n");
     
@@ -0,0 +1,91 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "../src/expr/expr.h"
+#include "../src/macros/macros.h"
+
+/* Compile and evaluate text; returns 0 and sets *value, or 1 on error. */
+static int eval_text(const char *text, const macro_table_t *macros, long long *value)
+{
+    expr_program_t prog;
+    const char *err = NULL;
+    if (expr_compile(text, (long)strlen(text), &prog, &err) != 0) return 1;
+    int rc = expr_eval(&prog, macros, value, &err);
+    expr_program_free(&prog);
+    return rc;
+}
+
+int main(void)
+{
+    macro_table_t macros;
+    macros_init(&macros);
+    macros_define(&macros, "ONE", "1");
+    macros_define(&macros, "VER", "(ONE + 2) * 10");
+    macros_define(&macros, "EMPTY", "");
+    macros_define(&macros, "SELF", "SELF + 1");
+
+    /* Test 1: Precedence, literals and defined() */
+    static const struct { const char *text; long long value; } cases[] = {
+        { "1 + 2 * 3 - 4 / 2", 5 },
+        { "(1 + 2) * 3 == 9 && 7 % 4 == 3", 1 },
+        { "1 << 4 | 0x0f ^ 3 & 1", 30 },
+        { "-1 < 0 && !0 && ~0 == -1", 1 },
+        { "0x10 + 010 + '\\n' + 'A' + 2u + 3L", 16 + 8 + 10 + 65 + 5 },
+        { "defined ONE && defined(VER) && !defined MISSING", 1 },
+        { "0 ? 5 : ONE ? 6 : 7", 6 },
+        { "VER == 30 && UNKNOWN == 0", 1 },
+        { "0 && 1 / 0", 0 },
+        { "1 || 1 / 0", 1 },
+        { "1 // trailing comment", 1 },
+        { "2 /* inline */ + 2", 4 },
+        { "SELF", 1 },
+    };
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        long long value = -12345;
+        if (eval_text(cases[i].text, &macros, &value) != 0 || value != cases[i].value) {
+            printf("[FAIL] '%s' evaluated to %lld, expected %lld\n",
+                   cases[i].text, value, cases[i].value);
+            return 1;
+        }
+    }
+    printf("[PASS] Expressions evaluate with C precedence\n");
+
+    /* Test 2: Invalid expressions are rejected */
+    static const char *bad[] = {
+        "", "1 +", "(1", "1 2", "defined(", "1 ? 2", "1 / 0", "EMPTY", "ONE ONE", "\"str\"",
+    };
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+        long long value = 0;
+        if (eval_text(bad[i], &macros, &value) == 0) {
+            printf("[FAIL] '%s' was accepted\n", bad[i]);
+            return 1;
+        }
+    }
+    printf("[PASS] Invalid expressions are rejected\n");
+
+    /* Test 3: The cache compiles a location once and evaluates it again later */
+    expr_cache_t cache;
+    expr_cache_init(&cache);
+    static const char locations[100] = {0};
+    const char *err = NULL;
+    int ok = 1;
+    for (int round = 0; round < 2 && ok; round++) {
+        for (int i = 0; i < 100 && ok; i++) {
+            const expr_program_t *prog = expr_cache_get(&cache, &locations[i], "ONE + 1", 7, &err);
+            long long value = 0;
+            ok = prog && expr_eval(prog, &macros, &value, &err) == 0 && value == 2;
+        }
+    }
+    ok = ok && expr_cache_get(&cache, &locations[0], "(", 1, &err) != NULL;
+    ok = ok && expr_cache_get(&cache, "other", "(", 1, &err) == NULL;
+    if (ok && cache.compiled == 100 && cache.reused == 101) {
+        printf("[PASS] Condition cache reuses compiled programs\n");
+    } else {
+        printf("[FAIL] Condition cache: %ld compiled, %ld reused\n", cache.compiled, cache.reused);
+        return 1;
+    }
+    expr_cache_free(&cache);
+    macros_free(&macros);
+
+    return 0;
+}
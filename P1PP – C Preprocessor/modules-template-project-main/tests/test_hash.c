@@ -0,0 +1,51 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "../src/hash/hash.h"
+
+int main(void)
+{
+    char data[1000];
+    for (int i = 0; i < (int)sizeof(data); i++) data[i] = (char)(i * 7 + 3);
+
+    /* Test 1: Streaming in uneven pieces gives the one-shot hash */
+    hash128_t whole = hash_bytes(data, sizeof(data));
+    hash_state_t st;
+    hash_init(&st);
+    size_t off = 0, step = 1;
+    while (off < sizeof(data)) {
+        size_t n = step < sizeof(data) - off ? step : sizeof(data) - off;
+        hash_update(&st, data + off, n);
+        off += n;
+        step = step * 3 % 37 + 1;
+    }
+    hash128_t streamed = hash_final(&st);
+    if (streamed.lo == whole.lo && streamed.hi == whole.hi) {
+        printf("[PASS] Streaming hash matches one-shot hash\n");
+    } else {
+        printf("[FAIL] Streaming hash differs from one-shot hash\n");
+        return 1;
+    }
+
+    /* Test 2: A single changed byte changes the hash */
+    data[500] ^= 1;
+    hash128_t changed = hash_bytes(data, sizeof(data));
+    if (changed.lo != whole.lo || changed.hi != whole.hi) {
+        printf("[PASS] Hash detects a changed byte\n");
+    } else {
+        printf("[FAIL] Hash ignored a changed byte\n");
+        return 1;
+    }
+
+    /* Test 3: Hex form has the documented length */
+    char hex[HASH_HEX_LEN + 1];
+    hash_to_hex(whole, hex);
+    if (strlen(hex) == HASH_HEX_LEN && strspn(hex, "0123456789abcdef") == HASH_HEX_LEN) {
+        printf("[PASS] Hash hex form works\n");
+    } else {
+        printf("[FAIL] Hash hex form is malformed: %s\n", hex);
+        return 1;
+    }
+
+    return 0;
+}
@@ -2,7 +2,7 @@
  * tests/test_io.c
  *
  * Test program for the IO module.
- * Tests: io_read_file, io_write_file, io_make_output_name
+ * Tests: io_read_file, io_map_file, io_write_file, io_make_output_name
  * 
  */
 
@@ -164,6 +164,45 @@ void test_io_roundtrip(void) {
     delete_file(output_file);
 }
 
+/* Test 7: io_map_file - Map file contents without copying */
+void test_io_map_file(void) {
+    printf("Test 7: io_map_file\n");
+
+    const char *test_file = "test_map.txt";
+    const char *test_content = "#define A 1\nint x = A;\n";
+
+    create_temp_file(test_file, test_content);
+
+    buffer_t buf;
+    buffer_init(&buf);
+
+    int result = io_map_file(test_file, &buf);
+    assert(result == 0);
+    assert(buf.len == (long)strlen(test_content));
+    assert(memcmp(buf.data, test_content, (size_t)buf.len) == 0);
+#ifndef _WIN32
+    assert(buf.kind == BUFFER_KIND_MAPPED);
+    /* Mapped buffers are read-only views */
+    result = buffer_append_char(&buf, 'x');
+    assert(result != 0);
+#endif
+
+    buffer_free(&buf);
+    assert(buf.data == NULL && buf.len == 0 && buf.kind == BUFFER_KIND_HEAP);
+    printf("  [PASS] Mapped file read and released\n");
+
+    /* Empty files fall back to an empty heap buffer */
+    create_temp_file(test_file, "");
+    buffer_init(&buf);
+    result = io_map_file(test_file, &buf);
+    assert(result == 0);
+    assert(buf.len == 0 && buf.kind == BUFFER_KIND_HEAP && buf.data != NULL);
+    buffer_free(&buf);
+    printf("  [PASS] Empty file falls back to heap buffer\n");
+
+    delete_file(test_file);
+}
+
 int main(void) {
     printf("=== IO Module Test Suite ===\n\n");
     
@@ -173,6 +212,7 @@ int main(void) {
     test_io_make_output_name_no_ext();
     test_io_make_output_name_multi_dot();
     test_io_roundtrip();
+    test_io_map_file();
     
     printf("\n=== All IO tests passed! ===\n\n");
     
@@ -32,6 +32,248 @@ int main(void)
         return 1;
     }
 
+    /* Test 3: Redefinition replaces the value in place */
+    int size_before = table.size;
+    macros_define(&table, "MAX", "20");
+    val = macros_get(&table, "MAX", 3);
+    if (val && strcmp(val, "20") == 0 && table.size == size_before) {
+        printf("[PASS] Macro redefinition updates in place\n");
+    } else {
+        printf("[FAIL] Macro redefinition failed\n");
+        return 1;
+    }
+
+    /* Test 4: Many macros survive table growth */
+    char name[32];
+    char value[32];
+    for (int i = 0; i < 1000; i++) {
+        snprintf(name, sizeof(name), "M_%d", i);
+        snprintf(value, sizeof(value), "%d", i);
+        macros_define(&table, name, value);
+    }
+    for (int i = 0; i < 1000; i++) {
+        snprintf(name, sizeof(name), "M_%d", i);
+        snprintf(value, sizeof(value), "%d", i);
+        val = macros_get(&table, name, (int)strlen(name));
+        if (!val || strcmp(val, value) != 0) {
+            printf("[FAIL] Lookup after growth failed for %s\n", name);
+            return 1;
+        }
+    }
+    if (macros_is_defined(&table, "M_", 2) || macros_is_defined(&table, "MA", 2)) {
+        printf("[FAIL] Prefix of a macro name reported as defined\n");
+        return 1;
+    }
+    printf("[PASS] Lookup after table growth works\n");
+
+    /* Test 5: Long values are stored whole, counted names need no terminator */
+    static char long_value[4001];
+    for (int i = 0; i < 4000; i++) long_value[i] = (char)('a' + i % 26);
+    if (macros_define_n(&table, "LONGER", 4, long_value, 4000) != 0 ||
+        !(val = macros_get(&table, "LONG", 4)) || strlen(val) != 4000 ||
+        memcmp(val, long_value, 4000) != 0 || macros_is_defined(&table, "LONGER", 6)) {
+        printf("[FAIL] Long macro value was not stored intact\n");
+        return 1;
+    }
+    printf("[PASS] Long macro values are not truncated\n");
+
+    /* Test 6: Equal names and values are interned once */
+    long interned = table.interned;
+    const char *first = NULL;
+    for (int i = 0; i < 10; i++) {
+        snprintf(name, sizeof(name), "SAME_%d", i);
+        macros_define(&table, name, "shared value");
+        val = macros_get(&table, name, (int)strlen(name));
+        if (!first) first = val;
+        if (val != first) {
+            printf("[FAIL] Equal values were stored separately\n");
+            return 1;
+        }
+    }
+    macros_define(&table, "SAME_0", "shared value");
+    if (table.interned != interned + 11) {
+        printf("[FAIL] Expected 11 new strings, got %ld\n", table.interned - interned);
+        return 1;
+    }
+    printf("[PASS] Names and values are interned\n");
+
+    /* Test 7: The prefilter rejects plain identifiers; lines without macros are copied whole */
+    macro_table_t small;
+    macros_init(&small);
+    macros_define(&small, "LIMIT", "64");
+    output.len = 0;
+    const char *plain = "int count = total + offset;\n";
+    const char *mixed = "x = LIMIT + \"LIMIT\";\n";
+    macros_expand_line(&small, plain, (long)strlen(plain), &output);
+    macros_expand_line(&small, mixed, (long)strlen(mixed), &output);
+    const char *expected = "int count = total + offset;\nx = 64 + \"LIMIT\";\n";
+    if (output.len == (long)strlen(expected) && memcmp(output.data, expected, strlen(expected)) == 0 &&
+        small.lines_copied == 1 && small.lines_expanded == 1 &&
+        small.prefilter_checked == 6 && small.prefilter_rejected >= 4) {
+        printf("[PASS] Prefilter skips non-macro identifiers\n");
+    } else {
+        printf("[FAIL] Prefilter: %ld checked, %ld rejected, %ld copied\n",
+               small.prefilter_checked, small.prefilter_rejected, small.lines_copied);
+        return 1;
+    }
+    macros_free(&small);
+
+    /* Test 8: Replacements are rescanned; self-references stop; memos follow redefinitions */
+    macro_table_t chain;
+    macros_init(&chain);
+    macros_define(&chain, "A", "B + 1");
+    macros_define(&chain, "B", "C");
+    macros_define(&chain, "SELF", "(SELF)");
+    macros_define(&chain, "PING", "PONG");
+    macros_define(&chain, "PONG", "PING");
+    static const struct { const char *define_name, *define_value, *line, *expected; } steps[] = {
+        { NULL, NULL, "A A\n", "C + 1 C + 1\n" },
+        { "C", "42", "A\n", "42 + 1\n" },
+        { NULL, NULL, "A SELF PING\n", "42 + 1 (SELF) PING\n" },
+        { "B", "7", "A\n", "7 + 1\n" },
+        { "C", "0", "A\n", "7 + 1\n" },
+    };
+    for (size_t i = 0; i < sizeof(steps) / sizeof(steps[0]); i++) {
+        if (steps[i].define_name) macros_define(&chain, steps[i].define_name, steps[i].define_value);
+        output.len = 0;
+        if (macros_expand_line(&chain, steps[i].line, (long)strlen(steps[i].line), &output) != 0 ||
+            output.len != (long)strlen(steps[i].expected) ||
+            memcmp(output.data, steps[i].expected, (size_t)output.len) != 0) {
+            printf("[FAIL] '%s' expanded to '%.*s'\n", steps[i].line, (int)output.len, output.data);
+            return 1;
+        }
+    }
+    if (chain.memo_hits == 0 || chain.memo_invalidated == 0) {
+        printf("[FAIL] Expansion memo unused: %ld hits, %ld invalidated\n",
+               chain.memo_hits, chain.memo_invalidated);
+        return 1;
+    }
+    printf("[PASS] Rescanned expansion is memoized and invalidated\n");
+    macros_free(&chain);
+
+    /* Test 9: Function-like macros (arguments, #, ##, __VA_ARGS__, rescan) */
+    macro_table_t fn;
+    macros_init(&fn);
+    static const char *definitions[][2] = {
+        { "MAX", "(a, b) ((a) > (b) ? (a) : (b))" },
+        { "STR", "(x) #x" },
+        { "XSTR", "(x) STR(x)" },
+        { "CAT", "(a, b) a ## b" },
+        { "LOG", "(fmt, ...) printf(fmt, __VA_ARGS__)" },
+        { "ID", "(x) x" },
+        { "F", "(x) x F(x)" },
+        { "NONE", "() 0" },
+    };
+    for (size_t i = 0; i < sizeof(definitions) / sizeof(definitions[0]); i++) {
+        const char *name = definitions[i][0], *def = definitions[i][1];
+        if (macros_define_function_n(&fn, name, (int)strlen(name), def, (int)strlen(def)) != MACROS_OK) {
+            printf("[FAIL] Could not define %s%s\n", name, def);
+            return 1;
+        }
+    }
+    macros_define(&fn, "V", "42");
+    macros_define(&fn, "G", "MAX");
+    macros_define(&fn, "X", "X + 1");
+    static const struct { const char *line, *expected; } calls[] = {
+        { "MAX(1, MAX(2,3))\n", "((1) > (((2) > (3) ? (2) : (3))) ? (1) : (((2) > (3) ? (2) : (3))))\n" },
+        { "STR( a  \"q\\\"\"  b ) XSTR(V)\n", "\"a \\\"q\\\\\\\"\\\" b\" \"42\"\n" },
+        { "CAT(V, 1) CAT(x, y)\n", "V1 xy\n" },
+        { "LOG(\"%d\", 1, (2, 3))\n", "printf(\"%d\", 1, (2, 3))\n" },
+        { "G(4, 5)\n", "((4) > (5) ? (4) : (5))\n" },
+        { "F(1) ID(ID)(V)\n", "1 F(1) ID(42)\n" },
+        { "ID(X) MAX NONE() \"MAX(1,2)\"\n", "X + 1 MAX 0 \"MAX(1,2)\"\n" },
+    };
+    for (size_t i = 0; i < sizeof(calls) / sizeof(calls[0]); i++) {
+        output.len = 0;
+        if (macros_expand_line(&fn, calls[i].line, (long)strlen(calls[i].line), &output) != MACROS_OK ||
+            output.len != (long)strlen(calls[i].expected) ||
+            memcmp(output.data, calls[i].expected, (size_t)output.len) != 0) {
+            printf("[FAIL] '%s' expanded to '%.*s'\n", calls[i].line, (int)output.len, output.data);
+            return 1;
+        }
+    }
+    output.len = 0;
+    if (macros_expand_line(&fn, "MAX(1)\n", 7, &output) != MACROS_ERR_ARGS ||
+        macros_define_function_n(&fn, "BAD", 3, "(a, a) a", 8) != MACROS_ERR_SYNTAX ||
+        macros_define_function_n(&fn, "BAD", 3, "(a) #b", 6) != MACROS_ERR_SYNTAX ||
+        macros_get(&fn, "MAX", 3) != NULL) {
+        printf("[FAIL] Invalid function-like macro use was accepted\n");
+        return 1;
+    }
+    if (fn.invocations_direct == 0 || fn.invocations_direct == fn.invocations) {
+        printf("[FAIL] Rescan-free substitution unused: %ld of %ld\n",
+               fn.invocations_direct, fn.invocations);
+        return 1;
+    }
+    printf("[PASS] Function-like macros expand with #, ## and __VA_ARGS__\n");
+    macros_free(&fn);
+
+    /* Test 10: Forks see the parent's macros, shadow them, and never write to it */
+    macro_table_t prefix, left, right;
+    macros_init(&prefix);
+    macros_define(&prefix, "A", "B + 1");
+    macros_define(&prefix, "B", "C");
+    macros_define(&prefix, "LIMIT", "64");
+    macros_fork(&left, &prefix);
+    macros_fork(&right, &prefix);
+    macros_define(&left, "C", "1");
+    macros_define(&right, "LIMIT", "32");
+    const struct { macro_table_t *table; const char *line, *expected; } forks[] = {
+        { &left, "A LIMIT\n", "1 + 1 64\n" },
+        { &right, "A LIMIT\n", "C + 1 32\n" },
+        { &left, "A\n", "1 + 1\n" },
+        { &prefix, "A LIMIT\n", "C + 1 64\n" },
+    };
+    for (size_t i = 0; i < sizeof(forks) / sizeof(forks[0]); i++) {
+        output.len = 0;
+        if (macros_expand_line(forks[i].table, forks[i].line, (long)strlen(forks[i].line), &output) != MACROS_OK ||
+            output.len != (long)strlen(forks[i].expected) ||
+            memcmp(output.data, forks[i].expected, (size_t)output.len) != 0) {
+            printf("[FAIL] Fork %zu expanded '%s' to '%.*s'\n", i, forks[i].line, (int)output.len, output.data);
+            return 1;
+        }
+    }
+    if (left.defined != 1 || left.size != 1 || left.parent_memos_kept == 0 || left.memo_hits == 0 ||
+        prefix.memo_misses == 0 || prefix.memo_hits != 0 || strcmp(macros_get(&prefix, "LIMIT", 5), "64") != 0) {
+        printf("[FAIL] Forks: %d own macros, %ld shared memos kept, %ld hits\n",
+               left.size, left.parent_memos_kept, left.memo_hits);
+        return 1;
+    }
+    printf("[PASS] Forked tables share the parent's macros read-only\n");
+    macros_free(&left);
+    macros_free(&right);
+    macros_free(&prefix);
+
+    /* Test: Expanding with tokens lexed by the caller gives the same line,
+     * also when an invocation ends inside one of those tokens */
+    const char *lexed[] = {
+        "F(X) \"X\" X+X\n",
+        "F(\"a\\\")\") X F (X)\n",
+        "'X' F(')') X\n",
+    };
+    macros_define_function_n(&table, "F", 1, "(a) [a]", 7);
+    macros_define(&table, "X", "1");
+    token_list_t tokens;
+    tokens_list_init(&tokens);
+    buffer_t direct;
+    buffer_init(&direct);
+    for (size_t i = 0; i < sizeof(lexed) / sizeof(lexed[0]); i++) {
+        long len = (long)strlen(lexed[i]);
+        tokens_list_reset(&tokens);
+        tokens_list_finish(&tokens, lexed[i], len);
+        output.len = 0;
+        direct.len = 0;
+        macros_expand_tokens(&table, lexed[i], len, &tokens, &output);
+        macros_expand_line(&table, lexed[i], len, &direct);
+        if (output.len != direct.len || memcmp(output.data, direct.data, (size_t)direct.len) != 0) {
+            printf("[FAIL] Lexed line '%s' expanded to '%.*s'\n", lexed[i], (int)output.len, output.data);
+            return 1;
+        }
+    }
+    tokens_list_free(&tokens);
+    buffer_free(&direct);
+    printf("[PASS] Lines lexed by the caller expand the same\n");
+
     macros_free(&table);
     buffer_free(&output);
 
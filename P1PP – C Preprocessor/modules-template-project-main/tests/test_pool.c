@@ -0,0 +1,57 @@
+#include <stdio.h>
+
+#include "../src/pool/pool.h"
+
+/* Number of top-level tasks submitted by the test. */
+#define TEST_TASKS 1000
+/* Subtasks each top-level task submits from inside the pool. */
+#define TEST_CHILDREN 3
+
+static long counter = 0;
+static pool_t pool;
+
+static void child_task(void *arg)
+{
+    (void)arg;
+    __atomic_fetch_add(&counter, 1, __ATOMIC_RELAXED);
+}
+
+static void parent_task(void *arg)
+{
+    (void)arg;
+    __atomic_fetch_add(&counter, 1, __ATOMIC_RELAXED);
+    for (int i = 0; i < TEST_CHILDREN; i++) pool_submit(&pool, child_task, NULL);
+}
+
+int main(void)
+{
+    /* Test 1: Every task (and every task submitted by a task) runs once */
+    if (pool_create(&pool, 4) != 0) {
+        printf("[FAIL] Pool creation failed\n");
+        return 1;
+    }
+    for (int i = 0; i < TEST_TASKS; i++) pool_submit(&pool, parent_task, NULL);
+    pool_wait(&pool);
+
+    long expected = TEST_TASKS * (1 + TEST_CHILDREN);
+    if (counter == expected && pool.executed == expected) {
+        printf("[PASS] Pool ran %ld tasks (%ld steals)\n", counter, pool.steals);
+    } else {
+        printf("[FAIL] Pool ran %ld tasks, expected %ld\n", counter, expected);
+        return 1;
+    }
+
+    /* Test 2: The pool can be reused after a wait */
+    counter = 0;
+    for (int i = 0; i < TEST_TASKS; i++) pool_submit(&pool, child_task, NULL);
+    pool_wait(&pool);
+    if (counter == TEST_TASKS) {
+        printf("[PASS] Pool reusable after wait\n");
+    } else {
+        printf("[FAIL] Second batch ran %ld tasks\n", counter);
+        return 1;
+    }
+
+    pool_destroy(&pool);
+    return 0;
+}
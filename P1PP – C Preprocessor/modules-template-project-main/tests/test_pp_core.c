@@ -8,6 +8,20 @@
  * - `run_pp_core`: Helper to execute pp_run with a given input string.
  * - `test_comment_line`: Verifies single-line comment removal.
  * - `test_comment_block`: Verifies block comment removal across lines.
+ * - `test_comment_literal_eol`: Verifies a literal left open ends at the newline.
+ * - `test_include_cache`: Verifies repeated includes are served from the cache.
+ * - `test_include_search`: Verifies angled includes resolve through a search
+ *   path and record the candidates that were missing.
+ * - `test_include_stack`: Verifies nested includes, cycle and depth errors.
+ * - `test_include_guard`: Verifies guarded / #pragma once headers are skipped.
+ * - `test_include_store`: Verifies runs share headers through a store until
+ *   the file changes.
+ * - `test_scratch_reuse`: Verifies line temporaries do not grow with input size.
+ * - `test_stream_output`: Verifies streamed output matches buffered output.
+ * - `test_parallel_comments`: Verifies chunked comment removal on the thread
+ *   pool is byte-identical to the serial run.
+ * - `test_context_fork`: Verifies runs forked from a prefix context match
+ *   full runs and leave the prefix unchanged.
  *
  * Usage:
  *     Built and executed by the CTest runner.
@@ -20,37 +34,64 @@
 #include "pp_core/pp_context.h"
 #include "buffer/buffer.h"
 #include "cli/cli.h"
+#include "sink/sink.h"
+#include "pool/pool.h"
+#include "cache/cache.h"
+#include "search_path/search_path.h"
 
 #include <assert.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
-
-/* Shared output handle expected by logging modules. */
-FILE *ofile = NULL;
+#include <time.h>
+#include <unistd.h>
+#include <utime.h>
 
 /* Test base directory used for pp_run. */
 #define TEST_BASE_DIR "."
 /* Test input filename used for context. */
 #define TEST_INPUT_NAME "test.c"
 
-/* Helper: run pp_core with provided input and options. */
-static void run_pp_core(const char *input_str, const cli_options_t *opt, buffer_t *out)
+/* Output file written by the streaming test. */
+#define TEST_STREAM_NAME "test_pp_core_stream.c"
+/* Small flush threshold so the streaming test performs many writes. */
+#define TEST_STREAM_THRESHOLD 256
+
+/* Test header written next to the test binary for include tests. */
+#define TEST_HEADER_NAME "test_pp_core_inc.h"
+
+/* Helper: run pp_core with provided input and options, keeping the context. */
+static void run_pp_core_ctx(const char *input_str, const cli_options_t *opt, buffer_t *out,
+                            pp_context_t *ctx)
 {
     buffer_t in;
     buffer_init(&in);
     buffer_init(out);
     buffer_append_str(&in, input_str);
 
-    pp_context_t ctx;
-    ctx.opt = *opt;
-    ctx.current_file = TEST_INPUT_NAME;
-    ctx.current_line = 0;
+    pp_context_init(ctx, opt, TEST_INPUT_NAME);
 
-    pp_run(&ctx, &in, out, TEST_BASE_DIR);
+    pp_run(ctx, &in, out, TEST_BASE_DIR);
 
     buffer_free(&in);
 }
 
+/* Helper: run pp_core with provided input and options. */
+static void run_pp_core(const char *input_str, const cli_options_t *opt, buffer_t *out)
+{
+    pp_context_t ctx;
+    run_pp_core_ctx(input_str, opt, out, &ctx);
+}
+
+/* Helper: write a small file used as an include target. */
+static void write_file(const char *path, const char *content)
+{
+    FILE *f = fopen(path, "w");
+    assert(f != NULL);
+    fputs(content, f);
+    fclose(f);
+}
+
 /* Verify single-line comment removal. */
 static void test_comment_line(void)
 {
@@ -89,13 +130,577 @@ static void test_comment_block(void)
     buffer_free(&out);
 }
 
+/* Verify an unterminated literal does not hide comments on the next line
+ * (comments-only mode strips whole spans, not single lines). */
+static void test_comment_literal_eol(void)
+{
+    cli_options_t opt = {0};
+    opt.do_comments = 1;
+
+    const char *input = "char *s = \"a // b\nint x; // c\nchar q = '/*\n/* d */y\n";
+    const char *expected = "char *s = \"a // b\nint x;  \nchar q = '/*\n y\n";
+
+    buffer_t out;
+    run_pp_core(input, &opt, &out);
+
+    assert(strcmp(out.data, expected) == 0);
+    buffer_free(&out);
+}
+
+/* Verify the fast-forward over false #ifdef regions keeps comment state:
+ * a '#' inside a block comment is not a directive, and only comment removal
+ * turns "/" + "* c *" + "/ #endif" into a directive. */
+static void test_inactive_skip(void)
+{
+    const char *input = "#ifdef NOPE\n"
+                        "int a; /* open\n"
+                        "#endif\n"
+                        "close */ int b;\n"
+                        "  #ifdef INNER\n"
+                        "#endif\n"
+                        "/* c */ #endif\n"
+                        "int live;\n";
+
+    cli_options_t opt = {0};
+    opt.do_comments = 1;
+    opt.do_directives = 1;
+    pp_context_t ctx;
+    buffer_t out;
+    run_pp_core_ctx(input, &opt, &out, &ctx);
+    assert(strcmp(out.data, "int live;\n") == 0);
+    assert(ctx.current_line == 8);
+    assert(ctx.ifdef_stack.top == -1 && ctx.ifdef_stack.first_inactive == -1);
+    buffer_free(&out);
+
+    opt.do_comments = 0;
+    run_pp_core_ctx(input, &opt, &out, &ctx);
+    assert(out.len == 0);
+    assert(ctx.current_line == 8);
+    assert(ctx.ifdef_stack.first_inactive == 0);
+    buffer_free(&out);
+}
+
+/* Verify #if/#elif/#else chains, and that a header's conditions compile once. */
+static void test_conditions(void)
+{
+    cli_options_t opt = {0};
+    opt.do_directives = 1;
+
+    write_file(TEST_HEADER_NAME, "#if MODE == 1\nint one;\n"
+                                 "#elif MODE == 2 && defined(EXTRA)\nint two;\n"
+                                 "#else\nint other;\n#endif\n");
+
+    const char *input = "#define MODE 1\n"
+                        "#include \"" TEST_HEADER_NAME "\"\n"
+                        "#define MODE 2\n"
+                        "#include \"" TEST_HEADER_NAME "\"\n"
+                        "#define EXTRA\n"
+                        "#include \"" TEST_HEADER_NAME "\"\n"
+                        "#if 0\n#if (((\n#elif 1 / 0\n#endif\n#else\nint last;\n#endif\n";
+    const char *expected = "int one;\nint other;\nint two;\nint last;\n";
+
+    pp_context_t ctx;
+    buffer_t out;
+    run_pp_core_ctx(input, &opt, &out, &ctx);
+
+    assert(strcmp(out.data, expected) == 0);
+    assert(ctx.errors.count == 0);
+    assert(ctx.ifdef_stack.top == -1);
+    /* Two header conditions plus '#if 0' are compiled; the skipped ones never are */
+    assert(ctx.conditions.compiled == 3);
+    assert(ctx.conditions.reused == 3);
+    buffer_free(&out);
+    unlink(TEST_HEADER_NAME);
+}
+
+/* Verify function-like #defines are expanded and misuse is reported. */
+static void test_function_macros(void)
+{
+    cli_options_t opt = {0};
+    opt.do_comments = 1;
+    opt.do_directives = 1;
+
+    const char *input = "#define SQ(x) ((x) * (x)) /* square */\n"
+                        "#define SHOW(v, ...) \\\n    show(#v, v, __VA_ARGS__)\n"
+                        "#define SQ_OF SQ\n"
+                        "int a = SQ(SQ(2)), b = SQ_OF(3);\n"
+                        "SHOW(a + 1, 1, 2);\n"
+                        "int c = SQ(1, 2) + SQ;\n"
+                        "#define BAD(x, x) x\n";
+    const char *expected = "int a = ((((2) * (2))) * (((2) * (2)))), b = ((3) * (3));\n"
+                           "show(\"a + 1\", a + 1, 1, 2);\n"
+                           "int c = SQ(1, 2) + SQ;\n";
+
+    pp_context_t ctx;
+    buffer_t out;
+    run_pp_core_ctx(input, &opt, &out, &ctx);
+
+    assert(strcmp(out.data, expected) == 0);
+    /* Wrong argument count and the repeated parameter, on their own lines */
+    assert(ctx.errors.count == 2);
+    assert(ctx.current_line == 8);
+    assert(ctx.macros.invocations == 4);
+    buffer_free(&out);
+}
+
+/* Verify repeated includes are read once and then served from the cache. */
+static void test_include_cache(void)
+{
+    cli_options_t opt = {0};
+    opt.do_comments = 1;
+    opt.do_directives = 1;
+
+    write_file(TEST_HEADER_NAME, "int v = 1;\nint w;");
+
+    const char *input = "#include \"" TEST_HEADER_NAME "\"\n"
+                        "#include \"" TEST_HEADER_NAME "\"\n"
+                        "#include \"" TEST_HEADER_NAME "\"\n";
+    const char *expected = "int v = 1;\nint w;int v = 1;\nint w;int v = 1;\nint w;";
+
+    pp_context_t ctx;
+    buffer_t out;
+    run_pp_core_ctx(input, &opt, &out, &ctx);
+
+    assert(strcmp(out.data, expected) == 0);
+    assert(ctx.includes.misses == 1);
+    assert(ctx.includes.hits == 2);
+    buffer_free(&out);
+    unlink(TEST_HEADER_NAME);
+}
+
+/* Verify every included file is reported once, with its content hash. */
+static void test_include_deps(void)
+{
+    cli_options_t opt = {0};
+    opt.do_directives = 1;
+
+    const char *header = "int d;\n";
+    write_file(TEST_HEADER_NAME, header);
+
+    buffer_t in, out;
+    buffer_init(&in);
+    buffer_init(&out);
+    buffer_append_str(&in, "#include \"" TEST_HEADER_NAME "\"\n#include \"" TEST_HEADER_NAME "\"\n");
+
+    pp_context_t ctx;
+    cache_deps_t deps;
+    cache_deps_init(&deps);
+    pp_context_init(&ctx, &opt, TEST_INPUT_NAME);
+    ctx.deps = &deps;
+    int result = pp_run(&ctx, &in, &out, TEST_BASE_DIR);
+    assert(result == PP_RUN_SUCCESS);
+
+    hash128_t expected = hash_bytes(header, strlen(header));
+    assert(deps.count == 1);
+    assert(strstr(deps.paths[0], TEST_HEADER_NAME) != NULL);
+    assert(deps.hashes[0].lo == expected.lo && deps.hashes[0].hi == expected.hi);
+
+    cache_deps_free(&deps);
+    buffer_free(&in);
+    buffer_free(&out);
+    unlink(TEST_HEADER_NAME);
+}
+
+/* Verify angled includes resolve through a search path and are kept without one. */
+static void test_include_search(void)
+{
+    cli_options_t opt = {0};
+    opt.do_directives = 1;
+
+    write_file(TEST_HEADER_NAME, "int s;\n");
+    const char *input = "#include <" TEST_HEADER_NAME ">\n#include <test_pp_core_absent.h>\n";
+
+    buffer_t out;
+    run_pp_core(input, &opt, &out);
+    assert(strcmp(out.data, input) == 0);
+    buffer_free(&out);
+
+    search_path_t search;
+    search_path_init(&search);
+    int result = search_path_add(&search, TEST_BASE_DIR, 0);
+    assert(result == 0);
+    buffer_t in;
+    buffer_init(&in);
+    buffer_init(&out);
+    buffer_append_str(&in, input);
+    pp_context_t ctx;
+    cache_deps_t deps;
+    cache_deps_init(&deps);
+    pp_context_init(&ctx, &opt, TEST_INPUT_NAME);
+    ctx.search = &search;
+    ctx.deps = &deps;
+    result = pp_run(&ctx, &in, &out, TEST_BASE_DIR);
+    assert(result == PP_RUN_SUCCESS);
+
+    assert(strcmp(out.data, "int s;\n#include <test_pp_core_absent.h>\n") == 0);
+    /* The unresolved name must stay absent; the header is recorded last */
+    assert(deps.count == 2);
+    assert(cache_deps_is_missing(&deps, 0) && strstr(deps.paths[0], "test_pp_core_absent.h"));
+    assert(!cache_deps_is_missing(&deps, 1) && strstr(deps.paths[1], TEST_HEADER_NAME));
+    assert(search.lookups == 2 && search.dirs_listed == 1);
+
+    cache_deps_free(&deps);
+    search_path_free(&search);
+    buffer_free(&in);
+    buffer_free(&out);
+    unlink(TEST_HEADER_NAME);
+}
+
+/* Verify includes run on an explicit stack: re-entry after a #define is
+ * allowed, a pure cycle and too deep nesting are errors, and line numbers
+ * continue in the including file. */
+static void test_include_stack(void)
+{
+    cli_options_t opt = {0};
+    opt.do_directives = 1;
+    const char *input = "#include \"" TEST_HEADER_NAME "\"\nint after;\n";
+    pp_context_t ctx;
+    buffer_t out;
+
+    /* Not a guard: the file continues after #endif, so it is entered twice */
+    write_file(TEST_HEADER_NAME, "#ifndef TWICE\n#define TWICE\n#include \"" TEST_HEADER_NAME "\"\n"
+                                 "#endif\nint x;\n");
+    run_pp_core_ctx(input, &opt, &out, &ctx);
+    assert(strcmp(out.data, "int x;\nint x;\nint after;\n") == 0);
+    assert(ctx.errors.count == 0);
+    assert(ctx.current_line == 2 && strcmp(ctx.current_file, TEST_INPUT_NAME) == 0);
+    buffer_free(&out);
+
+    /* Including itself with nothing defined in between never ends */
+    write_file(TEST_HEADER_NAME, "int a;\n#include \"" TEST_HEADER_NAME "\"\n");
+    run_pp_core_ctx(input, &opt, &out, &ctx);
+    assert(strcmp(out.data, "int a;\n") == 0);
+    assert(ctx.errors.count == 1);
+    assert(strcmp(ctx.current_file, TEST_INPUT_NAME) == 0);
+    buffer_free(&out);
+
+    /* A #define on every level defeats the cycle check; the depth limit stops it */
+    write_file(TEST_HEADER_NAME, "#define LEVEL x\nint a;\n#include \"" TEST_HEADER_NAME "\"\n");
+    opt.max_include_depth = 5;
+    run_pp_core_ctx(input, &opt, &out, &ctx);
+    assert(strcmp(out.data, "int a;\nint a;\nint a;\nint a;\nint a;\n") == 0);
+    assert(ctx.errors.count == 1);
+    assert(ctx.frame_count == 0);
+    buffer_free(&out);
+    unlink(TEST_HEADER_NAME);
+}
+
+/* Verify guarded and #pragma once headers are only expanded once. */
+static void test_include_guard(void)
+{
+    cli_options_t opt = {0};
+    opt.do_comments = 1;
+    opt.do_directives = 1;
+
+    write_file(TEST_HEADER_NAME,
+               "/* header */\n#ifndef TEST_GUARD_H // guard\n#define TEST_GUARD_H\nint g;\n#endif\n");
+
+    const char *input = "#include \"" TEST_HEADER_NAME "\"\n"
+                        "#include \"" TEST_HEADER_NAME "\"\n"
+                        "int x = 1;\n";
+
+    pp_context_t ctx;
+    buffer_t out;
+    run_pp_core_ctx(input, &opt, &out, &ctx);
+
+    assert(strstr(out.data, "int g;") != NULL);
+    assert(strstr(strstr(out.data, "int g;") + 1, "int g;") == NULL);
+    assert(strstr(out.data, "int x = 1;\n") != NULL);
+    assert(ctx.includes.guard_skips == 1);
+    buffer_free(&out);
+
+    write_file(TEST_HEADER_NAME, "#pragma once\nint p;\n");
+    run_pp_core_ctx(input, &opt, &out, &ctx);
+
+    assert(strcmp(out.data, "int p;\nint x = 1;\n") == 0);
+    assert(ctx.includes.guard_skips == 1);
+    buffer_free(&out);
+    unlink(TEST_HEADER_NAME);
+}
+
+/* Write the test header with an mtime age seconds in the past. */
+static void write_header_aged(const char *content, int age)
+{
+    write_file(TEST_HEADER_NAME, content);
+    struct utimbuf times;
+    times.actime = times.modtime = time(NULL) - age;
+    int result = utime(TEST_HEADER_NAME, &times);
+    assert(result == 0);
+}
+
+/* Run input with opt through a context borrowing from store. */
+static void run_with_store(const char *input, const cli_options_t *opt, include_store_t *store,
+                           buffer_t *out, pp_context_t *ctx)
+{
+    buffer_t in;
+    buffer_init(&in);
+    buffer_init(out);
+    buffer_append_str(&in, input);
+    pp_context_init(ctx, opt, TEST_INPUT_NAME);
+    ctx->include_store = store;
+    int result = pp_run(ctx, &in, out, TEST_BASE_DIR);
+    assert(result == PP_RUN_SUCCESS);
+    buffer_free(&in);
+}
+
+/* Verify a later run borrows a stored header (guard included), and that a
+ * changed header, or one modified this second, is read again. */
+static void test_include_store(void)
+{
+    cli_options_t opt = {0};
+    opt.do_directives = 1;
+    const char *input = "#include \"" TEST_HEADER_NAME "\"\n"
+                        "#include \"" TEST_HEADER_NAME "\"\n";
+
+    include_store_t store;
+    int result = include_store_init(&store);
+    assert(result == 0);
+    write_header_aged("#ifndef STORE_H\n#define STORE_H\nint s;\n#endif\n", 60);
+
+    pp_context_t ctx;
+    buffer_t out;
+    for (int run = 0; run < 2; run++) {
+        run_with_store(input, &opt, &store, &out, &ctx);
+        assert(strcmp(out.data, "int s;\n") == 0);
+        assert(ctx.includes.misses == 1 && ctx.includes.guard_skips == 1);
+        assert(ctx.includes.store_hits == run);
+        buffer_free(&out);
+    }
+    assert(store.loads == 1 && store.hits == 1 && store.count == 1);
+
+    write_header_aged("int changed;\n", 30);
+    run_with_store(input, &opt, &store, &out, &ctx);
+    assert(strcmp(out.data, "int changed;\nint changed;\n") == 0);
+    assert(ctx.includes.store_hits == 0 && store.stale == 1 && store.count == 1);
+    buffer_free(&out);
+
+    write_file(TEST_HEADER_NAME, "int fresh;\n");
+    run_with_store(input, &opt, &store, &out, &ctx);
+    assert(strcmp(out.data, "int fresh;\nint fresh;\n") == 0);
+    assert(store.loads == 3 && store.count == 0);
+    buffer_free(&out);
+
+    include_store_free(&store);
+    unlink(TEST_HEADER_NAME);
+}
+
+/* Build an input of n lines mixing defines, comments and macro uses. */
+static char *make_lines(int n)
+{
+    buffer_t b;
+    buffer_init(&b);
+    buffer_append_str(&b, "#define VALUE 42\n");
+    char line[128];
+    for (int i = 0; i < n; i++) {
+        snprintf(line, sizeof(line), "int v%d = VALUE; /* comment %d */ // tail\n", i, i);
+        buffer_append_str(&b, line);
+    }
+    char *s = strdup(b.data);
+    buffer_free(&b);
+    return s;
+}
+
+/* Verify the scratch arena makes the same number of heap allocations
+ * whatever the number of lines (blocks are reused line after line). */
+static void test_scratch_reuse(void)
+{
+    cli_options_t opt = {0};
+    opt.do_comments = 1;
+    opt.do_directives = 1;
+
+    char *small = make_lines(50);
+    char *large = make_lines(5000);
+
+    pp_context_t ctx;
+    buffer_t out;
+    run_pp_core_ctx(small, &opt, &out, &ctx);
+    long small_allocs = ctx.scratch.heap_allocs;
+    buffer_free(&out);
+
+    run_pp_core_ctx(large, &opt, &out, &ctx);
+    long large_allocs = ctx.scratch.heap_allocs;
+    assert(strstr(out.data, "int v4999 = 42;") != NULL);
+    buffer_free(&out);
+
+    assert(small_allocs > 0);
+    assert(large_allocs == small_allocs);
+    free(small);
+    free(large);
+}
+
+/* Verify streaming through a small sink gives the buffered result while
+ * keeping the staged output bounded. */
+static void test_stream_output(void)
+{
+    cli_options_t opt = {0};
+    opt.do_comments = 1;
+    opt.do_directives = 1;
+
+    char *input = make_lines(2000);
+    pp_context_t ctx;
+    buffer_t expected;
+    run_pp_core_ctx(input, &opt, &expected, &ctx);
+
+    buffer_t in;
+    buffer_init(&in);
+    buffer_append_str(&in, input);
+    sink_t sink;
+    int result = sink_open_path(&sink, TEST_STREAM_NAME, TEST_STREAM_THRESHOLD);
+    assert(result == 0);
+    pp_context_init(&ctx, &opt, TEST_INPUT_NAME);
+    result = pp_run_stream(&ctx, &in, &sink, TEST_BASE_DIR);
+    assert(result == PP_RUN_SUCCESS);
+    assert(sink.flushes > 1);
+    assert(sink.peak_pending < 2 * TEST_STREAM_THRESHOLD);
+    assert(sink.bytes_written == expected.len);
+    result = sink_close(&sink);
+    assert(result == 0);
+
+    FILE *f = fopen(TEST_STREAM_NAME, "rb");
+    assert(f != NULL);
+    char *got = malloc((size_t)expected.len + 1);
+    size_t got_len = fread(got, 1, (size_t)expected.len + 1, f);
+    assert(got_len == (size_t)expected.len);
+    fclose(f);
+    assert(memcmp(got, expected.data, (size_t)expected.len) == 0);
+
+    free(got);
+    free(input);
+    buffer_free(&in);
+    buffer_free(&expected);
+    unlink(TEST_STREAM_NAME);
+}
+
+/* Append filler code lines until b holds at least target bytes. */
+static void fill_code(buffer_t *b, long target)
+{
+    while (b->len < target) {
+        buffer_append_str(b, "int a = 1; char *s = \"/* no */\"; char c = '/'; // tail\n");
+    }
+}
+
+/* Verify the parallel comments-only path matches the serial one when block
+ * comments cross chunk boundaries, including one spanning a whole chunk. */
+static void test_parallel_comments(void)
+{
+    cli_options_t opt = {0};
+    opt.do_comments = 1;
+
+    buffer_t in;
+    buffer_init(&in);
+    fill_code(&in, PP_PARALLEL_CHUNK - 1000);
+    buffer_append_str(&in, "x; /* crosses the first boundary\n");
+    fill_code(&in, PP_PARALLEL_CHUNK + 1000);
+    buffer_append_str(&in, "end */ y;\n");
+    fill_code(&in, 2 * PP_PARALLEL_CHUNK - 1000);
+    buffer_append_str(&in, "/* covers a whole chunk\n");
+    fill_code(&in, 3 * PP_PARALLEL_CHUNK + 1000);
+    buffer_append_str(&in, "**/ z; \"unterminated /*\n");
+    fill_code(&in, 4 * PP_PARALLEL_CHUNK + 1000);
+
+    pp_context_t ctx;
+    buffer_t serial;
+    buffer_init(&serial);
+    pp_context_init(&ctx, &opt, TEST_INPUT_NAME);
+    int result = pp_run(&ctx, &in, &serial, TEST_BASE_DIR);
+    assert(result == PP_RUN_SUCCESS);
+    int serial_lines = ctx.current_line;
+
+    pool_t pool;
+    result = pool_create(&pool, 3);
+    assert(result == 0);
+    buffer_t parallel;
+    buffer_init(&parallel);
+    ctx.pool = &pool;
+    result = pp_run(&ctx, &in, &parallel, TEST_BASE_DIR);
+    assert(result == PP_RUN_SUCCESS);
+    assert(pool.executed > 3);
+    pool_destroy(&pool);
+
+    assert(parallel.len == serial.len);
+    assert(memcmp(parallel.data, serial.data, (size_t)serial.len) == 0);
+    assert(ctx.current_line == serial_lines);
+
+    buffer_free(&in);
+    buffer_free(&serial);
+    buffer_free(&parallel);
+}
+
+/* Verify runs forked from a shared prefix match running prefix + input. */
+static void test_context_fork(void)
+{
+    cli_options_t opt = {0};
+    opt.do_comments = 1;
+    opt.do_directives = 1;
+
+    const char *prefix = "#define LIMIT 64\n"
+                         "#define TWICE(x) ((x) * 2)\n"
+                         "#if LIMIT > 10\n"
+                         "#define BIG 1\n";
+    const char *inputs[] = {
+        "#define EXTRA 3\nint a = TWICE(LIMIT) + EXTRA + BIG;\n#endif\n",
+        "#define LIMIT 8\nint b = TWICE(LIMIT);\n#endif\nint c = EXTRA + LIMIT;\n",
+        "int d = LIMIT;\n#else\nint e;\n#endif\n",
+    };
+
+    pp_context_t parent;
+    buffer_t in, discarded;
+    buffer_init(&in);
+    buffer_init(&discarded);
+    buffer_append_str(&in, prefix);
+    pp_context_init(&parent, &opt, TEST_HEADER_NAME);
+    int result = pp_run_prefix(&parent, &in, &discarded, TEST_BASE_DIR);
+    assert(result == 0);
+    assert(discarded.len == 0);
+
+    for (size_t i = 0; i < sizeof(inputs) / sizeof(inputs[0]); i++) {
+        char whole[512];
+        snprintf(whole, sizeof(whole), "%s%s", prefix, inputs[i]);
+        buffer_t expected;
+        run_pp_core(whole, &opt, &expected);
+
+        pp_context_t child;
+        buffer_t out;
+        buffer_init(&out);
+        in.len = 0;
+        buffer_append_str(&in, inputs[i]);
+        pp_context_fork(&child, &parent, TEST_INPUT_NAME);
+        pp_run(&child, &in, &out, TEST_BASE_DIR);
+
+        assert(out.len == expected.len && memcmp(out.data, expected.data, (size_t)out.len) == 0);
+        assert(child.errors.count == 0);
+        buffer_free(&out);
+        buffer_free(&expected);
+    }
+    /* The redefinition in the second input stayed in its fork */
+    assert(strcmp(macros_get(&parent.macros, "LIMIT", 5), "64") == 0);
+    assert(parent.macros.size == 3);
+
+    pp_context_free(&parent);
+    buffer_free(&in);
+    buffer_free(&discarded);
+}
+
 int main(void)
 {
-    ofile = stdout;
     printf("=== pp_core Test Suite ===\n\n");
 
     test_comment_line();
     test_comment_block();
+    test_comment_literal_eol();
+    test_inactive_skip();
+    test_conditions();
+    test_function_macros();
+    test_include_cache();
+    test_include_deps();
+    test_include_search();
+    test_include_stack();
+    test_include_guard();
+    test_include_store();
+    test_scratch_reuse();
+    test_stream_output();
+    test_parallel_comments();
+    test_context_fork();
 
     printf("=== All pp_core tests passed! ===\n\n");
     return 0;
@@ -0,0 +1,128 @@
+#define _XOPEN_SOURCE 700
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "../src/prefetch/prefetch.h"
+#include "../src/spec/pp_spec.h"
+
+/* Template of the fresh directory tree created next to the test binary. */
+#define TEST_ROOT "test_prefetch_XXXXXX"
+
+static char root[] = TEST_ROOT;
+
+/* Write content to root/rel. */
+static void write_file(const char *rel, const char *content)
+{
+    char path[PP_MAX_PATH_LEN];
+    snprintf(path, sizeof(path), "%s/%s", root, rel);
+    FILE *f = fopen(path, "w");
+    fputs(content, f);
+    fclose(f);
+}
+
+/* Path of root/rel in a static buffer. */
+static const char *at(const char *rel)
+{
+    static char path[PP_MAX_PATH_LEN];
+    snprintf(path, sizeof(path), "%s/%s", root, rel);
+    return path;
+}
+
+/* nftw callback removing one entry of the test tree. */
+static int remove_entry(const char *path, const struct stat *sb, int flag, struct FTW *ftw)
+{
+    (void)sb;
+    (void)flag;
+    (void)ftw;
+    return remove(path);
+}
+
+int main(void)
+{
+    if (!mkdtemp(root)) {
+        printf("[FAIL] Test directory could not be created\n");
+        return 1;
+    }
+    char sys_dir[PP_MAX_PATH_LEN];
+    snprintf(sys_dir, sizeof(sys_dir), "%s/sys", root);
+    mkdir(sys_dir, 0755);
+    write_file("tu.c", "#include \"a.h\"\n#include <s.h>\n// #include \"c.h\"\nint x;\n");
+    write_file("a.h", "  #  include \"b.h\"\n#include \"missing.h\"\nint a;\n");
+    write_file("b.h", "#include \"a.h\"\nint b;");
+    write_file("c.h", "int c;\n");
+    write_file("sys/s.h", "int s;\n");
+
+    /* Test 1: Includes are followed transitively, once each; angled names need a search path */
+    prefetch_t pf;
+    if (prefetch_init(&pf, 2, NULL) != 0) {
+        printf("[FAIL] Read-ahead threads could not be started\n");
+        return 1;
+    }
+    prefetch_file(&pf, at("tu.c"));
+    prefetch_file(&pf, at("tu.c"));
+    prefetch_wait(&pf);
+    if (pf.read == 3 && pf.not_found == 1) {
+        printf("[PASS] Include targets read ahead transitively\n");
+    } else {
+        printf("[FAIL] Read ahead: %ld read, %ld not found\n", pf.read, pf.not_found);
+        return 1;
+    }
+
+    /* Test 2: Loads are counted; a header the read-ahead missed is looked into */
+    prefetch_note(&pf, at("a.h"));
+    prefetch_note(&pf, at("c.h"));
+    prefetch_wait(&pf);
+    if (pf.ready == 1 && pf.unseen == 1 && pf.in_flight == 0 && pf.read == 4) {
+        printf("[PASS] Header loads counted against the read-ahead\n");
+    } else {
+        printf("[FAIL] Loads: %ld ready, %ld in flight, %ld not prefetched, %ld read\n", pf.ready,
+               pf.in_flight, pf.unseen, pf.read);
+        return 1;
+    }
+    prefetch_free(&pf);
+
+    /* Test 3: With a search path, angled names resolve and missing targets are not opened */
+    search_path_t search;
+    search_path_init(&search);
+    search_path_add(&search, sys_dir, 1);
+    if (prefetch_init(&pf, 1, &search) != 0) {
+        printf("[FAIL] Read-ahead threads could not be started\n");
+        return 1;
+    }
+    prefetch_file(&pf, at("tu.c"));
+    prefetch_wait(&pf);
+    prefetch_note(&pf, at("sys/s.h"));
+    if (pf.read == 4 && pf.not_found == 0 && pf.ready == 1) {
+        printf("[PASS] Read-ahead follows the search path\n");
+    } else {
+        printf("[FAIL] Search path: %ld read, %ld not found, %ld ready\n", pf.read, pf.not_found,
+               pf.ready);
+        return 1;
+    }
+    prefetch_free(&pf);
+    search_path_free(&search);
+
+    /* Test 4: An input already in memory is only looked into, not read again */
+    const char *tu = "#include \"a.h\"\nint x;\n";
+    if (prefetch_init(&pf, 1, NULL) != 0) {
+        printf("[FAIL] Read-ahead threads could not be started\n");
+        return 1;
+    }
+    prefetch_buffer(&pf, tu, (long)strlen(tu), root);
+    prefetch_wait(&pf);
+    prefetch_note(&pf, at("a.h"));
+    if (pf.read == 2 && pf.not_found == 1 && pf.ready == 1) {
+        printf("[PASS] Loaded input looked into without reading it\n");
+    } else {
+        printf("[FAIL] Loaded input: %ld read, %ld not found, %ld ready\n", pf.read,
+               pf.not_found, pf.ready);
+        return 1;
+    }
+    prefetch_free(&pf);
+
+    nftw(root, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+    return 0;
+}
@@ -0,0 +1,106 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/scan/scan.h"
+
+/* Reference: first byte of [p, end) that appears in set, or end. */
+static const char *naive_find(const char *p, const char *end, const char *set)
+{
+    for (; p < end; p++) {
+        if (strchr(set, *p)) return p;
+    }
+    return end;
+}
+
+/* Reference: first byte of [p, end) that cannot continue an identifier. */
+static const char *naive_non_ident(const char *p, const char *end)
+{
+    for (; p < end; p++) {
+        unsigned char c = (unsigned char)*p;
+        if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_')) {
+            return p;
+        }
+    }
+    return end;
+}
+
+int main(void)
+{
+    char data[300];
+    printf("Scanner implementation: %s\n", scan_impl_name());
+
+    /* Test 1: Every start/end pair agrees with the reference, for matches
+     * placed at every position (covers SIMD blocks and scalar tails) */
+    srand(7);
+    for (int round = 0; round < 200; round++) {
+        for (int k = 0; k < (int)sizeof(data); k++) data[k] = (char)('a' + rand() % 26);
+        int hits = rand() % 4;
+        for (int h = 0; h < hits; h++) data[rand() % sizeof(data)] = "/\"'\n*"[rand() % 5];
+
+        for (int start = 0; start < 70; start++) {
+            for (int len = 0; start + len <= (int)sizeof(data); len += 1 + len / 8) {
+                const char *p = data + start;
+                const char *end = p + len;
+                if (scan_find_newline(p, end) != naive_find(p, end, "\n") ||
+                    scan_find_special(p, end) != naive_find(p, end, "/\"'\n") ||
+                    scan_find_block_special(p, end) != naive_find(p, end, "*\n")) {
+                    printf("[FAIL] Scanner mismatch at start %d, len %d\n", start, len);
+                    return 1;
+                }
+            }
+        }
+    }
+    printf("[PASS] Scanners match the reference\n");
+
+    /* Test 2: Identifier ends agree with the reference, including the bytes
+     * right next to each range ('@', '[', '`', '{', '/', ':') and bytes >= 0x80 */
+    const char edges[] = "@[`{/:\x80\xdf\xff \n";
+    for (int round = 0; round < 200; round++) {
+        for (int k = 0; k < (int)sizeof(data); k++) {
+            data[k] = "azAZ09_mQ5"[rand() % 10];
+        }
+        int hits = rand() % 3;
+        for (int h = 0; h < hits; h++) data[rand() % sizeof(data)] = edges[rand() % (sizeof(edges) - 1)];
+
+        for (int start = 0; start < 70; start++) {
+            for (int len = 0; start + len <= (int)sizeof(data); len += 1 + len / 8) {
+                const char *p = data + start;
+                if (scan_find_non_ident(p, p + len) != naive_non_ident(p, p + len)) {
+                    printf("[FAIL] Identifier scan mismatch at start %d, len %d\n", start, len);
+                    return 1;
+                }
+            }
+        }
+    }
+    printf("[PASS] Identifier scan matches the reference\n");
+
+    /* Test 3: Block classes agree with the reference, bit for bit */
+    for (int round = 0; round < 2000; round++) {
+        for (int k = 0; k < 32; k++) data[k] = (char)(rand() % 256);
+        if (round % 2) data[rand() % 32] = "\"\n_9Z"[rand() % 5];
+        scan_classes_t cls;
+        scan_classify32(data, &cls);
+        for (int k = 0; k < 32; k++) {
+            unsigned char c = (unsigned char)data[k];
+            int digit = c >= '0' && c <= '9';
+            if (!!(cls.ident & (1u << k)) != (naive_non_ident(data + k, data + k + 1) == data + k + 1) ||
+                !!(cls.digit & (1u << k)) != digit || !!(cls.quote & (1u << k)) != (c == '"') ||
+                !!(cls.end & (1u << k)) != (c == '\n' || c == '\0')) {
+                printf("[FAIL] Class of byte 0x%02x\n", c);
+                return 1;
+            }
+        }
+    }
+    printf("[PASS] Block classes match the reference\n");
+
+    /* Test 4: Empty range returns end */
+    if (scan_find_special(data, data) != data || scan_find_newline(data, data) != data ||
+        scan_find_non_ident(data, data) != data) {
+        printf("[FAIL] Empty range\n");
+        return 1;
+    }
+    printf("[PASS] Empty range returns end\n");
+
+    return 0;
+}
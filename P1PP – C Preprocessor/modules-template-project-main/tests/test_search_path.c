@@ -0,0 +1,151 @@
+#define _XOPEN_SOURCE 700
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "../src/search_path/search_path.h"
+#include "../src/spec/pp_spec.h"
+
+/* Template of the fresh directory tree created next to the test binary. */
+#define TEST_ROOT "test_search_XXXXXX"
+
+static char root[] = TEST_ROOT;
+
+/* Write an empty file at root/rel. */
+static void touch(const char *rel)
+{
+    char path[PP_MAX_PATH_LEN];
+    snprintf(path, sizeof(path), "%s/%s", root, rel);
+    FILE *f = fopen(path, "w");
+    fclose(f);
+}
+
+/* Create the directory root/rel. */
+static void make_dir(const char *rel)
+{
+    char path[PP_MAX_PATH_LEN];
+    snprintf(path, sizeof(path), "%s/%s", root, rel);
+    mkdir(path, 0755);
+}
+
+/* Add root/rel to sp. */
+static void add_dir(search_path_t *sp, const char *rel, int system)
+{
+    char path[PP_MAX_PATH_LEN];
+    snprintf(path, sizeof(path), "%s/%s", root, rel);
+    search_path_add(sp, path, system);
+}
+
+/* Resolve name and check it lands in root/expected (NULL: not found). */
+static int resolves_to(search_path_t *sp, const char *from, const char *name, int angled,
+                       const char *expected, cache_deps_t *missing)
+{
+    char from_dir[PP_MAX_PATH_LEN], want[PP_MAX_PATH_LEN], out[PP_MAX_PATH_LEN];
+    snprintf(from_dir, sizeof(from_dir), "%s/%s", root, from);
+    int rc = search_path_find(sp, from_dir, name, angled, out, sizeof(out), missing);
+    if (!expected) return rc == SEARCH_NOT_FOUND;
+    snprintf(want, sizeof(want), "%s/%s", root, expected);
+    return rc == SEARCH_FOUND && strcmp(out, want) == 0;
+}
+
+/* nftw callback removing one entry of the test tree. */
+static int remove_entry(const char *path, const struct stat *sb, int flag, struct FTW *ftw)
+{
+    (void)sb;
+    (void)flag;
+    (void)ftw;
+    return remove(path);
+}
+
+int main(void)
+{
+    if (!mkdtemp(root)) {
+        printf("[FAIL] Test directory could not be created\n");
+        return 1;
+    }
+    make_dir("src");
+    make_dir("inc1");
+    make_dir("inc2");
+    make_dir("inc2/sub");
+    make_dir("sys");
+    touch("src/local.h");
+    touch("inc1/local.h");
+    touch("inc2/a.h");
+    touch("inc2/sub/b.h");
+    touch("sys/a.h");
+    touch("sys/s.h");
+
+    /* -isystem given first is still searched after every -I directory */
+    search_path_t sp;
+    search_path_init(&sp);
+    add_dir(&sp, "sys", 1);
+    add_dir(&sp, "inc1/", 0);
+    add_dir(&sp, "inc2", 0);
+    add_dir(&sp, "missing", 0);
+    cache_deps_t missing;
+    cache_deps_init(&missing);
+
+    /* Test 1: Quoted names look next to the including file first, angled ones do not */
+    if (resolves_to(&sp, "src", "local.h", 0, "src/local.h", NULL) &&
+        resolves_to(&sp, "src", "local.h", 1, "inc1/local.h", NULL)) {
+        printf("[PASS] Quoted and angled names searched in the right places\n");
+    } else {
+        printf("[FAIL] Wrong directory for local.h\n");
+        return 1;
+    }
+
+    /* Test 2: -I order, then -isystem; names with a directory part */
+    if (resolves_to(&sp, "src", "a.h", 1, "inc2/a.h", &missing) &&
+        resolves_to(&sp, "src", "s.h", 1, "sys/s.h", NULL) &&
+        resolves_to(&sp, "src", "sub/b.h", 0, "inc2/sub/b.h", NULL) &&
+        missing.count == 1 && cache_deps_is_missing(&missing, 0) &&
+        strstr(missing.paths[0], "/inc1/a.h") != NULL && missing.paths[0][0] == '/') {
+        printf("[PASS] Search order and missing candidates recorded\n");
+    } else {
+        printf("[FAIL] Search order: %d missing\n", missing.count);
+        return 1;
+    }
+
+    /* Test 3: Once listed, directories answer misses without reading them again */
+    long listed = sp.dirs_listed, avoided = sp.probes_avoided;
+    int again = resolves_to(&sp, "src", "a.h", 1, "inc2/a.h", &missing) &&
+                resolves_to(&sp, "src", "none.h", 0, NULL, &missing);
+    if (again && sp.dirs_listed == listed && sp.probes_avoided == avoided + 6 &&
+        missing.count == 6 && sp.stat_probes == 0) {
+        printf("[PASS] Directory listings are reused\n");
+    } else {
+        printf("[FAIL] Listings: %ld -> %ld read, %ld -> %ld avoided, %d missing\n", listed,
+               sp.dirs_listed, avoided, sp.probes_avoided, missing.count);
+        return 1;
+    }
+
+    /* Test 4: The key follows the directories, their kinds and their order */
+    hash128_t key = search_path_key(&sp);
+    search_path_t other;
+    search_path_init(&other);
+    add_dir(&other, "inc2", 0);
+    add_dir(&other, "inc1", 0);
+    add_dir(&other, "missing", 0);
+    add_dir(&other, "sys", 1);
+    hash128_t swapped = search_path_key(&other);
+    search_path_free(&other);
+    search_path_init(&other);
+    add_dir(&other, "inc1", 0);
+    add_dir(&other, "inc2", 0);
+    add_dir(&other, "missing", 0);
+    add_dir(&other, "sys", 1);
+    if (!hash_equal(key, swapped) && hash_equal(key, search_path_key(&other))) {
+        printf("[PASS] Search path key follows the search order\n");
+    } else {
+        printf("[FAIL] Search path key\n");
+        return 1;
+    }
+    search_path_free(&other);
+
+    cache_deps_free(&missing);
+    search_path_free(&sp);
+    nftw(root, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+    return 0;
+}
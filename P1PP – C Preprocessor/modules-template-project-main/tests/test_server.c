@@ -0,0 +1,184 @@
+#define _XOPEN_SOURCE 700
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../src/server/server.h"
+
+/* Template of the directory created next to the test binary; the socket and
+ * the files of the client live in it. */
+#define TEST_ROOT "test_server_XXXXXX"
+#define SOCKET_NAME "sock"
+#define MARKER_NAME "marker"
+/* Requests sent at once by the concurrency test. */
+#define CLIENTS 8
+
+static char root[] = TEST_ROOT;
+static server_t srv;
+
+/* Handler: echo argv to stdout (with "found" if argv[1] exists in the
+ * working directory), argc to stderr; the status is argc. */
+static int echo_handler(int argc, char **argv, const server_io_t *io, void *arg)
+{
+    (void)arg;
+    char line[256] = "";
+    for (int i = 0; i < argc; i++) {
+        strcat(line, argv[i]);
+        strcat(line, " ");
+    }
+    strcat(line, argc > 1 && access(argv[1], F_OK) == 0 ? "found\n" : "missing\n");
+    if (write(io->out_fd, line, strlen(line)) < 0) return 100;
+    fprintf(io->err, "argc %d\n", argc);
+    return argc;
+}
+
+static void stop(int sig)
+{
+    (void)sig;
+    server_stop(&srv);
+}
+
+/* Contents of path (static buffer). */
+static const char *slurp(const char *path)
+{
+    static char data[256];
+    FILE *f = fopen(path, "r");
+    size_t n = f ? fread(data, 1, sizeof(data) - 1, f) : 0;
+    data[n] = '\0';
+    if (f) fclose(f);
+    return data;
+}
+
+/* One concurrent client: argv {"client", "<i>"}, output in out<i>. */
+typedef struct {
+    int index;
+    int rc;
+    int status;
+} client_t;
+
+static void *client_run(void *arg)
+{
+    client_t *c = (client_t *)arg;
+    char name[32], index[16];
+    snprintf(name, sizeof(name), "out%d", c->index);
+    snprintf(index, sizeof(index), "%d", c->index);
+    int fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    char *argv[] = {"client", index, NULL};
+    c->rc = server_request(SOCKET_NAME, 2, argv, fd, fd, &c->status);
+    close(fd);
+    return NULL;
+}
+
+int main(void)
+{
+    if (!mkdtemp(root)) {
+        printf("[FAIL] Test directory could not be created\n");
+        return 1;
+    }
+    char sock[64], marker[64];
+    snprintf(sock, sizeof(sock), "%s/%s", root, SOCKET_NAME);
+    snprintf(marker, sizeof(marker), "%s/%s", root, MARKER_NAME);
+    fclose(fopen(marker, "w"));
+
+    /* Test 1: Without a server the request is not taken */
+    int status = -1;
+    char *probe[] = {"probe", NULL};
+    if (server_request(sock, 1, probe, STDOUT_FILENO, STDERR_FILENO, &status) == SERVER_ERR_SOCKET) {
+        printf("[PASS] No server: the request is left to the caller\n");
+    } else {
+        printf("[FAIL] A request succeeded without a server\n");
+        return 1;
+    }
+
+    /* The server runs in a child process whose directory is not the client's */
+    int ready[2];
+    if (pipe(ready) != 0) return 1;
+    pid_t pid = fork();
+    if (pid == 0) {
+        char rc = (char)server_open(&srv, sock, 2, echo_handler, NULL);
+        if (write(ready[1], &rc, 1) != 1 || rc != SERVER_OK) _exit(1);
+        signal(SIGTERM, stop);
+        server_run(&srv);
+        server_close(&srv);
+        _exit(0);
+    }
+    char opened = -1;
+    if (read(ready[0], &opened, 1) != 1 || opened != SERVER_OK) {
+        printf("[FAIL] Server could not listen\n");
+        return 1;
+    }
+
+    /* Test 2: A second server on the same socket is refused */
+    server_t other;
+    if (server_open(&other, sock, 1, echo_handler, NULL) == SERVER_ERR_IN_USE) {
+        printf("[PASS] Socket in use is detected\n");
+    } else {
+        printf("[FAIL] Second server was not refused\n");
+        return 1;
+    }
+
+    /* Test 3: The handler writes to the client's descriptors, resolves
+     * paths in the client's directory, and its status comes back */
+    if (chdir(root) != 0) return 1;
+    int out = open("out", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    int err = open("err", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    char *argv[] = {"echo", MARKER_NAME, "b", NULL};
+    int rc = server_request(SOCKET_NAME, 3, argv, out, err, &status);
+    close(out);
+    close(err);
+    char expected_out[] = "echo " MARKER_NAME " b found\n";
+    if (rc == SERVER_OK && status == 3 && strcmp(slurp("out"), expected_out) == 0 &&
+        strcmp(slurp("err"), "argc 3\n") == 0) {
+        printf("[PASS] Request ran in the client's directory with its output\n");
+    } else {
+        printf("[FAIL] Request: rc %d, status %d, out \"%s\"\n", rc, status, slurp("out"));
+        return 1;
+    }
+
+    /* Test 4: Concurrent requests each get their own output and status */
+    pthread_t threads[CLIENTS];
+    client_t clients[CLIENTS];
+    for (int i = 0; i < CLIENTS; i++) {
+        clients[i].index = i;
+        pthread_create(&threads[i], NULL, client_run, &clients[i]);
+    }
+    int ok = 1;
+    for (int i = 0; i < CLIENTS; i++) {
+        pthread_join(threads[i], NULL);
+        char name[32], expected[64];
+        snprintf(name, sizeof(name), "out%d", i);
+        snprintf(expected, sizeof(expected), "client %d missing\nargc 2\n", i);
+        ok = ok && clients[i].rc == SERVER_OK && clients[i].status == 2 &&
+             strcmp(slurp(name), expected) == 0;
+        unlink(name);
+    }
+    if (ok) {
+        printf("[PASS] Concurrent requests served\n");
+    } else {
+        printf("[FAIL] A concurrent request went wrong\n");
+        return 1;
+    }
+
+    /* Test 5: SIGTERM stops the server, which removes its socket */
+    kill(pid, SIGTERM);
+    int wstatus = 0;
+    waitpid(pid, &wstatus, 0);
+    if (WIFEXITED(wstatus) && WEXITSTATUS(wstatus) == 0 && access(SOCKET_NAME, F_OK) != 0) {
+        printf("[PASS] Server stopped and removed its socket\n");
+    } else {
+        printf("[FAIL] Server stop: status %d\n", wstatus);
+        return 1;
+    }
+
+    unlink("out");
+    unlink("err");
+    unlink(MARKER_NAME);
+    if (chdir("..") != 0) return 1;
+    rmdir(root);
+    return 0;
+}
@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/snapshot/snapshot.h"
+
+/* Files written next to the test binary. */
+#define TEST_HEADER_NAME "test_snapshot_prefix.h"
+#define TEST_DEP_NAME "test_snapshot_dep.h"
+#define TEST_SNAPSHOT_NAME "test_snapshot.snap"
+
+/* Write content to path (replacing it). */
+static void write_file(const char *path, const char *content)
+{
+    FILE *f = fopen(path, "w");
+    fputs(content, f);
+    fclose(f);
+}
+
+/* Expand line with table and compare against expected. */
+static int expands_to(macro_table_t *table, const char *line, const char *expected)
+{
+    buffer_t out;
+    buffer_init(&out);
+    int ok = macros_expand_line(table, line, (long)strlen(line), &out) == MACROS_OK &&
+             out.len == (long)strlen(expected) && memcmp(out.data, expected, (size_t)out.len) == 0;
+    buffer_free(&out);
+    return ok;
+}
+
+int main(void)
+{
+    const char *header = "#define LIMIT 64\n";
+    write_file(TEST_HEADER_NAME, header);
+    write_file(TEST_DEP_NAME, "int dep;\n");
+    hash128_t header_hash = hash_bytes(header, strlen(header));
+    time_t later = time(NULL) + 10;
+
+    /* State left by the header: two macros and one open #if level */
+    macro_table_t macros;
+    macros_init(&macros);
+    macros_define(&macros, "LIMIT", "64");
+    macros_define_function_n(&macros, "MAX", 3, "(a, b) ((a) > (b) ? (a) : (b))", 30);
+    ifdef_stack_t ifs;
+    ifdef_stack_init(&ifs);
+    ifdef_push(&ifs, 0);
+
+    cache_deps_t deps;
+    cache_deps_init(&deps);
+    cache_deps_add(&deps, TEST_DEP_NAME, "int dep;\n", 9);
+
+    /* Test 1: Captured state round-trips through the file */
+    snapshot_state_t state;
+    snapshot_state_init(&state);
+    snapshot_t snap;
+    const char *output = "int dep;\n";
+    if (snapshot_capture(&state, &macros, &ifs) != 0 ||
+        snapshot_write(TEST_SNAPSHOT_NAME, &state, 3, TEST_HEADER_NAME, header_hash, &deps,
+                       output, (long)strlen(output), later) != 0 ||
+        snapshot_open(TEST_SNAPSHOT_NAME, 3, &snap) != SNAPSHOT_OK) {
+        printf("[FAIL] Snapshot could not be written and opened\n");
+        return 1;
+    }
+
+    macro_table_t restored;
+    macros_init(&restored);
+    ifdef_stack_t restored_ifs;
+    buffer_t restored_output;
+    buffer_init(&restored_output);
+    cache_deps_t restored_deps;
+    cache_deps_init(&restored_deps);
+    if (snapshot_apply(&snap, &restored, &restored_ifs) != 0 ||
+        snapshot_emit(&snap, &restored_output, &restored_deps) != 0 ||
+        !expands_to(&restored, "MAX(LIMIT, 1)\n", "((64) > (1) ? (64) : (1))\n") ||
+        restored_ifs.top != 0 || restored_ifs.first_inactive != 0 || restored_ifs.stack[0] != 0 ||
+        strcmp(restored_output.data, output) != 0 || restored_deps.count != 2 ||
+        strstr(snapshot_header_path(&snap), TEST_HEADER_NAME) == NULL) {
+        printf("[FAIL] Restored state differs from the captured one\n");
+        return 1;
+    }
+    printf("[PASS] Macros, #if stack and output restored from snapshot\n");
+
+    /* Test 2: Restored names and values are used in place, not copied */
+    const char *value = macros_get(&restored, "LIMIT", 5);
+    if (value && value >= snap.map.data && value < snap.map.data + snap.map.len) {
+        printf("[PASS] Snapshot strings are referenced from the mapping\n");
+    } else {
+        printf("[FAIL] Snapshot strings were copied\n");
+        return 1;
+    }
+    macros_free(&restored);
+    snapshot_close(&snap);
+
+    /* Test 3: Other options or a changed file reject the snapshot */
+    if (snapshot_open(TEST_SNAPSHOT_NAME, 1, &snap) != SNAPSHOT_ERR_OPTIONS) {
+        printf("[FAIL] Snapshot accepted with other options\n");
+        return 1;
+    }
+    write_file(TEST_DEP_NAME, "int changed;\n");
+    if (snapshot_open(TEST_SNAPSHOT_NAME, 3, &snap) != SNAPSHOT_ERR_STALE) {
+        printf("[FAIL] Stale snapshot accepted\n");
+        return 1;
+    }
+    printf("[PASS] Stale snapshot rejected\n");
+
+    /* Test 4: Files that are not snapshots are rejected */
+    if (snapshot_open(TEST_HEADER_NAME, 3, &snap) != SNAPSHOT_ERR_FORMAT ||
+        snapshot_open("test_snapshot_missing.snap", 3, &snap) != SNAPSHOT_ERR_READ) {
+        printf("[FAIL] Invalid snapshot file accepted\n");
+        return 1;
+    }
+    printf("[PASS] Invalid snapshot files rejected\n");
+
+    remove(TEST_HEADER_NAME);
+    remove(TEST_DEP_NAME);
+    remove(TEST_SNAPSHOT_NAME);
+    snapshot_state_free(&state);
+    cache_deps_free(&deps);
+    cache_deps_free(&restored_deps);
+    buffer_free(&restored_output);
+    macros_free(&macros);
+    return 0;
+}
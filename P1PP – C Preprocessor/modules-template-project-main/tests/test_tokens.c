@@ -0,0 +1,134 @@
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/tokens/tokens.h"
+
+/* Lines tokenized by the throughput measurement. */
+#define BENCH_LINES 2000
+#define BENCH_ROUNDS 20
+
+static const char *const sample[] = {
+    "#define BUFFER_SIZE 4096\n",
+    "static int parse_header(const char *name, long len, int flags);\n",
+    "    if (count > MAX_ITEMS && (mode & FLAG_VERBOSE) != 0) return -1;\n",
+    "#include \"config/settings.h\"\n",
+    "    total += values[i] * 31 + offset_table[i % 16];\n",
+};
+
+/* Tokenize line; write "type:text " per token into out. Returns the token count. */
+static int describe(char *line, char *out, size_t size)
+{
+    Tokenizer tk;
+    Token tok;
+    int n = 0;
+    size_t used = 0;
+    out[0] = '\0';
+    tokens_init(&tk, 1, line);
+    while (tokenize(&tk, &tok)) {
+        used += (size_t)snprintf(out + used, size - used, "%d:%.*s ", tok.type, tok.length, tok.word);
+        n++;
+    }
+    return n;
+}
+
+int main(void)
+{
+    /* Test 1: The class table agrees with <ctype.h> in the "C" locale */
+    for (int c = 0; c < 256; c++) {
+        int ident_start = isalpha(c) || c == '_';
+        int ident = isalnum(c) || c == '_';
+        if (!!TK_IS(c, TK_IDENT_START) != ident_start || !!TK_IS(c, TK_IDENT) != ident ||
+            !!TK_IS(c, TK_DIGIT) != !!isdigit(c) || !!TK_IS(c, TK_BLANK) != (c == ' ' || c == '\t') ||
+            !!TK_IS(c, TK_END) != (c == '\n' || c == '\0') || !!TK_IS(c, TK_QUOTE) != (c == '"')) {
+            printf("[FAIL] Class of byte 0x%02x\n", c);
+            return 1;
+        }
+    }
+    printf("[PASS] Character classes match <ctype.h>\n");
+
+    /* Test 2: Token boundaries; bytes >= 0x80 are one-byte symbols */
+    char line[] = "  #define\tX_1 0x1F \"a b\" \xc3\xa9z(\"open\n";
+    char out[256];
+    int n = describe(line, out, sizeof(out));
+    const char *expected = "2:# 0:define 0:X_1 1:0 0:x1F 3:\"a b\" 2:\xc3 2:\xa9 0:z 2:( 3:\"open\n ";
+    if (n == 11 && strcmp(out, expected) == 0) {
+        printf("[PASS] Lines split into the expected tokens\n");
+    } else {
+        printf("[FAIL] Tokens: %s\n", out);
+        return 1;
+    }
+
+    /* Test 3: A line lexed in pieces (as comments writes it) or whole (as a
+     * line without comments is) gives the tokens of the tokenize loop, and the
+     * directive '#' is found */
+    srand(24);
+    const char alphabet[] = "ab_Z09 \t\"#(/\fabcxyz_019 ";
+    token_list_t list;
+    tokens_list_init(&list);
+    for (int round = 0; round < 4000; round++) {
+        char text[100];
+        int len = rand() % (int)(sizeof(text) - 1);
+        for (int k = 0; k < len; k++) text[k] = alphabet[rand() % (int)(sizeof(alphabet) - 1)];
+        if (len > 0 && rand() % 2) text[len - 1] = '\n';
+        if (len > 0 && rand() % 8 == 0) text[rand() % len] = '\n';
+        text[len] = '\0';
+
+        tokens_list_reset(&list);
+        if (round % 2) {
+            for (int at = 0; at < len; at += 1 + rand() % 6) tokens_list_feed(&list, text, at);
+        }
+        tokens_list_finish(&list, text, len);
+
+        Tokenizer tk;
+        Token tok;
+        int k = 0, ok = 1;
+        tokens_init(&tk, 1, text);
+        const char *first = text + strspn(text, " \t\f");
+        while (ok && tokenize(&tk, &tok)) {
+            /* Past the leading whitespace of a non-directive only identifiers and strings are kept */
+            if (*first != '#' && tok.word >= first && (tok.type == SYMBOL || tok.type == NUMBER)) continue;
+            ok = k < list.count && list.items[k].type == tok.type &&
+                 text + list.items[k].start == tok.word && list.items[k].length == tok.length;
+            k++;
+        }
+        int hash = *first == '#' ? 0 : -1;
+        for (int j = 0; hash == 0 && j < list.count && list.items[j].start < first - text; j++) hash++;
+        if (!ok || k != list.count || list.hash != hash) {
+            printf("[FAIL] Lexed tokens differ for \"%s\"\n", text);
+            return 1;
+        }
+    }
+    tokens_list_free(&list);
+    printf("[PASS] Lines lexed in pieces match tokenize\n");
+
+    /* Test 4: Throughput (informational) */
+    int count = (int)(sizeof(sample) / sizeof(sample[0]));
+    char **lines = malloc(sizeof(char *) * BENCH_LINES);
+    long bytes = 0;
+    for (int i = 0; i < BENCH_LINES; i++) {
+        lines[i] = strdup(sample[i % count]);
+        bytes += (long)strlen(lines[i]);
+    }
+    long tokens = 0;
+    clock_t start = clock();
+    for (int r = 0; r < BENCH_ROUNDS; r++) {
+        for (int i = 0; i < BENCH_LINES; i++) {
+            Tokenizer tk;
+            Token tok;
+            tokens_init(&tk, i, lines[i]);
+            while (tokenize(&tk, &tok)) tokens++;
+        }
+    }
+    double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+    if (seconds > 0) {
+        printf("Tokenizer throughput: %.0f MB/s, %.1f M tokens/s\n",
+               (double)bytes * BENCH_ROUNDS / seconds / 1e6, (double)tokens / seconds / 1e6);
+    }
+    for (int i = 0; i < BENCH_LINES; i++) free(lines[i]);
+    free(lines);
+    printf("[PASS] Tokenizer throughput measured\n");
+    return 0;
+}